@@ -0,0 +1,78 @@
+#ifndef CHINESE_CONVERTER_H
+#define CHINESE_CONVERTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mapped_window.h"
+
+namespace ChineseConvert {
+
+// Simplified <-> Traditional conversion of UTF-8 text by longest phrase match.
+//
+// Dictionaries are compiled once (compile_dictionary) from OpenCC-style text
+// files, "phrase<TAB>replacement[ alternative...]" per line, into a double-
+// array trie over UTF-8 bytes: each state is a (base, check) pair, and the
+// child for byte b lives at base + b + 1 if its check names the parent. A
+// compiled file is mapped as is, so loading costs nothing and the pages are
+// shared between processes.
+class Dictionary {
+public:
+    bool open(const std::string &path, std::string *error_message);
+    void close();
+    bool is_open() const { return units_ != nullptr; }
+
+    // Longest phrase that prefixes [begin, end); its length goes to `matched`
+    // and its replacement to `value` / `value_length`. False if none matches.
+    bool longest_match(const char *begin, const char *end, size_t &matched, const char *&value,
+                       size_t &value_length) const;
+
+    // Converts a whole line, copying text without a match one code point at a time.
+    std::string convert(const std::string &utf8) const;
+
+private:
+    struct Unit {
+        std::int32_t base;  // child offset; for a leaf, -(value index + 1)
+        std::int32_t check; // parent state, or -1 if the slot is free
+    };
+
+    FileView::MappedFile file_;
+    const Unit *units_ = nullptr;
+    size_t unit_count_ = 0;
+    const std::uint32_t *value_offsets_ = nullptr; // value_count_ + 1 entries into pool_
+    size_t value_count_ = 0;
+    const char *pool_ = nullptr;
+    size_t pool_bytes_ = 0;
+};
+
+// Builds a dictionary file from the text files in `sources`. The first
+// replacement listed for a phrase wins, and earlier files win over later ones.
+bool compile_dictionary(const std::vector<std::string> &sources, const std::string &output_path,
+                        std::string *error_message);
+
+// Least-recently-used cache of converted lines keyed by where they start in
+// the book, so paging back and forth converts each line once.
+class LineCache {
+public:
+    explicit LineCache(size_t capacity) : capacity_(capacity) {}
+
+    // The converted text for the line at `key`, converting `utf8` on a miss.
+    const std::string &get(std::uint64_t key, const std::string &utf8, const Dictionary &dictionary);
+    void clear();
+
+private:
+    typedef std::list<std::pair<std::uint64_t, std::string>> Entries;
+
+    size_t capacity_;
+    Entries entries_; // most recently used first
+    std::unordered_map<std::uint64_t, Entries::iterator> by_key_;
+};
+
+} // namespace ChineseConvert
+
+#endif // CHINESE_CONVERTER_H
@@ -0,0 +1,82 @@
+#ifndef COMPACT_OFFSETS_H
+#define COMPACT_OFFSETS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace TextIndex {
+
+// Strictly increasing byte offsets stored in about two bytes each.
+//
+// Offsets are grouped kGroupSize at a time. Each sealed group keeps its first
+// offset as an absolute 64-bit base and the rest as (offset - base) packed at
+// the smallest bit width that fits the group's span, so a group of short
+// lines costs ~14 bits per offset. The newest, still-filling group stays
+// unpacked. Lookup by position is O(1); lookup by value is a binary search
+// over group bases followed by one inside the group.
+class CompactOffsets {
+public:
+    static const size_t kGroupSize = 128;
+
+    void clear();
+    size_t size() const { return sealed_groups_.size() * kGroupSize + tail_.size(); }
+    bool empty() const { return size() == 0; }
+
+    std::uint64_t at(size_t i) const;
+    std::uint64_t back() const { return at(size() - 1); }
+
+    // `offset` must be greater than back().
+    void push_back(std::uint64_t offset);
+    // Drops every entry from position `count` on.
+    void truncate(size_t count);
+    // Replaces entries [first, last) with `values`, keeping the order strictly
+    // increasing. Replacing entries one for one costs only the groups touched
+    // unless a group's span outgrows its bit width; otherwise the entries from
+    // `first` on are packed again.
+    void replace(size_t first, size_t last, const std::vector<std::uint64_t> &values);
+
+    // Number of entries <= offset (i.e. std::upper_bound position).
+    size_t count_at_most(std::uint64_t offset) const;
+    // Number of entries < offset (i.e. std::lower_bound position).
+    size_t count_below(std::uint64_t offset) const;
+
+    // Heap bytes held by the structure, for diagnostics.
+    size_t memory_bytes() const;
+
+    // Little-endian binary form; this is also the line table of the on-disk index.
+    void write(std::ostream &out) const;
+    bool read(std::istream &in);
+
+private:
+    struct Group {
+        std::uint64_t base;
+        std::uint64_t packed; // bit position in words_ << 7 | width
+    };
+
+    static std::uint64_t group_bit_position(const Group &g) { return g.packed >> 7; }
+    static unsigned group_width(const Group &g) { return static_cast<unsigned>(g.packed & 0x7F); }
+
+    std::uint64_t read_bits(std::uint64_t position, unsigned width) const;
+    void append_bits(std::uint64_t value, unsigned width);
+    void write_bits(std::uint64_t position, unsigned width, std::uint64_t value);
+    bool replace_in_place(size_t first, const std::vector<std::uint64_t> &values);
+    void seal_tail();
+    // Position of the first entry in group `g` greater than `offset`.
+    size_t upper_in_group(size_t g, std::uint64_t offset) const;
+
+    std::vector<Group> sealed_groups_;
+    std::vector<std::uint64_t> words_;
+    std::uint64_t bit_count_ = 0;
+    std::vector<std::uint64_t> tail_;
+};
+
+// Fixed-width little-endian integers for the index files.
+void write_u64_le(std::ostream &out, std::uint64_t value);
+bool read_u64_le(std::istream &in, std::uint64_t &value);
+
+} // namespace TextIndex
+
+#endif // COMPACT_OFFSETS_H
@@ -0,0 +1,84 @@
+#ifndef CONCATENATED_FILES_H
+#define CONCATENATED_FILES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace FileView {
+
+// A folder of chapter files (0001.txt ... 3000.txt) presented as one book:
+// the .txt files, in natural name order ("2.txt" before "10.txt"), laid end
+// to end, each followed by a newline of its own so that a chapter never runs
+// into the next. Offsets into the book map to files through a table of file
+// starts built from the directory listing alone; files are opened only when
+// their bytes are read, and at most kMaxOpenFiles stay open (least recently
+// used first to go). Each file's encoding is detected the first time it is
+// asked for, so folders mixing UTF-8 and GBK chapters decode correctly.
+class ConcatenatedFiles {
+public:
+    static const size_t kMaxOpenFiles = 16;
+    static const size_t npos = static_cast<size_t>(-1);
+
+    ConcatenatedFiles();
+    ~ConcatenatedFiles();
+
+    ConcatenatedFiles(const ConcatenatedFiles &) = delete;
+    ConcatenatedFiles &operator=(const ConcatenatedFiles &) = delete;
+
+    // Lists `directory`; fails, keeping whatever was open, if it holds no .txt files.
+    bool open(const std::string &directory, std::string *error_message);
+    void close();
+    bool is_open() const { return !names_.empty(); }
+    const std::string &directory() const { return directory_; }
+
+    // Bytes in the book, separators included.
+    std::uint64_t size() const { return starts_.empty() ? 0 : starts_.back(); }
+    size_t file_count() const { return names_.size(); }
+    const std::string &file_name(size_t file) const { return names_[file]; }
+    std::string file_path(size_t file) const;
+    std::uint64_t file_start(size_t file) const { return starts_[file]; }
+    // Bytes of the file itself, without its separator.
+    std::uint64_t file_size(size_t file) const { return starts_[file + 1] - starts_[file] - 1; }
+    // The file holding `offset`; a separator belongs to the file before it.
+    size_t file_at(std::uint64_t offset) const;
+    bool is_file_start(std::uint64_t offset) const;
+    // Index of the file named `name`, or npos.
+    size_t find_file(const std::string &name) const;
+    // EncodingUtils::detect_encoding() of the file, detected on first use.
+    const std::string &encoding_of(size_t file);
+
+    // Copies up to `length` bytes at `offset` into `out` (fewer at the end).
+    bool read(std::uint64_t offset, std::uint64_t length, std::string &out);
+
+    // Seekable stream over the whole book, e.g. for TextIndex::LineIndex.
+    std::istream &stream() { return *stream_; }
+
+private:
+    class Buffer;
+    struct OpenFile {
+        size_t file;
+        std::ifstream in;
+        std::uint64_t last_used;
+    };
+
+    std::ifstream *open_file(size_t file);
+
+    std::string directory_;
+    std::vector<std::string> names_;
+    // Start of each file in the book, plus the book size at the end.
+    std::vector<std::uint64_t> starts_;
+    std::vector<std::string> encodings_;
+    std::vector<std::unique_ptr<OpenFile>> open_files_;
+    std::uint64_t use_counter_ = 0;
+    std::unique_ptr<Buffer> buffer_;
+    std::unique_ptr<std::istream> stream_;
+};
+
+} // namespace FileView
+
+#endif // CONCATENATED_FILES_H
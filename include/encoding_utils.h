@@ -0,0 +1,87 @@
+#ifndef ENCODING_UTILS_H
+#define ENCODING_UTILS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace EncodingUtils {
+
+// 检测文件编码（BOM 优先，其次 uchardet / Windows 下的 UTF-8 校验）
+std::string detect_encoding(const std::string &filename);
+// 转码为UTF-8
+std::string convert_to_utf8(const std::string &input, const std::string &from_encoding);
+// UTF-8 转为指定编码；无法表示时返回空串
+std::string convert_from_utf8(const std::string &utf8, const std::string &to_encoding);
+void strip_utf8_bom_prefix(std::string &s);
+// 该编码下按空白处理的多字节序列（BOM、全角空格等），供行索引判断空行
+std::vector<std::string> blank_sequences(const std::string &encoding);
+// 文件中途换了编码（不同来源拼接的合集）时尝试的另一种编码：UTF-8 文件为 GB18030（Windows 为系统 ANSI 代码页），其余为 UTF-8
+std::string alternate_encoding(const std::string &primary);
+
+// Where a stretch of bytes stops and starts being UTF-8. A character cut off
+// by either end of the stretch does not count as broken.
+struct Utf8Survey {
+    size_t first_invalid = 0;    // first byte that is not UTF-8, or the size if there is none
+    size_t last_invalid_end = 0; // just past the last such byte; 0 if there is none
+    size_t first_multibyte = 0;  // first multi-byte character after that, or the size
+    size_t multibyte_count = 0;  // multi-byte characters after last_invalid_end
+};
+Utf8Survey survey_utf8(const char *data, size_t size);
+// For a line whose part of the file has not been classified: true if its
+// bytes read as alternate_encoding(primary) rather than as `primary`.
+bool line_in_alternate_encoding(const char *data, size_t size, const std::string &primary);
+
+// 该编码下的句末标点（。！？」等），供段落切分判断一行是否在句中被硬换行
+std::vector<std::string> sentence_end_sequences(const std::string &encoding);
+// 以上两者再并上 alternate_encoding(encoding) 下的序列，供可能混有两种编码的文件使用
+std::vector<std::string> blank_sequences_with_alternate(const std::string &encoding);
+std::vector<std::string> sentence_end_sequences_with_alternate(const std::string &encoding);
+
+// Length of the first piece of an overlong line that starts at `data` (a
+// character boundary) and has `size` bytes: at most `limit`, ending after the
+// last of `sentence_ends` in its second half, or else after its last whole
+// character. Characters are told apart as UTF-8 or, where the bytes do not
+// read as UTF-8, as double-byte GBK/Big5 (with GB18030's four-byte forms).
+// Returns `size` when it is within `limit`.
+size_t line_piece_length(const char *data, size_t size, size_t limit, const std::string &encoding,
+                         const std::vector<std::string> &sentence_ends);
+
+// Characters in [data, data + size) that show on screen; control bytes (line
+// breaks, CRs, tabs) and stray UTF-8 continuation bytes are left out. `utf8`
+// picks UTF-8 or the legacy double-byte encodings, as line_piece_length()
+// tells them apart. The UTF-8 count takes 16 bytes per step where SSE2 is
+// available: every printable ASCII byte or lead byte starts one character.
+std::uint64_t count_characters(const char *data, size_t size, bool utf8);
+// The same UTF-8 test as a bitmap, bit i % 64 of marks[i / 64] for byte i, so
+// that the characters in any stretch of the bytes are a popcount away.
+void mark_utf8_characters(const char *data, size_t size, std::vector<std::uint64_t> &marks);
+// Marked bytes in [begin, end).
+std::uint64_t count_marked(const std::vector<std::uint64_t> &marks, size_t begin, size_t end);
+
+// Converts many strings from one encoding without reopening iconv per call.
+// Falls back to returning the input unchanged, like convert_to_utf8().
+class Utf8Converter {
+public:
+    explicit Utf8Converter(const std::string &from_encoding);
+    ~Utf8Converter();
+
+    Utf8Converter(const Utf8Converter &) = delete;
+    Utf8Converter &operator=(const Utf8Converter &) = delete;
+
+    const std::string &encoding() const { return from_encoding_; }
+    std::string convert(const std::string &input);
+
+private:
+    std::string from_encoding_;
+    bool passthrough_ = true;
+#ifndef _WIN32
+    void *cd_ = nullptr; // iconv_t
+    std::vector<char> buffer_;
+#endif
+};
+
+} // namespace EncodingUtils
+
+#endif // ENCODING_UTILS_H
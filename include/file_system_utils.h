@@ -1,15 +1,45 @@
 #ifndef FILE_SYSTEM_UTILS_H
 #define FILE_SYSTEM_UTILS_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace FileSystemUtils {
 
+    // Byte offset not recorded (older config and progress files, or a line
+    // number entered by hand).
+    const std::uint64_t kNoByteOffset = static_cast<std::uint64_t>(-1);
+
+    // Per-book reading progress, keyed by content fingerprint so that it
+    // follows a book across renames and moves. Most recently used first.
+    // A folder of chapter files is keyed "folder:<file name>" instead, with
+    // the line and offset inside that file, and found by its path.
+    struct ProgressRecord {
+        std::string fingerprint;
+        std::int64_t line_number = 0;
+        std::uint64_t byte_offset = kNoByteOffset; // start of that line
+        std::string novel_path; // last known location; identifies a folder
+    };
+
     std::string get_config_directory_path();
+    // Disposable data such as saved line indexes; safe to delete at any time.
+    std::string get_cache_directory_path();
+    bool is_directory(const std::string& path);
     bool create_directory_if_not_exists(const std::string& path);
-    bool read_config(const std::string& config_file_path, std::string& novel_path, int& line_number_from_config);
-    bool write_config(const std::string& config_file_path, const std::string& novel_path, int line_number_to_config);
+    // Modification time (seconds since the epoch) and inode of a regular file;
+    // the inode is 0 on Windows.
+    bool get_file_stamp(const std::string& path, std::int64_t& mtime, std::uint64_t& inode);
+    // Writes to "<path>.tmp" and renames it over `file_path`.
+    bool write_file_atomic(const std::string& file_path, const std::string& contents);
+    // The config holds the novel path, a line number and, optionally, the byte
+    // offset where that line starts (kNoByteOffset when absent).
+    bool read_config(const std::string& config_file_path, std::string& novel_path, std::int64_t& line_number_from_config,
+                     std::uint64_t& byte_offset_from_config);
+    bool write_config(const std::string& config_file_path, const std::string& novel_path, std::int64_t line_number_to_config,
+                      std::uint64_t byte_offset_to_config);
+    bool read_progress(const std::string& progress_file_path, std::vector<ProgressRecord>& records);
+    bool write_progress(const std::string& progress_file_path, const std::vector<ProgressRecord>& records);
 
 }
 
@@ -0,0 +1,45 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+
+namespace FileWatch {
+
+enum class FileChange {
+    None,
+    Modified, // same file, contents or size changed
+    Replaced, // path now refers to a different file (rename-over save, recreate)
+};
+
+// Watches one file for changes (inotify on Linux). The descriptor returned by
+// fd() becomes readable when something happened; consume() then drains the
+// queued notifications. On other platforms watch() fails and fd() stays -1.
+class FileWatcher {
+public:
+    FileWatcher() = default;
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    bool watch(const std::string &path, std::string *error_message);
+    void stop();
+
+    int fd() const { return fd_; }
+    bool is_active() const { return fd_ >= 0; }
+
+    FileChange consume();
+
+private:
+    void add_file_watch();
+
+    int fd_ = -1;
+    int file_wd_ = -1;
+    int dir_wd_ = -1;
+    std::string path_;
+    std::string file_name_;
+};
+
+} // namespace FileWatch
+
+#endif // FILE_WATCHER_H
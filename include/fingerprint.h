@@ -0,0 +1,33 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Fingerprint {
+
+// XXH64 (xxHash, 64-bit variant).
+std::uint64_t xxhash64(const void *data, size_t length, std::uint64_t seed);
+
+// Identity of a book's contents, independent of its path: the file size plus
+// an XXH64 over a handful of sampled blocks (head, tail and evenly spaced
+// interior blocks). Small files are hashed whole.
+struct BookFingerprint {
+    std::uint64_t size = 0;
+    std::uint64_t sample_hash = 0;
+    bool valid = false;
+
+    // "<size hex>-<hash hex>", used as the key in progress and cache files.
+    std::string to_string() const;
+};
+
+bool operator==(const BookFingerprint &a, const BookFingerprint &b);
+bool operator!=(const BookFingerprint &a, const BookFingerprint &b);
+
+bool parse_fingerprint(const std::string &text, BookFingerprint &out);
+bool compute_fingerprint(const std::string &path, BookFingerprint &out, std::string *error_message);
+
+} // namespace Fingerprint
+
+#endif // FINGERPRINT_H
@@ -0,0 +1,68 @@
+#ifndef JUNK_FILTER_H
+#define JUNK_FILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace TextIndex {
+
+// Aho-Corasick automaton over raw bytes for spotting ad and watermark lines
+// ("本章未完", site URLs, ...) while the line index is built. Bytes are
+// mapped to the classes that occur in the patterns, so the transition table
+// is dense but small, and each byte costs one table lookup. From the root
+// state, bytes are skipped until a byte pair that can begin some pattern, so
+// ordinary text mostly runs through a cheap bitmap test instead. Patterns
+// are matched in the file's own encoding and never across a line break.
+class JunkFilter {
+public:
+    // Replaces the pattern set. Empty patterns keep their slot (so hit counts
+    // line up with the caller's list) but never match.
+    void set_patterns(const std::vector<std::string> &patterns);
+    bool empty() const { return match_count_ == 0; }
+    const std::vector<std::string> &patterns() const { return patterns_; }
+    // Identifies the pattern set in saved indexes; 0 when empty.
+    std::uint64_t signature() const { return signature_; }
+
+    // Runs [begin, end) through the automaton from `state` (0 at the start of
+    // a line) and returns the index of the first pattern completed, or -1.
+    // `state` is updated so a line can be fed in pieces.
+    int feed(std::uint32_t &state, const char *begin, const char *end) const;
+
+private:
+    static const std::uint32_t kMatchBit = 0x80000000u;
+
+    bool may_start(const char *p) const
+    {
+        const size_t pair = static_cast<size_t>(static_cast<unsigned char>(p[0])) << 8 | static_cast<unsigned char>(p[1]);
+        return ((start_pairs_[pair / 64] >> (pair % 64)) & 1) != 0;
+    }
+
+    std::vector<std::string> patterns_;
+    size_t match_count_ = 0;
+    std::uint64_t signature_ = 0;
+    std::uint16_t byte_class_[256] = {};
+    size_t class_count_ = 1;
+    // Row offsets (state * class_count_) of the next state, with kMatchBit set
+    // if a pattern ends there.
+    std::vector<std::uint32_t> next_;
+    // Pattern reported for each state, or -1.
+    std::vector<int> output_;
+    // One bit per two-byte sequence that begins a pattern (any second byte
+    // for one-byte patterns).
+    std::vector<std::uint64_t> start_pairs_;
+};
+
+// The user's pattern list: the "junk_patterns" file in the config directory,
+// one UTF-8 pattern per line; blank lines and lines starting with '#' are skipped.
+std::string junk_patterns_path();
+std::vector<std::string> read_junk_patterns(const std::string &path);
+// The patterns as bytes in `encoding`; a pattern that can't be represented
+// there becomes empty.
+std::vector<std::string> encode_junk_patterns(const std::vector<std::string> &utf8_patterns,
+                                              const std::string &encoding);
+
+} // namespace TextIndex
+
+#endif // JUNK_FILTER_H
@@ -0,0 +1,52 @@
+#ifndef LIBRARY_CATALOG_H
+#define LIBRARY_CATALOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace LibraryCatalog {
+
+// One book found under a scanned library folder.
+struct CatalogEntry {
+    std::string path;
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0; // seconds since the epoch
+    std::string fingerprint;
+    std::string encoding;
+    std::int64_t line_count = 0;
+    std::int64_t chapter_count = 0;
+};
+
+struct ScanStats {
+    size_t directories = 0;
+    size_t files = 0;
+    size_t rescanned = 0; // new or changed since the last scan
+    size_t reused = 0;    // size and mtime unchanged, previous results kept
+    size_t failed = 0;
+};
+
+// Catalog file: one tab-separated entry per line, path last.
+bool load_catalog(const std::string &catalog_file_path, std::vector<CatalogEntry> &entries);
+bool save_catalog(const std::string &catalog_file_path, const std::vector<CatalogEntry> &entries);
+
+// Walks `root` on the calling thread plus Tasks::Priority::Bulk workers of the
+// shared scheduler and refreshes `entries` in place:
+// .txt files whose size and mtime are unchanged keep their previous results,
+// others are fingerprinted, encoding-detected and counted. Entries are stored
+// with absolute paths, whatever form `root` is given in. Entries under
+// `root` that no longer exist are dropped; entries elsewhere are kept.
+bool scan_library(const std::string &root, std::vector<CatalogEntry> &entries, ScanStats *stats,
+                  std::string *error_message);
+
+// Indices of entries whose path contains every whitespace-separated term of
+// `query` (ASCII case-insensitive). An empty query matches everything.
+std::vector<size_t> filter_catalog(const std::vector<CatalogEntry> &entries, const std::string &query);
+
+// File name part of an entry's path, for display.
+std::string display_name(const CatalogEntry &entry);
+
+} // namespace LibraryCatalog
+
+#endif // LIBRARY_CATALOG_H
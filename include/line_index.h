@@ -0,0 +1,288 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include "compact_offsets.h"
+#include "junk_filter.h"
+#include "rank_bitmap.h"
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace EncodingUtils {
+class Utf8Converter;
+}
+
+namespace TextIndex {
+
+enum class RefreshResult {
+    Unchanged,
+    Appended, // existing lines untouched, more bytes to scan
+    Edited,   // some line starts changed; positions must be re-anchored
+};
+
+// Index of one file's lines, built lazily in fixed-size blocks from a single
+// pass over each. Every scanned block keeps a checksum, so a changed file is
+// re-validated block by block, and the whole index can be saved and reloaded.
+// It holds:
+// - line starts, in a CompactOffsets table (~2 bytes per line);
+// - rank/select bitmaps of content lines (blank and junk lines excluded),
+//   paragraph starts and chapter headings;
+// - a running character total per line, in a second CompactOffsets table;
+// - the encoding runs, where the text switches between the detected encoding
+//   and one alternate;
+// - virtual lines: a line longer than max_line_bytes() is cut, never inside
+//   a character, so no line read through the index is unbounded.
+// Line numbers are 1-based.
+class LineIndex {
+public:
+    static const std::uint64_t kBlockSize = 64 * 1024;
+    static const std::uint64_t kDefaultMaxLineBytes = 4096;
+
+    // Starts over for a file of `file_size` bytes.
+    void reset(std::uint64_t file_size);
+    // Multi-byte sequences (up to 4 bytes) that count as blank besides ASCII
+    // spaces, tabs and CR, e.g. a BOM or a full-width space in the file's
+    // encoding. Set before scanning; reset() keeps them.
+    void set_blank_sequences(const std::vector<std::string> &sequences);
+    // Byte patterns, in the file's encoding, that mark a whole line as junk.
+    // Set before scanning; reset() keeps them.
+    void set_junk_patterns(const std::vector<std::string> &patterns) { junk_.set_patterns(patterns); }
+    // Sentence-final punctuation (up to 4 bytes each) in the file's encoding;
+    // a line ending in one is not hard-wrapped. Set before scanning.
+    void set_sentence_ends(const std::vector<std::string> &sequences);
+    // The encoding detected from the start of the file. Sets the blank and
+    // sentence-end sequences of it and of EncodingUtils::alternate_encoding(),
+    // between which the scan then tracks the runs. Set before scanning.
+    void set_encoding(const std::string &encoding);
+    const std::string &encoding() const { return encoding_; }
+    const std::string &alternate_encoding() const { return alternate_encoding_; }
+    // Longer lines are cut into virtual lines. Set before scanning; reset() keeps it.
+    void set_max_line_bytes(std::uint64_t bytes);
+    std::uint64_t max_line_bytes() const { return max_line_bytes_; }
+    // How many of the `size` bytes of a line starting at `data` (without its
+    // newline) make up its first virtual line; the same cut the scan makes.
+    size_t first_piece_length(const char *data, size_t size) const;
+    const std::vector<std::string> &junk_patterns() const { return junk_.patterns(); }
+    // Junk lines found so far, per pattern; a line counts under the first
+    // pattern seen in it.
+    std::vector<std::uint64_t> junk_hits() const;
+    // Called with [begin, end) after each block is scanned, e.g. to drop the
+    // bytes from the page cache once they are indexed.
+    void set_scan_callback(std::function<void(std::uint64_t begin, std::uint64_t end)> callback)
+    {
+        scan_callback_ = std::move(callback);
+    }
+
+    // Scans forward until `line` is indexed; false if the file has fewer lines.
+    bool index_through(std::istream &in, std::int64_t line);
+    // Scans forward until every line starting at or before `offset` is indexed.
+    void index_through_offset(std::istream &in, std::uint64_t offset);
+    // Scans to the end of the file and returns the total line count.
+    std::int64_t index_all(std::istream &in);
+
+    std::int64_t indexed_line_count() const { return static_cast<std::int64_t>(starts_.size()); }
+    bool fully_indexed() const { return scanned_bytes_ >= file_size_; }
+    std::uint64_t file_size() const { return file_size_; }
+    std::uint64_t scanned_bytes() const { return scanned_bytes_; }
+    size_t memory_bytes() const;
+
+    // `line` must already be indexed.
+    std::uint64_t line_start(std::int64_t line) const { return starts_.at(static_cast<size_t>(line - 1)); }
+    // Line containing `offset` among the indexed lines; 0 if none are indexed.
+    std::int64_t line_at_offset(std::uint64_t offset) const;
+
+    // Nearest line with non-blank text at or after / at or before `line`,
+    // scanning forward as needed; 0 if there is none.
+    std::int64_t next_content_line(std::istream &in, std::int64_t line);
+    std::int64_t prev_content_line(std::istream &in, std::int64_t line);
+    // The blank/junk test applied while scanning, for a line read without the
+    // index (its bytes up to, not including, the line break).
+    bool is_skipped_line(const std::string &line) const;
+
+    // Whether the line starting at `offset`, whose bytes are `line`, is in the
+    // alternate encoding. Past the scanned part the line's own bytes decide.
+    bool in_alternate_encoding(std::uint64_t offset, const std::string &line) const;
+    // Number of encoding runs found so far.
+    size_t encoding_run_count() const { return encoding_switches_.size() + 1; }
+
+    // Paragraph `n` (1-based) begins at line paragraph_first_line(n); both
+    // count only the lines indexed so far. paragraph_of() is 0 before the first.
+    std::int64_t paragraph_of(std::int64_t line) const;
+    std::int64_t paragraph_first_line(std::int64_t paragraph) const;
+    // First paragraph start after `line`, or the start of the paragraph holding
+    // `line`, scanning forward as needed; 0 if there is none.
+    std::int64_t next_paragraph_start(std::istream &in, std::int64_t line);
+    std::int64_t paragraph_start(std::istream &in, std::int64_t line);
+    // True if the lines indexed so far read as text hard-wrapped at a fixed
+    // width, i.e. paragraphs typically span several lines.
+    bool looks_hard_wrapped() const;
+
+    // Characters (EncodingUtils::count_characters()) in the lines before
+    // `line`, which must be completed or the first line still open.
+    std::uint64_t characters_before(std::int64_t line) const;
+    // Characters in the completed lines: the whole book once fully_indexed().
+    std::uint64_t indexed_characters() const;
+    // Chapter `n` (1-based) begins at heading line chapter_first_line(n); both
+    // count only the completed lines. chapter_of() is 0 before the first heading.
+    std::int64_t chapter_of(std::int64_t line) const;
+    std::int64_t chapter_first_line(std::int64_t chapter) const;
+    std::int64_t chapter_count() const { return static_cast<std::int64_t>(chapters_.count()); }
+
+    // Re-validates the index against the file, which is now `new_size` bytes.
+    // Appends only check the tail block; other changes verify every scanned
+    // block and re-index just the blocks whose checksum no longer matches.
+    RefreshResult refresh(std::istream &in, std::uint64_t new_size);
+
+    // Binary form of the index, for caching on disk. The caller keys saved
+    // indexes by content fingerprint; read() checks the format, that `file` is
+    // still `file_size` bytes, and re-reads its last block and a few sampled
+    // ones against their checksums. It leaves the index reset on failure.
+    void write(std::ostream &out) const;
+    bool read(std::istream &in, std::istream &file, std::uint64_t file_size);
+
+private:
+    // Blank/content state of a line whose end has not been seen yet.
+    struct LineScanState {
+        bool has_content = false;
+        unsigned char partial[3] = {0, 0, 0}; // bytes of a possible blank sequence
+        size_t partial_length = 0;
+        std::uint32_t junk_state = 0; // JunkFilter::feed() state
+        int junk_pattern = -1;        // first junk pattern found in the line
+        bool indented = false;        // blank before the first content byte
+        unsigned char tail[4] = {0, 0, 0, 0}; // last bytes before any trailing ASCII blanks
+        size_t tail_length = 0;
+        bool continued = false; // a virtual line carrying on from the one before
+    };
+
+    // A junk line found while scanning; `line` is 0-based, like the content bits.
+    struct JunkLine {
+        std::uint64_t line;
+        std::uint32_t pattern;
+    };
+
+    // A line start where the encoding flips between the detected and the
+    // alternate one, and the block whose scan found it.
+    struct EncodingSwitch {
+        std::uint64_t offset;
+        std::uint64_t block;
+    };
+
+    void feed_line(LineScanState &state, const char *begin, const char *end) const;
+    // True once the rest of the line cannot change how it is classified.
+    bool line_decided(const LineScanState &state) const
+    {
+        return state.junk_pattern >= 0 || (state.has_content && junk_.empty());
+    }
+    // A sequence cut off by the end of the line is not a blank one; junk never counts.
+    static bool counts_as_content(const LineScanState &state)
+    {
+        return (state.has_content || state.partial_length > 0) && state.junk_pattern < 0;
+    }
+    bool ends_sentence(const unsigned char *tail, size_t length) const;
+    // Appends the classification of the next completed line.
+    void push_line(const LineScanState &state);
+    void truncate_lines(std::istream &in, size_t count);
+    // Whether a paragraph may start after `line`, which must be completed.
+    bool line_ends_paragraph(std::istream &in, std::int64_t line) const;
+    // Reads the end of the line and checks it against the sentence ends.
+    bool line_ends_sentence(std::istream &in, std::int64_t line) const;
+    LineScanState scan_line_prefix(std::istream &in, std::uint64_t begin, std::uint64_t end) const;
+    LineScanState scan_line(std::istream &in, std::int64_t line) const;
+    size_t completed_line_count() const;
+    void finish_last_line();
+    void track_encoding(const char *data, size_t size, std::uint64_t begin);
+    void add_encoding_switch(std::uint64_t offset, size_t block);
+    bool scanning_utf8() const;
+    // Whether scanning the block now in buffer_ would add an encoding switch,
+    // or did so before.
+    bool block_switches_encoding(size_t block) const;
+    // Whether the scanned byte at `offset` lies in an alternate-encoding run.
+    bool alternate_run_at(std::uint64_t offset) const;
+    // Measures the lines completed since the last call; [data, data + size)
+    // holds the file's bytes from `data_begin`, the rest is read from `in`.
+    void measure_completed_lines(std::istream &in, const char *data, std::uint64_t data_begin, size_t size);
+    // Character count and heading test of the line [start, end), with
+    // character_marks_ made from the same `data`.
+    void measure_line(std::istream &in, const char *data, std::uint64_t data_begin, size_t size, std::uint64_t start,
+                      std::uint64_t end, std::uint64_t &characters, bool &heading);
+
+    bool scan_next_block(std::istream &in);
+    // Where to cut the overlong line at `start`, which runs past `line_end`;
+    // the block read at `begin` is in buffer_.
+    std::uint64_t cut_point(std::istream &in, std::uint64_t start, std::uint64_t begin, std::uint64_t line_end);
+    bool follows_newline(std::istream &in, std::uint64_t offset) const;
+    bool read_block(std::istream &in, size_t block, std::vector<char> &out) const;
+    bool block_matches(std::istream &in, size_t block);
+    // The last checksummed block and about kVerifiedBlocks spread before it.
+    bool sampled_blocks_match(std::istream &in);
+    void collect_line_starts(const std::vector<char> &data, std::uint64_t base, std::vector<std::uint64_t> &out) const;
+    // False, changing nothing, if the block's lines would need cutting anew,
+    // if the edit changes their number or their character total, or if it
+    // moves the encoding runs.
+    bool reindex_block_in_place(std::istream &in, size_t block);
+    void truncate_to_block(std::istream &in, size_t block);
+    std::uint64_t block_end(size_t block) const;
+
+    CompactOffsets starts_;
+    std::vector<std::uint64_t> fresh_starts_;
+    // Bit i is set if line i + 1 has non-blank text; covers completed lines only.
+    RankSelectBitmap content_;
+    // Sorted by line; covers completed lines only.
+    std::vector<JunkLine> junk_lines_;
+    // Bit i is set if line i + 1 starts a paragraph; covers completed lines only.
+    RankSelectBitmap paragraphs_;
+    bool last_line_ends_paragraph_ = true;
+    // Entry i is the characters in lines 1 .. i + 1, plus i to keep the
+    // entries increasing; covers completed lines only.
+    CompactOffsets characters_;
+    // Bit i is set if line i + 1 is a chapter heading; covers completed lines only.
+    RankSelectBitmap chapters_;
+    // TextAnalysis::chapter_heading_initials() in both encodings, and the
+    // first bytes of those and of the blank sequences, to pass over most
+    // lines at a glance.
+    std::vector<std::string> heading_initials_;
+    std::bitset<256> heading_leads_;
+    std::bitset<256> blank_leads_;
+    // EncodingUtils::mark_utf8_characters() of the bytes being measured.
+    std::vector<std::uint64_t> character_marks_;
+    bool detected_utf8_ = true;
+    // Decodes possible headings in whichever of the two encodings is not UTF-8.
+    std::shared_ptr<EncodingUtils::Utf8Converter> legacy_converter_;
+    std::string line_bytes_;
+    std::vector<std::string> sentence_ends_;
+    std::string encoding_;
+    std::string alternate_encoding_;
+    // Sorted; runs alternate between encoding_ and alternate_encoding_, starting with the former.
+    std::vector<EncodingSwitch> encoding_switches_;
+    std::uint64_t max_line_bytes_ = kDefaultMaxLineBytes;
+    LineScanState open_line_;
+    std::vector<std::string> blank_sequences_;
+    JunkFilter junk_;
+    std::function<void(std::uint64_t, std::uint64_t)> scan_callback_;
+    std::vector<std::uint64_t> block_checksums_;
+    // Start of the line open where each scanned block begins; a rescan of the
+    // block redoes any cuts made after it.
+    std::vector<std::uint64_t> block_open_lines_;
+    std::uint64_t scanned_bytes_ = 0;
+    std::uint64_t file_size_ = 0;
+    std::vector<char> buffer_;
+};
+
+// The line length limit from the "max_line_bytes" file in the config
+// directory, LineIndex::kDefaultMaxLineBytes without one.
+std::uint64_t read_max_line_bytes();
+
+// Size of the stream's underlying file; leaves the stream cleared.
+std::uint64_t stream_size(std::istream &in);
+
+} // namespace TextIndex
+
+#endif // LINE_INDEX_H
@@ -0,0 +1,85 @@
+#ifndef MAPPED_WINDOW_H
+#define MAPPED_WINDOW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace FileView {
+
+// Read-only access to one file through a memory-mapped window that slides
+// with the reader, so a multi-GB book costs at most one window of address
+// space and resident pages. The window is advised for sequential access and
+// the stretch just ahead of each read is prefetched. If a window cannot be
+// mapped the read falls back to plain positioned reads.
+class MappedWindow {
+public:
+    static const std::uint64_t kWindowBytes = 32ull * 1024 * 1024;
+
+    MappedWindow() = default;
+    ~MappedWindow();
+
+    MappedWindow(const MappedWindow &) = delete;
+    MappedWindow &operator=(const MappedWindow &) = delete;
+
+    bool open(const std::string &path, std::string *error_message);
+    void close();
+    bool is_open() const;
+
+    // Size at the last read; reads re-check it so a shrinking file is never touched past its end.
+    std::uint64_t size() const { return size_; }
+
+    // Copies up to `length` bytes at `offset` into `out` (fewer at EOF).
+    bool read(std::uint64_t offset, std::uint64_t length, std::string &out);
+
+    // Drops [offset, offset + length) from the page cache unless the window
+    // covers it; used after indexing passes over bytes the reader won't need soon.
+    void release(std::uint64_t offset, std::uint64_t length);
+
+private:
+    bool update_size();
+    bool map_window(std::uint64_t offset, std::uint64_t length);
+    void unmap();
+    bool read_direct(std::uint64_t offset, std::uint64_t length, std::string &out);
+
+#ifdef _WIN32
+    void *file_ = nullptr;    // HANDLE
+    void *mapping_ = nullptr; // HANDLE, sized to mapping_size_
+    std::uint64_t mapping_size_ = 0;
+#else
+    int fd_ = -1;
+#endif
+    char *view_ = nullptr;
+    std::uint64_t view_offset_ = 0;
+    size_t view_length_ = 0;
+    std::uint64_t size_ = 0;
+};
+
+// A whole small file mapped read-only, e.g. a precompiled dictionary that is
+// used in place instead of being parsed into memory.
+// An empty file opens with no data (data() is null, size() is 0).
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path, std::string *error_message);
+    void close();
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Best-effort page-cache release for a file read once by a scan (no-op where
+// posix_fadvise is unavailable). `length` 0 means through the end of the file.
+void release_page_cache(const std::string &path, std::uint64_t offset, std::uint64_t length);
+
+} // namespace FileView
+
+#endif // MAPPED_WINDOW_H
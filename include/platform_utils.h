@@ -7,6 +7,13 @@ namespace PlatformUtils {
 
     void platform_sleep(int milliseconds);
     void clear_screen();
+    // Clears the terminal and writes `contents` in a single write, without
+    // spawning a process. Used for frames that must appear at once.
+    void paint_screen(const std::string& contents);
+    // Writes `bytes` (escape sequences included) to the terminal in a single
+    // write. False, with nothing written, if the console can't interpret
+    // escape sequences (older Windows consoles).
+    bool write_terminal(const std::string& bytes);
     char get_path_separator();
     std::string get_os_name();
 
@@ -0,0 +1,68 @@
+#ifndef RANK_BITMAP_H
+#define RANK_BITMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace TextIndex {
+
+// Growable bit vector with rank/select, one bit per line.
+//
+// A running count of set bits is sampled every 512 bits, so rank() is one
+// sample plus at most eight popcounts. select() binary-searches the samples
+// and then walks one 512-bit block. Together they give the nearest set bit in
+// either direction without visiting the bits in between.
+class RankSelectBitmap {
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    void clear();
+    size_t size() const { return size_; }
+    // Number of set bits.
+    size_t count() const { return ones_; }
+
+    bool get(size_t i) const { return ((words_[i / 64] >> (i % 64)) & 1) != 0; }
+    void push_back(bool bit);
+    // Drops every bit from position `count` on.
+    void truncate(size_t count);
+    // Replaces bits [first, last) with `bits`. One-for-one replacement rewrites
+    // only the words holding the range and shifts the later samples by the
+    // change in count; otherwise the words from `first` on are rewritten and
+    // the samples from its 512-bit block on are recounted.
+    void replace(size_t first, size_t last, const std::vector<bool> &bits);
+
+    // Set bits in [0, i).
+    size_t rank(size_t i) const;
+    // Position of the set bit with rank `k` (0-based); npos if k >= count().
+    size_t select(size_t k) const;
+    // First set bit at or after `i` / last set bit at or before `i`; npos if none.
+    size_t next_set(size_t i) const;
+    size_t prev_set(size_t i) const;
+
+    size_t memory_bytes() const;
+
+    void write(std::ostream &out) const;
+    bool read(std::istream &in);
+
+private:
+    static const size_t kWordsPerSample = 8;
+
+    // Recounts the samples from the block holding `first_word` on.
+    void rebuild_samples(size_t first_word = 0);
+    // `width` (<= 64) bits starting at bit `i`.
+    std::uint64_t bits_at(size_t i, unsigned width) const;
+    // Appends the low `width` bits of `value` without updating the samples.
+    void append_bits(std::uint64_t value, unsigned width);
+
+    std::vector<std::uint64_t> words_;
+    std::vector<std::uint64_t> samples_; // set bits before each 512-bit block
+    size_t size_ = 0;
+    size_t ones_ = 0;
+};
+
+} // namespace TextIndex
+
+#endif // RANK_BITMAP_H
@@ -0,0 +1,67 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+namespace FileView {
+
+// Warms the page cache around the reading position without ever waiting on
+// the disk, so that the mapped window's page faults are served from memory
+// even when the book lives on a network mount or a spinning disk.
+//
+// The file is cut into fixed blocks; each call to prefetch_around() submits
+// reads for the blocks near the cursor that were not fetched yet, nearest
+// first and mostly ahead, in one batch. On Linux the batch goes through an
+// io_uring with its buffers registered up front (fixed-buffer reads, one
+// system call per batch); where io_uring is unavailable or refused,
+// prefetch tasks on the shared Tasks::Scheduler issue positioned reads
+// instead. The data read is thrown
+// away: only the page cache it leaves behind matters, so the reader never
+// sees stale bytes from this path.
+class Readahead {
+public:
+    static const std::uint64_t kBlockBytes = 128 * 1024;
+
+    Readahead();
+    ~Readahead();
+
+    Readahead(const Readahead &) = delete;
+    Readahead &operator=(const Readahead &) = delete;
+
+    bool open(const std::string &path, std::string *error_message);
+    // Waits for reads in flight, then releases the file and the backend.
+    void close();
+    bool is_open() const;
+    // "io_uring", "threads", or "" when closed.
+    const char *backend_name() const;
+
+    // Queues reads for the unfetched blocks within reach of `offset`; returns
+    // at once. Reads queued for an earlier position that have not started yet
+    // are dropped in favour of the new ones.
+    void prefetch_around(std::uint64_t offset, std::uint64_t file_size);
+
+    // Forgets which blocks were fetched, e.g. after the file changed.
+    void forget();
+
+private:
+    struct Ring;
+    struct Pool;
+
+    bool remembered(std::uint64_t block) const { return fetched_.count(block) != 0; }
+    void remember(std::uint64_t block);
+
+    std::unique_ptr<Ring> ring_;
+    std::unique_ptr<Pool> pool_;
+    // Blocks already read (or in flight), oldest first, bounded.
+    std::unordered_set<std::uint64_t> fetched_;
+    std::deque<std::uint64_t> fetch_order_;
+};
+
+} // namespace FileView
+
+#endif // READAHEAD_H
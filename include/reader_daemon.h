@@ -0,0 +1,62 @@
+#ifndef READER_DAEMON_H
+#define READER_DAEMON_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "fingerprint.h"
+#include "line_index.h"
+
+namespace ReaderDaemon {
+
+// Optional background process that keeps recently opened books (open file,
+// detected encoding, fingerprint and a line index it completes on its own)
+// so that each reader launch can skip all of that work. Clients attach over
+// a Unix domain socket; the serialized index is handed over as a sealed
+// shared-memory object and mapped by the client, never copied through the
+// socket. POSIX only: on Windows run() fails and request_book() returns false.
+
+// $XDG_RUNTIME_DIR/NovelReader.sock, else daemon.sock in the cache directory;
+// empty where the daemon is not supported.
+std::string socket_path();
+
+// Serves clients in the foreground until SIGINT or SIGTERM. Fails if another
+// daemon already answers on socket_path().
+bool run(std::string *error_message);
+
+// A book as the daemon knows it. The index stays mapped until release() or
+// destruction.
+class BookInfo {
+public:
+    BookInfo() = default;
+    ~BookInfo();
+
+    BookInfo(const BookInfo &) = delete;
+    BookInfo &operator=(const BookInfo &) = delete;
+
+    Fingerprint::BookFingerprint fingerprint;
+    std::string encoding;
+
+    // Loads the shared index into `index`, which must already have the
+    // encoding's blank sequences and the junk patterns set; false if it
+    // doesn't fit `file`, of `file_size` bytes, or the daemon filtered with
+    // other patterns.
+    bool load_index(TextIndex::LineIndex &index, std::istream &file, std::uint64_t file_size) const;
+    bool has_index() const { return index_data_ != nullptr; }
+    void release();
+
+private:
+    friend bool request_book(const std::string &, BookInfo &, std::string *);
+
+    const char *index_data_ = nullptr;
+    size_t index_bytes_ = 0;
+};
+
+// Asks a running daemon about the book at `path`. Returns false quickly when
+// no daemon is listening, so callers can always try it first.
+bool request_book(const std::string &path, BookInfo &out, std::string *error_message);
+
+} // namespace ReaderDaemon
+
+#endif // READER_DAEMON_H
@@ -0,0 +1,104 @@
+#ifndef REGEX_SEARCH_H
+#define REGEX_SEARCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace TextSearch {
+
+// A regular expression over UTF-8 text, compiled to a Thompson NFA whose
+// edges are byte ranges; Unicode classes are expanded into the UTF-8 byte
+// sequences that encode them. Supported syntax:
+//
+//   literals, .  [abc] [^a-z] [一-龥]   \d \w \s \D \W \S (\s includes U+3000)
+//   ( ) (?: ) |   * + ? {n} {n,} {n,m} (a trailing ? is accepted and ignored)
+//   ^ at the start and $ at the end of the whole pattern
+//
+// Matching is per line: a line matches if any part of it does.
+class Regex {
+public:
+    bool compile(const std::string &pattern, std::string *error_message);
+    bool empty() const { return states_.empty(); }
+
+    // NFA states; Split is an epsilon fork (out1 may be -1), EndOfLine is
+    // crossed only at the end of the line.
+    enum class StateType : std::uint8_t { Bytes, Split, EndOfLine, Match };
+    struct State {
+        StateType type;
+        std::uint8_t lo; // byte range for Bytes
+        std::uint8_t hi;
+        int out;
+        int out1; // second branch of a Split
+    };
+
+private:
+    friend class Matcher;
+
+    std::vector<State> states_;
+    int start_ = -1;
+    bool anchored_ = false; // pattern began with ^
+    std::uint8_t byte_class_[256] = {};
+    size_t class_count_ = 0;
+};
+
+// Lazily built DFA for one Regex. Each state is the set of NFA states the
+// text so far can be in; transitions are computed the first time they are
+// taken and cached, and the cache is flushed whenever it outgrows its memory
+// budget, so memory stays bounded however large the automaton would become.
+// Not thread-safe: give every thread its own Matcher over a shared Regex.
+class Matcher {
+public:
+    Matcher(const Regex &regex, size_t memory_budget);
+
+    // True if the line [begin, end) (without its newline) contains a match.
+    bool matches_line(const char *begin, const char *end);
+    size_t cache_flushes() const { return flushes_; }
+
+private:
+    static const int kUnknown = -1;
+    static const int kDead = 0;
+
+    int add_state(std::vector<int> &nfa_states);
+    int step(int state, size_t symbol);
+    void add_closure(int nfa_state, std::vector<int> &out, std::vector<unsigned> &seen) const;
+    void reset_cache();
+
+    const Regex &regex_;
+    size_t memory_budget_;
+    size_t stride_;      // classes + the end-of-line symbol
+    int start_ = kDead;
+    std::vector<int> transitions_;
+    std::vector<std::vector<int>> sets_;
+    std::vector<char> matching_;
+    std::unordered_map<std::string, int> ids_;
+    size_t memory_used_ = 0;
+    size_t flushes_ = 0;
+    std::vector<unsigned> seen_;
+    unsigned generation_ = 0;
+};
+
+struct Hit {
+    std::int64_t line;   // 1-based
+    std::uint64_t offset; // first byte of the (virtual) line
+};
+
+// Matches every line of the file at `path` (text in `encoding`, or in places
+// its EncodingUtils::alternate_encoding()) against `regex`, scanning
+// fixed-size chunks of the mapped file on the calling thread and on
+// Tasks::Priority::Search workers of the shared scheduler.
+// Lines are numbered by counting newlines on the way, so no index is needed;
+// lines longer than `max_line_bytes` count as the virtual lines
+// TextIndex::LineIndex cuts them into, each searched on its own.
+// Hits come back in file order, at most `max_hits` of them. Returns false on
+// I/O errors or if `cancel` was raised.
+bool search_file(const std::string &path, const std::string &encoding, size_t max_line_bytes, const Regex &regex,
+                 size_t max_hits, const std::atomic<bool> *cancel, std::vector<Hit> &hits,
+                 std::string *error_message);
+
+} // namespace TextSearch
+
+#endif // REGEX_SEARCH_H
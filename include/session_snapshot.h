@@ -0,0 +1,35 @@
+#ifndef SESSION_SNAPSHOT_H
+#define SESSION_SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+
+#include "fingerprint.h"
+
+namespace Session {
+
+// What the reader was showing when it last closed: enough to paint the same
+// screen on the next launch before any file is opened, and to check afterwards
+// that the book behind it has not changed.
+struct Snapshot {
+    std::string fingerprint; // Fingerprint::BookFingerprint::to_string()
+    std::string novel_path;
+    std::string encoding;
+    std::int64_t line_number = 0;
+    std::uint64_t byte_offset = 0; // start of the displayed line
+    std::uint64_t line_bytes = 0;  // raw length of the displayed line, without its line break
+    std::uint64_t line_hash = 0;   // XXH64 of those bytes
+    std::string frame;             // the screen as painted, excluding transient key hints
+};
+
+bool read_snapshot(const std::string &path, Snapshot &out);
+bool write_snapshot(const std::string &path, const Snapshot &snapshot);
+
+// True if `snapshot.novel_path` still holds the same book and the displayed
+// line is still at its offset. `fingerprint` receives the file's current
+// fingerprint either way (invalid if the file can't be read).
+bool validate_snapshot(const Snapshot &snapshot, Fingerprint::BookFingerprint &fingerprint);
+
+} // namespace Session
+
+#endif // SESSION_SNAPSHOT_H
@@ -0,0 +1,66 @@
+#ifndef STREAM_SPOOL_H
+#define STREAM_SPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace FileView {
+
+// Copies a source that cannot be seeked (standard input, a FIFO) into a
+// temporary file on a background thread, so that the reader can open the
+// file like any other book while it is still growing: the line index picks
+// up appended text incrementally (see FileWatch::FileWatcher), and paging
+// back reaches everything received so far. Memory stays at one copy buffer
+// however long the stream runs; the data itself lives on disk until the
+// spool is destroyed. POSIX only: on Windows start() fails.
+class StreamSpool {
+public:
+    StreamSpool() = default;
+    // Stops copying and deletes the temporary file.
+    ~StreamSpool();
+
+    StreamSpool(const StreamSpool &) = delete;
+    StreamSpool &operator=(const StreamSpool &) = delete;
+
+    // True for "-" (standard input) and for paths naming a FIFO, socket or
+    // character device, i.e. anything that has to be spooled to be read.
+    static bool is_stream_source(const std::string &name);
+
+    // Starts copying `name` ("-" for standard input). When standard input is
+    // the source and `take_terminal` is set, the controlling terminal is
+    // reopened in its place so keys can still be read.
+    bool start(const std::string &name, bool take_terminal, std::string *error_message);
+    // The temporary file; empty before start().
+    const std::string &path() const { return path_; }
+
+    std::uint64_t bytes_received() const { return received_; }
+    // The source reached its end (or failed, see error()).
+    bool finished() const { return finished_; }
+    std::string error() const;
+
+    // Blocks until at least `bytes` have arrived or the source has ended.
+    void wait_for(std::uint64_t bytes);
+
+private:
+    void run();
+    void stop();
+
+    int source_fd_ = -1;
+    int spool_fd_ = -1;
+    std::string path_;
+    std::thread thread_;
+    std::atomic<std::uint64_t> received_{0};
+    std::atomic<bool> finished_{false};
+    std::atomic<bool> stopping_{false};
+    mutable std::mutex mutex_;
+    std::condition_variable arrived_;
+    std::string error_;
+};
+
+} // namespace FileView
+
+#endif // STREAM_SPOOL_H
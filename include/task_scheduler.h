@@ -0,0 +1,166 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Tasks {
+
+// Classes of background work, most urgent first. A free worker always takes
+// the most urgent task it is allowed to run, so a viewport task never waits
+// behind queued search or indexing work; at worst it waits for one running
+// task to finish, which is why long jobs are submitted in slices.
+enum class Priority {
+    Viewport = 0, // the screen is waiting for it (e.g. checking a resumed frame)
+    Prefetch,     // reads ahead of the reading position
+    Search,       // regex search over the book
+    Bulk,         // indexing whole books, library scans, transcoding
+};
+const size_t kPriorityCount = 4;
+
+// Shared flag for stopping a family of tasks. Queued tasks whose token is
+// cancelled are dropped without running; running ones poll cancelled().
+// Copies share the flag.
+class CancelToken {
+public:
+    CancelToken() : flag_(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() { flag_->store(true); }
+    bool cancelled() const { return flag_ && flag_->load(); }
+    // For code taking a plain flag, e.g. TextSearch::search_file().
+    const std::atomic<bool> *flag() const { return flag_.get(); }
+
+private:
+    friend class Scheduler;
+    // Placeholder in the scheduler's task slots, so that an empty slot costs no allocation.
+    explicit CancelToken(std::nullptr_t) {}
+
+    std::shared_ptr<std::atomic<bool>> flag_;
+};
+
+class Scheduler;
+
+// Tasks submitted together so that they can be waited for together. The
+// destructor waits, so a group must outlive everything its tasks touch.
+class TaskGroup {
+public:
+    TaskGroup() = default;
+    ~TaskGroup() { wait(); }
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    // Returns once every task of the group has run or been dropped. While
+    // waiting, the caller runs the group's queued tasks itself instead of
+    // idling, so waiting from inside a task cannot deadlock the pool.
+    void wait();
+    bool idle() const;
+
+private:
+    friend class Scheduler;
+
+    Scheduler *scheduler_ = nullptr;
+    mutable std::mutex mutex_;
+    std::condition_variable done_;
+    size_t outstanding_ = 0;
+};
+
+// One work-stealing pool for all background work. Each worker has a deque
+// per priority; tasks submitted from a worker go to its own deque (taken
+// newest first, for locality) and tasks from other threads to a shared one.
+// An idle worker takes, for each priority from the most urgent down, from
+// its own deque, then the shared one, then the oldest task of another
+// worker. The CPU-heavy classes are capped: Search and Bulk together run on
+// at most cpu_share_percent of the hardware threads (Bulk on at most half of
+// that), so that the reading screen keeps a core to itself however much
+// background work is queued.
+class Scheduler {
+public:
+    static const size_t kMaxWorkers = 16;
+    static const unsigned kDefaultCpuSharePercent = 75;
+
+    // `workers` threads (at least 2, at most kMaxWorkers); 0 picks one per
+    // hardware thread. `cpu_share_percent` is clamped to 10..100.
+    Scheduler(size_t workers, unsigned cpu_share_percent);
+    // Drops the queued tasks and waits for the running ones.
+    ~Scheduler();
+
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    size_t worker_count() const { return workers_.size(); }
+    // Tasks of `priority` that may run at once; sizes the parallel loops.
+    size_t max_running(Priority priority) const { return max_running_[static_cast<size_t>(priority)]; }
+
+    void submit(Priority priority, std::function<void()> task, const CancelToken &token = CancelToken(),
+                TaskGroup *group = nullptr);
+
+    // Runs `function` as a task and hands back its result. If the token is
+    // cancelled before the task starts, the future reports a broken promise.
+    template <typename Function>
+    auto async(Priority priority, Function function, const CancelToken &token = CancelToken())
+        -> std::future<decltype(function())>
+    {
+        typedef decltype(function()) Result;
+        std::shared_ptr<std::packaged_task<Result()>> task =
+            std::make_shared<std::packaged_task<Result()>>(std::move(function));
+        std::future<Result> result = task->get_future();
+        submit(priority, [task]() { (*task)(); }, token);
+        return result;
+    }
+
+private:
+    friend class TaskGroup;
+
+    struct Task {
+        std::function<void()> run;
+        Priority priority = Priority::Bulk;
+        CancelToken token{nullptr};
+        TaskGroup *group = nullptr;
+    };
+    struct Queues {
+        std::mutex mutex;
+        std::deque<Task> tasks[kPriorityCount];
+    };
+
+    void run_worker(size_t index);
+    bool take(size_t worker, Task &task);
+    bool take_from_group(const TaskGroup *group, Task &task);
+    bool pop(Queues &queues, size_t priority, bool newest, const TaskGroup *group, Task &task);
+    bool reserve(size_t priority, bool ignore_caps);
+    void execute(Task &task);
+    void finish(Task &task);
+    void wake_workers();
+
+    std::vector<std::unique_ptr<Queues>> worker_queues_;
+    Queues shared_;
+    std::vector<std::thread> workers_;
+    std::mutex slots_mutex_;
+    size_t max_running_[kPriorityCount];
+    // Cap on Search and Bulk tasks together.
+    size_t max_running_cpu_heavy_ = 1;
+    size_t running_[kPriorityCount] = {};
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    // Bumped on every submit and finish; idle workers sleep until it moves.
+    std::uint64_t generation_ = 0;
+    bool stopping_ = false;
+};
+
+// The process-wide pool, started on first use with the CPU share from the
+// configuration directory's `cpu_share` file (a percentage).
+Scheduler &shared_scheduler();
+unsigned read_cpu_share_percent();
+
+} // namespace Tasks
+
+#endif // TASK_SCHEDULER_H
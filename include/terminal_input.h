@@ -18,14 +18,36 @@ enum class KeyType {
     ArrowDown,
     ArrowLeft,
     ArrowRight,
+    PageUp,
+    PageDown,
+    Home,
+    End,
+    Insert,
+    Delete,
+    Backspace,
+    Function, // F1..F12, number in KeyEvent::function_number
+    Paste,    // bracketed paste, payload in KeyEvent::text
+    Wakeup,   // no key: the wake descriptor became readable
     Escape,
     CtrlC,
     CtrlD,
 };
 
+// Modifier bits decoded from xterm-style "CSI 1;<mod> X" parameters.
+enum KeyModifier : unsigned {
+    ModNone = 0,
+    ModShift = 1u << 0,
+    ModAlt = 1u << 1,
+    ModCtrl = 1u << 2,
+    ModMeta = 1u << 3,
+};
+
 struct KeyEvent {
     KeyType type = KeyType::Unknown;
     char ch = '\0';
+    unsigned modifiers = ModNone;
+    int function_number = 0;
+    std::string text;
 };
 
 class ScopedRawMode {
@@ -45,7 +67,13 @@ private:
 #endif
 };
 
-bool read_key_blocking(KeyEvent &out, std::string *error_message);
+// Blocks for one key. If `wake_fd` is given and becomes readable first, returns
+// a KeyType::Wakeup event instead (POSIX only).
+bool read_key_blocking(KeyEvent &out, std::string *error_message, int wake_fd = -1);
+
+// True if a key is waiting, so read_key_blocking() would return at once.
+// Lets callers do background work between keys without delaying them.
+bool key_pending();
 
 } // namespace TerminalInput
 
@@ -0,0 +1,30 @@
+#ifndef TEXT_ANALYSIS_H
+#define TEXT_ANALYSIS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace TextAnalysis {
+
+// Longest line still considered a heading, in bytes.
+const size_t kMaxHeadingBytes = 120;
+
+// Decodes the UTF-8 code point at `pos` and advances `pos`. Invalid bytes
+// decode as U+FFFD and advance by one byte.
+std::uint32_t next_code_point(const std::string &utf8, size_t &pos);
+
+// Removes ASCII whitespace and U+3000 (ideographic space) from both ends.
+std::string trim_text(const std::string &utf8);
+
+// Heuristic for chapter headings in Chinese web novels and plain English
+// books: "第十二章 …", "第12回", "卷三", "序章", "Chapter 7", ...
+bool is_chapter_heading(const std::string &utf8_line);
+// The characters (UTF-8) a heading can begin with once trimmed, so that a scan
+// can pass over most lines without decoding them.
+const std::vector<std::string> &chapter_heading_initials();
+
+} // namespace TextAnalysis
+
+#endif // TEXT_ANALYSIS_H
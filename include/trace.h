@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Scoped timing spans written as Chrome Trace Event JSON, which Perfetto
+// (ui.perfetto.dev) and chrome://tracing open directly.
+//
+// Spans exist only in builds configured with -DNOVELREADER_WITH_TRACE=ON;
+// otherwise every macro below expands to nothing. A tracing build records
+// when the NOVELREADER_TRACE environment variable names an output file:
+//
+//     NOVELREADER_TRACE=/tmp/reader.json NovelReaderCLI
+//
+// Each span becomes one complete ("X") event stamped with the recording
+// thread, so background work shows up on its own track.
+
+#if defined(NOVELREADER_TRACE)
+
+#include <chrono>
+
+namespace Trace {
+
+// Opens the file named by NOVELREADER_TRACE, if set. Events are appended as
+// they finish, so a trace cut short by a kill is still readable.
+void start_from_environment();
+bool enabled();
+// Labels the calling thread's track.
+void name_thread(const char *name);
+
+class Span {
+public:
+    // `name` must outlive the program (a string literal).
+    explicit Span(const char *name);
+    ~Span();
+
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+private:
+    const char *name_;
+    std::chrono::steady_clock::time_point begin_;
+};
+
+} // namespace Trace
+
+#define NR_TRACE_JOIN_(a, b) a##b
+#define NR_TRACE_JOIN(a, b) NR_TRACE_JOIN_(a, b)
+#define TRACE_START() Trace::start_from_environment()
+#define TRACE_SPAN(name) Trace::Span NR_TRACE_JOIN(trace_span_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) Trace::name_thread(name)
+
+#else
+
+#define TRACE_START() ((void)0)
+#define TRACE_SPAN(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
+
+#endif // TRACE_H
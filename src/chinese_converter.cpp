@@ -0,0 +1,350 @@
+#include "chinese_converter.h"
+
+#include "file_system_utils.h"
+#include "trace.h"
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+
+namespace ChineseConvert {
+
+namespace {
+
+const char kDictionaryMagic[8] = {'N', 'R', 'Z', 'H', 'D', 'A', '0', '1'};
+// Written in native order; a file from a machine with the other byte order is refused.
+const std::uint32_t kByteOrderProbe = 0x01020304u;
+const size_t kHeaderBytes = 40;
+
+struct Header {
+    char magic[8];
+    std::uint32_t byte_order;
+    std::uint32_t reserved;
+    std::uint64_t unit_count;
+    std::uint64_t value_count;
+    std::uint64_t pool_bytes;
+};
+
+static_assert(sizeof(Header) == kHeaderBytes, "dictionary header layout");
+
+size_t utf8_sequence_length(unsigned char lead)
+{
+    if (lead >= 0xF0) return 4;
+    if (lead >= 0xE0) return 3;
+    if (lead >= 0xC0) return 2;
+    return 1;
+}
+
+// Double-array construction over keys sorted bytewise. Code 0 marks the end
+// of a key; byte b uses code b + 1.
+class TrieBuilder {
+public:
+    struct Unit {
+        std::int32_t base;
+        std::int32_t check;
+    };
+
+    explicit TrieBuilder(const std::vector<std::string> &keys) : keys_(keys) {}
+
+    bool build(std::string *error_message)
+    {
+        units_.assign(1024, Unit{0, -1});
+        units_[0].check = -2; // the root is nobody's child
+        if (keys_.empty()) return true;
+        return build_state(0, 0, keys_.size(), 0, error_message);
+    }
+
+    const std::vector<Unit> &units() const { return units_; }
+
+private:
+    size_t code_at(size_t key, size_t depth) const
+    {
+        const std::string &k = keys_[key];
+        return k.size() == depth ? 0 : static_cast<size_t>(static_cast<unsigned char>(k[depth])) + 1;
+    }
+
+    void ensure(size_t size)
+    {
+        if (units_.size() < size) units_.resize(size > units_.size() * 2 ? size : units_.size() * 2, Unit{0, -1});
+    }
+
+    // Keys [lo, hi) share their first `depth` bytes, the path to `state`.
+    bool build_state(size_t state, size_t lo, size_t hi, size_t depth, std::string *error_message)
+    {
+        std::vector<size_t> codes;
+        std::vector<size_t> group_starts;
+        for (size_t i = lo; i < hi; ++i)
+        {
+            const size_t code = code_at(i, depth);
+            if (codes.empty() || codes.back() != code)
+            {
+                codes.push_back(code);
+                group_starts.push_back(i);
+            }
+        }
+        group_starts.push_back(hi);
+
+        // Lowest base whose slots for every code are free.
+        size_t position = first_free_ > codes[0] + 1 ? first_free_ : codes[0] + 1;
+        size_t base = 0;
+        while (true)
+        {
+            ensure(position + 1);
+            if (units_[position].check != -1)
+            {
+                ++position;
+                continue;
+            }
+            base = position - codes[0];
+            ensure(base + codes.back() + 1);
+            bool fits = true;
+            for (size_t code : codes)
+            {
+                if (units_[base + code].check != -1)
+                {
+                    fits = false;
+                    break;
+                }
+            }
+            if (fits) break;
+            ++position;
+        }
+        if (base + codes.back() > static_cast<size_t>(std::numeric_limits<std::int32_t>::max()))
+        {
+            if (error_message) *error_message = "dictionary too large";
+            return false;
+        }
+
+        units_[state].base = static_cast<std::int32_t>(base);
+        for (size_t code : codes) units_[base + code].check = static_cast<std::int32_t>(state);
+        while (first_free_ < units_.size() && units_[first_free_].check != -1) ++first_free_;
+
+        for (size_t g = 0; g < codes.size(); ++g)
+        {
+            const size_t child = base + codes[g];
+            if (codes[g] == 0)
+            {
+                // A key ends here; its value index is the key's own.
+                units_[child].base = -static_cast<std::int32_t>(group_starts[g]) - 1;
+            }
+            else if (!build_state(child, group_starts[g], group_starts[g + 1], depth + 1, error_message))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const std::vector<std::string> &keys_;
+    std::vector<Unit> units_;
+    size_t first_free_ = 1;
+};
+
+} // namespace
+
+bool Dictionary::open(const std::string &path, std::string *error_message)
+{
+    close();
+    if (!file_.open(path, error_message)) return false;
+
+    Header header;
+    const size_t size = file_.size();
+    bool valid = size >= kHeaderBytes;
+    if (valid)
+    {
+        std::memcpy(&header, file_.data(), sizeof(header));
+        valid = std::memcmp(header.magic, kDictionaryMagic, sizeof(kDictionaryMagic)) == 0 &&
+                header.byte_order == kByteOrderProbe && header.unit_count > 0 &&
+                header.unit_count <= (size - kHeaderBytes) / sizeof(Unit);
+    }
+    if (valid)
+    {
+        const size_t rest = size - kHeaderBytes - static_cast<size_t>(header.unit_count) * sizeof(Unit);
+        valid = header.value_count < rest / sizeof(std::uint32_t) &&
+                header.pool_bytes == rest - (static_cast<size_t>(header.value_count) + 1) * sizeof(std::uint32_t);
+    }
+    if (!valid)
+    {
+        if (error_message) *error_message = "not a NovelReader dictionary: " + path;
+        file_.close();
+        return false;
+    }
+
+    units_ = reinterpret_cast<const Unit *>(file_.data() + kHeaderBytes);
+    unit_count_ = static_cast<size_t>(header.unit_count);
+    value_offsets_ = reinterpret_cast<const std::uint32_t *>(units_ + unit_count_);
+    value_count_ = static_cast<size_t>(header.value_count);
+    pool_ = reinterpret_cast<const char *>(value_offsets_ + value_count_ + 1);
+    pool_bytes_ = static_cast<size_t>(header.pool_bytes);
+    return true;
+}
+
+void Dictionary::close()
+{
+    file_.close();
+    units_ = nullptr;
+    unit_count_ = 0;
+    value_offsets_ = nullptr;
+    value_count_ = 0;
+    pool_ = nullptr;
+    pool_bytes_ = 0;
+}
+
+bool Dictionary::longest_match(const char *begin, const char *end, size_t &matched, const char *&value,
+                               size_t &value_length) const
+{
+    if (units_ == nullptr) return false;
+    bool found = false;
+    size_t state = 0;
+    for (const char *p = begin;; ++p)
+    {
+        const std::int32_t base = units_[state].base;
+        if (base < 0) break;
+        const size_t leaf = static_cast<size_t>(base);
+        if (leaf < unit_count_ && units_[leaf].check == static_cast<std::int32_t>(state) && units_[leaf].base < 0)
+        {
+            const size_t index = static_cast<size_t>(-(units_[leaf].base + 1));
+            const std::uint32_t from = index < value_count_ ? value_offsets_[index] : 0;
+            const std::uint32_t to = index < value_count_ ? value_offsets_[index + 1] : 0;
+            if (from <= to && to <= pool_bytes_)
+            {
+                matched = static_cast<size_t>(p - begin);
+                value = pool_ + from;
+                value_length = to - from;
+                found = true;
+            }
+        }
+        if (p == end) break;
+        const size_t next = leaf + static_cast<unsigned char>(*p) + 1;
+        if (next >= unit_count_ || units_[next].check != static_cast<std::int32_t>(state)) break;
+        state = next;
+    }
+    return found;
+}
+
+std::string Dictionary::convert(const std::string &utf8) const
+{
+    TRACE_SPAN("S/T convert");
+    std::string out;
+    out.reserve(utf8.size());
+    const char *p = utf8.data();
+    const char *end = p + utf8.size();
+    while (p < end)
+    {
+        size_t matched = 0;
+        const char *value = nullptr;
+        size_t value_length = 0;
+        if (longest_match(p, end, matched, value, value_length) && matched > 0)
+        {
+            out.append(value, value_length);
+            p += matched;
+            continue;
+        }
+        size_t step = utf8_sequence_length(static_cast<unsigned char>(*p));
+        if (step > static_cast<size_t>(end - p)) step = static_cast<size_t>(end - p);
+        out.append(p, step);
+        p += step;
+    }
+    return out;
+}
+
+bool compile_dictionary(const std::vector<std::string> &sources, const std::string &output_path,
+                        std::string *error_message)
+{
+    // Sorted bytewise, which is the order the builder needs.
+    std::map<std::string, std::string> entries;
+    for (const std::string &source : sources)
+    {
+        std::ifstream in(source, std::ios::in | std::ios::binary);
+        if (!in.is_open())
+        {
+            if (error_message) *error_message = "Could not open " + source;
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            const size_t tab = line.find('\t');
+            if (line.empty() || line[0] == '#' || tab == std::string::npos || tab == 0) continue;
+            const size_t value_end = line.find_first_of(" \t", tab + 1);
+            const std::string value =
+                line.substr(tab + 1, value_end == std::string::npos ? std::string::npos : value_end - tab - 1);
+            if (!value.empty()) entries.insert(std::make_pair(line.substr(0, tab), value));
+        }
+    }
+    if (entries.empty())
+    {
+        if (error_message) *error_message = "no entries found";
+        return false;
+    }
+
+    std::vector<std::string> keys;
+    std::string pool;
+    std::vector<std::uint32_t> value_offsets;
+    keys.reserve(entries.size());
+    for (const auto &entry : entries)
+    {
+        keys.push_back(entry.first);
+        value_offsets.push_back(static_cast<std::uint32_t>(pool.size()));
+        pool += entry.second;
+    }
+    value_offsets.push_back(static_cast<std::uint32_t>(pool.size()));
+    if (pool.size() > std::numeric_limits<std::uint32_t>::max())
+    {
+        if (error_message) *error_message = "dictionary too large";
+        return false;
+    }
+
+    TrieBuilder builder(keys);
+    if (!builder.build(error_message)) return false;
+    // Trim the free tail left by the last growth step.
+    std::vector<TrieBuilder::Unit> units = builder.units();
+    while (units.size() > 1 && units.back().check == -1) units.pop_back();
+
+    Header header;
+    std::memcpy(header.magic, kDictionaryMagic, sizeof(kDictionaryMagic));
+    header.byte_order = kByteOrderProbe;
+    header.reserved = 0;
+    header.unit_count = units.size();
+    header.value_count = keys.size();
+    header.pool_bytes = pool.size();
+
+    std::string contents(reinterpret_cast<const char *>(&header), sizeof(header));
+    contents.append(reinterpret_cast<const char *>(units.data()), units.size() * sizeof(TrieBuilder::Unit));
+    contents.append(reinterpret_cast<const char *>(value_offsets.data()), value_offsets.size() * sizeof(std::uint32_t));
+    contents += pool;
+    if (!FileSystemUtils::write_file_atomic(output_path, contents))
+    {
+        if (error_message) *error_message = "Could not write " + output_path;
+        return false;
+    }
+    return true;
+}
+
+const std::string &LineCache::get(std::uint64_t key, const std::string &utf8, const Dictionary &dictionary)
+{
+    const auto found = by_key_.find(key);
+    if (found != by_key_.end())
+    {
+        entries_.splice(entries_.begin(), entries_, found->second);
+        return found->second->second;
+    }
+    if (!entries_.empty() && entries_.size() >= capacity_)
+    {
+        by_key_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+    entries_.emplace_front(key, dictionary.convert(utf8));
+    by_key_[key] = entries_.begin();
+    return entries_.front().second;
+}
+
+void LineCache::clear()
+{
+    entries_.clear();
+    by_key_.clear();
+}
+
+} // namespace ChineseConvert
@@ -0,0 +1,293 @@
+#include "compact_offsets.h"
+
+#include <algorithm>
+
+namespace TextIndex {
+
+namespace {
+
+unsigned bits_needed(std::uint64_t value)
+{
+    unsigned bits = 0;
+    while (value != 0)
+    {
+        ++bits;
+        value >>= 1;
+    }
+    return bits;
+}
+
+std::uint64_t low_mask(unsigned width)
+{
+    return width >= 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << width) - 1;
+}
+
+} // namespace
+
+const size_t CompactOffsets::kGroupSize;
+
+void write_u64_le(std::ostream &out, std::uint64_t value)
+{
+    char bytes[8];
+    for (int i = 0; i < 8; ++i) bytes[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+    out.write(bytes, sizeof(bytes));
+}
+
+bool read_u64_le(std::istream &in, std::uint64_t &value)
+{
+    unsigned char bytes[8];
+    if (!in.read(reinterpret_cast<char *>(bytes), sizeof(bytes))) return false;
+    value = 0;
+    for (int i = 7; i >= 0; --i) value = (value << 8) | bytes[i];
+    return true;
+}
+
+void CompactOffsets::clear()
+{
+    sealed_groups_.clear();
+    words_.clear();
+    bit_count_ = 0;
+    tail_.clear();
+}
+
+std::uint64_t CompactOffsets::read_bits(std::uint64_t position, unsigned width) const
+{
+    if (width == 0) return 0;
+    const size_t word = static_cast<size_t>(position >> 6);
+    const unsigned shift = static_cast<unsigned>(position & 63);
+    std::uint64_t value = words_[word] >> shift;
+    if (shift + width > 64) value |= words_[word + 1] << (64 - shift);
+    return value & low_mask(width);
+}
+
+void CompactOffsets::append_bits(std::uint64_t value, unsigned width)
+{
+    if (width == 0) return;
+    const unsigned shift = static_cast<unsigned>(bit_count_ & 63);
+    if (shift == 0) words_.push_back(0);
+    words_.back() |= value << shift;
+    if (shift + width > 64) words_.push_back(value >> (64 - shift));
+    bit_count_ += width;
+}
+
+void CompactOffsets::seal_tail()
+{
+    const std::uint64_t base = tail_.front();
+    const unsigned width = bits_needed(tail_.back() - base);
+    sealed_groups_.push_back(Group{base, (bit_count_ << 7) | width});
+    for (size_t i = 1; i < tail_.size(); ++i) append_bits(tail_[i] - base, width);
+    tail_.clear();
+}
+
+std::uint64_t CompactOffsets::at(size_t i) const
+{
+    const size_t g = i / kGroupSize;
+    const size_t j = i % kGroupSize;
+    if (g >= sealed_groups_.size()) return tail_[j];
+    const Group &group = sealed_groups_[g];
+    if (j == 0) return group.base;
+    const unsigned width = group_width(group);
+    return group.base + read_bits(group_bit_position(group) + (j - 1) * width, width);
+}
+
+void CompactOffsets::push_back(std::uint64_t offset)
+{
+    tail_.push_back(offset);
+    if (tail_.size() == kGroupSize) seal_tail();
+}
+
+void CompactOffsets::truncate(size_t count)
+{
+    if (count >= size()) return;
+    const size_t g = count / kGroupSize;
+    if (g >= sealed_groups_.size())
+    {
+        tail_.resize(count - sealed_groups_.size() * kGroupSize);
+        return;
+    }
+
+    // Unpack the kept head of group `g` into the tail, then drop the packed bits from there on.
+    std::vector<std::uint64_t> head;
+    for (size_t i = g * kGroupSize; i < count; ++i) head.push_back(at(i));
+    bit_count_ = group_bit_position(sealed_groups_[g]);
+    sealed_groups_.resize(g);
+    words_.resize(static_cast<size_t>((bit_count_ + 63) / 64));
+    const unsigned used = static_cast<unsigned>(bit_count_ & 63);
+    if (used != 0) words_.back() &= low_mask(used);
+    tail_.swap(head);
+}
+
+void CompactOffsets::write_bits(std::uint64_t position, unsigned width, std::uint64_t value)
+{
+    if (width == 0) return;
+    const size_t word = static_cast<size_t>(position >> 6);
+    const unsigned shift = static_cast<unsigned>(position & 63);
+    const std::uint64_t mask = low_mask(width);
+    value &= mask;
+    words_[word] = (words_[word] & ~(mask << shift)) | (value << shift);
+    if (shift + width > 64)
+    {
+        const unsigned spilled = 64 - shift;
+        words_[word + 1] = (words_[word + 1] & ~(mask >> spilled)) | (value >> spilled);
+    }
+}
+
+bool CompactOffsets::replace_in_place(size_t first, const std::vector<std::uint64_t> &values)
+{
+    const size_t end = first + values.size();
+    const size_t first_group = first / kGroupSize;
+    const size_t last_group = std::min((end - 1) / kGroupSize + 1, sealed_groups_.size());
+
+    // The new contents of the touched sealed groups, checked before anything is written.
+    std::vector<std::uint64_t> updated;
+    for (size_t g = first_group; g < last_group; ++g)
+    {
+        for (size_t i = g * kGroupSize; i < (g + 1) * kGroupSize; ++i)
+        {
+            updated.push_back(i >= first && i < end ? values[i - first] : at(i));
+        }
+        const std::uint64_t *group = updated.data() + updated.size() - kGroupSize;
+        if (bits_needed(group[kGroupSize - 1] - group[0]) > group_width(sealed_groups_[g])) return false;
+    }
+
+    for (size_t g = first_group; g < last_group; ++g)
+    {
+        Group &group = sealed_groups_[g];
+        const std::uint64_t *group_values = updated.data() + (g - first_group) * kGroupSize;
+        const unsigned width = group_width(group);
+        group.base = group_values[0];
+        for (size_t j = 1; j < kGroupSize; ++j)
+        {
+            write_bits(group_bit_position(group) + (j - 1) * width, width, group_values[j] - group.base);
+        }
+    }
+    const size_t tail_start = sealed_groups_.size() * kGroupSize;
+    for (size_t i = std::max(first, tail_start); i < end; ++i) tail_[i - tail_start] = values[i - first];
+    return true;
+}
+
+void CompactOffsets::replace(size_t first, size_t last, const std::vector<std::uint64_t> &values)
+{
+    if (last > size()) last = size();
+    if (first > last) first = last;
+    if (values.empty() && first == last) return;
+
+    // Same count and the touched groups' spans still fit their bit widths: rewrite just those groups.
+    if (values.size() == last - first && replace_in_place(first, values)) return;
+
+    // Otherwise everything from `first` on is packed again; the groups before it are kept.
+    std::vector<std::uint64_t> after;
+    after.reserve(size() - last);
+    for (size_t i = last; i < size(); ++i) after.push_back(at(i));
+    truncate(first);
+    for (std::uint64_t value : values) push_back(value);
+    for (std::uint64_t value : after) push_back(value);
+}
+
+size_t CompactOffsets::upper_in_group(size_t g, std::uint64_t offset) const
+{
+    if (g >= sealed_groups_.size())
+    {
+        return static_cast<size_t>(std::upper_bound(tail_.begin(), tail_.end(), offset) - tail_.begin());
+    }
+    const Group &group = sealed_groups_[g];
+    const unsigned width = group_width(group);
+    const std::uint64_t position = group_bit_position(group);
+    const std::uint64_t relative = offset - group.base;
+    // The base itself (index 0) is known to be <= offset.
+    size_t low = 1;
+    size_t high = kGroupSize;
+    while (low < high)
+    {
+        const size_t mid = low + (high - low) / 2;
+        if (read_bits(position + (mid - 1) * width, width) <= relative)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+size_t CompactOffsets::count_at_most(std::uint64_t offset) const
+{
+    // Groups whose base is <= offset.
+    size_t groups = static_cast<size_t>(
+        std::upper_bound(sealed_groups_.begin(), sealed_groups_.end(), offset,
+                         [](std::uint64_t value, const Group &group) { return value < group.base; }) -
+        sealed_groups_.begin());
+    if (groups == sealed_groups_.size() && !tail_.empty() && tail_.front() <= offset) ++groups;
+    if (groups == 0) return 0;
+    const size_t g = groups - 1;
+    return g * kGroupSize + upper_in_group(g, offset);
+}
+
+size_t CompactOffsets::count_below(std::uint64_t offset) const
+{
+    return offset == 0 ? 0 : count_at_most(offset - 1);
+}
+
+size_t CompactOffsets::memory_bytes() const
+{
+    return sealed_groups_.capacity() * sizeof(Group) + words_.capacity() * sizeof(std::uint64_t) +
+           tail_.capacity() * sizeof(std::uint64_t);
+}
+
+void CompactOffsets::write(std::ostream &out) const
+{
+    write_u64_le(out, sealed_groups_.size());
+    write_u64_le(out, bit_count_);
+    for (const Group &group : sealed_groups_)
+    {
+        write_u64_le(out, group.base);
+        write_u64_le(out, group.packed);
+    }
+    for (std::uint64_t word : words_) write_u64_le(out, word);
+    write_u64_le(out, tail_.size());
+    for (std::uint64_t value : tail_) write_u64_le(out, value);
+}
+
+bool CompactOffsets::read(std::istream &in)
+{
+    clear();
+    std::uint64_t group_count = 0;
+    std::uint64_t bit_count = 0;
+    if (!read_u64_le(in, group_count) || !read_u64_le(in, bit_count)) return false;
+
+    // Values are pushed one at a time so a corrupt count fails at EOF instead of allocating.
+    std::uint64_t previous_end = 0;
+    for (std::uint64_t i = 0; i < group_count; ++i)
+    {
+        Group group{};
+        if (!read_u64_le(in, group.base) || !read_u64_le(in, group.packed)) return false;
+        const unsigned width = group_width(group);
+        const std::uint64_t position = group_bit_position(group);
+        if (width > 64 || position != previous_end) return false;
+        previous_end = position + (kGroupSize - 1) * width;
+        sealed_groups_.push_back(group);
+    }
+    if (previous_end != bit_count) return false;
+
+    for (std::uint64_t i = 0; i < (bit_count + 63) / 64; ++i)
+    {
+        std::uint64_t word = 0;
+        if (!read_u64_le(in, word)) return false;
+        words_.push_back(word);
+    }
+    bit_count_ = bit_count;
+
+    std::uint64_t tail_count = 0;
+    if (!read_u64_le(in, tail_count) || tail_count >= kGroupSize) return false;
+    for (std::uint64_t i = 0; i < tail_count; ++i)
+    {
+        std::uint64_t value = 0;
+        if (!read_u64_le(in, value)) return false;
+        tail_.push_back(value);
+    }
+    return true;
+}
+
+} // namespace TextIndex
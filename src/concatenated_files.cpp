@@ -0,0 +1,336 @@
+#include "concatenated_files.h"
+
+#include "encoding_utils.h"
+#include "platform_utils.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <istream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+namespace FileView {
+
+namespace {
+
+// Read from the files per refill of the book's stream.
+const size_t kStreamBufferBytes = 64 * 1024;
+
+bool has_txt_extension(const std::string &name)
+{
+    if (name.size() < 4) return false;
+    std::string extension = name.substr(name.size() - 4);
+    for (char &c : extension) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return extension == ".txt";
+}
+
+std::string join_path(const std::string &dir, const std::string &name)
+{
+    const char separator = PlatformUtils::get_path_separator();
+    if (!dir.empty() && (dir.back() == separator || dir.back() == '/')) return dir + name;
+    return dir + separator + name;
+}
+
+// Orders runs of digits by value and everything else byte by byte, so that
+// "第2章.txt" sorts before "第10章.txt" with or without zero padding.
+bool natural_less(const std::string &a, const std::string &b)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.size() && j < b.size())
+    {
+        const bool digit_a = std::isdigit(static_cast<unsigned char>(a[i])) != 0;
+        const bool digit_b = std::isdigit(static_cast<unsigned char>(b[j])) != 0;
+        if (digit_a && digit_b)
+        {
+            size_t end_a = i;
+            size_t end_b = j;
+            while (end_a < a.size() && std::isdigit(static_cast<unsigned char>(a[end_a]))) ++end_a;
+            while (end_b < b.size() && std::isdigit(static_cast<unsigned char>(b[end_b]))) ++end_b;
+            size_t lead_a = i;
+            size_t lead_b = j;
+            while (lead_a + 1 < end_a && a[lead_a] == '0') ++lead_a;
+            while (lead_b + 1 < end_b && b[lead_b] == '0') ++lead_b;
+            if (end_a - lead_a != end_b - lead_b) return end_a - lead_a < end_b - lead_b;
+            const int order = a.compare(lead_a, end_a - lead_a, b, lead_b, end_b - lead_b);
+            if (order != 0) return order < 0;
+            i = end_a;
+            j = end_b;
+            continue;
+        }
+        if (a[i] != b[j]) return static_cast<unsigned char>(a[i]) < static_cast<unsigned char>(b[j]);
+        ++i;
+        ++j;
+    }
+    if (a.size() - i != b.size() - j) return a.size() - i < b.size() - j;
+    return a < b;
+}
+
+struct Listed {
+    std::string name;
+    std::uint64_t size;
+};
+
+// The regular .txt files directly in `dir`.
+bool list_text_files(const std::string &dir, std::vector<Listed> &out)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA(join_path(dir, "*").c_str(), &data);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    do
+    {
+        const std::string name = data.cFileName;
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        if (!has_txt_extension(name)) continue;
+        out.push_back({name, (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow});
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+    return true;
+#else
+    DIR *handle = opendir(dir.c_str());
+    if (handle == nullptr) return false;
+    while (dirent *entry = readdir(handle))
+    {
+        const std::string name = entry->d_name;
+        if (!has_txt_extension(name)) continue;
+        struct stat st;
+        if (stat(join_path(dir, name).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        out.push_back({name, static_cast<std::uint64_t>(st.st_size)});
+    }
+    closedir(handle);
+    return true;
+#endif
+}
+
+} // namespace
+
+const size_t ConcatenatedFiles::kMaxOpenFiles;
+const size_t ConcatenatedFiles::npos;
+
+// Serves the book's stream from ConcatenatedFiles::read(), one refill at a time.
+class ConcatenatedFiles::Buffer : public std::streambuf {
+public:
+    explicit Buffer(ConcatenatedFiles &files) : files_(files) {}
+
+    // Drops the buffered bytes and goes back to the start, e.g. for another folder.
+    void discard()
+    {
+        base_ = 0;
+        setg(nullptr, nullptr, nullptr);
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        const std::uint64_t at = base_ + static_cast<std::uint64_t>(egptr() - eback());
+        if (!files_.read(at, kStreamBufferBytes, chunk_) || chunk_.empty())
+        {
+            base_ = at;
+            setg(nullptr, nullptr, nullptr);
+            return traits_type::eof();
+        }
+        base_ = at;
+        setg(&chunk_[0], &chunk_[0], &chunk_[0] + chunk_.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override
+    {
+        off_type from = 0;
+        if (direction == std::ios_base::cur)
+        {
+            from = static_cast<off_type>(base_ + static_cast<std::uint64_t>(gptr() - eback()));
+        }
+        else if (direction == std::ios_base::end)
+        {
+            from = static_cast<off_type>(files_.size());
+        }
+        return seekpos(pos_type(from + offset), which);
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode) override
+    {
+        const off_type target = off_type(position);
+        if (target < 0 || static_cast<std::uint64_t>(target) > files_.size()) return pos_type(off_type(-1));
+        const std::uint64_t at = static_cast<std::uint64_t>(target);
+        const std::uint64_t buffered = static_cast<std::uint64_t>(egptr() - eback());
+        if (at >= base_ && at < base_ + buffered)
+        {
+            setg(eback(), eback() + (at - base_), egptr());
+        }
+        else
+        {
+            base_ = at;
+            setg(nullptr, nullptr, nullptr);
+        }
+        return position;
+    }
+
+private:
+    ConcatenatedFiles &files_;
+    std::string chunk_;
+    // Book offset of eback().
+    std::uint64_t base_ = 0;
+};
+
+ConcatenatedFiles::ConcatenatedFiles()
+    : buffer_(new Buffer(*this)), stream_(new std::istream(buffer_.get()))
+{
+}
+
+ConcatenatedFiles::~ConcatenatedFiles() = default;
+
+bool ConcatenatedFiles::open(const std::string &directory, std::string *error_message)
+{
+    TRACE_SPAN("list chapter files");
+    std::vector<Listed> listed;
+    if (!list_text_files(directory, listed))
+    {
+        if (error_message != nullptr) *error_message = "cannot list " + directory;
+        return false;
+    }
+    if (listed.empty())
+    {
+        if (error_message != nullptr) *error_message = "no .txt files in " + directory;
+        return false;
+    }
+    std::sort(listed.begin(), listed.end(),
+              [](const Listed &a, const Listed &b) { return natural_less(a.name, b.name); });
+
+    close();
+    directory_ = directory;
+    starts_.push_back(0);
+    for (const Listed &file : listed)
+    {
+        names_.push_back(file.name);
+        starts_.push_back(starts_.back() + file.size + 1);
+    }
+    encodings_.assign(names_.size(), std::string());
+    return true;
+}
+
+void ConcatenatedFiles::close()
+{
+    directory_.clear();
+    names_.clear();
+    starts_.clear();
+    encodings_.clear();
+    open_files_.clear();
+    buffer_->discard();
+    stream_->clear();
+}
+
+std::string ConcatenatedFiles::file_path(size_t file) const
+{
+    return join_path(directory_, names_[file]);
+}
+
+size_t ConcatenatedFiles::file_at(std::uint64_t offset) const
+{
+    if (names_.empty()) return npos;
+    const size_t after = static_cast<size_t>(std::upper_bound(starts_.begin(), starts_.end(), offset) - starts_.begin());
+    return after == 0 ? 0 : std::min(after - 1, names_.size() - 1);
+}
+
+bool ConcatenatedFiles::is_file_start(std::uint64_t offset) const
+{
+    if (starts_.size() < 2) return false;
+    return std::binary_search(starts_.begin(), starts_.end() - 1, offset);
+}
+
+size_t ConcatenatedFiles::find_file(const std::string &name) const
+{
+    for (size_t i = 0; i < names_.size(); ++i)
+    {
+        if (names_[i] == name) return i;
+    }
+    return npos;
+}
+
+const std::string &ConcatenatedFiles::encoding_of(size_t file)
+{
+    if (encodings_[file].empty()) encodings_[file] = EncodingUtils::detect_encoding(file_path(file));
+    return encodings_[file];
+}
+
+std::ifstream *ConcatenatedFiles::open_file(size_t file)
+{
+    ++use_counter_;
+    OpenFile *slot = nullptr;
+    for (const auto &open : open_files_)
+    {
+        if (open->file == file)
+        {
+            open->last_used = use_counter_;
+            return &open->in;
+        }
+        if (slot == nullptr || open->last_used < slot->last_used) slot = open.get();
+    }
+    if (open_files_.size() < kMaxOpenFiles)
+    {
+        open_files_.emplace_back(new OpenFile());
+        slot = open_files_.back().get();
+    }
+    else
+    {
+        slot->in.close();
+    }
+    slot->file = file;
+    slot->last_used = use_counter_;
+    slot->in.clear();
+    slot->in.open(file_path(file), std::ios::in | std::ios::binary);
+    if (!slot->in.is_open())
+    {
+        slot->file = npos;
+        return nullptr;
+    }
+    return &slot->in;
+}
+
+bool ConcatenatedFiles::read(std::uint64_t offset, std::uint64_t length, std::string &out)
+{
+    out.clear();
+    if (!is_open()) return false;
+    if (offset >= size()) return true;
+    if (length > size() - offset) length = size() - offset;
+    out.resize(static_cast<size_t>(length));
+    size_t filled = 0;
+    while (filled < out.size())
+    {
+        const std::uint64_t at = offset + filled;
+        const size_t file = file_at(at);
+        const std::uint64_t within = at - starts_[file];
+        const std::uint64_t bytes = file_size(file);
+        if (within >= bytes)
+        {
+            out[filled++] = '\n';
+            continue;
+        }
+        const size_t wanted = static_cast<size_t>(std::min<std::uint64_t>(out.size() - filled, bytes - within));
+        std::ifstream *in = open_file(file);
+        if (in == nullptr) return false;
+        in->clear();
+        in->seekg(static_cast<std::streamoff>(within));
+        in->read(&out[filled], static_cast<std::streamsize>(wanted));
+        const size_t got = static_cast<size_t>(in->gcount());
+        // A file that shrank since the listing reads as blank lines past its new end.
+        if (got < wanted)
+        {
+            std::fill(out.begin() + static_cast<std::ptrdiff_t>(filled + got),
+                      out.begin() + static_cast<std::ptrdiff_t>(filled + wanted), '\n');
+        }
+        filled += wanted;
+    }
+    return true;
+}
+
+} // namespace FileView
@@ -0,0 +1,577 @@
+#include "encoding_utils.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NOVELREADER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <iconv.h>
+#if defined(NOVELREADER_HAVE_UCHARDET)
+#include <uchardet/uchardet.h>
+#endif
+#endif
+
+namespace EncodingUtils {
+
+namespace {
+
+std::string detect_bom_encoding_prefix(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) return "";
+
+    unsigned char bom[4] = {0, 0, 0, 0};
+    file.read(reinterpret_cast<char *>(bom), sizeof(bom));
+    const size_t n = static_cast<size_t>(file.gcount());
+
+    if (n >= 2 && bom[0] == 0xFF && bom[1] == 0xFE) return "UTF-16LE";
+    if (n >= 2 && bom[0] == 0xFE && bom[1] == 0xFF) return "UTF-16BE";
+    if (n >= 3 && bom[0] == 0xEF && bom[1] == 0xBB && bom[2] == 0xBF) return "UTF-8";
+
+    return "";
+}
+
+// A line this many UTF-8 characters long is not a legacy multi-byte text by chance.
+const size_t kMinUtf8LineChars = 4;
+
+bool is_utf8_name(const std::string &encoding)
+{
+    return encoding.empty() || encoding == "UTF-8" || encoding == "ASCII";
+}
+
+// Length of the UTF-8 character at `p`, 0 if it is malformed; one cut off by
+// `end` counts as whole.
+size_t utf8_char_length(const unsigned char *p, const unsigned char *end)
+{
+    const unsigned char lead = p[0];
+    size_t length = 0;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF)
+    {
+        length = 2;
+    }
+    else if (lead >= 0xE0 && lead <= 0xEF)
+    {
+        length = 3;
+        if (lead == 0xE0) low = 0xA0;  // overlong
+        if (lead == 0xED) high = 0x9F; // surrogates
+    }
+    else if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        length = 4;
+        if (lead == 0xF0) low = 0x90;  // overlong
+        if (lead == 0xF4) high = 0x8F; // beyond U+10FFFF
+    }
+    else
+    {
+        return 0;
+    }
+    for (size_t i = 1; i < length; ++i)
+    {
+        if (p + i >= end) return static_cast<size_t>(end - p);
+        const unsigned char c = p[i];
+        if (c < (i == 1 ? low : 0x80) || c > (i == 1 ? high : 0xBF)) return 0;
+    }
+    return length;
+}
+
+// A whole three-byte character with a lead byte that needs no range checks
+// (not E0, whose next byte guards against overlong forms, nor ED, surrogates).
+inline bool is_common_three_byte_char(const unsigned char *p, const unsigned char *end)
+{
+    return end - p >= 3 && p[0] > 0xE0 && p[0] < 0xF0 && p[0] != 0xED && (p[1] & 0xC0) == 0x80 &&
+           (p[2] & 0xC0) == 0x80;
+}
+
+#ifdef _WIN32
+bool is_valid_utf8_sample_strict(const std::string &bytes)
+{
+    if (bytes.empty()) return true;
+
+    int required = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, bytes.data(),
+                                       static_cast<int>(bytes.size()), nullptr, 0);
+    return required > 0;
+}
+
+std::string convert_to_utf8_windows(const std::string &input, UINT codepage, bool strict)
+{
+    if (input.empty()) return "";
+
+    DWORD flags = strict ? MB_ERR_INVALID_CHARS : 0;
+    int wide_len =
+        MultiByteToWideChar(codepage, flags, input.data(), static_cast<int>(input.size()), nullptr, 0);
+    if (wide_len <= 0)
+    {
+        // Best-effort fallback for ANSI-ish codepages.
+        wide_len = MultiByteToWideChar(codepage, 0, input.data(), static_cast<int>(input.size()), nullptr, 0);
+        if (wide_len <= 0) return input;
+    }
+
+    std::wstring wide;
+    wide.resize(static_cast<size_t>(wide_len));
+    if (MultiByteToWideChar(codepage, 0, input.data(), static_cast<int>(input.size()), &wide[0], wide_len) <= 0)
+    {
+        return input;
+    }
+
+    int u8_len =
+        WideCharToMultiByte(CP_UTF8, 0, wide.data(), wide_len, nullptr, 0, nullptr, nullptr);
+    if (u8_len <= 0) return input;
+
+    std::string out;
+    out.resize(static_cast<size_t>(u8_len));
+    if (WideCharToMultiByte(CP_UTF8, 0, wide.data(), wide_len, &out[0], u8_len, nullptr, nullptr) <= 0)
+    {
+        return input;
+    }
+
+    return out;
+}
+#endif
+
+} // namespace
+
+std::string detect_encoding(const std::string &filename)
+{
+    TRACE_SPAN("detect encoding");
+    // BOM beats heuristics.
+    std::string bom_encoding = detect_bom_encoding_prefix(filename);
+    if (!bom_encoding.empty()) return bom_encoding;
+
+#ifdef _WIN32
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) return "UTF-8";
+
+    constexpr size_t kSampleBytes = 64 * 1024;
+    std::string data;
+    data.resize(kSampleBytes);
+    file.read(&data[0], static_cast<std::streamsize>(kSampleBytes));
+    data.resize(static_cast<size_t>(file.gcount()));
+
+    if (is_valid_utf8_sample_strict(data)) return "UTF-8";
+    return "CP_ACP";
+#else
+#if defined(NOVELREADER_HAVE_UCHARDET)
+    uchardet_t ud = uchardet_new();
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        uchardet_delete(ud);
+        return "UTF-8";
+    }
+    constexpr size_t kSampleBytes = 64 * 1024;
+    std::string data;
+    data.resize(kSampleBytes);
+    file.read(&data[0], static_cast<std::streamsize>(kSampleBytes));
+    data.resize(static_cast<size_t>(file.gcount()));
+    if (!data.empty())
+    {
+        uchardet_handle_data(ud, data.c_str(), data.size());
+    }
+    uchardet_data_end(ud);
+    std::string encoding = uchardet_get_charset(ud);
+    uchardet_delete(ud);
+    if (encoding.empty()) return "UTF-8";
+    // uchardet返回的编码名可能是大写，统一转大写
+    for (auto &c : encoding) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    return encoding;
+#else
+    (void)filename;
+    return "UTF-8";
+#endif
+#endif
+}
+
+std::string alternate_encoding(const std::string &primary)
+{
+    if (!is_utf8_name(primary)) return "UTF-8";
+#ifdef _WIN32
+    return "CP_ACP";
+#else
+    return "GB18030";
+#endif
+}
+
+Utf8Survey survey_utf8(const char *data, size_t size)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    const unsigned char *end = bytes + size;
+    Utf8Survey survey;
+    survey.first_invalid = size;
+    survey.first_multibyte = size;
+    size_t i = 0;
+    // Continuation bytes of a character that began before the stretch.
+    while (i < size && i < 3 && (bytes[i] & 0xC0) == 0x80) ++i;
+    while (i < size)
+    {
+        if (bytes[i] < 0x80)
+        {
+            // Plain ASCII goes by eight bytes at a time.
+            while (i + 8 <= size)
+            {
+                std::uint64_t word = 0;
+                std::memcpy(&word, bytes + i, sizeof(word));
+                if ((word & 0x8080808080808080ULL) != 0) break;
+                i += 8;
+            }
+            while (i < size && bytes[i] < 0x80) ++i;
+            continue;
+        }
+        if (is_common_three_byte_char(bytes + i, end))
+        {
+            // CJK text is mostly these; take a run of them in one go.
+            if (survey.first_multibyte == size) survey.first_multibyte = i;
+            size_t run = 0;
+            do
+            {
+                ++run;
+                i += 3;
+            } while (is_common_three_byte_char(bytes + i, end));
+            survey.multibyte_count += run;
+            continue;
+        }
+        const size_t length = utf8_char_length(bytes + i, end);
+        if (length == 0)
+        {
+            if (survey.first_invalid == size) survey.first_invalid = i;
+            survey.last_invalid_end = i + 1;
+            survey.first_multibyte = size;
+            survey.multibyte_count = 0;
+            ++i;
+            continue;
+        }
+        if (survey.first_multibyte == size) survey.first_multibyte = i;
+        ++survey.multibyte_count;
+        i += length;
+    }
+    return survey;
+}
+
+bool line_in_alternate_encoding(const char *data, size_t size, const std::string &primary)
+{
+    const Utf8Survey survey = survey_utf8(data, size);
+    if (is_utf8_name(primary)) return survey.first_invalid < size;
+    return survey.first_invalid == size && survey.multibyte_count >= kMinUtf8LineChars;
+}
+
+std::vector<std::string> blank_sequences(const std::string &encoding)
+{
+    std::string name;
+    for (char c : encoding) name += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+
+#ifdef _WIN32
+    if (name == "CP_ACP")
+    {
+        const UINT code_page = GetACP();
+        if (code_page == 936) name = "GBK";
+        if (code_page == 950) name = "BIG5";
+    }
+#endif
+    if (name.empty() || name == "UTF-8" || name == "ASCII")
+    {
+        // BOM / U+FEFF, U+3000 ideographic space, U+00A0 no-break space
+        return {"\xEF\xBB\xBF", "\xE3\x80\x80", "\xC2\xA0"};
+    }
+    if (name.compare(0, 2, "GB") == 0 || name == "CP936" || name == "EUC-CN")
+    {
+        return {"\xA1\xA1"};
+    }
+    if (name == "BIG5" || name == "BIG5-HKSCS" || name == "CP950")
+    {
+        return {"\xA1\x40"};
+    }
+    return {};
+}
+
+std::vector<std::string> sentence_end_sequences(const std::string &encoding)
+{
+    // 。！？；：…」』”’）．～ and their ASCII counterparts
+    static const char *const kUtf8SentenceEnds[] = {
+        "\xE3\x80\x82", "\xEF\xBC\x81", "\xEF\xBC\x9F", "\xEF\xBC\x9B", "\xEF\xBC\x9A", "\xE2\x80\xA6",
+        "\xE3\x80\x8D", "\xE3\x80\x8F", "\xE2\x80\x9D", "\xE2\x80\x99", "\xEF\xBC\x89", "\xEF\xBC\x8E",
+        "\xEF\xBD\x9E", ".", "!", "?", ";", ":", "\"", "'", ")",
+    };
+    std::vector<std::string> sequences;
+    for (const char *utf8 : kUtf8SentenceEnds)
+    {
+        const std::string converted = convert_from_utf8(utf8, encoding);
+        if (!converted.empty()) sequences.push_back(converted);
+    }
+    return sequences;
+}
+
+namespace {
+
+std::vector<std::string> with_alternate(std::vector<std::string> sequences, const std::vector<std::string> &more)
+{
+    for (const std::string &sequence : more)
+    {
+        if (std::find(sequences.begin(), sequences.end(), sequence) == sequences.end()) sequences.push_back(sequence);
+    }
+    return sequences;
+}
+
+// Length of the character at data[i] in the legacy double-byte encodings.
+size_t legacy_char_length(const unsigned char *data, size_t i, size_t size)
+{
+    if (data[i] < 0x81 || data[i] == 0xFF || i + 1 >= size) return 1;
+    return (data[i + 1] >= 0x30 && data[i + 1] <= 0x39) ? 4 : 2;
+}
+
+inline bool is_printable_utf8_start(unsigned char c)
+{
+    return (c >= 0x20 && c < 0x7F) || c >= 0xC0;
+}
+
+#if defined(NOVELREADER_SSE2)
+// 0xFF in each lane whose byte is_printable_utf8_start(). Signed compares:
+// printable ASCII is 0x20..0x7E, lead bytes 0xC0..0xFF are -64..-1.
+inline __m128i utf8_character_starts(__m128i bytes)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i printable =
+        _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7F)));
+    const __m128i lead =
+        _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(static_cast<char>(0xBF))), _mm_cmplt_epi8(bytes, zero));
+    return _mm_or_si128(printable, lead);
+}
+#endif
+
+unsigned popcount64(std::uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_popcountll(x));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<unsigned>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+std::uint64_t count_utf8_characters(const unsigned char *data, size_t size)
+{
+    std::uint64_t count = 0;
+    size_t i = 0;
+#if defined(NOVELREADER_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    while (size - i >= 16)
+    {
+        // Each byte lane counts at most 255 vectors before they are summed.
+        size_t vectors = (size - i) / 16;
+        if (vectors > 255) vectors = 255;
+        __m128i lanes = zero;
+        for (size_t v = 0; v < vectors; ++v, i += 16)
+        {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            lanes = _mm_sub_epi8(lanes, utf8_character_starts(bytes));
+        }
+        const __m128i sums = _mm_sad_epu8(lanes, zero);
+        count += static_cast<std::uint64_t>(_mm_extract_epi16(sums, 0) + _mm_extract_epi16(sums, 4));
+    }
+#endif
+    for (; i < size; ++i) count += is_printable_utf8_start(data[i]) ? 1 : 0;
+    return count;
+}
+
+} // namespace
+
+std::vector<std::string> blank_sequences_with_alternate(const std::string &encoding)
+{
+    return with_alternate(blank_sequences(encoding), blank_sequences(alternate_encoding(encoding)));
+}
+
+std::vector<std::string> sentence_end_sequences_with_alternate(const std::string &encoding)
+{
+    return with_alternate(sentence_end_sequences(encoding), sentence_end_sequences(alternate_encoding(encoding)));
+}
+
+size_t line_piece_length(const char *data, size_t size, size_t limit, const std::string &encoding,
+                         const std::vector<std::string> &sentence_ends)
+{
+    if (size <= limit) return size;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    const bool utf8 = is_utf8_name(encoding) != line_in_alternate_encoding(data, limit, encoding);
+    size_t last_character_end = 0;
+    size_t last_sentence_end = 0;
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t length = 1;
+        if (utf8)
+        {
+            // Malformed bytes go one at a time, as they decode.
+            const size_t whole = utf8_char_length(bytes + i, bytes + size);
+            if (whole > 1) length = whole;
+        }
+        else
+        {
+            length = legacy_char_length(bytes, i, size);
+        }
+        // Even a limit shorter than one character cuts after it, not inside it.
+        if (i + length > limit && i > 0) break;
+        i += length;
+        last_character_end = i;
+        if (i < limit / 2) continue;
+        for (const std::string &end : sentence_ends)
+        {
+            if (end.size() == length && std::memcmp(end.data(), data + i - length, length) == 0)
+            {
+                last_sentence_end = i;
+                break;
+            }
+        }
+    }
+    return last_sentence_end > 0 ? last_sentence_end : last_character_end;
+}
+
+std::uint64_t count_characters(const char *data, size_t size, bool utf8)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    if (utf8) return count_utf8_characters(bytes, size);
+    std::uint64_t count = 0;
+    for (size_t i = 0; i < size;)
+    {
+        const size_t length = legacy_char_length(bytes, i, size);
+        if (length > 1 || (bytes[i] >= 0x20 && bytes[i] < 0x7F)) ++count;
+        i += length;
+    }
+    return count;
+}
+
+void mark_utf8_characters(const char *data, size_t size, std::vector<std::uint64_t> &marks)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    marks.assign((size + 63) / 64, 0);
+    size_t i = 0;
+#if defined(NOVELREADER_SSE2)
+    for (; size - i >= 16; i += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+        const unsigned starts = static_cast<unsigned>(_mm_movemask_epi8(utf8_character_starts(chunk)));
+        marks[i / 64] |= static_cast<std::uint64_t>(starts) << (i % 64);
+    }
+#endif
+    for (; i < size; ++i)
+    {
+        if (is_printable_utf8_start(bytes[i])) marks[i / 64] |= std::uint64_t(1) << (i % 64);
+    }
+}
+
+std::uint64_t count_marked(const std::vector<std::uint64_t> &marks, size_t begin, size_t end)
+{
+    if (begin >= end) return 0;
+    const size_t first = begin / 64;
+    const size_t last = (end - 1) / 64;
+    const std::uint64_t head = ~std::uint64_t(0) << (begin % 64);
+    const std::uint64_t tail = ~std::uint64_t(0) >> (63 - (end - 1) % 64);
+    if (first == last) return popcount64(marks[first] & head & tail);
+    std::uint64_t count = popcount64(marks[first] & head) + popcount64(marks[last] & tail);
+    for (size_t w = first + 1; w < last; ++w) count += popcount64(marks[w]);
+    return count;
+}
+
+void strip_utf8_bom_prefix(std::string &s)
+{
+    if (s.size() >= 3 && static_cast<unsigned char>(s[0]) == 0xEF &&
+        static_cast<unsigned char>(s[1]) == 0xBB && static_cast<unsigned char>(s[2]) == 0xBF)
+    {
+        s.erase(0, 3);
+    }
+}
+
+std::string convert_to_utf8(const std::string &input, const std::string &from_encoding)
+{
+    Utf8Converter converter(from_encoding);
+    return converter.convert(input);
+}
+
+std::string convert_from_utf8(const std::string &utf8, const std::string &to_encoding)
+{
+    if (utf8.empty() || to_encoding.empty() || to_encoding == "UTF-8" || to_encoding == "ASCII") return utf8;
+#ifdef _WIN32
+    if (to_encoding != "CP_ACP") return "";
+    const int wide_len = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, utf8.data(), static_cast<int>(utf8.size()),
+                                             nullptr, 0);
+    if (wide_len <= 0) return "";
+    std::wstring wide(static_cast<size_t>(wide_len), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, utf8.data(), static_cast<int>(utf8.size()), &wide[0], wide_len);
+    BOOL lossy = FALSE;
+    const int out_len = WideCharToMultiByte(CP_ACP, 0, wide.data(), wide_len, nullptr, 0, nullptr, &lossy);
+    if (out_len <= 0 || lossy) return "";
+    std::string out(static_cast<size_t>(out_len), '\0');
+    WideCharToMultiByte(CP_ACP, 0, wide.data(), wide_len, &out[0], out_len, nullptr, nullptr);
+    return out;
+#else
+    iconv_t cd = iconv_open(to_encoding.c_str(), "UTF-8");
+    if (cd == (iconv_t)-1) return "";
+    std::vector<char> buffer(utf8.size() * 4 + 4);
+    char *inptr = const_cast<char *>(utf8.data());
+    char *outptr = buffer.data();
+    size_t inbytesleft = utf8.size();
+    size_t outbytesleft = buffer.size();
+    const size_t res = iconv(cd, &inptr, &inbytesleft, &outptr, &outbytesleft);
+    iconv_close(cd);
+    if (res == (size_t)-1) return "";
+    return std::string(buffer.data(), buffer.size() - outbytesleft);
+#endif
+}
+
+Utf8Converter::Utf8Converter(const std::string &from_encoding) : from_encoding_(from_encoding)
+{
+#ifdef _WIN32
+    passthrough_ = (from_encoding == "UTF-8" || from_encoding == "UTF-16LE" || from_encoding == "UTF-16BE");
+#else
+    if (from_encoding == "UTF-8") return;
+    iconv_t cd = iconv_open("UTF-8", from_encoding.c_str());
+    if (cd == (iconv_t)-1) return;
+    cd_ = cd;
+    passthrough_ = false;
+#endif
+}
+
+Utf8Converter::~Utf8Converter()
+{
+#ifndef _WIN32
+    if (cd_ != nullptr) iconv_close(static_cast<iconv_t>(cd_));
+#endif
+}
+
+std::string Utf8Converter::convert(const std::string &input)
+{
+    if (passthrough_) return input;
+#ifdef _WIN32
+    // "CP_ACP" is a stable contract: whatever the user's system ANSI codepage is.
+    // Anything else gets the same conservative fallback.
+    return convert_to_utf8_windows(input, CP_ACP, false);
+#else
+    iconv_t cd = static_cast<iconv_t>(cd_);
+    // Reset shift state left over from a previous (possibly failed) call.
+    iconv(cd, nullptr, nullptr, nullptr, nullptr);
+
+    size_t inlen = input.size();
+    size_t outlen = inlen * 4 + 4;
+    if (buffer_.size() < outlen) buffer_.resize(outlen);
+    char *inptr = const_cast<char *>(input.data());
+    char *outptr = buffer_.data();
+    size_t inbytesleft = inlen;
+    size_t outbytesleft = outlen;
+    size_t res = iconv(cd, &inptr, &inbytesleft, &outptr, &outbytesleft);
+    if (res == (size_t)-1) return input;
+    return std::string(buffer_.data(), outlen - outbytesleft);
+#endif
+}
+
+} // namespace EncodingUtils
@@ -1,6 +1,7 @@
 #include "file_system_utils.h"
 #include "platform_utils.h"
 #include <fstream>
+#include <sstream>
 #include <iostream>  // Keep for potential future std::cerr uncommenting
 #include <cstdlib>   // For getenv, free (used with _dupenv_s)
 #include <cstdio>    // For std::rename
@@ -162,39 +163,32 @@ bool create_directories_recursive(const std::string& path) {
 }
 
 bool write_config_atomic(const std::string& config_file_path, const std::string& novel_path,
-                         int line_number_to_config) {
-    const std::string tmp_path = config_file_path + ".tmp";
-
-    std::fstream tmp_stream;
-    tmp_stream.open(tmp_path, std::ios::out | std::ios::trunc);
-    if (!tmp_stream.is_open()) {
-        return false;
-    }
-    tmp_stream << novel_path << std::endl;
-    tmp_stream << line_number_to_config << std::endl;
-    tmp_stream.flush();
-    bool ok = tmp_stream.good();
-    tmp_stream.close();
-    if (!ok) {
-        return false;
+                         std::int64_t line_number_to_config, std::uint64_t byte_offset_to_config) {
+    std::ostringstream contents;
+    contents << novel_path << '\n';
+    contents << line_number_to_config << '\n';
+    if (byte_offset_to_config != kNoByteOffset) {
+        contents << byte_offset_to_config << '\n';
     }
+    return write_file_atomic(config_file_path, contents.str());
+}
 
-#ifdef _WIN32
-    if (!MoveFileExA(tmp_path.c_str(), config_file_path.c_str(),
-                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED)) {
-        DeleteFileA(tmp_path.c_str());
-        return false;
+// Parses an optional byte offset field; anything else reads as kNoByteOffset.
+std::uint64_t parse_byte_offset(const std::string& text) {
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+        return kNoByteOffset;
     }
-    return true;
-#else
-    if (std::rename(tmp_path.c_str(), config_file_path.c_str()) != 0) {
-        std::remove(tmp_path.c_str());
-        return false;
+    try {
+        size_t idx = 0;
+        const unsigned long long parsed = std::stoull(text, &idx, 10);
+        return idx == text.size() ? static_cast<std::uint64_t>(parsed) : kNoByteOffset;
+    } catch (...) {
+        return kNoByteOffset;
     }
-    return true;
-#endif
 }
 
+const char kProgressHeader[] = "# NovelReader progress v2";
+
 } // namespace
 
 std::string get_config_directory_path() {
@@ -228,11 +222,97 @@ std::string get_config_directory_path() {
 #endif
 }
 
+std::string get_cache_directory_path() {
+#ifdef _WIN32
+    std::string config_dir = get_config_directory_path();
+    if (config_dir.empty()) {
+        return "";
+    }
+    return config_dir + PlatformUtils::get_path_separator() + "cache";
+#else // Linux/POSIX
+    const char* xdg_cache_home_cstr = getenv("XDG_CACHE_HOME");
+    std::string cache_home_path;
+    if (xdg_cache_home_cstr != nullptr && xdg_cache_home_cstr[0] != '\0') {
+        cache_home_path = xdg_cache_home_cstr;
+    } else {
+        const char* home_dir_cstr = getenv("HOME");
+        if (home_dir_cstr == nullptr || home_dir_cstr[0] == '\0') {
+            return "";
+        }
+        cache_home_path = std::string(home_dir_cstr) + PlatformUtils::get_path_separator() + ".cache";
+    }
+    return cache_home_path + PlatformUtils::get_path_separator() + "NovelReader";
+#endif
+}
+
+bool is_directory(const std::string& path) {
+    return file_exists_and_is_directory(path);
+}
+
 bool create_directory_if_not_exists(const std::string& path) {
     return create_directories_recursive(path);
 }
 
-bool read_config(const std::string& config_file_path, std::string& novel_path, int& line_number_from_config) {
+bool get_file_stamp(const std::string& path, std::int64_t& mtime, std::uint64_t& inode) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data) ||
+        (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+        return false;
+    }
+    ULARGE_INTEGER ticks;
+    ticks.LowPart = data.ftLastWriteTime.dwLowDateTime;
+    ticks.HighPart = data.ftLastWriteTime.dwHighDateTime;
+    // FILETIME counts 100 ns ticks since 1601-01-01.
+    mtime = static_cast<std::int64_t>(ticks.QuadPart / 10000000ULL) - 11644473600LL;
+    inode = 0;
+    return true;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    mtime = static_cast<std::int64_t>(st.st_mtime);
+    inode = static_cast<std::uint64_t>(st.st_ino);
+    return true;
+#endif
+}
+
+bool write_file_atomic(const std::string& file_path, const std::string& contents) {
+    const std::string tmp_path = file_path + ".tmp";
+
+    std::fstream tmp_stream;
+    tmp_stream.open(tmp_path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!tmp_stream.is_open()) {
+        return false;
+    }
+    tmp_stream << contents;
+    tmp_stream.flush();
+    bool ok = tmp_stream.good();
+    tmp_stream.close();
+    if (!ok) {
+        return false;
+    }
+
+#ifdef _WIN32
+    if (!MoveFileExA(tmp_path.c_str(), file_path.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED)) {
+        DeleteFileA(tmp_path.c_str());
+        return false;
+    }
+    return true;
+#else
+    if (std::rename(tmp_path.c_str(), file_path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool read_config(const std::string& config_file_path, std::string& novel_path, std::int64_t& line_number_from_config,
+                 std::uint64_t& byte_offset_from_config) {
+    byte_offset_from_config = kNoByteOffset;
     std::fstream config_stream;
     config_stream.open(config_file_path, std::ios::in);
 
@@ -263,13 +343,19 @@ bool read_config(const std::string& config_file_path, std::string& novel_path, i
         bool ok = true;
         try {
             size_t idx = 0;
-            int parsed = std::stoi(line_number_str, &idx, 10);
+            long long parsed = std::stoll(line_number_str, &idx, 10);
             (void)idx;
-            line_number_from_config = parsed;
+            line_number_from_config = static_cast<std::int64_t>(parsed);
         } catch (...) {
             ok = false;
         }
 
+        std::string byte_offset_str;
+        if (ok && std::getline(config_stream, byte_offset_str)) {
+            strip_trailing_carriage_return(byte_offset_str);
+            byte_offset_from_config = parse_byte_offset(byte_offset_str);
+        }
+
         if (!ok) {
             // std::cerr << "Warning: Could not read line number from config or config is incomplete. Resetting to defaults." << std::endl;
             novel_path = "";
@@ -294,8 +380,71 @@ bool read_config(const std::string& config_file_path, std::string& novel_path, i
     return true;
 }
 
-bool write_config(const std::string& config_file_path, const std::string& novel_path, int line_number_to_config) {
-    return write_config_atomic(config_file_path, novel_path, line_number_to_config);
+bool write_config(const std::string& config_file_path, const std::string& novel_path, std::int64_t line_number_to_config,
+                  std::uint64_t byte_offset_to_config) {
+    return write_config_atomic(config_file_path, novel_path, line_number_to_config, byte_offset_to_config);
+}
+
+bool read_progress(const std::string& progress_file_path, std::vector<ProgressRecord>& records) {
+    records.clear();
+    std::ifstream progress_stream(progress_file_path, std::ios::binary);
+    if (!progress_stream.is_open()) {
+        // No progress recorded yet.
+        return true;
+    }
+
+    std::string line;
+    bool has_offsets = false;
+    bool first_line = true;
+    while (std::getline(progress_stream, line)) {
+        strip_trailing_carriage_return(line);
+        if (first_line) {
+            first_line = false;
+            if (line == kProgressHeader) {
+                has_offsets = true;
+                continue;
+            }
+        }
+        // fingerprint \t line number [\t byte offset, v2] \t path (the path may contain anything but a newline)
+        const size_t first_tab = line.find('\t');
+        const size_t second_tab = (first_tab == std::string::npos) ? std::string::npos : line.find('\t', first_tab + 1);
+        const size_t path_tab = (has_offsets && second_tab != std::string::npos) ? line.find('\t', second_tab + 1) : second_tab;
+        if (path_tab == std::string::npos) {
+            continue;
+        }
+
+        ProgressRecord record;
+        record.fingerprint = line.substr(0, first_tab);
+        try {
+            record.line_number = static_cast<std::int64_t>(std::stoll(line.substr(first_tab + 1, second_tab - first_tab - 1)));
+        } catch (...) {
+            continue;
+        }
+        if (has_offsets) {
+            record.byte_offset = parse_byte_offset(line.substr(second_tab + 1, path_tab - second_tab - 1));
+        }
+        record.novel_path = line.substr(path_tab + 1);
+        if (record.fingerprint.empty()) {
+            continue;
+        }
+        records.push_back(record);
+    }
+    return true;
+}
+
+bool write_progress(const std::string& progress_file_path, const std::vector<ProgressRecord>& records) {
+    std::ostringstream contents;
+    contents << kProgressHeader << '\n';
+    for (const ProgressRecord& record : records) {
+        contents << record.fingerprint << '\t' << record.line_number << '\t';
+        if (record.byte_offset == kNoByteOffset) {
+            contents << '-';
+        } else {
+            contents << record.byte_offset;
+        }
+        contents << '\t' << record.novel_path << '\n';
+    }
+    return write_file_atomic(progress_file_path, contents.str());
 }
 
 } // namespace FileSystemUtils
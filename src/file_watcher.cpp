@@ -0,0 +1,136 @@
+#include "file_watcher.h"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace FileWatch {
+
+FileWatcher::~FileWatcher()
+{
+    stop();
+}
+
+#ifdef __linux__
+namespace {
+
+const uint32_t kFileEvents = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+// Editors often save by writing a temp file and renaming it over the original.
+const uint32_t kDirEvents = IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE;
+
+} // namespace
+
+bool FileWatcher::watch(const std::string &path, std::string *error_message)
+{
+    stop();
+
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0)
+    {
+        if (error_message) *error_message = std::strerror(errno);
+        return false;
+    }
+
+    path_ = path;
+    const size_t slash = path.find_last_of('/');
+    const std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    file_name_ = (slash == std::string::npos) ? path : path.substr(slash + 1);
+
+    add_file_watch();
+    if (file_wd_ < 0)
+    {
+        if (error_message) *error_message = std::strerror(errno);
+        stop();
+        return false;
+    }
+    // Best effort: without the directory watch we still see in-place writes.
+    dir_wd_ = inotify_add_watch(fd_, dir.c_str(), kDirEvents | IN_ONLYDIR);
+    return true;
+}
+
+void FileWatcher::add_file_watch()
+{
+    file_wd_ = inotify_add_watch(fd_, path_.c_str(), kFileEvents);
+}
+
+void FileWatcher::stop()
+{
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+    file_wd_ = -1;
+    dir_wd_ = -1;
+}
+
+FileChange FileWatcher::consume()
+{
+    if (fd_ < 0) return FileChange::None;
+
+    FileChange change = FileChange::None;
+    alignas(inotify_event) char buffer[4096];
+    while (true)
+    {
+        const ssize_t n = read(fd_, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        for (ssize_t offset = 0; offset < n;)
+        {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+            if (event->wd == dir_wd_)
+            {
+                if (event->len > 0 && file_name_ == event->name && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+                {
+                    change = FileChange::Replaced;
+                }
+                continue;
+            }
+            if (event->wd != file_wd_) continue;
+
+            if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+            {
+                change = FileChange::Replaced;
+            }
+            else if (change == FileChange::None && (event->mask & (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB)))
+            {
+                change = FileChange::Modified;
+            }
+        }
+    }
+
+    if (change == FileChange::Replaced)
+    {
+        // Follow the path to whatever file now lives there.
+        if (file_wd_ >= 0) inotify_rm_watch(fd_, file_wd_);
+        add_file_watch();
+    }
+    return change;
+}
+#else
+bool FileWatcher::watch(const std::string &path, std::string *error_message)
+{
+    (void)path;
+    if (error_message) *error_message = "file watching is not supported on this platform";
+    return false;
+}
+
+void FileWatcher::stop()
+{
+}
+
+FileChange FileWatcher::consume()
+{
+    return FileChange::None;
+}
+
+void FileWatcher::add_file_watch()
+{
+}
+#endif
+
+} // namespace FileWatch
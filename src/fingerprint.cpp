@@ -0,0 +1,206 @@
+#include "fingerprint.h"
+
+#include "trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace Fingerprint {
+
+namespace {
+
+const std::uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const std::uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+const std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+const std::uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+// Sampling layout: kSampleCount blocks of kSampleBytes, first and last block
+// pinned to the head and tail of the file.
+const size_t kSampleBytes = 4096;
+const size_t kSampleCount = 8;
+
+inline std::uint64_t rotl64(std::uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline std::uint64_t read64(const unsigned char *p)
+{
+    std::uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+inline std::uint32_t read32(const unsigned char *p)
+{
+    return static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) |
+           (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+inline std::uint64_t xxh_round(std::uint64_t acc, std::uint64_t input)
+{
+    acc += input * kPrime2;
+    acc = rotl64(acc, 31);
+    return acc * kPrime1;
+}
+
+inline std::uint64_t xxh_merge_round(std::uint64_t acc, std::uint64_t value)
+{
+    acc ^= xxh_round(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+
+} // namespace
+
+std::uint64_t xxhash64(const void *data, size_t length, std::uint64_t seed)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    const unsigned char *const end = p + length;
+    std::uint64_t h;
+
+    if (length >= 32)
+    {
+        const unsigned char *const limit = end - 32;
+        std::uint64_t v1 = seed + kPrime1 + kPrime2;
+        std::uint64_t v2 = seed + kPrime2;
+        std::uint64_t v3 = seed;
+        std::uint64_t v4 = seed - kPrime1;
+        do
+        {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge_round(h, v1);
+        h = xxh_merge_round(h, v2);
+        h = xxh_merge_round(h, v3);
+        h = xxh_merge_round(h, v4);
+    }
+    else
+    {
+        h = seed + kPrime5;
+    }
+
+    h += static_cast<std::uint64_t>(length);
+
+    while (p + 8 <= end)
+    {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * kPrime1 + kPrime4;
+        p += 8;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= static_cast<std::uint64_t>(read32(p)) * kPrime1;
+        h = rotl64(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    while (p < end)
+    {
+        h ^= static_cast<std::uint64_t>(*p) * kPrime5;
+        h = rotl64(h, 11) * kPrime1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+std::string BookFingerprint::to_string() const
+{
+    char text[40];
+    std::snprintf(text, sizeof(text), "%llx-%016llx", static_cast<unsigned long long>(size),
+                  static_cast<unsigned long long>(sample_hash));
+    return text;
+}
+
+bool operator==(const BookFingerprint &a, const BookFingerprint &b)
+{
+    return a.valid == b.valid && a.size == b.size && a.sample_hash == b.sample_hash;
+}
+
+bool operator!=(const BookFingerprint &a, const BookFingerprint &b)
+{
+    return !(a == b);
+}
+
+bool parse_fingerprint(const std::string &text, BookFingerprint &out)
+{
+    const size_t dash = text.find('-');
+    if (dash == std::string::npos || dash == 0 || dash + 1 >= text.size()) return false;
+
+    char *end = nullptr;
+    const unsigned long long size = std::strtoull(text.c_str(), &end, 16);
+    if (end != text.c_str() + dash) return false;
+    const unsigned long long hash = std::strtoull(text.c_str() + dash + 1, &end, 16);
+    if (*end != '\0') return false;
+
+    out.size = size;
+    out.sample_hash = hash;
+    out.valid = true;
+    return true;
+}
+
+bool compute_fingerprint(const std::string &path, BookFingerprint &out, std::string *error_message)
+{
+    TRACE_SPAN("fingerprint");
+    out = BookFingerprint{};
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        if (error_message) *error_message = "cannot open " + path;
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    const std::streamoff end = file.tellg();
+    if (end < 0)
+    {
+        if (error_message) *error_message = "cannot determine size of " + path;
+        return false;
+    }
+    const std::uint64_t size = static_cast<std::uint64_t>(end);
+
+    std::vector<char> samples;
+    if (size <= kSampleBytes * kSampleCount)
+    {
+        samples.resize(static_cast<size_t>(size));
+        file.seekg(0);
+        file.read(samples.data(), static_cast<std::streamsize>(samples.size()));
+    }
+    else
+    {
+        samples.resize(kSampleBytes * kSampleCount);
+        const std::uint64_t last_start = size - kSampleBytes;
+        for (size_t i = 0; i < kSampleCount; ++i)
+        {
+            const std::uint64_t offset = last_start / (kSampleCount - 1) * i;
+            file.seekg(static_cast<std::streamoff>(i + 1 == kSampleCount ? last_start : offset));
+            file.read(samples.data() + i * kSampleBytes, static_cast<std::streamsize>(kSampleBytes));
+        }
+    }
+    if (!file)
+    {
+        if (error_message) *error_message = "cannot read " + path;
+        return false;
+    }
+
+    out.size = size;
+    out.sample_hash = xxhash64(samples.data(), samples.size(), size);
+    out.valid = true;
+    return true;
+}
+
+} // namespace Fingerprint
@@ -0,0 +1,179 @@
+#include "junk_filter.h"
+
+#include "encoding_utils.h"
+#include "file_system_utils.h"
+#include "fingerprint.h"
+#include "platform_utils.h"
+
+#include <deque>
+#include <fstream>
+
+namespace TextIndex {
+
+const std::uint32_t JunkFilter::kMatchBit;
+
+void JunkFilter::set_patterns(const std::vector<std::string> &patterns)
+{
+    patterns_ = patterns;
+    match_count_ = 0;
+    signature_ = 0;
+    next_.clear();
+    output_.clear();
+    start_pairs_.assign(65536 / 64, 0);
+
+    // Only bytes that occur in some pattern need their own column.
+    for (std::uint16_t &c : byte_class_) c = 0;
+    class_count_ = 1;
+    std::string signed_bytes;
+    for (const std::string &pattern : patterns_)
+    {
+        signed_bytes += std::to_string(pattern.size()) + ':' + pattern;
+        if (pattern.empty()) continue;
+        ++match_count_;
+        const size_t first = static_cast<unsigned char>(pattern[0]);
+        for (size_t second = 0; second < 256; ++second)
+        {
+            if (pattern.size() == 1 || second == static_cast<unsigned char>(pattern[1]))
+            {
+                const size_t pair = first << 8 | second;
+                start_pairs_[pair / 64] |= std::uint64_t(1) << (pair % 64);
+            }
+        }
+        for (char c : pattern)
+        {
+            std::uint16_t &cls = byte_class_[static_cast<unsigned char>(c)];
+            if (cls == 0) cls = static_cast<std::uint16_t>(class_count_++);
+        }
+    }
+    if (match_count_ == 0) return;
+    signature_ = Fingerprint::xxhash64(signed_bytes.data(), signed_bytes.size(), 0);
+    if (signature_ == 0) signature_ = 1;
+
+    // Trie, with -1 for missing edges.
+    const size_t classes = class_count_;
+    std::vector<int> go(classes, -1);
+    output_.assign(1, -1);
+    for (size_t i = 0; i < patterns_.size(); ++i)
+    {
+        int state = 0;
+        for (char c : patterns_[i])
+        {
+            const size_t edge = static_cast<size_t>(state) * classes + byte_class_[static_cast<unsigned char>(c)];
+            if (go[edge] < 0)
+            {
+                go[edge] = static_cast<int>(output_.size());
+                output_.push_back(-1);
+                go.resize(go.size() + classes, -1);
+            }
+            state = go[edge];
+        }
+        if (!patterns_[i].empty() && output_[static_cast<size_t>(state)] < 0)
+        {
+            output_[static_cast<size_t>(state)] = static_cast<int>(i);
+        }
+    }
+
+    // Breadth-first over the trie: fill missing edges from the failure state,
+    // and let each state report what its failure state reports.
+    std::vector<int> fail(output_.size(), 0);
+    std::deque<int> queue;
+    for (size_t c = 0; c < classes; ++c)
+    {
+        if (go[c] < 0)
+        {
+            go[c] = 0;
+        }
+        else
+        {
+            queue.push_back(go[c]);
+        }
+    }
+    while (!queue.empty())
+    {
+        const size_t state = static_cast<size_t>(queue.front());
+        queue.pop_front();
+        const size_t fallback = static_cast<size_t>(fail[state]);
+        if (output_[state] < 0) output_[state] = output_[fallback];
+        for (size_t c = 0; c < classes; ++c)
+        {
+            int &edge = go[state * classes + c];
+            if (edge < 0)
+            {
+                edge = go[fallback * classes + c];
+            }
+            else
+            {
+                fail[static_cast<size_t>(edge)] = go[fallback * classes + c];
+                queue.push_back(edge);
+            }
+        }
+    }
+
+    next_.resize(go.size());
+    for (size_t i = 0; i < go.size(); ++i)
+    {
+        const size_t target = static_cast<size_t>(go[i]);
+        next_[i] = static_cast<std::uint32_t>(target * classes) | (output_[target] >= 0 ? kMatchBit : 0u);
+    }
+}
+
+int JunkFilter::feed(std::uint32_t &state, const char *begin, const char *end) const
+{
+    if (empty()) return -1;
+    const std::uint32_t *next = next_.data();
+    std::uint32_t row = state;
+    for (const char *p = begin; p < end; ++p)
+    {
+        if (row == 0)
+        {
+            // No match can start at a byte whose pair with the next one begins no pattern.
+            while (p + 1 < end && !may_start(p)) ++p;
+        }
+        row = next[row + byte_class_[static_cast<unsigned char>(*p)]];
+        if ((row & kMatchBit) != 0)
+        {
+            state = row & ~kMatchBit;
+            return output_[state / class_count_];
+        }
+    }
+    state = row;
+    return -1;
+}
+
+std::string junk_patterns_path()
+{
+    const std::string config_dir = FileSystemUtils::get_config_directory_path();
+    if (config_dir.empty()) return "";
+    return config_dir + PlatformUtils::get_path_separator() + "junk_patterns";
+}
+
+std::vector<std::string> read_junk_patterns(const std::string &path)
+{
+    std::vector<std::string> patterns;
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    std::string line;
+    bool first_line = true;
+    while (std::getline(in, line))
+    {
+        if (first_line) EncodingUtils::strip_utf8_bom_prefix(line);
+        first_line = false;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        patterns.push_back(line);
+    }
+    return patterns;
+}
+
+std::vector<std::string> encode_junk_patterns(const std::vector<std::string> &utf8_patterns,
+                                              const std::string &encoding)
+{
+    std::vector<std::string> encoded;
+    encoded.reserve(utf8_patterns.size());
+    for (const std::string &pattern : utf8_patterns)
+    {
+        encoded.push_back(EncodingUtils::convert_from_utf8(pattern, encoding));
+    }
+    return encoded;
+}
+
+} // namespace TextIndex
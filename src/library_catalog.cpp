@@ -0,0 +1,524 @@
+#include "library_catalog.h"
+
+#include "encoding_utils.h"
+#include "file_system_utils.h"
+#include "fingerprint.h"
+#include "mapped_window.h"
+#include "platform_utils.h"
+#include "task_scheduler.h"
+#include "text_analysis.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+namespace LibraryCatalog {
+
+namespace {
+
+const char kCatalogHeader[] = "# NovelReader catalog v1";
+const size_t kMaxScanThreads = 16;
+const size_t kCountBlockBytes = 1 << 20;
+// Counted bytes are dropped from the page cache in steps of this size.
+const std::uint64_t kReleaseStepBytes = 16 << 20;
+
+struct ScanTask {
+    bool is_directory = false;
+    std::string path;
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0;
+};
+
+std::string to_lower_ascii(std::string text)
+{
+    for (char &c : text) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return text;
+}
+
+bool has_txt_extension(const std::string &name)
+{
+    if (name.size() < 4) return false;
+    return to_lower_ascii(name.substr(name.size() - 4)) == ".txt";
+}
+
+std::string join_path(const std::string &dir, const std::string &name)
+{
+    const char separator = PlatformUtils::get_path_separator();
+    if (!dir.empty() && (dir.back() == separator || dir.back() == '/')) return dir + name;
+    return dir + separator + name;
+}
+
+// Absolute form of `path`, so that entries don't depend on the directory the
+// scan ran from; `path` itself if it can't be resolved.
+std::string absolute_path(const std::string &path)
+{
+#ifdef _WIN32
+    char resolved[MAX_PATH];
+    if (_fullpath(resolved, path.c_str(), MAX_PATH) != nullptr) return resolved;
+#else
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) != nullptr) return resolved;
+#endif
+    return path;
+}
+
+std::string normalize_root(std::string root)
+{
+    const char separator = PlatformUtils::get_path_separator();
+    while (root.size() > 1 && (root.back() == separator || root.back() == '/')) root.pop_back();
+    return root;
+}
+
+bool is_under_root(const std::string &path, const std::string &root)
+{
+    if (path.compare(0, root.size(), root) != 0) return false;
+    if (path.size() == root.size()) return true;
+    const char next = path[root.size()];
+    return next == PlatformUtils::get_path_separator() || next == '/' || root.back() == '/';
+}
+
+// Lists `dir`, appending subdirectories and .txt files to `out`.
+bool list_directory(const std::string &dir, std::vector<ScanTask> &out)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA(join_path(dir, "*").c_str(), &data);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    do
+    {
+        const std::string name = data.cFileName;
+        if (name == "." || name == "..") continue;
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) continue;
+
+        ScanTask task;
+        task.path = join_path(dir, name);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            task.is_directory = true;
+        }
+        else if (has_txt_extension(name))
+        {
+            task.size = (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+            ULARGE_INTEGER ticks;
+            ticks.LowPart = data.ftLastWriteTime.dwLowDateTime;
+            ticks.HighPart = data.ftLastWriteTime.dwHighDateTime;
+            // FILETIME counts 100 ns ticks since 1601-01-01.
+            task.mtime = static_cast<std::int64_t>(ticks.QuadPart / 10000000ULL) - 11644473600LL;
+        }
+        else
+        {
+            continue;
+        }
+        out.push_back(task);
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+    return true;
+#else
+    DIR *handle = opendir(dir.c_str());
+    if (handle == nullptr) return false;
+    while (dirent *entry = readdir(handle))
+    {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+
+        ScanTask task;
+        task.path = join_path(dir, name);
+        struct stat st;
+        // lstat: symlinked directories are skipped so that link cycles can't loop the walk.
+        if (lstat(task.path.c_str(), &st) != 0) continue;
+        if (S_ISLNK(st.st_mode))
+        {
+            if (stat(task.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            task.is_directory = true;
+        }
+        else if (S_ISREG(st.st_mode) && has_txt_extension(name))
+        {
+            task.size = static_cast<std::uint64_t>(st.st_size);
+            task.mtime = static_cast<std::int64_t>(st.st_mtime);
+        }
+        else
+        {
+            continue;
+        }
+        out.push_back(task);
+    }
+    closedir(handle);
+    return true;
+#endif
+}
+
+// Counts lines and chapter headings. Lines are counted as the file breaks them;
+// the reader additionally cuts overlong ones into virtual lines.
+bool count_lines_and_chapters(const std::string &path, const std::string &encoding, std::int64_t &line_count,
+                              std::int64_t &chapter_count)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    EncodingUtils::Utf8Converter converter(encoding);
+    std::vector<char> block(kCountBlockBytes);
+    std::string line;
+    bool line_too_long = false;
+    bool first_line = true;
+    bool last_byte_was_newline = true;
+    bool any_bytes = false;
+    std::int64_t newlines = 0;
+    std::uint64_t bytes_read = 0;
+    std::uint64_t bytes_released = 0;
+    chapter_count = 0;
+
+    auto finish_line = [&]() {
+        if (!line_too_long && !line.empty())
+        {
+            if (line.back() == '\r') line.pop_back();
+            std::string utf8 = converter.convert(line);
+            if (first_line) EncodingUtils::strip_utf8_bom_prefix(utf8);
+            if (TextAnalysis::is_chapter_heading(utf8)) chapter_count++;
+        }
+        line.clear();
+        line_too_long = false;
+        first_line = false;
+    };
+
+    while (file)
+    {
+        file.read(block.data(), static_cast<std::streamsize>(block.size()));
+        const size_t got = static_cast<size_t>(file.gcount());
+        if (got == 0) break;
+        any_bytes = true;
+        bytes_read += got;
+        if (bytes_read - bytes_released >= kReleaseStepBytes)
+        {
+            // A library scan reads each book once; don't let it evict everything else.
+            FileView::release_page_cache(path, bytes_released, bytes_read - bytes_released);
+            bytes_released = bytes_read;
+        }
+
+        const char *p = block.data();
+        const char *end = p + got;
+        while (p < end)
+        {
+            const char *newline = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+            const char *segment_end = newline ? newline : end;
+            if (!line_too_long)
+            {
+                const size_t segment = static_cast<size_t>(segment_end - p);
+                if (line.size() + segment > TextAnalysis::kMaxHeadingBytes)
+                {
+                    line_too_long = true;
+                    line.clear();
+                }
+                else
+                {
+                    line.append(p, segment);
+                }
+            }
+            if (newline == nullptr) break;
+            newlines++;
+            finish_line();
+            p = newline + 1;
+        }
+        last_byte_was_newline = (block[got - 1] == '\n');
+    }
+    if (any_bytes && !last_byte_was_newline) finish_line();
+    if (bytes_released > 0) FileView::release_page_cache(path, bytes_released, 0);
+
+    line_count = newlines + ((any_bytes && !last_byte_was_newline) ? 1 : 0);
+    return true;
+}
+
+bool analyze_file(const ScanTask &task, CatalogEntry &entry)
+{
+    entry.path = task.path;
+    entry.size = task.size;
+    entry.mtime = task.mtime;
+
+    Fingerprint::BookFingerprint fingerprint;
+    if (!Fingerprint::compute_fingerprint(task.path, fingerprint, nullptr)) return false;
+    entry.fingerprint = fingerprint.to_string();
+    entry.encoding = EncodingUtils::detect_encoding(task.path);
+    if (entry.encoding == "UTF-16LE" || entry.encoding == "UTF-16BE")
+    {
+        // Listed so the user sees it, but the reader can't open it.
+        entry.line_count = 0;
+        entry.chapter_count = 0;
+        return true;
+    }
+    return count_lines_and_chapters(task.path, entry.encoding, entry.line_count, entry.chapter_count);
+}
+
+// Shared state of one scan: a queue of directories and files, drained by
+// the worker threads. Directories enqueue their children as they are listed.
+class ScanQueue {
+public:
+    ScanQueue(const std::unordered_map<std::string, const CatalogEntry *> &previous) : previous_(previous)
+    {
+    }
+
+    void push(const ScanTask &task)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(task);
+        ready_.notify_one();
+    }
+
+    void run_worker()
+    {
+        while (true)
+        {
+            ScanTask task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return !tasks_.empty() || active_ == 0; });
+                if (tasks_.empty()) return;
+                // Directories first keeps the queue fed for the other workers.
+                task = tasks_.front();
+                tasks_.pop_front();
+                active_++;
+            }
+
+            if (task.is_directory)
+            {
+                TRACE_SPAN("catalog directory");
+                process_directory(task);
+            }
+            else
+            {
+                TRACE_SPAN("catalog file");
+                process_file(task);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_--;
+            if (active_ == 0 && tasks_.empty()) ready_.notify_all();
+        }
+    }
+
+    std::vector<CatalogEntry> &results() { return results_; }
+    ScanStats &stats() { return stats_; }
+
+private:
+    void process_directory(const ScanTask &task)
+    {
+        std::vector<ScanTask> children;
+        const bool ok = list_directory(task.path, children);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!ok)
+        {
+            stats_.failed++;
+            return;
+        }
+        stats_.directories++;
+        for (const ScanTask &child : children)
+        {
+            if (child.is_directory)
+            {
+                tasks_.push_front(child);
+            }
+            else
+            {
+                tasks_.push_back(child);
+            }
+        }
+        ready_.notify_all();
+    }
+
+    void process_file(const ScanTask &task)
+    {
+        auto previous = previous_.find(task.path);
+        if (previous != previous_.end() && previous->second->size == task.size &&
+            previous->second->mtime == task.mtime)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            results_.push_back(*previous->second);
+            stats_.files++;
+            stats_.reused++;
+            return;
+        }
+
+        CatalogEntry entry;
+        const bool ok = analyze_file(task, entry);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.files++;
+        if (!ok)
+        {
+            stats_.failed++;
+            return;
+        }
+        stats_.rescanned++;
+        results_.push_back(entry);
+    }
+
+    const std::unordered_map<std::string, const CatalogEntry *> &previous_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<ScanTask> tasks_;
+    size_t active_ = 0;
+    std::vector<CatalogEntry> results_;
+    ScanStats stats_;
+};
+
+} // namespace
+
+bool load_catalog(const std::string &catalog_file_path, std::vector<CatalogEntry> &entries)
+{
+    entries.clear();
+    std::ifstream catalog_stream(catalog_file_path, std::ios::binary);
+    if (!catalog_stream.is_open())
+    {
+        // No catalog yet.
+        return true;
+    }
+
+    std::string line;
+    while (std::getline(catalog_stream, line))
+    {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        // size \t mtime \t fingerprint \t encoding \t lines \t chapters \t path
+        std::vector<std::string> fields;
+        size_t start = 0;
+        while (fields.size() < 6)
+        {
+            const size_t tab = line.find('\t', start);
+            if (tab == std::string::npos) break;
+            fields.push_back(line.substr(start, tab - start));
+            start = tab + 1;
+        }
+        if (fields.size() != 6 || start >= line.size()) continue;
+
+        CatalogEntry entry;
+        try
+        {
+            entry.size = std::stoull(fields[0]);
+            entry.mtime = std::stoll(fields[1]);
+            entry.line_count = std::stoll(fields[4]);
+            entry.chapter_count = std::stoll(fields[5]);
+        }
+        catch (...)
+        {
+            continue;
+        }
+        entry.fingerprint = fields[2];
+        entry.encoding = fields[3];
+        entry.path = line.substr(start);
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+bool save_catalog(const std::string &catalog_file_path, const std::vector<CatalogEntry> &entries)
+{
+    std::ostringstream out;
+    out << kCatalogHeader << '\n';
+    for (const CatalogEntry &entry : entries)
+    {
+        out << entry.size << '\t' << entry.mtime << '\t' << entry.fingerprint << '\t' << entry.encoding << '\t'
+            << entry.line_count << '\t' << entry.chapter_count << '\t' << entry.path << '\n';
+    }
+    return FileSystemUtils::write_file_atomic(catalog_file_path, out.str());
+}
+
+bool scan_library(const std::string &root_path, std::vector<CatalogEntry> &entries, ScanStats *stats,
+                  std::string *error_message)
+{
+    const std::string root = normalize_root(absolute_path(root_path));
+    std::vector<ScanTask> probe;
+    if (root.empty() || !list_directory(root, probe))
+    {
+        if (error_message) *error_message = "cannot open directory " + root_path;
+        return false;
+    }
+
+    std::unordered_map<std::string, const CatalogEntry *> previous;
+    for (const CatalogEntry &entry : entries) previous[entry.path] = &entry;
+
+    ScanQueue queue(previous);
+    ScanTask root_task;
+    root_task.is_directory = true;
+    root_task.path = root;
+    queue.push(root_task);
+
+    // Bulk work: the calling thread walks the tree, helped by as many pool
+    // workers as the bulk share allows.
+    Tasks::Scheduler &scheduler = Tasks::shared_scheduler();
+    size_t helper_count = scheduler.max_running(Tasks::Priority::Bulk);
+    if (helper_count >= kMaxScanThreads) helper_count = kMaxScanThreads - 1;
+
+    Tasks::TaskGroup helpers;
+    for (size_t i = 0; i < helper_count; ++i)
+    {
+        scheduler.submit(Tasks::Priority::Bulk, [&queue]() { queue.run_worker(); }, Tasks::CancelToken(), &helpers);
+    }
+    queue.run_worker();
+    helpers.wait();
+
+    std::vector<CatalogEntry> merged;
+    for (const CatalogEntry &entry : entries)
+    {
+        if (!is_under_root(entry.path, root)) merged.push_back(entry);
+    }
+    for (CatalogEntry &entry : queue.results()) merged.push_back(std::move(entry));
+    std::sort(merged.begin(), merged.end(),
+              [](const CatalogEntry &a, const CatalogEntry &b) { return a.path < b.path; });
+    entries.swap(merged);
+
+    if (stats) *stats = queue.stats();
+    return true;
+}
+
+std::vector<size_t> filter_catalog(const std::vector<CatalogEntry> &entries, const std::string &query)
+{
+    std::vector<std::string> terms;
+    std::istringstream words(to_lower_ascii(query));
+    std::string word;
+    while (words >> word) terms.push_back(word);
+
+    std::vector<size_t> matches;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const std::string path = terms.empty() ? std::string() : to_lower_ascii(entries[i].path);
+        bool ok = true;
+        for (const std::string &term : terms)
+        {
+            if (path.find(term) == std::string::npos)
+            {
+                ok = false;
+                break;
+            }
+        }
+        if (ok) matches.push_back(i);
+    }
+    return matches;
+}
+
+std::string display_name(const CatalogEntry &entry)
+{
+    const size_t slash = entry.path.find_last_of("/\\");
+    return slash == std::string::npos ? entry.path : entry.path.substr(slash + 1);
+}
+
+} // namespace LibraryCatalog
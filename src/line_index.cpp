@@ -0,0 +1,1206 @@
+#include "line_index.h"
+
+#include "encoding_utils.h"
+#include "file_system_utils.h"
+#include "fingerprint.h"
+#include "platform_utils.h"
+#include "text_analysis.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace TextIndex {
+
+namespace {
+
+const char kIndexMagic[8] = {'N', 'R', 'L', 'I', 'D', 'X', '0', '7'};
+const size_t kMaxBlankSequenceLength = 4;
+const size_t kMaxSentenceEndLength = 4;
+// How far back from a line's end to look past trailing blanks for its last character.
+const size_t kLineTailBytes = 64;
+// Lines needed before judging whether text is hard-wrapped, and the average
+// paragraph length beyond which it just lacks punctuation instead.
+const size_t kMinHardWrappedLines = 50;
+const size_t kMaxWrappedParagraphLines = 32;
+// UTF-8 characters in a row, after the last byte that is not UTF-8, that end
+// a run of legacy multi-byte text; GBK/Big5 text almost never has eight.
+const size_t kMinUtf8RunChars = 8;
+// Bounds for a configured line length limit; a cut never splits a character of up to four bytes.
+const std::uint64_t kMinMaxLineBytes = 256;
+const std::uint64_t kMaxMaxLineBytes = 1024 * 1024;
+const std::uint64_t kMaxCharacterBytes = 4;
+// Blocks re-read against their checksums, besides the last one, before a saved index is trusted.
+const size_t kVerifiedBlocks = 8;
+
+std::uint64_t block_checksum(const std::vector<char> &data)
+{
+    return Fingerprint::xxhash64(data.data(), data.size(), 0);
+}
+
+bool is_ascii_blank(unsigned char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Sequences of up to 7 bytes, one u64 each: the length, then the bytes.
+void write_sequences(std::ostream &out, const std::vector<std::string> &sequences)
+{
+    write_u64_le(out, sequences.size());
+    for (const std::string &sequence : sequences)
+    {
+        std::uint64_t packed = sequence.size();
+        for (size_t i = 0; i < sequence.size(); ++i)
+        {
+            packed |= static_cast<std::uint64_t>(static_cast<unsigned char>(sequence[i])) << (8 * (i + 1));
+        }
+        write_u64_le(out, packed);
+    }
+}
+
+bool read_matching_sequences(std::istream &in, const std::vector<std::string> &expected)
+{
+    std::uint64_t count = 0;
+    if (!read_u64_le(in, count) || count != expected.size()) return false;
+    for (const std::string &sequence : expected)
+    {
+        std::uint64_t packed = 0;
+        if (!read_u64_le(in, packed) || (packed & 0xFF) != sequence.size()) return false;
+        for (size_t i = 0; i < sequence.size(); ++i)
+        {
+            if (((packed >> (8 * (i + 1))) & 0xFF) != static_cast<unsigned char>(sequence[i])) return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+const std::uint64_t LineIndex::kBlockSize;
+
+void LineIndex::reset(std::uint64_t file_size)
+{
+    starts_.clear();
+    content_.clear();
+    junk_lines_.clear();
+    paragraphs_.clear();
+    characters_.clear();
+    chapters_.clear();
+    encoding_switches_.clear();
+    last_line_ends_paragraph_ = true;
+    open_line_ = LineScanState{};
+    block_checksums_.clear();
+    block_open_lines_.clear();
+    scanned_bytes_ = 0;
+    file_size_ = file_size;
+}
+
+void LineIndex::set_blank_sequences(const std::vector<std::string> &sequences)
+{
+    blank_sequences_.clear();
+    blank_leads_.reset();
+    for (const std::string &sequence : sequences)
+    {
+        if (sequence.empty() || sequence.size() > kMaxBlankSequenceLength) continue;
+        blank_sequences_.push_back(sequence);
+        blank_leads_.set(static_cast<unsigned char>(sequence[0]));
+    }
+}
+
+void LineIndex::set_sentence_ends(const std::vector<std::string> &sequences)
+{
+    sentence_ends_.clear();
+    for (const std::string &sequence : sequences)
+    {
+        if (!sequence.empty() && sequence.size() <= kMaxSentenceEndLength) sentence_ends_.push_back(sequence);
+    }
+}
+
+void LineIndex::set_encoding(const std::string &encoding)
+{
+    encoding_ = encoding;
+    alternate_encoding_ = EncodingUtils::alternate_encoding(encoding);
+    // A UTF-8 file's alternate is a legacy encoding, and the other way round.
+    detected_utf8_ = alternate_encoding_ != "UTF-8";
+    // Blank lines and sentence ends are recognized in either encoding.
+    set_blank_sequences(EncodingUtils::blank_sequences_with_alternate(encoding));
+    set_sentence_ends(EncodingUtils::sentence_end_sequences_with_alternate(encoding));
+    // So are chapter headings; only lines that begin like one are decoded.
+    heading_initials_.clear();
+    heading_leads_.reset();
+    for (const std::string &initial : TextAnalysis::chapter_heading_initials())
+    {
+        for (const std::string &target : {encoding_, alternate_encoding_})
+        {
+            const std::string encoded = EncodingUtils::convert_from_utf8(initial, target);
+            if (!encoded.empty() &&
+                std::find(heading_initials_.begin(), heading_initials_.end(), encoded) == heading_initials_.end())
+            {
+                heading_initials_.push_back(encoded);
+                heading_leads_.set(static_cast<unsigned char>(encoded[0]));
+            }
+        }
+    }
+    legacy_converter_ =
+        std::make_shared<EncodingUtils::Utf8Converter>(detected_utf8_ ? alternate_encoding_ : encoding_);
+}
+
+void LineIndex::set_max_line_bytes(std::uint64_t bytes)
+{
+    max_line_bytes_ = std::min(std::max(bytes, kMinMaxLineBytes), kMaxMaxLineBytes);
+}
+
+size_t LineIndex::first_piece_length(const char *data, size_t size) const
+{
+    return EncodingUtils::line_piece_length(data, size, static_cast<size_t>(max_line_bytes_), encoding_,
+                                            sentence_ends_);
+}
+
+std::vector<std::uint64_t> LineIndex::junk_hits() const
+{
+    std::vector<std::uint64_t> hits(junk_.patterns().size(), 0);
+    for (const JunkLine &junk : junk_lines_)
+    {
+        if (junk.pattern < hits.size()) ++hits[junk.pattern];
+    }
+    return hits;
+}
+
+bool LineIndex::index_through(std::istream &in, std::int64_t line)
+{
+    if (indexed_line_count() >= line) return true;
+    TRACE_SPAN("index build");
+    while (indexed_line_count() < line)
+    {
+        if (!scan_next_block(in)) return false;
+    }
+    return true;
+}
+
+void LineIndex::index_through_offset(std::istream &in, std::uint64_t offset)
+{
+    if (scanned_bytes_ > offset || fully_indexed()) return;
+    TRACE_SPAN("index build");
+    while (scanned_bytes_ <= offset && scan_next_block(in))
+    {
+    }
+}
+
+std::int64_t LineIndex::index_all(std::istream &in)
+{
+    if (fully_indexed()) return indexed_line_count();
+    TRACE_SPAN("index build");
+    while (scan_next_block(in))
+    {
+    }
+    return indexed_line_count();
+}
+
+std::int64_t LineIndex::line_at_offset(std::uint64_t offset) const
+{
+    if (starts_.empty()) return 0;
+    const size_t at_or_before = starts_.count_at_most(offset);
+    return at_or_before == 0 ? 1 : static_cast<std::int64_t>(at_or_before);
+}
+
+std::int64_t LineIndex::next_content_line(std::istream &in, std::int64_t line)
+{
+    if (line < 1) line = 1;
+    while (true)
+    {
+        const size_t completed = content_.size();
+        if (static_cast<size_t>(line) <= completed)
+        {
+            const size_t found = content_.next_set(static_cast<size_t>(line - 1));
+            if (found != RankSelectBitmap::npos) return static_cast<std::int64_t>(found + 1);
+            line = static_cast<std::int64_t>(completed + 1);
+        }
+        if (!scan_next_block(in) && content_.size() == completed) return 0;
+    }
+}
+
+std::int64_t LineIndex::prev_content_line(std::istream &in, std::int64_t line)
+{
+    if (line < 1) return 0;
+    while (content_.size() < static_cast<size_t>(line) && scan_next_block(in))
+    {
+    }
+    const size_t through = content_.size() < static_cast<size_t>(line) ? content_.size() : static_cast<size_t>(line);
+    if (through == 0) return 0;
+    const size_t found = content_.prev_set(through - 1);
+    return found == RankSelectBitmap::npos ? 0 : static_cast<std::int64_t>(found + 1);
+}
+
+std::int64_t LineIndex::paragraph_of(std::int64_t line) const
+{
+    if (line < 1) return 0;
+    const size_t through = paragraphs_.size() < static_cast<size_t>(line) ? paragraphs_.size() : static_cast<size_t>(line);
+    return static_cast<std::int64_t>(paragraphs_.rank(through));
+}
+
+std::int64_t LineIndex::paragraph_first_line(std::int64_t paragraph) const
+{
+    if (paragraph < 1) return 0;
+    const size_t found = paragraphs_.select(static_cast<size_t>(paragraph - 1));
+    return found == RankSelectBitmap::npos ? 0 : static_cast<std::int64_t>(found + 1);
+}
+
+std::int64_t LineIndex::next_paragraph_start(std::istream &in, std::int64_t line)
+{
+    // Bit `line` is the line after `line`.
+    size_t from = line < 0 ? 0 : static_cast<size_t>(line);
+    while (true)
+    {
+        const size_t completed = paragraphs_.size();
+        if (from < completed)
+        {
+            const size_t found = paragraphs_.next_set(from);
+            if (found != RankSelectBitmap::npos) return static_cast<std::int64_t>(found + 1);
+            from = completed;
+        }
+        if (!scan_next_block(in) && paragraphs_.size() == completed) return 0;
+    }
+}
+
+std::int64_t LineIndex::paragraph_start(std::istream &in, std::int64_t line)
+{
+    if (line < 1) return 0;
+    while (paragraphs_.size() < static_cast<size_t>(line) && scan_next_block(in))
+    {
+    }
+    const size_t through = paragraphs_.size() < static_cast<size_t>(line) ? paragraphs_.size() : static_cast<size_t>(line);
+    if (through == 0) return 0;
+    const size_t found = paragraphs_.prev_set(through - 1);
+    return found == RankSelectBitmap::npos ? 0 : static_cast<std::int64_t>(found + 1);
+}
+
+bool LineIndex::looks_hard_wrapped() const
+{
+    const size_t lines = content_.count();
+    const size_t paragraphs = paragraphs_.count();
+    // Unwrapped novels run close to one line per paragraph; wrapped ones several.
+    return lines >= kMinHardWrappedLines && paragraphs > 0 && lines * 2 >= paragraphs * 3 &&
+           lines <= paragraphs * kMaxWrappedParagraphLines;
+}
+
+std::uint64_t LineIndex::characters_before(std::int64_t line) const
+{
+    if (line <= 1 || characters_.empty()) return 0;
+    const size_t last = std::min(static_cast<size_t>(line - 1), characters_.size()) - 1;
+    return characters_.at(last) - last;
+}
+
+std::uint64_t LineIndex::indexed_characters() const
+{
+    return characters_before(static_cast<std::int64_t>(characters_.size()) + 1);
+}
+
+std::int64_t LineIndex::chapter_of(std::int64_t line) const
+{
+    if (line < 1) return 0;
+    const size_t through = chapters_.size() < static_cast<size_t>(line) ? chapters_.size() : static_cast<size_t>(line);
+    return static_cast<std::int64_t>(chapters_.rank(through));
+}
+
+std::int64_t LineIndex::chapter_first_line(std::int64_t chapter) const
+{
+    if (chapter < 1) return 0;
+    const size_t found = chapters_.select(static_cast<size_t>(chapter - 1));
+    return found == RankSelectBitmap::npos ? 0 : static_cast<std::int64_t>(found + 1);
+}
+
+size_t LineIndex::memory_bytes() const
+{
+    return starts_.memory_bytes() + content_.memory_bytes() + junk_lines_.capacity() * sizeof(JunkLine) +
+           paragraphs_.memory_bytes() + characters_.memory_bytes() + chapters_.memory_bytes() +
+           block_checksums_.capacity() * sizeof(std::uint64_t) + block_open_lines_.capacity() * sizeof(std::uint64_t);
+}
+
+bool LineIndex::ends_sentence(const unsigned char *tail, size_t length) const
+{
+    for (const std::string &sequence : sentence_ends_)
+    {
+        if (sequence.size() <= length &&
+            std::memcmp(tail + length - sequence.size(), sequence.data(), sequence.size()) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LineIndex::push_line(const LineScanState &state)
+{
+    const bool content = counts_as_content(state);
+    if (state.junk_pattern >= 0)
+    {
+        junk_lines_.push_back(JunkLine{content_.size(), static_cast<std::uint32_t>(state.junk_pattern)});
+    }
+    paragraphs_.push_back(content && !state.continued &&
+                          (content_.size() == 0 || state.indented || last_line_ends_paragraph_));
+    content_.push_back(content);
+    last_line_ends_paragraph_ = !content || ends_sentence(state.tail, state.tail_length);
+}
+
+void LineIndex::truncate_lines(std::istream &in, size_t count)
+{
+    if (content_.size() <= count) return;
+    content_.truncate(count);
+    paragraphs_.truncate(count);
+    if (characters_.size() > count) characters_.truncate(count);
+    if (chapters_.size() > count) chapters_.truncate(count);
+    while (!junk_lines_.empty() && junk_lines_.back().line >= count) junk_lines_.pop_back();
+    last_line_ends_paragraph_ = count == 0 || line_ends_paragraph(in, static_cast<std::int64_t>(count));
+}
+
+bool LineIndex::line_ends_paragraph(std::istream &in, std::int64_t line) const
+{
+    return !content_.get(static_cast<size_t>(line - 1)) || line_ends_sentence(in, line);
+}
+
+bool LineIndex::line_ends_sentence(std::istream &in, std::int64_t line) const
+{
+    const std::uint64_t begin = line_start(line);
+    const std::uint64_t end = static_cast<size_t>(line) < starts_.size() ? line_start(line + 1) : file_size_;
+    const std::uint64_t from = end - begin > kLineTailBytes ? end - kLineTailBytes : begin;
+    char chunk[kLineTailBytes];
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(from));
+    in.read(chunk, static_cast<std::streamsize>(end - from));
+    size_t length = static_cast<size_t>(in.gcount());
+    in.clear();
+    while (length > 0 && (chunk[length - 1] == '\n' || is_ascii_blank(static_cast<unsigned char>(chunk[length - 1]))))
+    {
+        --length;
+    }
+    const size_t tail = length < kMaxSentenceEndLength ? length : kMaxSentenceEndLength;
+    return ends_sentence(reinterpret_cast<const unsigned char *>(chunk) + length - tail, tail);
+}
+
+void LineIndex::finish_last_line()
+{
+    // The last line has no newline to finish it.
+    if (content_.size() < starts_.size()) push_line(open_line_);
+    open_line_ = LineScanState{};
+}
+
+size_t LineIndex::completed_line_count() const
+{
+    if (starts_.empty()) return 0;
+    return fully_indexed() ? starts_.size() : starts_.size() - 1;
+}
+
+void LineIndex::feed_line(LineScanState &state, const char *begin, const char *end) const
+{
+    if (state.junk_pattern < 0) state.junk_pattern = junk_.feed(state.junk_state, begin, end);
+    if (state.junk_pattern >= 0) return;
+
+    // Keep the last few bytes before trailing blanks, to see how the line ends.
+    const char *last = end;
+    while (last > begin && is_ascii_blank(static_cast<unsigned char>(last[-1]))) --last;
+    const size_t added = static_cast<size_t>(last - begin);
+    if (added >= kMaxSentenceEndLength)
+    {
+        std::memcpy(state.tail, last - kMaxSentenceEndLength, kMaxSentenceEndLength);
+        state.tail_length = kMaxSentenceEndLength;
+    }
+    else if (added > 0)
+    {
+        const size_t kept = state.tail_length < kMaxSentenceEndLength - added ? state.tail_length
+                                                                              : kMaxSentenceEndLength - added;
+        std::memmove(state.tail, state.tail + state.tail_length - kept, kept);
+        std::memcpy(state.tail + kept, begin, added);
+        state.tail_length = kept + added;
+    }
+
+    for (const char *p = begin; p < end && !state.has_content; ++p)
+    {
+        const unsigned char c = static_cast<unsigned char>(*p);
+        if (state.partial_length == 0 && is_ascii_blank(c))
+        {
+            state.indented = true;
+            continue;
+        }
+
+        unsigned char candidate[kMaxBlankSequenceLength];
+        std::memcpy(candidate, state.partial, state.partial_length);
+        candidate[state.partial_length] = c;
+        const size_t length = state.partial_length + 1;
+
+        bool complete = false;
+        bool prefix = false;
+        for (const std::string &sequence : blank_sequences_)
+        {
+            if (sequence.size() < length || std::memcmp(sequence.data(), candidate, length) != 0) continue;
+            if (sequence.size() == length)
+            {
+                complete = true;
+                break;
+            }
+            prefix = true;
+        }
+        if (complete)
+        {
+            state.partial_length = 0;
+            state.indented = true;
+        }
+        else if (prefix)
+        {
+            std::memcpy(state.partial, candidate, length);
+            state.partial_length = length;
+        }
+        else
+        {
+            state.has_content = true;
+        }
+    }
+}
+
+LineIndex::LineScanState LineIndex::scan_line_prefix(std::istream &in, std::uint64_t begin, std::uint64_t end) const
+{
+    LineScanState state;
+    state.continued = !follows_newline(in, begin);
+    char chunk[4096];
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(begin));
+    while (begin < end && !line_decided(state))
+    {
+        const std::uint64_t want = end - begin < sizeof(chunk) ? end - begin : sizeof(chunk);
+        in.read(chunk, static_cast<std::streamsize>(want));
+        const size_t got = static_cast<size_t>(in.gcount());
+        if (got == 0) break;
+        const void *newline = std::memchr(chunk, '\n', got);
+        feed_line(state, chunk, newline != nullptr ? static_cast<const char *>(newline) : chunk + got);
+        if (newline != nullptr) break;
+        begin += got;
+    }
+    in.clear();
+    return state;
+}
+
+LineIndex::LineScanState LineIndex::scan_line(std::istream &in, std::int64_t line) const
+{
+    const std::uint64_t begin = line_start(line);
+    const std::uint64_t end = static_cast<size_t>(line) < starts_.size() ? line_start(line + 1) : file_size_;
+    return scan_line_prefix(in, begin, end);
+}
+
+bool LineIndex::is_skipped_line(const std::string &line) const
+{
+    LineScanState state;
+    feed_line(state, line.data(), line.data() + line.size());
+    return !counts_as_content(state);
+}
+
+bool LineIndex::in_alternate_encoding(std::uint64_t offset, const std::string &line) const
+{
+    if (offset >= scanned_bytes_)
+    {
+        return EncodingUtils::line_in_alternate_encoding(line.data(), line.size(), encoding_);
+    }
+    return alternate_run_at(offset);
+}
+
+bool LineIndex::alternate_run_at(std::uint64_t offset) const
+{
+    if (encoding_switches_.empty()) return false;
+    auto by_offset = [](std::uint64_t at, const EncodingSwitch &change) { return at < change.offset; };
+    const auto after = std::upper_bound(encoding_switches_.begin(), encoding_switches_.end(), offset, by_offset);
+    return (after - encoding_switches_.begin()) % 2 == 1;
+}
+
+bool LineIndex::scanning_utf8() const
+{
+    return detected_utf8_ != (encoding_switches_.size() % 2 == 1);
+}
+
+void LineIndex::add_encoding_switch(std::uint64_t offset, size_t block)
+{
+    if (!encoding_switches_.empty() && encoding_switches_.back().offset >= offset)
+    {
+        // Flipping back at the same line start: that line never changed encoding.
+        encoding_switches_.pop_back();
+        return;
+    }
+    encoding_switches_.push_back(EncodingSwitch{offset, block});
+}
+
+// Runs switch at line starts: to the legacy encoding at the line holding the
+// first byte that is not UTF-8, and back once a line after the last such byte
+// holds enough UTF-8 text to be sure of it. Pure ASCII decides nothing.
+void LineIndex::track_encoding(const char *data, size_t size, std::uint64_t begin)
+{
+    const EncodingUtils::Utf8Survey survey = EncodingUtils::survey_utf8(data, size);
+    const size_t block = block_checksums_.size();
+    bool utf8 = scanning_utf8();
+    if (utf8 && survey.first_invalid < size)
+    {
+        add_encoding_switch(line_start(line_at_offset(begin + survey.first_invalid)), block);
+        utf8 = false;
+    }
+    if (utf8 || survey.multibyte_count < kMinUtf8RunChars) return;
+    std::int64_t line = line_at_offset(begin + survey.first_multibyte);
+    if (survey.last_invalid_end > 0 && line_start(line) < begin + survey.last_invalid_end)
+    {
+        // The line with the last stray byte stays in the legacy encoding.
+        ++line;
+        if (line > indexed_line_count()) return;
+    }
+    add_encoding_switch(line_start(line), block);
+}
+
+bool LineIndex::block_switches_encoding(size_t block) const
+{
+    for (const EncodingSwitch &change : encoding_switches_)
+    {
+        if (change.block == block) return true;
+    }
+    // The same tests as track_encoding(), from the run the block starts in.
+    const EncodingUtils::Utf8Survey survey = EncodingUtils::survey_utf8(buffer_.data(), buffer_.size());
+    const bool utf8 = detected_utf8_ != alternate_run_at(static_cast<std::uint64_t>(block) * kBlockSize);
+    return utf8 ? survey.first_invalid < buffer_.size() : survey.multibyte_count >= kMinUtf8RunChars;
+}
+
+void LineIndex::measure_completed_lines(std::istream &in, const char *data, std::uint64_t data_begin, size_t size)
+{
+    if (characters_.size() >= content_.size()) return;
+    // One pass over the block marks every character; a line's count is then a popcount.
+    if (data != nullptr) EncodingUtils::mark_utf8_characters(data, size, character_marks_);
+    size_t line = characters_.size();
+    std::uint64_t total = characters_before(static_cast<std::int64_t>(line) + 1);
+    std::uint64_t start = starts_.at(line);
+    for (; line < content_.size(); ++line)
+    {
+        const std::uint64_t end = line + 1 < starts_.size() ? starts_.at(line + 1) : file_size_;
+        std::uint64_t characters = 0;
+        bool heading = false;
+        measure_line(in, data, data_begin, size, start, end, characters, heading);
+        total += characters;
+        characters_.push_back(total + line);
+        chapters_.push_back(heading);
+        start = end;
+    }
+}
+
+void LineIndex::measure_line(std::istream &in, const char *data, std::uint64_t data_begin, size_t size,
+                             std::uint64_t start, std::uint64_t end, std::uint64_t &characters, bool &heading)
+{
+    const bool utf8 = detected_utf8_ != alternate_run_at(start);
+    const char *bytes = nullptr;
+    size_t length = static_cast<size_t>(end - start);
+    bool counted = false;
+    if (data != nullptr && start >= data_begin && end <= data_begin + size)
+    {
+        bytes = data + (start - data_begin);
+        if (utf8 && start > 0)
+        {
+            characters = EncodingUtils::count_marked(character_marks_, static_cast<size_t>(start - data_begin),
+                                                     static_cast<size_t>(end - data_begin));
+            counted = true;
+        }
+    }
+    else
+    {
+        // A line reaching into another block; cuts keep it within max_line_bytes_.
+        line_bytes_.resize(length);
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(start));
+        in.read(&line_bytes_[0], static_cast<std::streamsize>(length));
+        length = static_cast<size_t>(in.gcount());
+        in.clear();
+        bytes = line_bytes_.data();
+    }
+    if (!counted)
+    {
+        // The BOM is a lead byte too, but not a character.
+        if (start == 0 && utf8 && length >= 3 && std::memcmp(bytes, "\xEF\xBB\xBF", 3) == 0)
+        {
+            bytes += 3;
+            length -= 3;
+        }
+        characters = EncodingUtils::count_characters(bytes, length, utf8);
+    }
+
+    heading = false;
+    while (length > 0 && (bytes[length - 1] == '\n' || bytes[length - 1] == '\r')) --length;
+    if (length == 0 || length > TextAnalysis::kMaxHeadingBytes) return;
+    size_t at = 0;
+    while (at < length)
+    {
+        const unsigned char lead = static_cast<unsigned char>(bytes[at]);
+        size_t blank = is_ascii_blank(lead) ? 1 : 0;
+        for (size_t k = 0; k < blank_sequences_.size() && blank == 0 && blank_leads_.test(lead); ++k)
+        {
+            const std::string &sequence = blank_sequences_[k];
+            if (sequence.size() <= length - at && std::memcmp(bytes + at, sequence.data(), sequence.size()) == 0)
+            {
+                blank = sequence.size();
+            }
+        }
+        if (blank == 0) break;
+        at += blank;
+    }
+    if (at == length || !heading_leads_.test(static_cast<unsigned char>(bytes[at]))) return;
+    bool initial = false;
+    for (const std::string &candidate : heading_initials_)
+    {
+        if (candidate.size() <= length - at && std::memcmp(bytes + at, candidate.data(), candidate.size()) == 0)
+        {
+            initial = true;
+            break;
+        }
+    }
+    if (!initial) return;
+    std::string utf8_line = utf8 ? std::string(bytes + at, length - at)
+                                 : legacy_converter_->convert(std::string(bytes + at, length - at));
+    heading = TextAnalysis::is_chapter_heading(utf8_line);
+}
+
+std::uint64_t LineIndex::block_end(size_t block) const
+{
+    const std::uint64_t end = (static_cast<std::uint64_t>(block) + 1) * kBlockSize;
+    return end < scanned_bytes_ ? end : scanned_bytes_;
+}
+
+bool LineIndex::read_block(std::istream &in, size_t block, std::vector<char> &out) const
+{
+    const std::uint64_t begin = static_cast<std::uint64_t>(block) * kBlockSize;
+    const std::uint64_t end = block_end(block);
+    out.resize(static_cast<size_t>(end - begin));
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(begin));
+    in.read(out.data(), static_cast<std::streamsize>(out.size()));
+    const bool ok = static_cast<size_t>(in.gcount()) == out.size();
+    in.clear();
+    return ok;
+}
+
+void LineIndex::collect_line_starts(const std::vector<char> &data, std::uint64_t base,
+                                    std::vector<std::uint64_t> &out) const
+{
+    const char *begin = data.data();
+    const char *end = begin + data.size();
+    const char *p = begin;
+    while (p < end)
+    {
+        const void *hit = std::memchr(p, '\n', static_cast<size_t>(end - p));
+        if (hit == nullptr) break;
+        const char *newline = static_cast<const char *>(hit);
+        const std::uint64_t start = base + static_cast<std::uint64_t>(newline - begin) + 1;
+        // A trailing newline does not open another line.
+        if (start < file_size_) out.push_back(start);
+        p = newline + 1;
+    }
+}
+
+bool LineIndex::scan_next_block(std::istream &in)
+{
+    if (scanned_bytes_ >= file_size_) return false;
+
+    const std::uint64_t begin = scanned_bytes_;
+    const std::uint64_t remaining = file_size_ - begin;
+    buffer_.resize(static_cast<size_t>(remaining < kBlockSize ? remaining : kBlockSize));
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(begin));
+    in.read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    const size_t got = static_cast<size_t>(in.gcount());
+    in.clear();
+    if (got == 0)
+    {
+        // The file shrank underneath us; stop here until the next refresh.
+        file_size_ = scanned_bytes_;
+        finish_last_line();
+        measure_completed_lines(in, nullptr, 0, 0);
+        return false;
+    }
+    buffer_.resize(got);
+
+    if (begin == 0 && starts_.empty()) starts_.push_back(0);
+    block_open_lines_.push_back(starts_.back());
+
+    // Same walk as collect_line_starts(), also classifying each finished line.
+    const char *data = buffer_.data();
+    const char *end = data + got;
+    const char *p = data;
+    while (p < end)
+    {
+        const void *hit = std::memchr(p, '\n', static_cast<size_t>(end - p));
+        const char *line_end = hit != nullptr ? static_cast<const char *>(hit) : end;
+        const std::uint64_t line_end_offset = begin + static_cast<std::uint64_t>(line_end - data);
+        // An overlong line is cut as soon as its bytes are seen, so no open line outgrows the limit.
+        while (line_end_offset - starts_.back() > max_line_bytes_)
+        {
+            const std::uint64_t cut = cut_point(in, starts_.back(), begin, line_end_offset);
+            const std::uint64_t at = begin + static_cast<std::uint64_t>(p - data);
+            if (cut >= at)
+            {
+                feed_line(open_line_, p, data + (cut - begin));
+                push_line(open_line_);
+                open_line_ = LineScanState{};
+                open_line_.continued = true;
+                p = data + (cut - begin);
+            }
+            else
+            {
+                // The cut falls in bytes already fed from the previous block.
+                push_line(scan_line_prefix(in, starts_.back(), cut));
+                open_line_ = scan_line_prefix(in, cut, at);
+            }
+            starts_.push_back(cut);
+        }
+        feed_line(open_line_, p, line_end);
+        if (hit == nullptr) break;
+        push_line(open_line_);
+        open_line_ = LineScanState{};
+        const std::uint64_t start = begin + static_cast<std::uint64_t>(line_end - data) + 1;
+        if (start < file_size_) starts_.push_back(start);
+        p = line_end + 1;
+    }
+
+    track_encoding(data, got, begin);
+    block_checksums_.push_back(block_checksum(buffer_));
+    scanned_bytes_ = begin + got;
+    if (scanned_bytes_ >= file_size_) finish_last_line();
+    measure_completed_lines(in, data, begin, got);
+    if (scan_callback_) scan_callback_(begin, scanned_bytes_);
+    return true;
+}
+
+std::uint64_t LineIndex::cut_point(std::istream &in, std::uint64_t start, std::uint64_t begin, std::uint64_t line_end)
+{
+    const std::uint64_t window = std::min(max_line_bytes_ + kMaxCharacterBytes, line_end - start);
+    if (start >= begin) return start + first_piece_length(buffer_.data() + (start - begin), static_cast<size_t>(window));
+    std::vector<char> bytes(static_cast<size_t>(window));
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(start));
+    in.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    bytes.resize(static_cast<size_t>(in.gcount()));
+    in.clear();
+    return start + first_piece_length(bytes.data(), bytes.size());
+}
+
+bool LineIndex::follows_newline(std::istream &in, std::uint64_t offset) const
+{
+    if (offset == 0) return true;
+    char before = '\n';
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(offset - 1));
+    in.get(before);
+    in.clear();
+    return before == '\n';
+}
+
+bool LineIndex::block_matches(std::istream &in, size_t block)
+{
+    if (!read_block(in, block, buffer_)) return false;
+    return block_checksum(buffer_) == block_checksums_[block];
+}
+
+bool LineIndex::sampled_blocks_match(std::istream &in)
+{
+    const size_t count = block_checksums_.size();
+    if (count == 0) return true;
+    const size_t step = count / kVerifiedBlocks + 1;
+    for (size_t block = 0; block + 1 < count; block += step)
+    {
+        if (!block_matches(in, block)) return false;
+    }
+    return block_matches(in, count - 1);
+}
+
+bool LineIndex::reindex_block_in_place(std::istream &in, size_t block)
+{
+    const std::uint64_t begin = static_cast<std::uint64_t>(block) * kBlockSize;
+    const std::uint64_t end = block_end(block);
+    if (!read_block(in, block, buffer_)) return false;
+    if (block_switches_encoding(block)) return false;
+    EncodingUtils::mark_utf8_characters(buffer_.data(), buffer_.size(), character_marks_);
+
+    // Starts in (begin, end] are derived from this block's bytes.
+    fresh_starts_.clear();
+    collect_line_starts(buffer_, begin, fresh_starts_);
+    const size_t first = starts_.count_at_most(begin); // line holding `begin`
+    const size_t last = starts_.count_at_most(end);
+
+    // Only newlines are found here; lines that need cutting are left to a rescan.
+    std::uint64_t previous = starts_.at(first - 1);
+    for (std::uint64_t start : fresh_starts_)
+    {
+        if (start - previous > max_line_bytes_) return false;
+        previous = start;
+    }
+    const bool open_after = last >= starts_.size();
+    const std::uint64_t next = open_after ? scanned_bytes_ : starts_.at(last);
+    if (next - previous > max_line_bytes_ || (!open_after && !follows_newline(in, next))) return false;
+
+    // Character totals run on through the rest of the file, so the edit has to
+    // keep the number of lines and the characters in them.
+    if (fresh_starts_.size() != last - first) return false;
+    std::vector<std::uint64_t> characters;
+    std::vector<bool> headings;
+    std::uint64_t total = characters_before(static_cast<std::int64_t>(first));
+    for (size_t k = 0; k <= fresh_starts_.size() && first - 1 + k < characters_.size(); ++k)
+    {
+        const std::uint64_t start = k == 0 ? starts_.at(first - 1) : fresh_starts_[k - 1];
+        const std::uint64_t line_end = k < fresh_starts_.size() ? fresh_starts_[k] : next;
+        std::uint64_t count = 0;
+        bool heading = false;
+        measure_line(in, buffer_.data(), begin, buffer_.size(), start, line_end, count, heading);
+        total += count;
+        characters.push_back(total + first - 1 + k);
+        headings.push_back(heading);
+    }
+    if (!characters.empty() && characters.back() != characters_.at(first - 2 + characters.size())) return false;
+
+    const size_t old_completed = content_.size();
+    starts_.replace(first, last, fresh_starts_);
+    block_checksums_[block] = block_checksum(buffer_);
+    if (block + 1 < block_open_lines_.size()) block_open_lines_[block + 1] = starts_.at(starts_.count_at_most(end) - 1);
+
+    // Lines `first` .. `first + fresh` overlap the block and are classified
+    // again; the ones after it only moved.
+    const size_t completed = completed_line_count();
+    const size_t old_end = last < old_completed ? last : old_completed;
+    const size_t new_end = first + fresh_starts_.size() < completed ? first + fresh_starts_.size() : completed;
+    std::vector<bool> bits;
+    std::vector<bool> paragraph_bits;
+    std::vector<JunkLine> junk;
+    // Line `first - 1` lies wholly before the block, so its classification still holds.
+    bool previous_ends = first <= 1 || line_ends_paragraph(in, static_cast<std::int64_t>(first - 1));
+    for (size_t line = first; line <= new_end; ++line)
+    {
+        const LineScanState state = scan_line(in, static_cast<std::int64_t>(line));
+        if (state.junk_pattern >= 0) junk.push_back(JunkLine{line - 1, static_cast<std::uint32_t>(state.junk_pattern)});
+        const bool content = counts_as_content(state);
+        bits.push_back(content);
+        paragraph_bits.push_back(content && !state.continued && (line == 1 || state.indented || previous_ends));
+        previous_ends = !content || line_ends_sentence(in, static_cast<std::int64_t>(line));
+    }
+    content_.replace(first - 1, old_end, bits);
+    paragraphs_.replace(first - 1, old_end, paragraph_bits);
+    characters_.replace(first - 1, first - 1 + characters.size(), characters);
+    chapters_.replace(first - 1, first - 1 + headings.size(), headings);
+    // The first line after the rescanned ones starts a paragraph depending on how they end.
+    const size_t after = first - 1 + bits.size();
+    if (after < paragraphs_.size())
+    {
+        const LineScanState next_state = scan_line(in, static_cast<std::int64_t>(after + 1));
+        const bool starts = content_.get(after) && !next_state.continued && (next_state.indented || previous_ends);
+        paragraphs_.replace(after, after + 1, std::vector<bool>(1, starts));
+    }
+    else
+    {
+        last_line_ends_paragraph_ = previous_ends;
+    }
+
+    // Same splice for the junk lines, shifting the ones after the block.
+    auto by_line = [](const JunkLine &junk_line, std::uint64_t line) { return junk_line.line < line; };
+    const auto erase_begin = std::lower_bound(junk_lines_.begin(), junk_lines_.end(), first - 1, by_line);
+    const auto erase_end = std::lower_bound(erase_begin, junk_lines_.end(), old_end, by_line);
+    const std::int64_t shift = static_cast<std::int64_t>(bits.size()) - static_cast<std::int64_t>(old_end - (first - 1));
+    for (auto it = erase_end; it != junk_lines_.end(); ++it) it->line = static_cast<std::uint64_t>(it->line + shift);
+    junk_lines_.insert(junk_lines_.erase(erase_begin, erase_end), junk.begin(), junk.end());
+    if (first + fresh_starts_.size() > completed)
+    {
+        open_line_ = scan_line_prefix(in, starts_.back(), scanned_bytes_);
+    }
+    return true;
+}
+
+void LineIndex::truncate_to_block(std::istream &in, size_t block)
+{
+    const std::uint64_t begin = static_cast<std::uint64_t>(block) * kBlockSize;
+    // Keep the line open at `begin`, whose start comes from an earlier block;
+    // cuts in it were made by this block's scan and are made again.
+    const std::uint64_t open_start = block < block_open_lines_.size() ? block_open_lines_[block] : begin;
+    starts_.truncate(starts_.count_at_most(open_start));
+    if (block_checksums_.size() > block) block_checksums_.resize(block);
+    if (block_open_lines_.size() > block) block_open_lines_.resize(block);
+    // Switches found by the dropped blocks are found again by their rescan.
+    while (!encoding_switches_.empty() && encoding_switches_.back().block >= block) encoding_switches_.pop_back();
+    if (scanned_bytes_ > begin) scanned_bytes_ = begin;
+    // The line open at `begin` is finished again by the rescan.
+    truncate_lines(in, starts_.empty() ? 0 : starts_.size() - 1);
+    open_line_ = starts_.empty() ? LineScanState{} : scan_line_prefix(in, starts_.back(), scanned_bytes_);
+}
+
+RefreshResult LineIndex::refresh(std::istream &in, std::uint64_t new_size)
+{
+    TRACE_SPAN("index refresh");
+    const std::uint64_t old_size = file_size_;
+
+    if (new_size > old_size)
+    {
+        // Fast path for a growing file: only the tail block needs checking.
+        const size_t tail = block_checksums_.empty() ? 0 : block_checksums_.size() - 1;
+        if (block_checksums_.empty() || block_matches(in, tail))
+        {
+            if (!block_checksums_.empty() && scanned_bytes_ >= old_size)
+            {
+                // The tail block was cut short by the old EOF; rescan it whole.
+                truncate_to_block(in, tail);
+            }
+            file_size_ = new_size;
+            return RefreshResult::Appended;
+        }
+    }
+
+    bool changed = false;
+    size_t first_bad = block_checksums_.size();
+    std::vector<size_t> bad_blocks;
+    for (size_t block = 0; block < block_checksums_.size(); ++block)
+    {
+        if (block_end(block) > new_size || !block_matches(in, block))
+        {
+            bad_blocks.push_back(block);
+            if (first_bad == block_checksums_.size()) first_bad = block;
+        }
+    }
+
+    if (new_size == old_size)
+    {
+        // Same length: line starts outside the changed blocks are still valid.
+        for (size_t block : bad_blocks)
+        {
+            if (reindex_block_in_place(in, block)) continue;
+            truncate_to_block(in, block);
+            break;
+        }
+        changed = !bad_blocks.empty();
+    }
+    else
+    {
+        if (first_bad < block_checksums_.size()) truncate_to_block(in, first_bad);
+        file_size_ = new_size;
+        if (scanned_bytes_ > file_size_) scanned_bytes_ = file_size_;
+        changed = true;
+    }
+
+    starts_.truncate(starts_.count_below(file_size_));
+    if (file_size_ == 0) reset(0);
+    truncate_lines(in, completed_line_count());
+    if (fully_indexed()) finish_last_line();
+    measure_completed_lines(in, nullptr, 0, 0);
+    return changed ? RefreshResult::Edited : RefreshResult::Unchanged;
+}
+
+void LineIndex::write(std::ostream &out) const
+{
+    TRACE_SPAN("index save");
+    out.write(kIndexMagic, sizeof(kIndexMagic));
+    write_u64_le(out, kBlockSize);
+    write_u64_le(out, CompactOffsets::kGroupSize);
+    write_u64_le(out, file_size_);
+    write_u64_le(out, scanned_bytes_);
+    write_u64_le(out, block_checksums_.size());
+    for (std::uint64_t checksum : block_checksums_) write_u64_le(out, checksum);
+
+    // The content bitmap depends on which sequences counted as blank.
+    write_sequences(out, blank_sequences_);
+    std::uint64_t open_line = (open_line_.has_content ? 1u : 0u) | (open_line_.partial_length << 1);
+    for (size_t i = 0; i < open_line_.partial_length; ++i)
+    {
+        open_line |= static_cast<std::uint64_t>(open_line_.partial[i]) << (8 * (i + 1));
+    }
+    write_u64_le(out, open_line);
+
+    // So is it on the junk patterns; the lines they hit are kept for the hit counts.
+    write_u64_le(out, junk_.signature());
+    write_u64_le(out, open_line_.junk_state | (static_cast<std::uint64_t>(open_line_.junk_pattern + 1) << 32));
+
+    // And the paragraph bitmap on the sentence ends.
+    write_sequences(out, sentence_ends_);
+    std::uint64_t paragraph_state = (last_line_ends_paragraph_ ? 1u : 0u) | (open_line_.indented ? 2u : 0u) |
+                                    (static_cast<std::uint64_t>(open_line_.tail_length) << 2);
+    for (size_t i = 0; i < open_line_.tail_length; ++i)
+    {
+        paragraph_state |= static_cast<std::uint64_t>(open_line_.tail[i]) << (8 * (i + 1));
+    }
+    if (open_line_.continued) paragraph_state |= std::uint64_t(1) << 48;
+    write_u64_le(out, paragraph_state);
+
+    starts_.write(out);
+    content_.write(out);
+    write_u64_le(out, junk_lines_.size());
+    for (const JunkLine &junk : junk_lines_)
+    {
+        write_u64_le(out, junk.line);
+        write_u64_le(out, junk.pattern);
+    }
+    paragraphs_.write(out);
+
+    // The encoding runs depend on which encoding the file was detected as.
+    write_u64_le(out, Fingerprint::xxhash64(encoding_.data(), encoding_.size(), 0));
+    write_u64_le(out, encoding_switches_.size());
+    for (const EncodingSwitch &change : encoding_switches_)
+    {
+        write_u64_le(out, change.offset);
+        write_u64_le(out, change.block);
+    }
+
+    // Where the lines were cut depends on the limit.
+    write_u64_le(out, max_line_bytes_);
+    for (std::uint64_t open_line_start : block_open_lines_) write_u64_le(out, open_line_start);
+
+    // Character counts and headings were read in the encoding of each run.
+    characters_.write(out);
+    chapters_.write(out);
+}
+
+bool LineIndex::read(std::istream &in, std::istream &file, std::uint64_t file_size)
+{
+    TRACE_SPAN("index load");
+    reset(file_size);
+
+    char magic[sizeof(kIndexMagic)];
+    std::uint64_t block_size = 0;
+    std::uint64_t group_size = 0;
+    std::uint64_t saved_size = 0;
+    std::uint64_t scanned = 0;
+    std::uint64_t block_count = 0;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kIndexMagic, sizeof(magic)) != 0 ||
+        !read_u64_le(in, block_size) || !read_u64_le(in, group_size) || !read_u64_le(in, saved_size) ||
+        !read_u64_le(in, scanned) || !read_u64_le(in, block_count))
+    {
+        return false;
+    }
+    if (block_size != kBlockSize || group_size != CompactOffsets::kGroupSize || saved_size != file_size ||
+        scanned > file_size || block_count != (scanned + kBlockSize - 1) / kBlockSize)
+    {
+        return false;
+    }
+
+    std::vector<std::uint64_t> checksums;
+    for (std::uint64_t i = 0; i < block_count; ++i)
+    {
+        std::uint64_t checksum = 0;
+        if (!read_u64_le(in, checksum)) return false;
+        checksums.push_back(checksum);
+    }
+
+    if (!read_matching_sequences(in, blank_sequences_)) return false;
+    std::uint64_t open_line = 0;
+    if (!read_u64_le(in, open_line)) return false;
+    LineScanState open_state;
+    open_state.has_content = (open_line & 1) != 0;
+    open_state.partial_length = static_cast<size_t>((open_line >> 1) & 0x7F);
+    if (open_state.partial_length >= kMaxBlankSequenceLength) return false;
+    for (size_t i = 0; i < open_state.partial_length; ++i)
+    {
+        open_state.partial[i] = static_cast<unsigned char>(open_line >> (8 * (i + 1)));
+    }
+    std::uint64_t junk_signature = 0;
+    std::uint64_t open_junk = 0;
+    if (!read_u64_le(in, junk_signature) || junk_signature != junk_.signature() || !read_u64_le(in, open_junk))
+    {
+        return false;
+    }
+    open_state.junk_state = static_cast<std::uint32_t>(open_junk);
+    open_state.junk_pattern = static_cast<int>(open_junk >> 32) - 1;
+    if (open_state.junk_pattern >= static_cast<int>(junk_.patterns().size())) return false;
+
+    std::uint64_t paragraph_state = 0;
+    if (!read_matching_sequences(in, sentence_ends_) || !read_u64_le(in, paragraph_state)) return false;
+    const bool last_line_ends_paragraph = (paragraph_state & 1) != 0;
+    open_state.indented = (paragraph_state & 2) != 0;
+    open_state.tail_length = static_cast<size_t>((paragraph_state >> 2) & 0x3F);
+    if (open_state.tail_length > kMaxSentenceEndLength) return false;
+    for (size_t i = 0; i < open_state.tail_length; ++i)
+    {
+        open_state.tail[i] = static_cast<unsigned char>(paragraph_state >> (8 * (i + 1)));
+    }
+    open_state.continued = ((paragraph_state >> 48) & 1) != 0;
+
+    if (!starts_.read(in) || !content_.read(in) || (scanned > 0 && (starts_.empty() || starts_.at(0) != 0)) ||
+        (!starts_.empty() && starts_.back() >= file_size))
+    {
+        reset(file_size);
+        return false;
+    }
+
+    std::uint64_t junk_count = 0;
+    bool junk_ok = read_u64_le(in, junk_count) && junk_count <= content_.size();
+    std::vector<JunkLine> junk_lines;
+    for (std::uint64_t i = 0; junk_ok && i < junk_count; ++i)
+    {
+        std::uint64_t line = 0;
+        std::uint64_t pattern = 0;
+        junk_ok = read_u64_le(in, line) && read_u64_le(in, pattern) && line < content_.size() &&
+                  pattern < junk_.patterns().size() && (junk_lines.empty() || junk_lines.back().line < line);
+        if (junk_ok) junk_lines.push_back(JunkLine{line, static_cast<std::uint32_t>(pattern)});
+    }
+    if (!junk_ok || !paragraphs_.read(in) || paragraphs_.size() != content_.size())
+    {
+        reset(file_size);
+        return false;
+    }
+
+    std::uint64_t encoding_hash = 0;
+    std::uint64_t switch_count = 0;
+    bool switches_ok = read_u64_le(in, encoding_hash) &&
+                       encoding_hash == Fingerprint::xxhash64(encoding_.data(), encoding_.size(), 0) &&
+                       read_u64_le(in, switch_count) && switch_count <= block_count;
+    std::vector<EncodingSwitch> switches;
+    for (std::uint64_t i = 0; switches_ok && i < switch_count; ++i)
+    {
+        EncodingSwitch change{0, 0};
+        switches_ok = read_u64_le(in, change.offset) && read_u64_le(in, change.block) && change.offset < scanned &&
+                      change.block < block_count && (switches.empty() || switches.back().offset < change.offset);
+        if (switches_ok) switches.push_back(change);
+    }
+    std::uint64_t max_line_bytes = 0;
+    bool open_lines_ok = read_u64_le(in, max_line_bytes) && max_line_bytes == max_line_bytes_;
+    std::vector<std::uint64_t> open_lines;
+    for (std::uint64_t i = 0; switches_ok && open_lines_ok && i < block_count; ++i)
+    {
+        std::uint64_t open_line_start = 0;
+        open_lines_ok = read_u64_le(in, open_line_start) && open_line_start <= i * kBlockSize &&
+                        (open_lines.empty() || open_lines.back() <= open_line_start);
+        if (open_lines_ok) open_lines.push_back(open_line_start);
+    }
+    if (!switches_ok || !open_lines_ok || !characters_.read(in) || !chapters_.read(in) ||
+        characters_.size() != content_.size() || chapters_.size() != content_.size())
+    {
+        reset(file_size);
+        return false;
+    }
+    junk_lines_.swap(junk_lines);
+    encoding_switches_.swap(switches);
+    block_open_lines_.swap(open_lines);
+    last_line_ends_paragraph_ = last_line_ends_paragraph;
+
+    block_checksums_.swap(checksums);
+    scanned_bytes_ = scanned;
+    open_line_ = open_state;
+    if (content_.size() != completed_line_count() || !sampled_blocks_match(file))
+    {
+        reset(file_size);
+        return false;
+    }
+    return true;
+}
+
+std::uint64_t read_max_line_bytes()
+{
+    const std::string config_dir = FileSystemUtils::get_config_directory_path();
+    if (config_dir.empty()) return LineIndex::kDefaultMaxLineBytes;
+    std::ifstream in(config_dir + PlatformUtils::get_path_separator() + "max_line_bytes");
+    std::uint64_t bytes = 0;
+    if (!(in >> bytes) || bytes == 0) return LineIndex::kDefaultMaxLineBytes;
+    return bytes;
+}
+
+std::uint64_t stream_size(std::istream &in)
+{
+    in.clear();
+    const std::streampos resume = in.tellg();
+    in.seekg(0, std::ios::end);
+    const std::streampos end = in.tellg();
+    in.clear();
+    if (resume != std::streampos(-1)) in.seekg(resume);
+    if (end == std::streampos(-1)) return 0;
+    return static_cast<std::uint64_t>(static_cast<std::streamoff>(end));
+}
+
+} // namespace TextIndex
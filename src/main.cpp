@@ -8,239 +8,646 @@
 #include <fstream>
 #include <iostream>
 #include <limits> // Required for std::numeric_limits
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <cctype>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
-
-// 编码检测/转码
-#ifndef _WIN32
-#include <iconv.h>
-#if defined(NOVELREADER_HAVE_UCHARDET)
-#include <uchardet/uchardet.h>
-#endif
-#endif
+#include <future>
+#include <iomanip>
+#include <memory>
+#include <sstream>
 
 #ifdef _WIN32
 #include <windows.h> // For SetConsoleOutputCP only on Windows
 #endif
 
+#include "chinese_converter.h"
+#include "concatenated_files.h"
+#include "encoding_utils.h"
 #include "file_system_utils.h"
+#include "file_watcher.h"
+#include "fingerprint.h"
+#include "junk_filter.h"
+#include "library_catalog.h"
+#include "line_index.h"
+#include "mapped_window.h"
 #include "platform_utils.h" // Include the new platform utilities
+#include "readahead.h"
+#include "reader_daemon.h"
+#include "regex_search.h"
+#include "session_snapshot.h"
+#include "stream_spool.h"
+#include "task_scheduler.h"
 #include "terminal_input.h"
+#include "trace.h"
 
 // Global variables
 std::fstream novel_stream;
 std::string NovelPath;
-int current_line_number;
+std::int64_t current_line_number;
+// 当前行起始的字节位置；行号尚未知时（按位置续读或按百分比跳转）current_line_number 为 0
+std::uint64_t current_byte_offset = FileSystemUtils::kNoByteOffset;
 std::string ConfigFilePath;
 // 新增：保存小说文件编码
 std::string NovelEncoding = "UTF-8";
+// 按内容指纹保存的阅读进度（改名/移动后仍可续读）
+std::string ProgressFilePath;
+std::vector<FileSystemUtils::ProgressRecord> ProgressRecords;
+Fingerprint::BookFingerprint NovelFingerprint;
+// 从管道读入的书（NovelReaderCLI -）：NovelPath 是临时的落盘文件，不记进度也不写入配置
+bool NovelIsStream = false;
+// 提取命令（--stats - 等）从管道读入时的临时落盘文件：不交给守护进程，也不缓存索引；
+// 提示信息里显示原来的来源
+std::string ExtractSpoolPath;
+std::string ExtractSourceName;
+// 章节文件夹（0001.txt … 3000.txt）：按文件名顺序拼接成一本书，NovelPath 是文件夹；进度按（文件，行）保存
+FileView::ConcatenatedFiles NovelFolder;
+// 书库目录（按需加载）
+std::string CatalogFilePath;
+std::vector<LibraryCatalog::CatalogEntry> LibraryEntries;
+bool LibraryLoaded = false;
+
+// Function declarations
+bool loadAppSettings(std::string *error_message);
+void initConfigAndNovel();
+void readNovel();
+void showSettings();
+void showLibrary();
+void writeAppSettings();
+bool openNovel(const std::string &path);
+int runCommandLine(const std::vector<std::string> &args);
 
 namespace {
 
-void strip_utf8_bom_prefix(std::string &s)
+const size_t kMaxProgressRecords = 512;
+// Smaller books are re-indexed faster than a saved index could be found and read.
+const std::uint64_t kMinCachedIndexBytes = 1024 * 1024;
+
+FileSystemUtils::ProgressRecord *find_progress_by_fingerprint(const std::string &fingerprint)
 {
-    if (s.size() >= 3 && static_cast<unsigned char>(s[0]) == 0xEF &&
-        static_cast<unsigned char>(s[1]) == 0xBB && static_cast<unsigned char>(s[2]) == 0xBF)
+    for (auto &record : ProgressRecords)
     {
-        s.erase(0, 3);
+        if (record.fingerprint == fingerprint) return &record;
     }
+    return nullptr;
 }
 
-std::string detect_bom_encoding_prefix(const std::string &filename)
+FileSystemUtils::ProgressRecord *find_progress_by_path(const std::string &path)
 {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) return "";
+    for (auto &record : ProgressRecords)
+    {
+        if (record.novel_path == path) return &record;
+    }
+    return nullptr;
+}
 
-    unsigned char bom[4] = {0, 0, 0, 0};
-    file.read(reinterpret_cast<char *>(bom), sizeof(bom));
-    const size_t n = static_cast<size_t>(file.gcount());
+// Fingerprints the current novel; clears the fingerprint if the file can't be sampled.
+void update_novel_fingerprint()
+{
+    if (NovelPath.empty() || NovelIsStream || !Fingerprint::compute_fingerprint(NovelPath, NovelFingerprint, nullptr))
+    {
+        NovelFingerprint = Fingerprint::BookFingerprint{};
+    }
+}
 
-    if (n >= 2 && bom[0] == 0xFF && bom[1] == 0xFE) return "UTF-16LE";
-    if (n >= 2 && bom[0] == 0xFE && bom[1] == 0xFF) return "UTF-16BE";
-    if (n >= 3 && bom[0] == 0xEF && bom[1] == 0xBB && bom[2] == 0xBF) return "UTF-8";
+// Folder progress is stored as the file and the line and offset inside it, so
+// it stays put when chapters are added or renumbered around that file.
+const char kFolderProgressPrefix[] = "folder:";
+// Lines before the position are counted only in files up to this size.
+const std::uint64_t kMaxFolderLineCountBytes = 8 * 1024 * 1024;
 
-    return "";
+bool is_folder_record(const FileSystemUtils::ProgressRecord &record)
+{
+    return record.fingerprint.compare(0, sizeof(kFolderProgressPrefix) - 1, kFolderProgressPrefix) == 0;
 }
 
-#ifdef _WIN32
-bool is_valid_utf8_sample_strict(const std::string &bytes)
+// File names go into a tab-separated, line-based file: '%', tab, CR and LF are
+// written as %XX.
+std::string encode_folder_file_name(const std::string &name)
 {
-    if (bytes.empty()) return true;
+    static const char kHex[] = "0123456789ABCDEF";
+    std::string encoded;
+    for (const char c : name)
+    {
+        if (c == '%' || c == '\t' || c == '\r' || c == '\n')
+        {
+            encoded += '%';
+            encoded += kHex[static_cast<unsigned char>(c) >> 4];
+            encoded += kHex[static_cast<unsigned char>(c) & 0xF];
+        }
+        else
+        {
+            encoded += c;
+        }
+    }
+    return encoded;
+}
 
-    int required = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, bytes.data(),
-                                       static_cast<int>(bytes.size()), nullptr, 0);
-    return required > 0;
+std::string decode_folder_file_name(const std::string &encoded)
+{
+    std::string name;
+    for (size_t i = 0; i < encoded.size(); ++i)
+    {
+        const bool escape = encoded[i] == '%' && i + 2 < encoded.size() &&
+                            std::isxdigit(static_cast<unsigned char>(encoded[i + 1])) &&
+                            std::isxdigit(static_cast<unsigned char>(encoded[i + 2]));
+        if (escape)
+        {
+            name += static_cast<char>(std::stoi(encoded.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        }
+        else
+        {
+            name += encoded[i];
+        }
+    }
+    return name;
 }
 
-std::string convert_to_utf8_windows(const std::string &input, UINT codepage, bool strict)
+FileSystemUtils::ProgressRecord *find_folder_progress(const std::string &directory)
 {
-    if (input.empty()) return "";
+    for (auto &record : ProgressRecords)
+    {
+        if (is_folder_record(record) && record.novel_path == directory) return &record;
+    }
+    return nullptr;
+}
 
-    DWORD flags = strict ? MB_ERR_INVALID_CHARS : 0;
-    int wide_len =
-        MultiByteToWideChar(codepage, flags, input.data(), static_cast<int>(input.size()), nullptr, 0);
-    if (wide_len <= 0)
+// The current position as (file, line in that file); false if it is unknown.
+bool folder_progress_record(FileSystemUtils::ProgressRecord &record)
+{
+    const std::uint64_t offset = ::current_byte_offset;
+    if (offset == FileSystemUtils::kNoByteOffset || offset >= NovelFolder.size()) return false;
+    const size_t file = NovelFolder.file_at(offset);
+    const std::uint64_t within = offset - NovelFolder.file_start(file);
+    record.fingerprint = kFolderProgressPrefix + encode_folder_file_name(NovelFolder.file_name(file));
+    record.byte_offset = within;
+    record.line_number = -1;
+    std::string before;
+    if (within <= kMaxFolderLineCountBytes && NovelFolder.read(NovelFolder.file_start(file), within, before))
     {
-        // Best-effort fallback for ANSI-ish codepages.
-        wide_len = MultiByteToWideChar(codepage, 0, input.data(), static_cast<int>(input.size()), nullptr, 0);
-        if (wide_len <= 0) return input;
+        record.line_number = static_cast<std::int64_t>(std::count(before.begin(), before.end(), '\n'));
     }
+    return true;
+}
 
-    std::wstring wide;
-    wide.resize(static_cast<size_t>(wide_len));
-    if (MultiByteToWideChar(codepage, 0, input.data(), static_cast<int>(input.size()), &wide[0], wide_len) <= 0)
+// True if `within` is the start of a line of `file` (or its end).
+bool is_folder_line_start(size_t file, std::uint64_t within)
+{
+    if (within == 0) return true;
+    if (within > NovelFolder.file_size(file)) return false;
+    std::string previous;
+    return NovelFolder.read(NovelFolder.file_start(file) + within - 1, 1, previous) && previous == "\n";
+}
+
+// Offset of line `line` (0-based) of `file`, counted in the first
+// kMaxFolderLineCountBytes; the start of the file if it can't be found.
+std::uint64_t folder_line_start(size_t file, std::int64_t line)
+{
+    if (line <= 0) return 0;
+    const std::uint64_t length = std::min(NovelFolder.file_size(file), kMaxFolderLineCountBytes);
+    std::string text;
+    if (!NovelFolder.read(NovelFolder.file_start(file), length, text)) return 0;
+    size_t at = 0;
+    for (std::int64_t i = 0; i < line; ++i)
     {
-        return input;
+        at = text.find('\n', at);
+        if (at == std::string::npos) return 0;
+        ++at;
     }
+    return at;
+}
 
-    int u8_len =
-        WideCharToMultiByte(CP_UTF8, 0, wide.data(), wide_len, nullptr, 0, nullptr, nullptr);
-    if (u8_len <= 0) return input;
+// Moves the current book's record to the front with the current line.
+void remember_progress()
+{
+    TRACE_SPAN("save progress");
+    if (ProgressFilePath.empty()) return;
 
-    std::string out;
-    out.resize(static_cast<size_t>(u8_len));
-    if (WideCharToMultiByte(CP_UTF8, 0, wide.data(), wide_len, &out[0], u8_len, nullptr, nullptr) <= 0)
+    FileSystemUtils::ProgressRecord record;
+    if (NovelFolder.is_open())
+    {
+        if (!folder_progress_record(record)) return;
+    }
+    else
+    {
+        if (!NovelFingerprint.valid) return;
+        record.fingerprint = NovelFingerprint.to_string();
+        record.line_number = ::current_line_number - 1;
+        record.byte_offset = ::current_byte_offset;
+    }
+    record.novel_path = NovelPath;
+
+    for (auto it = ProgressRecords.begin(); it != ProgressRecords.end(); ++it)
     {
-        return input;
+        const bool same_book = is_folder_record(record)
+                                   ? is_folder_record(*it) && it->novel_path == record.novel_path
+                                   : it->fingerprint == record.fingerprint;
+        if (same_book)
+        {
+            ProgressRecords.erase(it);
+            break;
+        }
     }
+    ProgressRecords.insert(ProgressRecords.begin(), record);
+    if (ProgressRecords.size() > kMaxProgressRecords) ProgressRecords.resize(kMaxProgressRecords);
 
-    return out;
+    if (!FileSystemUtils::write_progress(ProgressFilePath, ProgressRecords))
+    {
+        std::cerr << "Warning: Failed to write reading progress." << std::endl;
+    }
 }
-#endif
 
-} // namespace
+// What a running reader daemon (--daemon) reported for the current book; empty without one.
+ReaderDaemon::BookInfo daemon_book;
 
-// 新增：检测文件编码
-std::string detect_encoding(const std::string &filename)
+// Saved progress holds "line - 1" plus the line's byte offset; -1 with an
+// offset means the line number was not known yet when it was saved.
+void set_position_from_saved(std::int64_t saved_line, std::uint64_t byte_offset)
 {
-    // BOM beats heuristics.
-    std::string bom_encoding = detect_bom_encoding_prefix(filename);
-    if (!bom_encoding.empty()) return bom_encoding;
+    ::current_byte_offset = byte_offset;
+    if (saved_line < 0 && byte_offset != FileSystemUtils::kNoByteOffset)
+    {
+        ::current_line_number = 0;
+        return;
+    }
+    ::current_line_number = (saved_line < 0 ? 0 : saved_line) + 1;
+}
 
-#ifdef _WIN32
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) return "UTF-8";
+std::string describe_position()
+{
+    if (::current_line_number > 0) return std::to_string(::current_line_number);
+    return "byte " + std::to_string(::current_byte_offset) + " (line number not yet known)";
+}
 
-    constexpr size_t kSampleBytes = 64 * 1024;
-    std::string data;
-    data.resize(kSampleBytes);
-    file.read(&data[0], static_cast<std::streamsize>(kSampleBytes));
-    data.resize(static_cast<size_t>(file.gcount()));
+// Resumes from the progress saved for the current fingerprint, if any.
+void apply_saved_progress()
+{
+    if (NovelFolder.is_open())
+    {
+        // Resumes in the saved file; if that file is gone the configured position stays.
+        const FileSystemUtils::ProgressRecord *record = find_folder_progress(NovelPath);
+        const size_t file =
+            record == nullptr ? FileView::ConcatenatedFiles::npos
+                              : NovelFolder.find_file(decode_folder_file_name(record->fingerprint.substr(sizeof(kFolderProgressPrefix) - 1)));
+        if (file == FileView::ConcatenatedFiles::npos) return;
+        std::uint64_t within = record->byte_offset == FileSystemUtils::kNoByteOffset ? 0 : record->byte_offset;
+        // An edited chapter can move the offset off a line start; the line number is the better guess then.
+        if (!is_folder_line_start(file, within)) within = folder_line_start(file, record->line_number);
+        set_position_from_saved(-1, NovelFolder.file_start(file) + within);
+        return;
+    }
+    if (!NovelFingerprint.valid) return;
+    const FileSystemUtils::ProgressRecord *record = find_progress_by_fingerprint(NovelFingerprint.to_string());
+    if (record != nullptr)
+    {
+        set_position_from_saved(record->line_number, record->byte_offset);
+    }
+    else if (find_progress_by_path(NovelPath) != nullptr)
+    {
+        std::cout << "Note: " << NovelPath << " has changed since it was last read." << std::endl;
+        PlatformUtils::platform_sleep(1500);
+    }
+}
 
-    if (is_valid_utf8_sample_strict(data)) return "UTF-8";
-    return "CP_ACP";
-#else
-#if defined(NOVELREADER_HAVE_UCHARDET)
-    uchardet_t ud = uchardet_new();
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open())
-    {
-        uchardet_delete(ud);
-        return "UTF-8";
-    }
-    constexpr size_t kSampleBytes = 64 * 1024;
-    std::string data;
-    data.resize(kSampleBytes);
-    file.read(&data[0], static_cast<std::streamsize>(kSampleBytes));
-    data.resize(static_cast<size_t>(file.gcount()));
-    if (!data.empty())
-    {
-        uchardet_handle_data(ud, data.c_str(), data.size());
-    }
-    uchardet_data_end(ud);
-    std::string encoding = uchardet_get_charset(ud);
-    uchardet_delete(ud);
-    if (encoding.empty()) return "UTF-8";
-    // uchardet返回的编码名可能是大写，统一转大写
-    for (auto &c : encoding) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
-    return encoding;
-#else
-    (void)filename;
-    return "UTF-8";
-#endif
-#endif
+// Opens `path` as a folder of chapter files in place of a single file.
+bool open_novel_folder(const std::string &path, std::string *error_message)
+{
+    if (!NovelFolder.open(path, error_message)) return false;
+    if (novel_stream.is_open()) novel_stream.close();
+    NovelPath = path;
+    NovelEncoding = NovelFolder.encoding_of(0);
+    NovelFingerprint = Fingerprint::BookFingerprint{};
+    return true;
 }
 
-// 新增：转码为UTF-8
-std::string convert_to_utf8(const std::string &input, const std::string &from_encoding)
+// The open file changed on disk: carry its progress over to the new fingerprint.
+void refresh_novel_fingerprint()
 {
-#ifdef _WIN32
-    if (from_encoding == "UTF-8") return input;
-    if (from_encoding == "UTF-16LE" || from_encoding == "UTF-16BE") return input;
+    const std::string previous = NovelFingerprint.to_string();
+    const bool had_fingerprint = NovelFingerprint.valid;
+    update_novel_fingerprint();
+    if (!had_fingerprint || !NovelFingerprint.valid) return;
 
-    // "CP_ACP" is a stable contract: whatever the user's system ANSI codepage is.
-    if (from_encoding == "CP_ACP")
+    FileSystemUtils::ProgressRecord *record = find_progress_by_fingerprint(previous);
+    if (record != nullptr && find_progress_by_fingerprint(NovelFingerprint.to_string()) == nullptr)
     {
-        return convert_to_utf8_windows(input, CP_ACP, false);
+        record->fingerprint = NovelFingerprint.to_string();
     }
+}
 
-    // Conservative fallback.
-    return convert_to_utf8_windows(input, CP_ACP, false);
-#else
-    if (from_encoding == "UTF-8") return input;
-    iconv_t cd = iconv_open("UTF-8", from_encoding.c_str());
-    if (cd == (iconv_t)-1) return input;
-    size_t inlen = input.size();
-    size_t outlen = inlen * 4 + 4;
-    std::vector<char> outbuf(outlen);
-    char *inptr = const_cast<char *>(input.data());
-    char *outptr = outbuf.data();
-    size_t inbytesleft = inlen;
-    size_t outbytesleft = outlen;
-    size_t res = iconv(cd, &inptr, &inbytesleft, &outptr, &outbytesleft);
-    iconv_close(cd);
-    if (res == (size_t)-1) return input;
-    return std::string(outbuf.data(), outlen - outbytesleft);
-#endif
+// Saved line indexes are keyed by content fingerprint, so they survive renames.
+// The fingerprint only samples the file, so each saved index also starts with
+// the file's mtime and inode and is not used once either differs.
+std::string index_cache_directory()
+{
+    const std::string cache_dir = FileSystemUtils::get_cache_directory_path();
+    if (cache_dir.empty()) return "";
+    return cache_dir + PlatformUtils::get_path_separator() + "index";
 }
 
-// Function declarations
-void initConfigAndNovel();
-void readNovel();
-void showSettings();
-void writeAppSettings();
+std::string index_cache_path(const std::string &directory, const Fingerprint::BookFingerprint &fingerprint)
+{
+    return directory + PlatformUtils::get_path_separator() + fingerprint.to_string() + ".idx";
+}
 
-void initConfigAndNovel()
+bool load_cached_index(TextIndex::LineIndex &index, const std::string &path, std::istream &file,
+                       std::uint64_t file_size, const Fingerprint::BookFingerprint &fingerprint)
 {
-#ifdef _WIN32
-    SetConsoleOutputCP(CP_UTF8);
-#else
-    // For Linux/macOS, UTF-8 is generally assumed or set by locale.
-    // Explicit setup might involve std::locale and std::ios_base::sync_with_stdio(false)
-    // but for basic console output, often not needed if system locale is UTF-8.
-#endif
+    const std::string directory = index_cache_directory();
+    std::int64_t mtime = 0;
+    std::uint64_t inode = 0;
+    if (file_size < kMinCachedIndexBytes || !fingerprint.valid || directory.empty() ||
+        !FileSystemUtils::get_file_stamp(path, mtime, inode))
+    {
+        return false;
+    }
+    std::ifstream in(index_cache_path(directory, fingerprint), std::ios::in | std::ios::binary);
+    std::uint64_t saved_mtime = 0;
+    std::uint64_t saved_inode = 0;
+    if (!in.is_open() || !TextIndex::read_u64_le(in, saved_mtime) || !TextIndex::read_u64_le(in, saved_inode) ||
+        saved_mtime != static_cast<std::uint64_t>(mtime) || saved_inode != inode)
+    {
+        return false;
+    }
+    return index.read(in, file, file_size);
+}
+
+void save_cached_index(const TextIndex::LineIndex &index, const std::string &path,
+                       const Fingerprint::BookFingerprint &fingerprint)
+{
+    const std::string directory = index_cache_directory();
+    std::int64_t mtime = 0;
+    std::uint64_t inode = 0;
+    if (index.scanned_bytes() < kMinCachedIndexBytes || !fingerprint.valid || directory.empty() ||
+        !FileSystemUtils::get_file_stamp(path, mtime, inode))
+    {
+        return;
+    }
+    if (!FileSystemUtils::create_directory_if_not_exists(directory)) return;
+    std::ostringstream contents;
+    TextIndex::write_u64_le(contents, static_cast<std::uint64_t>(mtime));
+    TextIndex::write_u64_le(contents, inode);
+    index.write(contents);
+    if (!FileSystemUtils::write_file_atomic(index_cache_path(directory, fingerprint), contents.str()))
+    {
+        std::cerr << "Warning: Failed to save the line index." << std::endl;
+    }
+}
+
+// The reader runs on the terminal's alternate screen; the hide key drops back
+// to the normal screen, or paints a decoy, in a single write.
+const char kEnterAlternateScreen[] = "\x1b[?1049h";
+const char kLeaveAlternateScreen[] = "\x1b[?1049l";
+const char kHomeAndClear[] = "\x1b[H\x1b[2J";
+
+// Contents of the optional "decoy" file in the config directory (e.g. a fake
+// build log), shown by the hide key instead of the normal screen.
+std::string load_decoy_frame()
+{
+    const std::string config_dir = FileSystemUtils::get_config_directory_path();
+    if (config_dir.empty()) return "";
+    std::ifstream in(config_dir + PlatformUtils::get_path_separator() + "decoy", std::ios::in | std::ios::binary);
+    if (!in.is_open()) return "";
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+// 简繁转换：配置目录中的 s2t.dat / t2s.dat 是用 --build-dict 预编译的词典，
+// 当前方向记在 "conversion" 文件里
+const char *const kConversionModes[] = {"s2t", "t2s"};
+
+std::string config_file_path(const std::string &name)
+{
+    const std::string config_dir = FileSystemUtils::get_config_directory_path();
+    if (config_dir.empty()) return "";
+    return config_dir + PlatformUtils::get_path_separator() + name;
+}
+
+bool is_conversion_mode(const std::string &mode)
+{
+    for (const char *known : kConversionModes)
+    {
+        if (mode == known) return true;
+    }
+    return false;
+}
+
+std::string load_conversion_mode()
+{
+    std::ifstream in(config_file_path("conversion"), std::ios::in | std::ios::binary);
+    std::string mode;
+    if (!in.is_open() || !std::getline(in, mode)) return "";
+    if (!mode.empty() && mode.back() == '\r') mode.pop_back();
+    return is_conversion_mode(mode) ? mode : "";
+}
+
+void save_conversion_mode(const std::string &mode)
+{
+    FileSystemUtils::write_file_atomic(config_file_path("conversion"), mode.empty() ? std::string() : mode + "\n");
+}
+
+// 阅读速度：翻页时累计读过的字数和用时，存在 "reading_rate" 文件里（"字数 秒数"）
+struct ReadingRate
+{
+    double characters = 0;
+    double seconds = 0;
+};
+
+// Until this much reading has been timed the estimate uses kDefaultCharactersPerMinute.
+constexpr double kMinRateSeconds = 60;
+constexpr double kDefaultCharactersPerMinute = 500;
+// Older samples fade out: past this much timed reading both totals are halved.
+constexpr double kMaxRateSeconds = 3600;
+
+ReadingRate load_reading_rate()
+{
+    ReadingRate rate;
+    std::ifstream in(config_file_path("reading_rate"), std::ios::in | std::ios::binary);
+    double characters = 0;
+    double seconds = 0;
+    if (in.is_open() && (in >> characters >> seconds) && characters >= 0 && seconds >= 0)
+    {
+        rate.characters = characters;
+        rate.seconds = seconds;
+    }
+    return rate;
+}
+
+void save_reading_rate(const ReadingRate &rate)
+{
+    if (rate.seconds <= 0) return;
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << rate.characters << ' ' << rate.seconds << '\n';
+    FileSystemUtils::write_file_atomic(config_file_path("reading_rate"), out.str());
+}
+
+double characters_per_minute(const ReadingRate &rate)
+{
+    if (rate.seconds < kMinRateSeconds || rate.characters <= 0) return kDefaultCharactersPerMinute;
+    return rate.characters * 60.0 / rate.seconds;
+}
+
+std::string format_reading_time(double minutes)
+{
+    if (minutes < 1) return "<1 min";
+    const std::uint64_t whole = static_cast<std::uint64_t>(minutes + 0.5);
+    if (whole < 60) return std::to_string(whole) + " min";
+    return std::to_string(whole / 60) + " h " + std::to_string(whole % 60) + " min";
+}
+
+// The screen the reader closed on, repainted by --resume before anything else is loaded.
+std::string session_snapshot_path()
+{
+    const std::string config_dir = FileSystemUtils::get_config_directory_path();
+    if (config_dir.empty()) return "";
+    return config_dir + PlatformUtils::get_path_separator() + "session";
+}
+
+void save_session_snapshot(std::int64_t line, std::uint64_t offset, const std::string &raw_line,
+                           const std::string &frame)
+{
+    TRACE_SPAN("save session");
+    const std::string path = session_snapshot_path();
+    if (path.empty() || !NovelFingerprint.valid || frame.empty()) return;
+    Session::Snapshot snapshot;
+    snapshot.fingerprint = NovelFingerprint.to_string();
+    snapshot.novel_path = NovelPath;
+    snapshot.encoding = NovelEncoding;
+    snapshot.line_number = line;
+    snapshot.byte_offset = offset;
+    snapshot.line_bytes = raw_line.size();
+    snapshot.line_hash = Fingerprint::xxhash64(raw_line.data(), raw_line.size(), 0);
+    snapshot.frame = frame;
+    if (!Session::write_snapshot(path, snapshot))
+    {
+        std::cerr << "Warning: Failed to save the session snapshot." << std::endl;
+    }
+}
+
+// A --resume launch: the saved frame is already on screen while a worker
+// thread checks the snapshot against the file.
+struct PendingResume
+{
+    bool active = false;
+    Session::Snapshot snapshot;
+    Fingerprint::BookFingerprint fingerprint; // set by the check
+    std::future<bool> check;
+};
+PendingResume pending_resume;
+
+// Paints the saved frame and starts checking it; false if there is no usable snapshot.
+bool begin_resume()
+{
+    const std::string path = session_snapshot_path();
+    if (path.empty() || !Session::read_snapshot(path, pending_resume.snapshot)) return false;
+    PlatformUtils::paint_screen(pending_resume.snapshot.frame);
+    // The first keypress waits on this check, so it goes ahead of any other background work.
+    pending_resume.check = Tasks::shared_scheduler().async(Tasks::Priority::Viewport, []() {
+        TRACE_SPAN("validate snapshot");
+        return Session::validate_snapshot(pending_resume.snapshot, pending_resume.fingerprint);
+    });
+    pending_resume.active = true;
+    return true;
+}
+
+// Waits for the check. True if the snapshot's position can be used as is;
+// otherwise falls back to encoding detection and the saved progress.
+bool settle_resume()
+{
+    if (!pending_resume.active) return false;
+    pending_resume.active = false;
+    TRACE_SPAN("settle resume");
+    const bool valid = pending_resume.check.get();
+    NovelFingerprint = pending_resume.fingerprint;
+    if (valid) return true;
+    // The snapshot's offset belongs to other contents.
+    ::current_byte_offset = FileSystemUtils::kNoByteOffset;
+    if (!NovelPath.empty() && novel_stream.is_open())
+    {
+        NovelEncoding = EncodingUtils::detect_encoding(NovelPath);
+        apply_saved_progress();
+    }
+    return false;
+}
+
+} // namespace
 
+// Sets the configuration paths and reads the configured novel and position,
+// without opening the novel. Problems reading the files are warnings on
+// stderr; only a missing configuration directory fails.
+bool loadAppSettings(std::string *error_message)
+{
     std::string config_dir = FileSystemUtils::get_config_directory_path();
     if (config_dir.empty())
     {
-        std::cerr << "Critical: Could not determine config directory. Exiting." << std::endl;
-        PlatformUtils::platform_sleep(3000);
-        exit(1);
+        if (error_message) *error_message = "Could not determine config directory.";
+        return false;
     }
 
     if (!FileSystemUtils::create_directory_if_not_exists(config_dir))
     {
-        std::cerr << "Critical: Could not create config directory: " << config_dir << ". Exiting." << std::endl;
-        PlatformUtils::platform_sleep(3000);
-        exit(1);
+        if (error_message) *error_message = "Could not create config directory: " + config_dir + ".";
+        return false;
     }
 
     ConfigFilePath = config_dir + PlatformUtils::get_path_separator() + "config";
+    ProgressFilePath = config_dir + PlatformUtils::get_path_separator() + "progress";
+    CatalogFilePath = config_dir + PlatformUtils::get_path_separator() + "catalog";
+    if (!FileSystemUtils::read_progress(ProgressFilePath, ProgressRecords))
+    {
+        std::cerr << "Warning: Reading progress could not be loaded." << std::endl;
+    }
 
-    int line_val_from_config = 0;
-    if (!FileSystemUtils::read_config(ConfigFilePath, NovelPath, line_val_from_config))
+    std::int64_t line_val_from_config = 0;
+    std::uint64_t offset_from_config = FileSystemUtils::kNoByteOffset;
+    if (!FileSystemUtils::read_config(ConfigFilePath, NovelPath, line_val_from_config, offset_from_config))
     {
         std::cerr << "Warning: Configuration could not be read or initialized properly." << std::endl;
         NovelPath = "";
         line_val_from_config = 0;
+        offset_from_config = FileSystemUtils::kNoByteOffset;
+    }
+    if (pending_resume.active)
+    {
+        NovelPath = pending_resume.snapshot.novel_path;
+        line_val_from_config = pending_resume.snapshot.line_number - 1;
+        offset_from_config = pending_resume.snapshot.byte_offset;
+    }
+    set_position_from_saved(line_val_from_config, offset_from_config);
+    return true;
+}
+
+void initConfigAndNovel()
+{
+    std::string error;
+    if (!loadAppSettings(&error))
+    {
+        std::cerr << "Critical: " << error << " Exiting." << std::endl;
+        PlatformUtils::platform_sleep(3000);
+        exit(1);
     }
-    if (line_val_from_config < 0) line_val_from_config = 0;
-    ::current_line_number = line_val_from_config + 1;
-    if (::current_line_number < 1) ::current_line_number = 1;
 
-    if (!NovelPath.empty())
+    if (!NovelPath.empty() && FileSystemUtils::is_directory(NovelPath))
+    {
+        std::string error;
+        if (open_novel_folder(NovelPath, &error))
+        {
+            apply_saved_progress();
+        }
+        else
+        {
+            std::cerr << "Error: Could not open chapter folder: " << error << ". Please check path in settings." << std::endl;
+        }
+    }
+    else if (!NovelPath.empty())
     {
         if (novel_stream.is_open()) novel_stream.close();
         novel_stream.open(NovelPath, std::ios::in | std::ios::binary);
@@ -248,17 +655,38 @@ void initConfigAndNovel()
         {
             std::cerr << "Error: Could not open novel file: " << NovelPath << ". Please check path in settings." << std::endl;
         }
+        else if (pending_resume.active)
+        {
+            // 续读会话：编码取自快照，指纹由后台校验给出
+            NovelEncoding = pending_resume.snapshot.encoding;
+        }
         else
         {
-            // 检测编码
-            NovelEncoding = detect_encoding(NovelPath);
+            if (ReaderDaemon::request_book(NovelPath, daemon_book, nullptr))
+            {
+                // 守护进程已检测过编码、算好指纹
+                NovelEncoding = daemon_book.encoding;
+                NovelFingerprint = daemon_book.fingerprint;
+            }
+            else
+            {
+                // 检测编码
+                NovelEncoding = EncodingUtils::detect_encoding(NovelPath);
+                update_novel_fingerprint();
+            }
+
+            // 进度以内容指纹为准；同一路径但指纹不同说明文件已被修改
+            apply_saved_progress();
         }
     }
 }
 
 void readNovel()
 {
-    if (!novel_stream.is_open())
+    // After --resume the saved frame is on screen; use its position only if the file still matches.
+    const bool resumed = settle_resume();
+    const bool folder = NovelFolder.is_open();
+    if (!novel_stream.is_open() && !folder)
     {
         PlatformUtils::clear_screen();
         std::cout << "Novel file is not open. Current path: " << (NovelPath.empty() ? "Not set" : NovelPath) << std::endl;
@@ -285,8 +713,10 @@ void readNovel()
         return;
     }
     std::cin.clear();
-    novel_stream.clear();
-    novel_stream.seekg(0);
+    // 章节文件夹经其文件表读取：索引扫描的流和按偏移读取都跨文件首尾相接
+    std::istream &book_stream = folder ? NovelFolder.stream() : static_cast<std::istream &>(novel_stream);
+    book_stream.clear();
+    book_stream.seekg(0);
 
     std::string content_buffer;
 
@@ -294,115 +724,797 @@ void readNovel()
         if (!line.empty() && line.back() == '\r') line.pop_back();
     };
 
-    // 记录每一行的起始偏移（1-based），用于上一行
-    std::vector<std::streampos> line_start_positions;
-    line_start_positions.push_back(std::streampos(0)); // index 0 unused
+    // 行内容经随阅读位置滑动的 mmap 窗口读取，大文件也只占一个窗口的内存
+    FileView::MappedWindow window;
+    std::string window_error;
+    if (!folder && !window.open(NovelPath, &window_error))
+    {
+        PlatformUtils::clear_screen();
+        std::cerr << "Error: Could not open novel file for reading: " << window_error << std::endl;
+        PlatformUtils::platform_sleep(2500);
+        return;
+    }
+
+    // 慢速存储（网络盘、机械盘）上提前异步读入光标前后的块，翻页时缺页只命中页缓存
+    FileView::Readahead readahead;
+    if (!folder) readahead.open(NovelPath, nullptr);
 
-    int line_being_displayed = ::current_line_number;
+    auto read_book = [&](std::uint64_t offset, std::uint64_t length, std::string &out) -> bool {
+        return folder ? NovelFolder.read(offset, length, out) : window.read(offset, length, out);
+    };
+    auto book_size = [&]() -> std::uint64_t { return folder ? NovelFolder.size() : window.size(); };
+    // Lines starting a file may begin with its byte order mark.
+    auto starts_file = [&](std::uint64_t offset) -> bool {
+        return folder ? NovelFolder.is_file_start(offset) : offset == 0;
+    };
 
-    // 定位到当前行，同时建立索引（避免上一行需要反复从头扫描）
-    for (int line = 1; line < line_being_displayed; ++line)
+    // 行起始偏移索引按需向后扩展；跳转和上一行都直接走索引
+    TextIndex::LineIndex index;
+    const std::uint64_t novel_size = TextIndex::stream_size(book_stream);
+    index.set_encoding(NovelEncoding);
+    // 超长行（整本书没有换行之类）切成若干虚拟行，内存和解码量都有上限
+    index.set_max_line_bytes(TextIndex::read_max_line_bytes());
+    // 广告、水印等垃圾行在建索引时一并标出，翻页时和空行一样跳过
+    index.set_junk_patterns(TextIndex::encode_junk_patterns(TextIndex::read_junk_patterns(TextIndex::junk_patterns_path()),
+                                                            NovelEncoding));
+    // A running daemon hands over its index through shared memory; otherwise use the disk cache.
+    if (!NovelIsStream && !folder && (!daemon_book.has_index() || daemon_book.fingerprint != NovelFingerprint))
+    {
+        ReaderDaemon::request_book(NovelPath, daemon_book, nullptr);
+    }
+    const bool from_daemon = NovelFingerprint.valid && daemon_book.fingerprint == NovelFingerprint &&
+                             daemon_book.load_index(index, book_stream, novel_size);
+    daemon_book.release();
+    if (!from_daemon && !load_cached_index(index, NovelPath, book_stream, novel_size, NovelFingerprint))
     {
-        line_start_positions.push_back(novel_stream.tellg());
-        if (!std::getline(novel_stream, content_buffer))
+        index.reset(novel_size);
+    }
+    const std::uint64_t cached_scanned_bytes = index.scanned_bytes();
+    bool index_edited = false;
+    // Bytes the index has been through are dropped from the page cache, away from the reader.
+    index.set_scan_callback([&window](std::uint64_t begin, std::uint64_t end) { window.release(begin, end - begin); });
+    // Saves the index if this session scanned further or the file changed under it.
+    auto save_index = [&]() {
+        if (index_edited || index.scanned_bytes() > cached_scanned_bytes)
         {
-            PlatformUtils::clear_screen();
-            std::cerr << "Requested line " << ::current_line_number << " is beyond EOF. Resetting to start." << std::endl;
-            PlatformUtils::platform_sleep(2000);
-            ::current_line_number = 1;
-            line_being_displayed = 1;
-            novel_stream.clear();
-            novel_stream.seekg(0);
-            line_start_positions.resize(1);
-            break;
+            save_cached_index(index, NovelPath, NovelFingerprint);
         }
-    }
+    };
 
-    bool has_buffered_line = false;
-    std::string buffered_utf8_line;
+    // 监视文件变化：追加时增量扩展索引，原地修改时只重建变化的块
+    FileWatch::FileWatcher watcher;
+    if (!folder) watcher.watch(NovelPath, nullptr);
 
-    enum class ReaderAction
-    {
-        None,
-        Next,
-        Prev,
-        Quit,
+    auto last_line_number = [&]() -> std::int64_t {
+        return index.index_all(book_stream);
     };
 
-    int last_persisted_line = -1;
-
-    while (true)
-    {
-        PlatformUtils::clear_screen();
+    // Raw bytes (CR stripped) of the line; also used for re-anchoring after edits.
+    auto read_line_raw = [&](std::int64_t line, std::string &out) -> bool {
+        if (line < 1 || !index.index_through(book_stream, line)) return false;
+        // The next line's start (or EOF) bounds this one.
+        index.index_through(book_stream, line + 1);
+        const std::uint64_t begin = index.line_start(line);
+        const std::uint64_t end = line < index.indexed_line_count() ? index.line_start(line + 1) : index.file_size();
+        if (!read_book(begin, end - begin, out)) return false;
+        const size_t newline = out.find('\n');
+        if (newline != std::string::npos) out.resize(newline);
+        strip_trailing_cr(out);
+        return true;
+    };
 
-        std::string utf8_line;
-        if (has_buffered_line)
-        {
-            utf8_line = buffered_utf8_line;
-            has_buffered_line = false;
-        }
-        else
+    // 合集中途换了编码时，按索引记录的编码段逐段转码
+    EncodingUtils::Utf8Converter converter(NovelEncoding);
+    EncodingUtils::Utf8Converter alternate_converter(index.alternate_encoding());
+    // A chapter file whose own encoding was detected differently is decoded as that.
+    std::map<std::string, std::unique_ptr<EncodingUtils::Utf8Converter>> file_converters;
+    auto convert_line = [&](std::uint64_t offset, const std::string &raw) -> std::string {
+        if (folder)
         {
-            if (line_being_displayed >= static_cast<int>(line_start_positions.size()))
+            const std::string &encoding = NovelFolder.encoding_of(NovelFolder.file_at(offset));
+            if (encoding != NovelEncoding)
             {
-                line_start_positions.push_back(novel_stream.tellg());
+                std::unique_ptr<EncodingUtils::Utf8Converter> &file_converter = file_converters[encoding];
+                if (!file_converter) file_converter.reset(new EncodingUtils::Utf8Converter(encoding));
+                return file_converter->convert(raw);
             }
+        }
+        return index.in_alternate_encoding(offset, raw) ? alternate_converter.convert(raw) : converter.convert(raw);
+    };
+    auto read_line_utf8 = [&](std::int64_t line, std::string &out) -> bool {
+        TRACE_SPAN("decode line");
+        if (!read_line_raw(line, content_buffer)) return false;
+        out = convert_line(index.line_start(line), content_buffer);
+        if (starts_file(index.line_start(line))) EncodingUtils::strip_utf8_bom_prefix(out);
+        return true;
+    };
 
-            if (!std::getline(novel_stream, content_buffer))
+    // Nearest non-blank line starting at `line` and moving in `direction` (+1/-1); 0 if none.
+    // Blank lines are skipped through the index's content bitmap without being read.
+    auto find_content_line = [&](std::int64_t line, int direction, std::string &out) -> std::int64_t {
+        const std::int64_t found = direction > 0 ? index.next_content_line(book_stream, line)
+                                        : index.prev_content_line(book_stream, line);
+        if (found == 0 || !read_line_utf8(found, out)) return 0;
+        return found;
+    };
+
+    // Lands on `target`, or the nearest content line around it, clamped to the file.
+    auto go_to_line = [&](std::int64_t target, std::string &out) -> std::int64_t {
+        if (target < 1) target = 1;
+        const std::int64_t found = find_content_line(target, 1, out);
+        if (found != 0) return found;
+        const std::int64_t last = last_line_number();
+        return find_content_line(target < last ? target : last, -1, out);
+    };
+
+    // After an edit, finds the line that still holds `anchor_raw`, searching
+    // outwards from wherever `anchor_offset` now falls; falls back to that line.
+    auto reanchor_line = [&](std::uint64_t anchor_offset, const std::string &anchor_raw) -> std::int64_t {
+        constexpr int kAnchorSearchLines = 256;
+        index.index_through_offset(book_stream, anchor_offset);
+        const std::int64_t around = index.line_at_offset(anchor_offset);
+        if (around == 0) return 0;
+        std::string candidate;
+        for (int distance = 0; distance <= kAnchorSearchLines; ++distance)
+        {
+            if (read_line_raw(around + distance, candidate) && candidate == anchor_raw) return around + distance;
+            if (distance > 0 && read_line_raw(around - distance, candidate) && candidate == anchor_raw)
             {
-                std::cout << "End of novel." << std::endl;
-                // Avoid persisting the "EOF + 1" state; keep progress at the last line.
-                int last_line = line_being_displayed - 1;
-                if (last_line < 1) last_line = 1;
-                ::current_line_number = last_line;
-                PlatformUtils::platform_sleep(1500);
-                break;
+                return around - distance;
             }
-            strip_trailing_cr(content_buffer);
-            utf8_line = convert_to_utf8(content_buffer, NovelEncoding);
-            if (line_being_displayed >= 1 && line_being_displayed < static_cast<int>(line_start_positions.size()) &&
-                line_start_positions[line_being_displayed] == std::streampos(0))
+        }
+        return around;
+    };
+
+    // Applies queued file notifications to the stream and index.
+    auto sync_with_file = [&]() -> TextIndex::RefreshResult {
+        const FileWatch::FileChange change = watcher.consume();
+        if (change == FileWatch::FileChange::None) return TextIndex::RefreshResult::Unchanged;
+        if (change == FileWatch::FileChange::Replaced)
+        {
+            novel_stream.close();
+            novel_stream.clear();
+            novel_stream.open(NovelPath, std::ios::in | std::ios::binary);
+            if (!novel_stream.is_open()) return TextIndex::RefreshResult::Unchanged;
+            window.open(NovelPath, nullptr);
+            if (readahead.is_open())
             {
-                strip_utf8_bom_prefix(utf8_line);
+                // Its descriptor still reads the old file.
+                readahead.close();
+                readahead.open(NovelPath, nullptr);
+                readahead.forget();
             }
         }
+        const TextIndex::RefreshResult result = index.refresh(book_stream, TextIndex::stream_size(book_stream));
+        if (result != TextIndex::RefreshResult::Unchanged) index_edited = true;
+        return result;
+    };
 
-        if (utf8_line.empty())
+    // 按字节位置定位：索引还没扫到的位置（保存的偏移、按百分比跳转）直接经窗口读取，
+    // 行号等索引追上之后再补上
+    constexpr std::uint64_t kSeekChunkBytes = 64 * 1024;
+    const std::uint64_t kNoOffset = FileSystemUtils::kNoByteOffset;
+
+    // Raw bytes (CR stripped) of the line starting at `offset`, read without the
+    // index; `next` receives the following line's start. An overlong line yields
+    // only its first virtual line, cut where the index cuts it. False past the end.
+    auto read_raw_at = [&](std::uint64_t offset, std::string &out, std::uint64_t &next) -> bool {
+        out.clear();
+        next = offset;
+        std::string chunk;
+        const std::uint64_t limit = index.max_line_bytes();
+        while (out.size() <= limit)
         {
-            line_being_displayed++;
-            ::current_line_number = line_being_displayed;
-            continue;
+            if (!read_book(next, kSeekChunkBytes, chunk)) return false;
+            const size_t newline = chunk.find('\n');
+            out.append(chunk, 0, newline == std::string::npos ? chunk.size() : newline);
+            next += (newline == std::string::npos) ? chunk.size() : newline + 1;
+            if (newline != std::string::npos || chunk.size() < kSeekChunkBytes) break;
         }
+        if (out.size() > limit)
+        {
+            out.resize(index.first_piece_length(out.data(), out.size()));
+            next = offset + out.size();
+        }
+        strip_trailing_cr(out);
+        return next > offset;
+    };
+
+    // Start of the line containing `offset`. Only the last max_line_bytes()
+    // are searched for a newline; a line start further back than that can only
+    // be a cut, which the index knows.
+    auto line_start_at = [&](std::uint64_t offset) -> std::uint64_t {
+        if (index.scanned_bytes() > offset) return index.line_start(index.line_at_offset(offset));
+        const std::uint64_t begin = offset > index.max_line_bytes() ? offset - index.max_line_bytes() : 0;
+        std::string chunk;
+        if (!read_book(begin, offset - begin, chunk)) return 0;
+        const size_t newline = chunk.rfind('\n');
+        if (newline != std::string::npos || begin == 0)
+        {
+            const std::uint64_t start = newline != std::string::npos ? begin + newline + 1 : 0;
+            std::uint64_t next = 0;
+            if (!read_raw_at(start, chunk, next) || next > offset) return start;
+        }
+        index.index_through_offset(book_stream, offset);
+        const std::int64_t line = index.line_at_offset(offset);
+        return line > 0 ? index.line_start(line) : 0;
+    };
+
+    // find_content_line() for a line known only by its start offset; kNoOffset if none.
+    auto find_content_offset = [&](std::uint64_t offset, int direction, std::string &raw) -> std::uint64_t {
+        std::uint64_t next = 0;
+        while (read_raw_at(offset, raw, next))
+        {
+            if (!index.is_skipped_line(raw)) return offset;
+            if (direction > 0)
+            {
+                offset = next;
+            }
+            else if (offset == 0)
+            {
+                break;
+            }
+            else
+            {
+                offset = line_start_at(offset - 1);
+            }
+        }
+        return kNoOffset;
+    };
+
+    auto decode_raw = [&](std::uint64_t offset, const std::string &raw, std::string &out) {
+        TRACE_SPAN("decode line");
+        out = convert_line(offset, raw);
+        if (starts_file(offset)) EncodingUtils::strip_utf8_bom_prefix(out);
+    };
+
+    // Number of the line starting at `offset` once the index reaches it (scanning
+    // that far first if `scan`); 0 while it is unknown.
+    auto line_number_at = [&](std::uint64_t offset, bool scan) -> std::int64_t {
+        if (scan) index.index_through_offset(book_stream, offset);
+        if (index.scanned_bytes() <= offset && !index.fully_indexed()) return 0;
+        const std::int64_t line = index.line_at_offset(offset);
+        return (line > 0 && index.line_start(line) == offset) ? line : 0;
+    };
+
+    std::int64_t line_being_displayed = ::current_line_number;
+    std::uint64_t offset_being_displayed = kNoOffset;
+    std::string utf8_line;
+    // What the terminal currently shows, so an unchanged frame is not repainted.
+    std::string frame_on_screen;
+    if (resumed) frame_on_screen = pending_resume.snapshot.frame;
+
+    // A saved byte offset is used directly, re-synced to the start of its line.
+    if (::current_byte_offset != kNoOffset && ::current_byte_offset < novel_size)
+    {
+        std::string raw;
+        const std::uint64_t found = find_content_offset(line_start_at(::current_byte_offset), 1, raw);
+        if (found != kNoOffset)
+        {
+            offset_being_displayed = found;
+            // Small books are indexed faster than it takes to notice.
+            line_being_displayed = line_number_at(found, novel_size < kMinCachedIndexBytes);
+            decode_raw(found, raw, utf8_line);
+        }
+    }
+    if (offset_being_displayed == kNoOffset)
+    {
+        if (line_being_displayed < 1) line_being_displayed = 1;
+        if (!index.index_through(book_stream, line_being_displayed))
+        {
+            PlatformUtils::clear_screen();
+            std::cerr << "Requested line " << ::current_line_number << " is beyond EOF. Resetting to start." << std::endl;
+            PlatformUtils::platform_sleep(2000);
+            ::current_line_number = 1;
+            line_being_displayed = 1;
+        }
+
+        line_being_displayed = find_content_line(line_being_displayed, 1, utf8_line);
+        if (line_being_displayed == 0)
+        {
+            PlatformUtils::clear_screen();
+            std::cout << "End of novel." << std::endl;
+            // Avoid persisting the "EOF + 1" state; keep progress at the last line.
+            const std::int64_t last_line = last_line_number();
+            ::current_line_number = last_line < 1 ? 1 : last_line;
+            ::current_byte_offset = last_line < 1 ? kNoOffset : index.line_start(last_line);
+            PlatformUtils::platform_sleep(1500);
+            writeAppSettings();
+            save_index();
+            PlatformUtils::clear_screen();
+            return;
+        }
+        offset_being_displayed = index.line_start(line_being_displayed);
+    }
+
+    // 段落模式：硬换行的文本按段显示，段内各行拼接成一屏；过长的段每 kMaxParagraphLines 行一屏
+    constexpr std::int64_t kMaxParagraphLines = 64;
+    bool reflow = index.looks_hard_wrapped();
+    std::int64_t paragraph_shown_line = 0;
+    std::string paragraph_text;
+
+    // First line after the paragraph shown from `line` (possibly past the last line).
+    auto paragraph_end = [&](std::int64_t line) -> std::int64_t {
+        const std::int64_t next = index.next_paragraph_start(book_stream, line);
+        return (next == 0 || next > line + kMaxParagraphLines) ? line + kMaxParagraphLines : next;
+    };
+
+    // The content lines of the paragraph shown from `line`, joined as one text.
+    auto read_paragraph = [&](std::int64_t line, std::string &out) {
+        TRACE_SPAN("read paragraph");
+        out.clear();
+        const std::int64_t end = paragraph_end(line);
+        std::string piece;
+        for (std::int64_t at = index.next_content_line(book_stream, line); at != 0 && at < end;
+             at = index.next_content_line(book_stream, at + 1))
+        {
+            if (!read_line_utf8(at, piece)) break;
+            while (!piece.empty() && std::isspace(static_cast<unsigned char>(piece.back()))) piece.pop_back();
+            if (!out.empty())
+            {
+                size_t first = 0;
+                while (first < piece.size() && (piece[first] == ' ' || piece[first] == '\t')) ++first;
+                piece.erase(0, first);
+                // Words wrapped in Latin text need their space back; CJK text joins directly.
+                const unsigned char before = static_cast<unsigned char>(out.back());
+                if (!piece.empty() && before < 0x80 && static_cast<unsigned char>(piece[0]) < 0x80) out += ' ';
+            }
+            out += piece;
+        }
+    };
 
-        std::cout << "Line " << line_being_displayed << ":\n";
-        std::cout << utf8_line << std::endl;
-
-        if (line_being_displayed != last_persisted_line)
+    // Progress when leaving the reader: the line after the one on screen, or that
+    // line itself if it is the last one.
+    auto keep_next_line_as_progress = [&]() {
+        if (reflow && line_being_displayed > 0)
         {
+            // The whole paragraph was on screen.
+            const std::int64_t end = paragraph_end(line_being_displayed);
             ::current_line_number = line_being_displayed;
+            ::current_byte_offset = offset_being_displayed;
+            if (!index.index_through(book_stream, end)) return;
+            ::current_line_number = end;
+            ::current_byte_offset = index.line_start(end);
+            return;
+        }
+        std::string raw;
+        std::uint64_t next = 0;
+        ::current_line_number = line_being_displayed;
+        ::current_byte_offset = offset_being_displayed;
+        if (!read_raw_at(offset_being_displayed, raw, next) || next >= book_size()) return;
+        ::current_line_number = line_being_displayed > 0 ? line_being_displayed + 1 : 0;
+        ::current_byte_offset = next;
+    };
+
+    // 简繁转换：转换后的行按起始偏移缓存，来回翻页时每行只转换一次
+    constexpr size_t kConvertedLinesCached = 512;
+    std::string conversion_mode = load_conversion_mode();
+    ChineseConvert::Dictionary chinese_dictionary;
+    ChineseConvert::LineCache converted_lines(kConvertedLinesCached);
+    if (!conversion_mode.empty() && !chinese_dictionary.open(config_file_path(conversion_mode + ".dat"), nullptr))
+    {
+        conversion_mode.clear();
+    }
+    // Shown under the text until the next key.
+    std::string notice;
+
+    // 正则搜索：'/' 输入模式串，多线程扫描整个文件；n/N 跳到下一个/上一个命中行
+    constexpr size_t kMaxSearchHits = 1000000;
+    std::string search_pattern;
+    std::vector<TextSearch::Hit> search_hits;
+    // Set when the file changed after the search, whose offsets are then re-found on the next n/N.
+    bool search_stale = false;
+
+    // Reads a pattern on a "/" line under the current frame; false if abandoned with Esc.
+    auto read_search_pattern = [&](const std::string &frame_shown, std::string &pattern) -> bool {
+        pattern.clear();
+        while (true)
+        {
+            frame_on_screen = frame_shown + "\n/" + pattern;
+            PlatformUtils::paint_screen(frame_on_screen);
+            TerminalInput::KeyEvent key;
+            if (!TerminalInput::read_key_blocking(key, nullptr)) return false;
+            switch (key.type)
+            {
+                case TerminalInput::KeyType::Enter:
+                    return true;
+                case TerminalInput::KeyType::Escape:
+                case TerminalInput::KeyType::CtrlC:
+                case TerminalInput::KeyType::CtrlD:
+                    return false;
+                case TerminalInput::KeyType::Backspace:
+                    // Drop one whole UTF-8 character.
+                    while (!pattern.empty() && (static_cast<unsigned char>(pattern.back()) & 0xC0) == 0x80)
+                    {
+                        pattern.pop_back();
+                    }
+                    if (!pattern.empty()) pattern.pop_back();
+                    break;
+                case TerminalInput::KeyType::Space:
+                    pattern += ' ';
+                    break;
+                case TerminalInput::KeyType::Character:
+                    pattern += key.ch;
+                    break;
+                case TerminalInput::KeyType::Paste:
+                    pattern += key.text.substr(0, key.text.find_first_of("\r\n"));
+                    break;
+                default:
+                    break;
+            }
+        }
+    };
+
+    // Runs `pattern` over the whole file; any key cancels. Leaves a message in `notice` unless hits were found.
+    auto run_search = [&](const std::string &frame_shown, const std::string &pattern) -> bool {
+        search_hits.clear();
+        search_stale = false;
+        TextSearch::Regex regex;
+        std::string error;
+        if (!regex.compile(pattern, &error))
+        {
+            notice = "Bad pattern: " + error;
+            return false;
+        }
+        frame_on_screen = frame_shown + "\nSearching for /" + pattern + " ... (any key cancels)";
+        PlatformUtils::paint_screen(frame_on_screen);
+        Tasks::CancelToken cancel;
+        const size_t max_line_bytes = static_cast<size_t>(index.max_line_bytes());
+        std::future<bool> search = Tasks::shared_scheduler().async(Tasks::Priority::Search, [&]() {
+            if (!folder)
+            {
+                return TextSearch::search_file(NovelPath, NovelEncoding, max_line_bytes, regex, kMaxSearchHits,
+                                               cancel.flag(), search_hits, &error);
+            }
+            // A folder is searched file by file. Hit offsets are moved into the
+            // book; their line numbers are left for the index to fill in.
+            std::vector<TextSearch::Hit> file_hits;
+            for (size_t file = 0; file < NovelFolder.file_count() && search_hits.size() < kMaxSearchHits; ++file)
+            {
+                if (!TextSearch::search_file(NovelFolder.file_path(file), NovelFolder.encoding_of(file), max_line_bytes,
+                                             regex, kMaxSearchHits - search_hits.size(), cancel.flag(), file_hits,
+                                             &error))
+                {
+                    return false;
+                }
+                for (TextSearch::Hit hit : file_hits)
+                {
+                    hit.line = 0;
+                    hit.offset += NovelFolder.file_start(file);
+                    search_hits.push_back(hit);
+                }
+            }
+            return true;
+        });
+        while (search.wait_for(std::chrono::milliseconds(50)) != std::future_status::ready)
+        {
+            if (!cancel.cancelled() && TerminalInput::key_pending())
+            {
+                TerminalInput::KeyEvent ignored;
+                TerminalInput::read_key_blocking(ignored, nullptr);
+                cancel.cancel();
+            }
+        }
+        if (!search.get())
+        {
+            search_hits.clear();
+            notice = cancel.cancelled() ? "Search cancelled." : "Search failed: " + error;
+            return false;
+        }
+        if (search_hits.empty())
+        {
+            notice = "Pattern not found: " + pattern;
+            return false;
+        }
+        return true;
+    };
+
+    enum class ReaderAction
+    {
+        None,
+        Next,
+        Prev,
+        PageNext,
+        PagePrev,
+        First,
+        Last,
+        Percent,
+        Reflow,
+        Convert,
+        Search,
+        SearchNext,
+        SearchPrev,
+        Quit,
+    };
+
+    // Lines moved by PgUp/PgDn (and Ctrl/Shift+Up/Down) per unit of count.
+    constexpr std::int64_t kLinesPerPage = 20;
+    constexpr std::int64_t kMaxCount = 1000000000000LL;
+    // Index scanned per idle step while filling in the number of a line reached by offset.
+    constexpr std::uint64_t kCatchUpBytes = 8 * 1024 * 1024;
+
+    std::int64_t last_persisted_line = -1;
+    std::uint64_t last_persisted_offset = kNoOffset;
+    std::int64_t pending_count = 0;
+    bool pending_g = false;
+    bool waiting_for_more = false;
+    std::uint64_t anchor_offset = 0;
+    std::string anchor_raw;
+    std::string frame;
+
+    // Only short forward steps taken within kMaxReadingPause count towards the reading rate.
+    constexpr std::uint64_t kMaxReadingStepCharacters = 4000;
+    constexpr double kMaxReadingPauseSeconds = 300;
+    ReadingRate reading_rate = load_reading_rate();
+    std::int64_t rate_line = -1;
+    auto rate_line_since = std::chrono::steady_clock::now();
+    auto note_reading_step = [&](std::int64_t line) {
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(now - rate_line_since).count();
+        if (rate_line > 0 && line > rate_line && line <= index.indexed_line_count() &&
+            seconds <= kMaxReadingPauseSeconds)
+        {
+            const std::uint64_t characters = index.characters_before(line) - index.characters_before(rate_line);
+            if (characters <= kMaxReadingStepCharacters)
+            {
+                reading_rate.characters += static_cast<double>(characters);
+                reading_rate.seconds += seconds;
+                if (reading_rate.seconds > kMaxRateSeconds)
+                {
+                    reading_rate.characters /= 2;
+                    reading_rate.seconds /= 2;
+                }
+            }
+        }
+        rate_line = line;
+        rate_line_since = now;
+    };
+
+    // 进度行：已读百分比、剩余字数、按阅读速度估计的剩余时间，以及本章剩余。
+    // 索引未完成时总字数按已索引部分的密度外推，并标为约数。
+    auto progress_status = [&]() -> std::string {
+        std::ostringstream status;
+        status << std::fixed << std::setprecision(1);
+        const std::uint64_t size = book_size();
+        const double byte_fraction =
+            size > 0 ? static_cast<double>(offset_being_displayed) / static_cast<double>(size) : 0.0;
+        if (line_being_displayed <= 0 || line_being_displayed > index.indexed_line_count() + 1 ||
+            index.indexed_characters() == 0)
+        {
+            status << byte_fraction * 100.0 << "% read";
+            return status.str();
+        }
+        const bool exact = index.fully_indexed();
+        const double read = static_cast<double>(index.characters_before(line_being_displayed));
+        double total = static_cast<double>(index.indexed_characters());
+        if (!exact && index.scanned_bytes() > 0)
+        {
+            total *= static_cast<double>(index.file_size()) / static_cast<double>(index.scanned_bytes());
+        }
+        const double left = total > read ? total - read : 0.0;
+        const double per_minute = characters_per_minute(reading_rate);
+        status << (exact ? "" : "about ") << (total > 0 ? 100.0 * read / total : 0.0) << "% read, "
+               << static_cast<std::uint64_t>(left) << " characters left (" << format_reading_time(left / per_minute)
+               << " at " << static_cast<std::uint64_t>(per_minute) << "/min)";
+
+        const std::int64_t chapter = index.chapter_of(line_being_displayed);
+        if (chapter > 0)
+        {
+            const std::int64_t next = index.chapter_first_line(chapter + 1);
+            if (next > 0 || exact)
+            {
+                const double chapter_end =
+                    next > 0 ? static_cast<double>(index.characters_before(next)) : total;
+                const double chapter_left = chapter_end > read ? chapter_end - read : 0.0;
+                status << "; chapter " << chapter << ": " << static_cast<std::uint64_t>(chapter_left) << " left ("
+                       << format_reading_time(chapter_left / per_minute) << ")";
+            }
+        }
+        return status.str();
+    };
+
+    // 隐藏键：切回普通屏幕或显示伪装内容；再按一次从保留的帧原样恢复，不重新读取或解码
+    const std::string decoy_frame = load_decoy_frame();
+    // The normal screen is cleared first so hiding never uncovers the menu. A
+    // resumed frame is carried over to the alternate screen in the same write,
+    // so it stays up (and counts as painted) until the first real frame.
+    std::string enter_screen = std::string(kHomeAndClear) + kEnterAlternateScreen;
+    if (resumed) enter_screen += kHomeAndClear + frame_on_screen;
+    const bool alternate_screen = PlatformUtils::write_terminal(enter_screen);
+    if (alternate_screen && !resumed) frame_on_screen.clear();
+    bool hidden = false;
+
+    while (true)
+    {
+        std::ostringstream frame_text;
+        const bool show_paragraph = reflow && line_being_displayed > 0;
+        if (show_paragraph && paragraph_shown_line != line_being_displayed)
+        {
+            read_paragraph(line_being_displayed, paragraph_text);
+            paragraph_shown_line = line_being_displayed;
+        }
+        if (show_paragraph)
+        {
+            frame_text << "Line " << line_being_displayed << " (paragraph " << index.paragraph_of(line_being_displayed)
+                       << "):\n";
+        }
+        else if (line_being_displayed > 0)
+        {
+            frame_text << "Line " << line_being_displayed << ":\n";
+        }
+        else
+        {
+            const std::uint64_t size = book_size();
+            const double percent = size > 0 ? 100.0 * static_cast<double>(offset_being_displayed) / static_cast<double>(size) : 0.0;
+            frame_text << "Line ? (" << std::fixed << std::setprecision(1) << percent << "%):\n";
+        }
+        const std::string &text = show_paragraph ? paragraph_text : utf8_line;
+        if (chinese_dictionary.is_open())
+        {
+            // A paragraph and the single line starting at the same offset are cached apart.
+            frame_text << converted_lines.get(offset_being_displayed * 2 + (show_paragraph ? 1 : 0), text,
+                                              chinese_dictionary)
+                       << '\n';
+        }
+        else
+        {
+            frame_text << text << '\n';
+        }
+        if (!notice.empty())
+        {
+            frame_text << '\n' << notice << '\n';
+        }
+        if (waiting_for_more)
+        {
+            frame_text << "\nEnd of novel so far. Waiting for more text...\n";
+        }
+        frame_text << '\n' << progress_status() << '\n';
+        frame_text << "\n--- (Enter/Space/Down: next, K/Up: previous, PgUp/PgDn: page, gg/G: first/last, [count]j/k, N%: jump to N%, /: search, n/N: next/prev match, P: paragraphs, C: S/T convert, B: hide, Q/Esc: quit to menu) ---";
+        frame = frame_text.str();
+
+        if (line_being_displayed != last_persisted_line || offset_being_displayed != last_persisted_offset)
+        {
+            ::current_line_number = line_being_displayed;
+            ::current_byte_offset = offset_being_displayed;
             writeAppSettings();
+            note_reading_step(line_being_displayed);
             last_persisted_line = line_being_displayed;
+            last_persisted_offset = offset_being_displayed;
+            if (watcher.is_active())
+            {
+                // Remember what is on screen so an edit can be followed to its new line.
+                std::uint64_t next = 0;
+                anchor_offset = offset_being_displayed;
+                read_raw_at(offset_being_displayed, anchor_raw, next);
+            }
+        }
+
+        // The pending count and "g" are shown after the frame but never saved with it.
+        std::string screen = frame;
+        if (pending_count > 0) screen += ' ' + std::to_string(pending_count);
+        if (pending_g) screen += (pending_count > 0 ? "g" : " g");
+        if (!hidden && screen != frame_on_screen)
+        {
+            PlatformUtils::paint_screen(screen);
+            frame_on_screen.swap(screen);
         }
 
-        std::cout << "\n--- (Enter/Space/Down: next, K/Up: previous, Q/Esc: quit to menu) ---" << std::flush;
+        // Between keys, let the index catch up with a line reached by offset and fill in its number.
+        if (line_being_displayed == 0 && index.scanned_bytes() <= offset_being_displayed && !index.fully_indexed() &&
+            !TerminalInput::key_pending())
+        {
+            const std::uint64_t goal = index.scanned_bytes() + kCatchUpBytes;
+            index.index_through_offset(book_stream, goal < offset_being_displayed ? goal : offset_being_displayed);
+            line_being_displayed = line_number_at(offset_being_displayed, false);
+            continue;
+        }
+
+        readahead.prefetch_around(offset_being_displayed, book_size());
+
         TerminalInput::KeyEvent key;
         std::string input_error;
-        if (!TerminalInput::read_key_blocking(key, &input_error))
+        if (!TerminalInput::read_key_blocking(key, &input_error, watcher.fd()))
         {
-            ::current_line_number = line_being_displayed + 1;
+            keep_next_line_as_progress();
             break;
         }
 
+        if (key.type == TerminalInput::KeyType::Wakeup)
+        {
+            const TextIndex::RefreshResult change = sync_with_file();
+            if (change != TextIndex::RefreshResult::Unchanged)
+            {
+                refresh_novel_fingerprint();
+                paragraph_shown_line = 0;
+                converted_lines.clear();
+                readahead.forget();
+                search_stale = !search_pattern.empty();
+            }
+            std::string refreshed;
+            if (change == TextIndex::RefreshResult::Edited)
+            {
+                const std::int64_t anchored = reanchor_line(anchor_offset, anchor_raw);
+                const std::int64_t target = go_to_line(anchored > 0 ? anchored : line_being_displayed, refreshed);
+                if (target != 0)
+                {
+                    line_being_displayed = target;
+                    offset_being_displayed = index.line_start(target);
+                    utf8_line.swap(refreshed);
+                }
+                last_persisted_line = -1;
+            }
+            if (waiting_for_more && change != TextIndex::RefreshResult::Unchanged)
+            {
+                const std::int64_t target = find_content_line(line_being_displayed + 1, 1, refreshed);
+                if (target != 0)
+                {
+                    line_being_displayed = target;
+                    offset_being_displayed = index.line_start(target);
+                    utf8_line.swap(refreshed);
+                    waiting_for_more = false;
+                }
+            }
+            continue;
+        }
+
+        const bool hide_key = (key.type == TerminalInput::KeyType::Character && (key.ch == 'b' || key.ch == 'B'));
+        if (hidden)
+        {
+            // Only the hide key (or Ctrl+C/Ctrl+D) does anything while hidden.
+            if (key.type == TerminalInput::KeyType::CtrlC || key.type == TerminalInput::KeyType::CtrlD) break;
+            if (!hide_key) continue;
+            hidden = false;
+            if (alternate_screen && decoy_frame.empty())
+            {
+                PlatformUtils::write_terminal(std::string(kEnterAlternateScreen) + kHomeAndClear + frame_on_screen);
+            }
+            else
+            {
+                PlatformUtils::paint_screen(frame_on_screen);
+            }
+            continue;
+        }
+        if (hide_key)
+        {
+            hidden = true;
+            pending_count = 0;
+            pending_g = false;
+            if (alternate_screen && decoy_frame.empty())
+            {
+                PlatformUtils::write_terminal(kLeaveAlternateScreen);
+            }
+            else
+            {
+                PlatformUtils::paint_screen(decoy_frame);
+            }
+            continue;
+        }
+
+        const bool page_modifier = (key.modifiers & (TerminalInput::ModCtrl | TerminalInput::ModShift)) != 0;
         ReaderAction action = ReaderAction::None;
         switch (key.type)
         {
             case TerminalInput::KeyType::Enter:
             case TerminalInput::KeyType::Space:
-            case TerminalInput::KeyType::ArrowDown:
                 action = ReaderAction::Next;
                 break;
+            case TerminalInput::KeyType::ArrowDown:
+                action = page_modifier ? ReaderAction::PageNext : ReaderAction::Next;
+                break;
             case TerminalInput::KeyType::ArrowUp:
-                action = ReaderAction::Prev;
+                action = page_modifier ? ReaderAction::PagePrev : ReaderAction::Prev;
+                break;
+            case TerminalInput::KeyType::PageDown:
+                action = ReaderAction::PageNext;
+                break;
+            case TerminalInput::KeyType::PageUp:
+                action = ReaderAction::PagePrev;
+                break;
+            case TerminalInput::KeyType::Home:
+                action = ReaderAction::First;
+                break;
+            case TerminalInput::KeyType::End:
+                action = ReaderAction::Last;
                 break;
             case TerminalInput::KeyType::Escape:
             case TerminalInput::KeyType::CtrlC:
@@ -410,7 +1522,52 @@ void readNovel()
                 action = ReaderAction::Quit;
                 break;
             case TerminalInput::KeyType::Character:
-                if (key.ch == 'q' || key.ch == 'Q')
+                if (key.ch >= '0' && key.ch <= '9' && (key.ch != '0' || pending_count > 0))
+                {
+                    // vim-style count prefix, e.g. "500j" or "120gg".
+                    const int digit = key.ch - '0';
+                    pending_count = (pending_count > (kMaxCount - digit) / 10) ? kMaxCount : pending_count * 10 + digit;
+                    pending_g = false;
+                    continue;
+                }
+                if (key.ch == 'g')
+                {
+                    if (!pending_g)
+                    {
+                        pending_g = true;
+                        continue;
+                    }
+                    action = ReaderAction::First;
+                }
+                else if (key.ch == 'G')
+                {
+                    action = ReaderAction::Last;
+                }
+                else if (key.ch == '%')
+                {
+                    action = ReaderAction::Percent;
+                }
+                else if (key.ch == 'p' || key.ch == 'P')
+                {
+                    action = ReaderAction::Reflow;
+                }
+                else if (key.ch == 'c' || key.ch == 'C')
+                {
+                    action = ReaderAction::Convert;
+                }
+                else if (key.ch == '/')
+                {
+                    action = ReaderAction::Search;
+                }
+                else if (key.ch == 'n')
+                {
+                    action = ReaderAction::SearchNext;
+                }
+                else if (key.ch == 'N')
+                {
+                    action = ReaderAction::SearchPrev;
+                }
+                else if (key.ch == 'q' || key.ch == 'Q')
                 {
                     action = ReaderAction::Quit;
                 }
@@ -427,89 +1584,381 @@ void readNovel()
                 break;
         }
 
+        const std::int64_t count = pending_count;
+        pending_count = 0;
+        pending_g = false;
+        notice.clear();
+        if (action != ReaderAction::None) waiting_for_more = false;
+
         if (action == ReaderAction::Quit)
         {
-            ::current_line_number = line_being_displayed + 1;
+            keep_next_line_as_progress();
             break;
         }
-        else if (action == ReaderAction::Prev)
+        if (action == ReaderAction::Reflow)
+        {
+            reflow = !reflow;
+            paragraph_shown_line = 0;
+            continue;
+        }
+        if (action == ReaderAction::Convert)
         {
-            const std::streampos resume_pos = novel_stream.tellg();
-            if (line_being_displayed <= 1)
+            // Off -> s2t -> t2s -> off, skipping directions without a compiled dictionary.
+            const bool was_off = conversion_mode.empty();
+            size_t next = 0;
+            while (next < 2 && conversion_mode != kConversionModes[next]) ++next;
+            next = was_off ? 0 : next + 1;
+            conversion_mode.clear();
+            chinese_dictionary.close();
+            for (; next < 2; ++next)
+            {
+                if (chinese_dictionary.open(config_file_path(std::string(kConversionModes[next]) + ".dat"), nullptr))
+                {
+                    conversion_mode = kConversionModes[next];
+                    break;
+                }
+            }
+            converted_lines.clear();
+            save_conversion_mode(conversion_mode);
+            if (!conversion_mode.empty())
+            {
+                notice = "S/T conversion: " + conversion_mode + ".";
+            }
+            else
+            {
+                notice = was_off ? "No S/T dictionary found. Build one with --build-dict s2t|t2s <file>..."
+                                 : "S/T conversion off.";
+            }
+            continue;
+        }
+
+        std::string target_line;
+        std::int64_t target = 0;
+        std::uint64_t target_offset = kNoOffset;
+        if (action == ReaderAction::Search || action == ReaderAction::SearchNext || action == ReaderAction::SearchPrev)
+        {
+            if (action == ReaderAction::Search)
+            {
+                std::string pattern;
+                if (!read_search_pattern(frame, pattern) || pattern.empty()) continue;
+                search_pattern = pattern;
+                if (!run_search(frame, search_pattern)) continue;
+            }
+            else if (search_pattern.empty())
+            {
+                notice = "No previous search; press / to search.";
+                continue;
+            }
+            else if ((search_stale || search_hits.empty()) && !run_search(frame, search_pattern))
             {
-                std::cout << "\nAlready at the first line." << std::endl;
-                PlatformUtils::platform_sleep(800);
-                buffered_utf8_line = utf8_line;
-                has_buffered_line = true;
                 continue;
             }
 
-            int candidate = line_being_displayed - 1;
-            bool found = false;
-            while (candidate >= 1)
+            // Hits are in file order; like vim, n/N wrap around the ends of the book.
+            const bool backwards = (action == ReaderAction::SearchPrev);
+            const std::int64_t hit_count = static_cast<std::int64_t>(search_hits.size());
+            const auto by_offset = [](const TextSearch::Hit &hit, std::uint64_t offset) { return hit.offset < offset; };
+            std::int64_t first = std::lower_bound(search_hits.begin(), search_hits.end(), offset_being_displayed,
+                                                  by_offset) -
+                                 search_hits.begin();
+            if (!backwards && first < hit_count && search_hits[first].offset == offset_being_displayed) ++first;
+            std::int64_t pick = backwards ? first - (count > 0 ? count : 1) : first + (count > 0 ? count : 1) - 1;
+            pick = ((pick % hit_count) + hit_count) % hit_count;
+            // Lines the junk filter hides are never shown, so pass over hits on them.
+            std::string raw;
+            std::int64_t tried = 0;
+            for (; tried < hit_count; ++tried)
+            {
+                std::uint64_t next = 0;
+                if (read_raw_at(search_hits[pick].offset, raw, next) && !index.is_skipped_line(raw)) break;
+                pick = ((backwards ? pick - 1 : pick + 1) + hit_count) % hit_count;
+            }
+            if (tried == hit_count)
+            {
+                notice = "Pattern not found: " + search_pattern;
+                continue;
+            }
+            const TextSearch::Hit &hit = search_hits[pick];
+            target_offset = hit.offset;
+            target = hit.line;
+            decode_raw(hit.offset, raw, target_line);
+            notice = "/" + search_pattern + ": match " + std::to_string(pick + 1) + " of " +
+                     std::to_string(hit_count) + (search_hits.size() >= kMaxSearchHits ? "+" : "") + ".";
+        }
+        const bool forward = (action == ReaderAction::Next || action == ReaderAction::PageNext);
+        const bool backward = (action == ReaderAction::Prev || action == ReaderAction::PagePrev);
+        if (line_being_displayed == 0 && (forward || backward))
+        {
+            // Away from the index, step line by line through the bytes themselves.
+            const bool paging = (action == ReaderAction::PageNext || action == ReaderAction::PagePrev);
+            const std::int64_t step = (count > 0 ? count : 1) * (paging ? kLinesPerPage : 1);
+            std::uint64_t at = offset_being_displayed;
+            std::string raw;
+            std::string found_raw;
+            for (std::int64_t moved = 0; moved < step; ++moved)
             {
-                if (candidate >= static_cast<int>(line_start_positions.size()))
+                std::uint64_t from = 0;
+                if (forward && !read_raw_at(at, raw, from)) break;
+                if (backward)
                 {
-                    candidate--;
-                    continue;
+                    if (at == 0) break;
+                    from = line_start_at(at - 1);
                 }
+                const std::uint64_t found = find_content_offset(from, forward ? 1 : -1, raw);
+                if (found == kNoOffset) break;
+                at = found;
+                found_raw.swap(raw);
+            }
+            if (at != offset_being_displayed)
+            {
+                target_offset = at;
+                target = line_number_at(at, false);
+                decode_raw(at, found_raw, target_line);
+            }
+            else
+            {
+                // Nothing further this way; the index works out the end of the file as usual.
+                line_being_displayed = line_number_at(offset_being_displayed, true);
+                if (line_being_displayed == 0) continue;
+            }
+        }
 
-                novel_stream.clear();
-                novel_stream.seekg(line_start_positions[candidate]);
-
-                std::string candidate_raw;
-                if (!std::getline(novel_stream, candidate_raw))
+        bool stepped_by_paragraph = false;
+        if (reflow && line_being_displayed > 0 && (forward || backward))
+        {
+            // Paragraph mode moves from one paragraph (or long-paragraph screen) to the next.
+            const bool paging = (action == ReaderAction::PageNext || action == ReaderAction::PagePrev);
+            const std::int64_t step = (count > 0 ? count : 1) * (paging ? kLinesPerPage : 1);
+            std::int64_t at = line_being_displayed;
+            for (std::int64_t moved = 0; moved < step; ++moved)
+            {
+                std::int64_t next = 0;
+                if (forward)
                 {
-                    candidate--;
-                    continue;
+                    next = index.next_content_line(book_stream, paragraph_end(at));
+                }
+                else if (at > 1)
+                {
+                    std::int64_t start = index.paragraph_start(book_stream, at - 1);
+                    if (start == 0 || at - start > kMaxParagraphLines)
+                    {
+                        start = at - kMaxParagraphLines < 1 ? 1 : at - kMaxParagraphLines;
+                    }
+                    next = index.next_content_line(book_stream, start);
+                    if (next >= at) next = 0;
                 }
-                strip_trailing_cr(candidate_raw);
+                if (next == 0) break;
+                at = next;
+            }
+            if (at == line_being_displayed && backward)
+            {
+                std::cout << "\nAlready at the first line." << std::endl;
+                PlatformUtils::platform_sleep(800);
+                continue;
+            }
+            if (at != line_being_displayed && read_line_utf8(at, target_line)) target = at;
+            stepped_by_paragraph = true;
+        }
 
-                std::string candidate_utf8 = convert_to_utf8(candidate_raw, NovelEncoding);
-                if (candidate >= 1 && candidate < static_cast<int>(line_start_positions.size()) &&
-                    line_start_positions[candidate] == std::streampos(0))
+        if (target_offset == kNoOffset && !stepped_by_paragraph)
+        {
+            switch (action)
+            {
+                case ReaderAction::Next:
+                case ReaderAction::PageNext:
                 {
-                    strip_utf8_bom_prefix(candidate_utf8);
+                    const std::int64_t step =
+                        (count > 0 ? count : 1) * (action == ReaderAction::PageNext ? kLinesPerPage : 1);
+                    const std::int64_t start = (line_being_displayed > std::numeric_limits<std::int64_t>::max() - step)
+                                                   ? std::numeric_limits<std::int64_t>::max()
+                                                   : line_being_displayed + step;
+                    target = find_content_line(start, 1, target_line);
+                    if (target == 0 && step > 1)
+                    {
+                        // Overshooting jumps clamp to the last line instead of leaving the reader.
+                        target = go_to_line(start, target_line);
+                        if (target == line_being_displayed) target = 0;
+                        if (target == 0)
+                        {
+                            std::cout << "\nAlready at the last line." << std::endl;
+                            PlatformUtils::platform_sleep(800);
+                            continue;
+                        }
+                    }
+                    break;
                 }
-                if (candidate_utf8.empty())
+                case ReaderAction::Prev:
+                case ReaderAction::PagePrev:
                 {
-                    candidate--;
-                    continue;
+                    const std::int64_t step =
+                        (count > 0 ? count : 1) * (action == ReaderAction::PagePrev ? kLinesPerPage : 1);
+                    if (line_being_displayed > 1)
+                    {
+                        const std::int64_t start = line_being_displayed - step < 1 ? 1 : line_being_displayed - step;
+                        target = find_content_line(start, -1, target_line);
+                    }
+                    if (target == 0)
+                    {
+                        std::cout << "\nAlready at the first line." << std::endl;
+                        PlatformUtils::platform_sleep(800);
+                        continue;
+                    }
+                    break;
                 }
-
-                buffered_utf8_line = candidate_utf8;
-                has_buffered_line = true;
-                line_being_displayed = candidate;
-                ::current_line_number = line_being_displayed;
-                found = true;
-                break;
+                case ReaderAction::First:
+                    target = go_to_line(count > 0 ? count : 1, target_line);
+                    break;
+                case ReaderAction::Last:
+                    target = go_to_line(count > 0 ? count : last_line_number(), target_line);
+                    break;
+                case ReaderAction::Percent:
+                {
+                    // vim-style "N%": seek to that share of the file's bytes; no index needed.
+                    if (count == 0) continue;
+                    const std::uint64_t size = book_size();
+                    const std::uint64_t percent = count > 100 ? 100 : static_cast<std::uint64_t>(count);
+                    const std::uint64_t goal = size / 100 * percent + size % 100 * percent / 100;
+                    const std::uint64_t start = line_start_at(goal < size ? goal : (size > 0 ? size - 1 : 0));
+                    std::string raw;
+                    std::uint64_t found = find_content_offset(start, 1, raw);
+                    if (found == kNoOffset) found = find_content_offset(start, -1, raw);
+                    if (found == kNoOffset) continue;
+                    target_offset = found;
+                    target = line_number_at(found, false);
+                    decode_raw(found, raw, target_line);
+                    break;
+                }
+                default:
+                    // Unrecognized key: keep the same line displayed.
+                    continue;
             }
+        }
+        if (target != 0 && target_offset == kNoOffset) target_offset = index.line_start(target);
+
+        if (target_offset == kNoOffset && watcher.is_active())
+        {
+            // The file may still be growing; stay here and pick up appended text.
+            waiting_for_more = true;
+            continue;
+        }
+        if (target_offset == kNoOffset)
+        {
+            PlatformUtils::clear_screen();
+            std::cout << "End of novel." << std::endl;
+            // Avoid persisting the "EOF + 1" state; keep progress at the last line.
+            ::current_line_number = line_being_displayed;
+            ::current_byte_offset = offset_being_displayed;
+            PlatformUtils::platform_sleep(1500);
+            break;
+        }
+
+        line_being_displayed = target;
+        offset_being_displayed = target_offset;
+        utf8_line.swap(target_line);
+        ::current_line_number = line_being_displayed;
+        ::current_byte_offset = offset_being_displayed;
+    }
+    if (alternate_screen && !(hidden && decoy_frame.empty())) PlatformUtils::write_terminal(kLeaveAlternateScreen);
+    writeAppSettings();
+    save_reading_rate(reading_rate);
+    std::string displayed_raw;
+    std::uint64_t displayed_end = 0;
+    if (read_raw_at(offset_being_displayed, displayed_raw, displayed_end))
+    {
+        save_session_snapshot(line_being_displayed, offset_being_displayed, displayed_raw, frame);
+    }
+    save_index();
+    PlatformUtils::clear_screen();
+}
+
+// Switches to the novel at `path`, resuming saved progress for its contents if any.
+// Reports problems to the user and leaves the current novel in place on failure.
+bool openNovel(const std::string &path)
+{
+    if (FileSystemUtils::is_directory(path))
+    {
+        std::string error;
+        if (!open_novel_folder(path, &error))
+        {
+            std::cerr << "\nError: " << error << std::endl;
+            std::cout << "Novel path not changed." << std::endl;
+            PlatformUtils::platform_sleep(2000);
+            return false;
+        }
+        ::current_line_number = 1;
+        ::current_byte_offset = 0;
+        apply_saved_progress();
+        std::cout << "\nNovel path updated: " << NovelFolder.file_count() << " chapter files read as one book";
+        std::cout << (find_folder_progress(NovelPath) != nullptr ? "; resuming." : ".") << std::endl;
+        PlatformUtils::platform_sleep(1500);
+        return true;
+    }
+
+    std::fstream test_novel(path, std::ios::in | std::ios::binary);
+    if (!test_novel.good())
+    {
+        std::cerr << "\nError: The new path is not correct or file cannot be opened." << std::endl;
+        std::cout << "Novel path not changed." << std::endl;
+        PlatformUtils::platform_sleep(2000);
+        return false;
+    }
+    test_novel.close();
+
+    const bool from_daemon = ReaderDaemon::request_book(path, daemon_book, nullptr);
+    const std::string encoding = from_daemon ? daemon_book.encoding : EncodingUtils::detect_encoding(path);
+    if (encoding == "UTF-16LE" || encoding == "UTF-16BE")
+    {
+        std::cerr << "\nError: This file appears to be " << encoding << ", which is not supported." << std::endl;
+        std::cerr << "Please convert it to UTF-8 text." << std::endl;
+        PlatformUtils::platform_sleep(2500);
+        return false;
+    }
+
+    if (novel_stream.is_open()) novel_stream.close();
+    NovelPath = path;
+    novel_stream.open(NovelPath, std::ios::in | std::ios::binary);
+    if (!novel_stream.is_open())
+    {
+        std::cerr << "\nError: Could not open new novel file: " << NovelPath << std::endl;
+        NovelPath = "";
+        NovelFingerprint = Fingerprint::BookFingerprint{};
+        ::current_line_number = 1;
+        ::current_byte_offset = FileSystemUtils::kNoByteOffset;
+        PlatformUtils::platform_sleep(1500);
+        return false;
+    }
+    NovelEncoding = encoding;
+    NovelFolder.close();
+    if (from_daemon)
+    {
+        NovelFingerprint = daemon_book.fingerprint;
+    }
+    else
+    {
+        update_novel_fingerprint();
+    }
 
-            if (!found)
-            {
-                buffered_utf8_line = utf8_line;
-                has_buffered_line = true;
-                novel_stream.clear();
-                if (resume_pos != std::streampos(-1))
-                {
-                    novel_stream.seekg(resume_pos);
-                }
-            }
-            continue;
-        }
-        else if (action == ReaderAction::Next)
+    const FileSystemUtils::ProgressRecord *record =
+        NovelFingerprint.valid ? find_progress_by_fingerprint(NovelFingerprint.to_string()) : nullptr;
+    if (record != nullptr)
+    {
+        // Same contents as a book read before, possibly under another path.
+        set_position_from_saved(record->line_number, record->byte_offset);
+        std::cout << "\nNovel path updated. Found saved progress for this book";
+        if (record->novel_path != NovelPath && !record->novel_path.empty())
         {
-            line_being_displayed++;
-            ::current_line_number = line_being_displayed;
-            continue;
+            std::cout << " (previously at " << record->novel_path << ")";
         }
-
-        // Unrecognized key: keep the same line displayed.
-        buffered_utf8_line = utf8_line;
-        has_buffered_line = true;
+        std::cout << "; resuming." << std::endl;
     }
-    writeAppSettings();
-    PlatformUtils::clear_screen();
+    else
+    {
+        std::cout << "\nNovel path updated. Reading will start from the beginning of the new novel." << std::endl;
+        ::current_line_number = 1;
+        ::current_byte_offset = 0;
+    }
+    PlatformUtils::platform_sleep(1500);
+    return true;
 }
 
 void showSettings()
@@ -525,55 +1974,22 @@ void showSettings()
 
     if (!inputNovelPath.empty())
     {
-        std::fstream test_novel(inputNovelPath, std::ios::in | std::ios::binary);
-        if (!test_novel.good())
-        {
-            std::cerr << "\nError: The new path is not correct or file cannot be opened." << std::endl;
-            std::cout << "Novel path not changed." << std::endl;
-            PlatformUtils::platform_sleep(2000);
-        }
-        else
-        {
-            test_novel.close();
-            const std::string encoding = detect_encoding(inputNovelPath);
-            if (encoding == "UTF-16LE" || encoding == "UTF-16BE")
-            {
-                std::cerr << "\nError: This file appears to be " << encoding << ", which is not supported." << std::endl;
-                std::cerr << "Please convert it to UTF-8 text." << std::endl;
-                PlatformUtils::platform_sleep(2500);
-            }
-            else
-            {
-                if (novel_stream.is_open()) novel_stream.close();
-                NovelPath = inputNovelPath;
-                novel_stream.open(NovelPath, std::ios::in | std::ios::binary);
-                if (!novel_stream.is_open())
-                {
-                    std::cerr << "\nError: Could not open new novel file: " << NovelPath << std::endl;
-                    NovelPath = "";
-                }
-                else
-                {
-                    NovelEncoding = encoding;
-                    std::cout << "\nNovel path updated. Reading will start from the beginning of the new novel." << std::endl;
-                }
-                ::current_line_number = 1;
-                PlatformUtils::platform_sleep(1500);
-            }
-        }
+        openNovel(inputNovelPath);
     }
 
-    std::cout << "\nNext line to read will be: " << ::current_line_number << std::endl;
+    std::cout << "\nNext line to read will be: " << describe_position() << std::endl;
     std::cout << "Enter new starting line number (e.g., 1) (or press Enter to keep current): ";
     std::getline(std::cin, inputLineStr);
     if (!inputLineStr.empty())
     {
         try
         {
-            int input_l = std::stoi(inputLineStr);
+            const long long input_l = std::stoll(inputLineStr);
             if (input_l >= 1)
             {
                 ::current_line_number = input_l;
+                // A hand-entered line has no known offset.
+                ::current_byte_offset = FileSystemUtils::kNoByteOffset;
                 std::cout << "\nStarting line number updated to: " << ::current_line_number << std::endl;
             }
             else
@@ -596,36 +2012,723 @@ void showSettings()
     PlatformUtils::platform_sleep(1500);
 }
 
+void loadLibraryCatalog()
+{
+    if (LibraryLoaded) return;
+    if (!LibraryCatalog::load_catalog(CatalogFilePath, LibraryEntries))
+    {
+        std::cerr << "Warning: Library catalog could not be read." << std::endl;
+    }
+    LibraryLoaded = true;
+}
+
+// Scans `root` into the catalog and saves it; prints a one-line summary.
+bool scanLibraryFolder(const std::string &root)
+{
+    loadLibraryCatalog();
+    const auto started = std::chrono::steady_clock::now();
+    LibraryCatalog::ScanStats stats;
+    std::string error;
+    if (!LibraryCatalog::scan_library(root, LibraryEntries, &stats, &error))
+    {
+        std::cerr << "Error: Library scan failed: " << error << std::endl;
+        return false;
+    }
+    const auto elapsed_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+
+    std::cout << "Scanned " << root << ": " << stats.files << " books in " << stats.directories << " folders ("
+              << stats.rescanned << " new or changed, " << stats.reused << " unchanged, " << stats.failed
+              << " failed) in " << elapsed_ms << " ms." << std::endl;
+    if (!LibraryCatalog::save_catalog(CatalogFilePath, LibraryEntries))
+    {
+        std::cerr << "Warning: Failed to write library catalog: " << CatalogFilePath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Indexes `path` with and without the junk filter; prints how often each
+// pattern hit and what the filter cost on top of plain indexing.
+bool printJunkReport(const std::string &path)
+{
+    const std::string patterns_path = TextIndex::junk_patterns_path();
+    const std::vector<std::string> patterns = TextIndex::read_junk_patterns(patterns_path);
+    if (patterns.empty())
+    {
+        std::cout << "No junk patterns configured (one per line in " << patterns_path << ")." << std::endl;
+        return true;
+    }
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.is_open())
+    {
+        std::cerr << "Error: Could not open " << path << std::endl;
+        return false;
+    }
+    const std::string encoding = EncodingUtils::detect_encoding(path);
+    const std::vector<std::string> encoded = TextIndex::encode_junk_patterns(patterns, encoding);
+    const std::uint64_t size = TextIndex::stream_size(in);
+
+    auto index_ms = [&](TextIndex::LineIndex &index) -> long long {
+        index.set_encoding(encoding);
+        index.set_max_line_bytes(TextIndex::read_max_line_bytes());
+        index.reset(size);
+        const auto started = std::chrono::steady_clock::now();
+        index.index_all(in);
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started)
+            .count();
+    };
+    TextIndex::LineIndex plain;
+    const long long plain_ms = index_ms(plain);
+    TextIndex::LineIndex filtered;
+    filtered.set_junk_patterns(encoded);
+    const long long filtered_ms = index_ms(filtered);
+
+    const std::vector<std::uint64_t> hits = filtered.junk_hits();
+    std::uint64_t total = 0;
+    for (size_t i = 0; i < patterns.size(); ++i)
+    {
+        std::cout << std::setw(10) << hits[i] << "  " << patterns[i];
+        if (encoded[i].empty()) std::cout << "  (not representable in " << encoding << ")";
+        std::cout << std::endl;
+        total += hits[i];
+    }
+    std::cout << total << " of " << filtered.indexed_line_count() << " lines are junk. Indexed in " << filtered_ms
+              << " ms with the filter, " << plain_ms << " ms without." << std::endl;
+    return true;
+}
+
+namespace {
+
+// 命令行提取（--print-lines 等）：与阅读界面共用同一份索引（守护进程或磁盘缓存）和按编码段转码，
+// 只扫描到所需的位置，结果以大块写到标准输出
+struct ExtractBook
+{
+    std::string path;
+    std::ifstream in;
+    FileView::MappedWindow window;
+    // Set instead of the two above for a folder of chapter files.
+    FileView::ConcatenatedFiles folder;
+    std::istream *stream = nullptr;
+    TextIndex::LineIndex index;
+    Fingerprint::BookFingerprint fingerprint;
+    std::uint64_t cached_scanned_bytes = 0;
+    std::unique_ptr<EncodingUtils::Utf8Converter> converter;
+    std::unique_ptr<EncodingUtils::Utf8Converter> alternate_converter;
+    std::map<std::string, std::unique_ptr<EncodingUtils::Utf8Converter>> file_converters;
+};
+
+// Output is gathered and written to stdout this many bytes at a time.
+constexpr size_t kExtractOutputBytes = 1024 * 1024;
+// Lines are read from the file in runs of about this many bytes.
+constexpr std::uint64_t kExtractReadBytes = 4 * 1024 * 1024;
+// Index scanned per step while looking for the chapter after the one asked for.
+constexpr std::uint64_t kExtractScanBytes = 8 * 1024 * 1024;
+
+// How `path` is named in messages: a spooled stream by where it came from.
+std::string extract_display_name(const std::string &path)
+{
+    return !ExtractSpoolPath.empty() && path == ExtractSpoolPath ? ExtractSourceName : path;
+}
+
+// Opens `path` with the index the reader would use for it; prints the error.
+bool open_extract_book(const std::string &path, ExtractBook &book)
+{
+    std::string error;
+    const bool folder = FileSystemUtils::is_directory(path);
+    if (folder ? !book.folder.open(path, &error)
+               : (book.in.open(path, std::ios::in | std::ios::binary), !book.in.is_open() || !book.window.open(path, &error)))
+    {
+        std::cerr << "Error: Could not open " << extract_display_name(path) << (error.empty() ? "" : ": " + error)
+                  << std::endl;
+        return false;
+    }
+    book.path = path;
+    book.stream = folder ? &book.folder.stream() : &book.in;
+    const bool spooled = !ExtractSpoolPath.empty() && path == ExtractSpoolPath;
+    ReaderDaemon::BookInfo from_daemon;
+    const bool known_to_daemon = !folder && !spooled && ReaderDaemon::request_book(path, from_daemon, nullptr);
+    std::string encoding;
+    if (folder)
+    {
+        encoding = book.folder.encoding_of(0);
+    }
+    else if (known_to_daemon)
+    {
+        encoding = from_daemon.encoding;
+        book.fingerprint = from_daemon.fingerprint;
+    }
+    else
+    {
+        encoding = EncodingUtils::detect_encoding(path);
+        if (path == NovelPath && NovelFingerprint.valid)
+        {
+            book.fingerprint = NovelFingerprint;
+        }
+        else if (spooled || !Fingerprint::compute_fingerprint(path, book.fingerprint, nullptr))
+        {
+            book.fingerprint = Fingerprint::BookFingerprint{};
+        }
+    }
+    if (encoding == "UTF-16LE" || encoding == "UTF-16BE")
+    {
+        std::cerr << "Error: " << extract_display_name(path) << " appears to be " << encoding
+                  << ", which is not supported." << std::endl;
+        return false;
+    }
+
+    const std::uint64_t size = TextIndex::stream_size(*book.stream);
+    TextIndex::LineIndex &index = book.index;
+    index.set_encoding(encoding);
+    index.set_max_line_bytes(TextIndex::read_max_line_bytes());
+    index.set_junk_patterns(
+        TextIndex::encode_junk_patterns(TextIndex::read_junk_patterns(TextIndex::junk_patterns_path()), encoding));
+    const bool loaded = (known_to_daemon && from_daemon.load_index(index, *book.stream, size)) ||
+                        load_cached_index(index, path, *book.stream, size, book.fingerprint);
+    if (!loaded) index.reset(size);
+    book.cached_scanned_bytes = index.scanned_bytes();
+    FileView::MappedWindow &window = book.window;
+    index.set_scan_callback([&window](std::uint64_t begin, std::uint64_t end) { window.release(begin, end - begin); });
+    book.converter.reset(new EncodingUtils::Utf8Converter(encoding));
+    book.alternate_converter.reset(new EncodingUtils::Utf8Converter(index.alternate_encoding()));
+    return true;
+}
+
+// Keeps whatever the command had to scan for the next run.
+void close_extract_book(ExtractBook &book)
+{
+    if (book.index.scanned_bytes() > book.cached_scanned_bytes)
+    {
+        save_cached_index(book.index, book.path, book.fingerprint);
+    }
+}
+
+void flush_output(std::string &out)
+{
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    out.clear();
+}
+
+// Writes lines `first` .. `last` (indexed, inclusive) as UTF-8. The pieces of
+// a cut overlong line are joined back together; every line ends in "\n".
+bool write_lines(ExtractBook &book, std::int64_t first, std::int64_t last)
+{
+    TextIndex::LineIndex &index = book.index;
+    index.index_through(*book.stream, last + 1);
+    auto line_end = [&](std::int64_t line) -> std::uint64_t {
+        return line < index.indexed_line_count() ? index.line_start(line + 1) : index.file_size();
+    };
+    std::string out;
+    out.reserve(kExtractOutputBytes + kExtractReadBytes);
+    std::string chunk;
+    std::string raw;
+    std::int64_t line = first;
+    while (line <= last)
+    {
+        const std::uint64_t begin = index.line_start(line);
+        std::int64_t run_last = line;
+        while (run_last < last && line_end(run_last + 1) - begin <= kExtractReadBytes) ++run_last;
+        const std::uint64_t end = line_end(run_last);
+        const bool read = book.folder.is_open() ? book.folder.read(begin, end - begin, chunk)
+                                                : book.window.read(begin, end - begin, chunk);
+        if (!read || chunk.size() != end - begin)
+        {
+            flush_output(out);
+            std::cerr << "Error: Could not read the file." << std::endl;
+            return false;
+        }
+        for (; line <= run_last; ++line)
+        {
+            const std::uint64_t start = index.line_start(line);
+            raw.assign(chunk, static_cast<size_t>(start - begin), static_cast<size_t>(line_end(line) - start));
+            const bool had_newline = !raw.empty() && raw.back() == '\n';
+            if (had_newline) raw.pop_back();
+            if (!raw.empty() && raw.back() == '\r') raw.pop_back();
+            EncodingUtils::Utf8Converter *converter =
+                index.in_alternate_encoding(start, raw) ? book.alternate_converter.get() : book.converter.get();
+            if (book.folder.is_open())
+            {
+                // As in the reader, a chapter file detected in another encoding is decoded as that.
+                const std::string &encoding = book.folder.encoding_of(book.folder.file_at(start));
+                if (encoding != index.encoding())
+                {
+                    std::unique_ptr<EncodingUtils::Utf8Converter> &file_converter = book.file_converters[encoding];
+                    if (!file_converter) file_converter.reset(new EncodingUtils::Utf8Converter(encoding));
+                    converter = file_converter.get();
+                }
+            }
+            std::string text = converter->convert(raw);
+            if (book.folder.is_open() ? book.folder.is_file_start(start) : start == 0)
+            {
+                EncodingUtils::strip_utf8_bom_prefix(text);
+            }
+            out += text;
+            if (had_newline || line == last) out += '\n';
+        }
+        if (out.size() >= kExtractOutputBytes) flush_output(out);
+    }
+    flush_output(out);
+    std::fflush(stdout);
+    return true;
+}
+
+// "A..B", "A.." (to the end) or "A"; false if malformed.
+bool parse_line_range(const std::string &text, std::int64_t &first, std::int64_t &last)
+{
+    const size_t dots = text.find("..");
+    const std::string head = text.substr(0, dots);
+    const std::string tail = dots == std::string::npos ? head : text.substr(dots + 2);
+    auto parse = [](const std::string &digits, std::int64_t &value) -> bool {
+        if (digits.empty() || digits.size() > 18 || digits.find_first_not_of("0123456789") != std::string::npos)
+        {
+            return false;
+        }
+        value = std::stoll(digits);
+        return value > 0;
+    };
+    if (!parse(head, first)) return false;
+    if (dots != std::string::npos && tail.empty())
+    {
+        last = std::numeric_limits<std::int64_t>::max();
+        return true;
+    }
+    return parse(tail, last) && last >= first;
+}
+
+bool parse_count(const std::string &text, std::uint64_t &value)
+{
+    if (text.empty() || text.size() > 19 || text.find_first_not_of("0123456789") != std::string::npos) return false;
+    value = std::stoull(text);
+    return true;
+}
+
+} // namespace
+
+// --print-lines: lines `range` of `path` as UTF-8; B past the end stops at the last line.
+bool printLines(const std::string &path, const std::string &range)
+{
+    std::int64_t first = 0;
+    std::int64_t last = 0;
+    if (!parse_line_range(range, first, last))
+    {
+        std::cerr << "Error: Expected a line range like 120..180, got \"" << range << "\"." << std::endl;
+        return false;
+    }
+    ExtractBook book;
+    if (!open_extract_book(path, book)) return false;
+    bool ok = book.index.index_through(*book.stream, first);
+    if (!ok)
+    {
+        std::cerr << "Error: " << extract_display_name(path) << " has only " << book.index.indexed_line_count()
+                  << " lines." << std::endl;
+    }
+    else
+    {
+        if (!book.index.index_through(*book.stream, last)) last = book.index.indexed_line_count();
+        ok = write_lines(book, first, last);
+    }
+    close_extract_book(book);
+    return ok;
+}
+
+// --print-chapter: chapter `number` (1-based, as counted by the heading test),
+// from its heading up to the next one. Scans only until that next heading.
+bool printChapter(const std::string &path, const std::string &number)
+{
+    std::uint64_t chapter = 0;
+    if (!parse_count(number, chapter) || chapter == 0)
+    {
+        std::cerr << "Error: Expected a chapter number, got \"" << number << "\"." << std::endl;
+        return false;
+    }
+    ExtractBook book;
+    if (!open_extract_book(path, book)) return false;
+    TextIndex::LineIndex &index = book.index;
+    const std::int64_t wanted = static_cast<std::int64_t>(chapter);
+    while (index.chapter_count() <= wanted && !index.fully_indexed())
+    {
+        index.index_through_offset(*book.stream, index.scanned_bytes() + kExtractScanBytes);
+    }
+    bool ok = index.chapter_count() >= wanted;
+    if (!ok)
+    {
+        std::cerr << "Error: " << extract_display_name(path) << " has only " << index.chapter_count() << " chapters."
+                  << std::endl;
+    }
+    else
+    {
+        const std::int64_t next = index.chapter_first_line(wanted + 1);
+        ok = write_lines(book, index.chapter_first_line(wanted), next > 0 ? next - 1 : index.indexed_line_count());
+    }
+    close_extract_book(book);
+    return ok;
+}
+
+// --line-at-offset: the number of the (virtual) line holding byte `offset`.
+bool printLineAtOffset(const std::string &path, const std::string &offset_text)
+{
+    std::uint64_t offset = 0;
+    if (!parse_count(offset_text, offset))
+    {
+        std::cerr << "Error: Expected a byte offset, got \"" << offset_text << "\"." << std::endl;
+        return false;
+    }
+    ExtractBook book;
+    if (!open_extract_book(path, book)) return false;
+    bool ok = offset < book.index.file_size();
+    if (!ok)
+    {
+        std::cerr << "Error: " << extract_display_name(path) << " has only " << book.index.file_size() << " bytes."
+                  << std::endl;
+    }
+    else
+    {
+        book.index.index_through_offset(*book.stream, offset);
+        std::cout << book.index.line_at_offset(offset) << std::endl;
+    }
+    close_extract_book(book);
+    return ok;
+}
+
+// --stats: what the index knows about the whole book.
+bool printStats(const std::string &path)
+{
+    ExtractBook book;
+    if (!open_extract_book(path, book)) return false;
+    TextIndex::LineIndex &index = book.index;
+    const std::int64_t lines = index.index_all(*book.stream);
+    const std::uint64_t characters = index.indexed_characters();
+    const double per_minute = characters_per_minute(load_reading_rate());
+    std::cout << "File:        " << extract_display_name(path) << std::endl;
+    std::cout << "Encoding:    " << index.encoding();
+    if (index.encoding_run_count() > 1)
+    {
+        std::cout << " (" << index.encoding_run_count() << " runs alternating with " << index.alternate_encoding()
+                  << ")";
+    }
+    std::cout << std::endl;
+    std::cout << "Bytes:       " << index.file_size() << std::endl;
+    std::cout << "Lines:       " << lines << std::endl;
+    std::cout << "Paragraphs:  " << index.paragraph_of(lines) << std::endl;
+    std::cout << "Chapters:    " << index.chapter_count() << std::endl;
+    std::cout << "Characters:  " << characters << std::endl;
+    std::cout << "Reading:     " << format_reading_time(static_cast<double>(characters) / per_minute) << " at "
+              << static_cast<std::uint64_t>(per_minute) << " characters/min" << std::endl;
+    close_extract_book(book);
+    return true;
+}
+
+void showLibrary()
+{
+    constexpr size_t kMaxListedBooks = 20;
+    loadLibraryCatalog();
+
+    std::string filter;
+    while (true)
+    {
+        PlatformUtils::clear_screen();
+        const std::vector<size_t> matches = LibraryCatalog::filter_catalog(LibraryEntries, filter);
+        const size_t listed = matches.size() < kMaxListedBooks ? matches.size() : kMaxListedBooks;
+
+        std::cout << "--- Library ---" << std::endl;
+        std::cout << "Catalog: " << LibraryEntries.size() << " books";
+        if (!filter.empty()) std::cout << ", " << matches.size() << " matching \"" << filter << "\"";
+        std::cout << std::endl;
+        if (LibraryEntries.empty())
+        {
+            std::cout << "No books cataloged yet. Use ':scan <folder>' to add a library folder." << std::endl;
+        }
+        for (size_t i = 0; i < listed; ++i)
+        {
+            const LibraryCatalog::CatalogEntry &entry = LibraryEntries[matches[i]];
+            std::cout << std::setw(3) << (i + 1) << ". " << LibraryCatalog::display_name(entry) << "  [" << entry.encoding
+                      << ", " << entry.line_count << " lines, " << entry.chapter_count << " chapters]" << std::endl;
+            std::cout << "     " << entry.path << std::endl;
+        }
+        if (matches.size() > listed)
+        {
+            std::cout << "... " << (matches.size() - listed) << " more; type part of the name to narrow the list." << std::endl;
+        }
+
+        std::cout << "\nNumber: open | text: filter | ':scan <folder>': scan or rescan | Enter: back" << std::endl;
+        std::cout << "> ";
+        std::string input;
+        if (!std::getline(std::cin, input) || input.empty()) return;
+
+        if (input.compare(0, 5, ":scan") == 0)
+        {
+            std::string root = input.substr(5);
+            const size_t first = root.find_first_not_of(" \t");
+            root = (first == std::string::npos) ? "" : root.substr(first);
+            if (root.empty())
+            {
+                std::cout << "Please give a folder, e.g. ':scan /path/to/novels'." << std::endl;
+            }
+            else
+            {
+                std::cout << "Scanning " << root << " ..." << std::endl;
+                scanLibraryFolder(root);
+            }
+            PlatformUtils::platform_sleep(2000);
+            continue;
+        }
+
+        if (input.find_first_not_of("0123456789") == std::string::npos && input.size() < 9)
+        {
+            const size_t choice = static_cast<size_t>(std::stoul(input));
+            if (choice >= 1 && choice <= listed)
+            {
+                if (openNovel(LibraryEntries[matches[choice - 1]].path))
+                {
+                    writeAppSettings();
+                    return;
+                }
+                continue;
+            }
+        }
+
+        filter = input;
+    }
+}
+
+// 管道/FIFO 输入：边接收边落盘到临时文件，阅读界面把它当作一个仍在追加的文件打开，
+// 收到开头的数据就能开始读，索引随数据到达增量扩展
+bool readStream(const std::string &source)
+{
+    // Enough of the start of the stream for the encoding to be detected.
+    constexpr std::uint64_t kDetectBytes = 64 * 1024;
+    FileView::StreamSpool spool;
+    std::string error;
+    if (source != "-") std::cout << "Waiting for " << source << " to be opened for writing..." << std::endl;
+    if (!spool.start(source, true, &error))
+    {
+        std::cerr << "Error: " << error << std::endl;
+        return false;
+    }
+    std::cout << "Receiving..." << std::endl;
+    spool.wait_for(kDetectBytes);
+    {
+        // Without a way to follow the file as it grows, the reader needs all of it up front.
+        FileWatch::FileWatcher probe;
+        if (!spool.finished() && !probe.watch(spool.path(), nullptr))
+        {
+            std::cout << "Waiting for the end of the input..." << std::endl;
+            spool.wait_for(std::numeric_limits<std::uint64_t>::max());
+        }
+    }
+    if (!spool.error().empty()) std::cerr << "Error: " << spool.error() << std::endl;
+    if (spool.bytes_received() == 0)
+    {
+        std::cerr << "Error: No input received." << std::endl;
+        return false;
+    }
+
+    if (novel_stream.is_open()) novel_stream.close();
+    NovelFolder.close();
+    NovelIsStream = true;
+    NovelPath = spool.path();
+    novel_stream.clear();
+    novel_stream.open(NovelPath, std::ios::in | std::ios::binary);
+    if (!novel_stream.is_open())
+    {
+        std::cerr << "Error: Could not open the spool file " << NovelPath << std::endl;
+        return false;
+    }
+    NovelEncoding = EncodingUtils::detect_encoding(NovelPath);
+    NovelFingerprint = Fingerprint::BookFingerprint{};
+    ::current_line_number = 1;
+    ::current_byte_offset = 0;
+    readNovel();
+    novel_stream.close();
+    return true;
+}
+
+// The report and extraction commands seek around their book, so a stream
+// given as the file ("-", a FIFO) is received in full into a spool file
+// first. Returns the path to read, or "" after printing the error.
+std::string spool_extract_source(const std::string &path, FileView::StreamSpool &spool)
+{
+    if (!FileView::StreamSpool::is_stream_source(path)) return path;
+    std::string error;
+    if (!spool.start(path, false, &error))
+    {
+        std::cerr << "Error: " << error << std::endl;
+        return "";
+    }
+    spool.wait_for(std::numeric_limits<std::uint64_t>::max());
+    if (!spool.error().empty())
+    {
+        std::cerr << "Error: " << spool.error() << std::endl;
+        return "";
+    }
+    ExtractSpoolPath = spool.path();
+    ExtractSourceName = path == "-" ? "standard input" : path;
+    return ExtractSpoolPath;
+}
+
+int runCommandLine(const std::vector<std::string> &args)
+{
+    if (args[0] == "--scan" && args.size() == 2)
+    {
+        return scanLibraryFolder(args[1]) ? 0 : 1;
+    }
+    if (args[0] == "--junk-report" && args.size() <= 2)
+    {
+        const std::string path = args.size() == 2 ? args[1] : NovelPath;
+        if (path.empty())
+        {
+            std::cerr << "Error: No novel selected; pass a file." << std::endl;
+            return 1;
+        }
+        FileView::StreamSpool spool;
+        const std::string source = spool_extract_source(path, spool);
+        return !source.empty() && printJunkReport(source) ? 0 : 1;
+    }
+    if (args[0] == "--build-dict" && args.size() >= 3 && is_conversion_mode(args[1]))
+    {
+        const std::string output_path = config_file_path(args[1] + ".dat");
+        std::string error;
+        if (output_path.empty() || !FileSystemUtils::create_directory_if_not_exists(FileSystemUtils::get_config_directory_path()))
+        {
+            std::cerr << "Error: Could not determine the configuration directory." << std::endl;
+            return 1;
+        }
+        if (!ChineseConvert::compile_dictionary(std::vector<std::string>(args.begin() + 2, args.end()), output_path, &error))
+        {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << output_path << std::endl;
+        return 0;
+    }
+    // Extraction commands read the given file, or the current novel.
+    const std::string extract_path = args.size() == 3 ? args[2] : NovelPath;
+    const bool extract_file_given = args.size() == 3 || !NovelPath.empty();
+    if ((args[0] == "--print-lines" || args[0] == "--print-chapter" || args[0] == "--line-at-offset") &&
+        (args.size() == 2 || args.size() == 3))
+    {
+        if (!extract_file_given)
+        {
+            std::cerr << "Error: No novel selected; pass a file." << std::endl;
+            return 1;
+        }
+        FileView::StreamSpool spool;
+        const std::string source = spool_extract_source(extract_path, spool);
+        if (source.empty()) return 1;
+        if (args[0] == "--print-lines") return printLines(source, args[1]) ? 0 : 1;
+        if (args[0] == "--print-chapter") return printChapter(source, args[1]) ? 0 : 1;
+        return printLineAtOffset(source, args[1]) ? 0 : 1;
+    }
+    if (args[0] == "--stats" && args.size() <= 2)
+    {
+        const std::string path = args.size() == 2 ? args[1] : NovelPath;
+        if (path.empty())
+        {
+            std::cerr << "Error: No novel selected; pass a file." << std::endl;
+            return 1;
+        }
+        FileView::StreamSpool spool;
+        const std::string source = spool_extract_source(path, spool);
+        return !source.empty() && printStats(source) ? 0 : 1;
+    }
+    if (args.size() == 1 && FileView::StreamSpool::is_stream_source(args[0]))
+    {
+        return readStream(args[0]) ? 0 : 1;
+    }
+    if (args[0] == "--daemon" && args.size() == 1)
+    {
+        std::string error;
+        if (ReaderDaemon::run(&error)) return 0;
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+
+    const bool asked_for_help = (args[0] == "--help" || args[0] == "-h");
+    std::ostream &out = asked_for_help ? std::cout : std::cerr;
+    out << "Usage: NovelReaderCLI [option]" << std::endl;
+    out << "  (no option)      interactive menu" << std::endl;
+    out << "  --scan <folder>  catalog the .txt books under <folder> (incremental)" << std::endl;
+    out << "  --resume         reopen the last reading session where it was left" << std::endl;
+    out << "  - | <fifo>       read a book piped in, starting on the first bytes received" << std::endl;
+    out << "  --daemon         keep recently opened books indexed for faster launches" << std::endl;
+    out << "  --junk-report [file]  count the lines each junk pattern hides (default: current novel)" << std::endl;
+    out << "  --build-dict s2t|t2s <file>...  compile OpenCC-style phrase lists for the C key" << std::endl;
+    out << "  --print-lines A..B [file]   print lines A to B (\"A..\" to the end) as UTF-8" << std::endl;
+    out << "  --print-chapter N [file]    print chapter N, from its heading to the next" << std::endl;
+    out << "  --line-at-offset BYTE [file]  print the number of the line holding that byte" << std::endl;
+    out << "  --stats [file]   print line, chapter and character counts" << std::endl;
+    out << "  --help           show this help" << std::endl;
+    return asked_for_help ? 0 : 2;
+}
+
 void writeAppSettings()
 {
+    TRACE_SPAN("save settings");
+    // A piped book is gone once the reader exits; keep the configured novel.
+    if (NovelIsStream) return;
     if (ConfigFilePath.empty())
     {
         std::cerr << "Critical Error: Config file path not set. Cannot save settings." << std::endl;
         PlatformUtils::platform_sleep(2000);
         return;
     }
-    if (!FileSystemUtils::write_config(ConfigFilePath, NovelPath, ::current_line_number - 1))
+    if (!FileSystemUtils::write_config(ConfigFilePath, NovelPath, ::current_line_number - 1, ::current_byte_offset))
     {
         std::cerr << "Warning: Failed to write settings to config file." << std::endl;
         PlatformUtils::platform_sleep(2000);
     }
+    remember_progress();
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    TRACE_START();
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+#else
+    // For Linux/macOS, UTF-8 is generally assumed or set by locale.
+    // Explicit setup might involve std::locale and std::ios_base::sync_with_stdio(false)
+    // but for basic console output, often not needed if system locale is UTF-8.
+#endif
+
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    // --resume paints the last session's screen before the config or any index is read.
+    const bool resume_requested = (args.size() == 1 && args[0] == "--resume");
+    if (!args.empty() && !resume_requested)
+    {
+        // Command-line modes write to stdout for scripts: they need the configured
+        // paths but not the interactive checks on the current novel.
+        std::string error;
+        if (!loadAppSettings(&error)) std::cerr << "Warning: " << error << std::endl;
+        const int rc = runCommandLine(args);
+        if (novel_stream.is_open()) novel_stream.close();
+        return rc;
+    }
+    const bool resuming = resume_requested && begin_resume();
     initConfigAndNovel();
+    if (resuming)
+    {
+        readNovel();
+    }
+    else if (resume_requested)
+    {
+        PlatformUtils::clear_screen();
+        std::cout << "No saved session to resume." << std::endl;
+        PlatformUtils::platform_sleep(1500);
+    }
     while (true)
     {
         PlatformUtils::clear_screen();
         std::cout << "--- NovelReader Menu (" << PlatformUtils::get_os_name() << ") ---" << std::endl; // Added OS name
         std::cout << "--------------------------" << std::endl;
         std::cout << "Novel: " << (NovelPath.empty() ? "Not Set" : NovelPath) << std::endl;
-        std::cout << "Next line to read: " << ::current_line_number << std::endl;
+        std::cout << "Next line to read: " << describe_position() << std::endl;
         std::cout << "--------------------------" << std::endl;
         std::cout << "1. Start/Continue Read Novel" << std::endl;
         std::cout << "2. Settings" << std::endl;
-        std::cout << "3. Exit" << std::endl;
-        std::cout << "Please select an option (1-3): ";
+        std::cout << "3. Library" << std::endl;
+        std::cout << "4. Exit" << std::endl;
+        std::cout << "Please select an option (1-4): ";
 
         std::string choice_line;
         if (!std::getline(std::cin, choice_line))
@@ -645,7 +2748,7 @@ int main()
         catch (...)
         {
             PlatformUtils::clear_screen();
-            std::cout << "Invalid input. Please enter a number (1-3)." << std::endl;
+            std::cout << "Invalid input. Please enter a number (1-4)." << std::endl;
             PlatformUtils::platform_sleep(1500);
             continue;
         }
@@ -653,7 +2756,7 @@ int main()
         switch (choice)
         {
             case 1:
-                if (NovelPath.empty() || !novel_stream.is_open())
+                if (NovelPath.empty() || (!novel_stream.is_open() && !NovelFolder.is_open()))
                 {
                     PlatformUtils::clear_screen();
                     std::cout << "Novel path not set or novel file cannot be opened." << std::endl;
@@ -667,6 +2770,9 @@ int main()
                 showSettings();
                 break;
             case 3:
+                showLibrary();
+                break;
+            case 4:
                 PlatformUtils::clear_screen();
                 std::cout << "Exiting NovelReader..." << std::endl;
                 PlatformUtils::platform_sleep(700);
@@ -674,7 +2780,7 @@ int main()
                 return 0;
             default:
                 PlatformUtils::clear_screen();
-                std::cout << "Invalid choice. Please enter a number between 1 and 3." << std::endl;
+                std::cout << "Invalid choice. Please enter a number between 1 and 4." << std::endl;
                 PlatformUtils::platform_sleep(1500);
                 break;
         }
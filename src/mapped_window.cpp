@@ -0,0 +1,381 @@
+#include "mapped_window.h"
+
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FileView {
+
+namespace {
+
+// Prefetched past the end of each read; about a screenful of long lines.
+const std::uint64_t kReadAheadBytes = 1024 * 1024;
+
+std::uint64_t allocation_granularity()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+#else
+    const long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? static_cast<std::uint64_t>(page) : 4096;
+#endif
+}
+
+} // namespace
+
+const std::uint64_t MappedWindow::kWindowBytes;
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+MappedWindow::~MappedWindow()
+{
+    close();
+}
+
+bool MappedWindow::read(std::uint64_t offset, std::uint64_t length, std::string &out)
+{
+    out.clear();
+    if (!is_open() || !update_size()) return false;
+    if (offset >= size_) return true;
+    if (length > size_ - offset) length = size_ - offset;
+    if (length == 0) return true;
+
+    const bool covered = view_ != nullptr && offset >= view_offset_ && offset + length <= view_offset_ + view_length_;
+    if (!covered && !map_window(offset, length)) return read_direct(offset, length, out);
+
+    const char *begin = view_ + (offset - view_offset_);
+    out.assign(begin, static_cast<size_t>(length));
+
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+    // Start paging in what the reader is about to reach.
+    const std::uint64_t granularity = allocation_granularity();
+    const std::uint64_t ahead_begin = ((offset + length - view_offset_) / granularity) * granularity;
+    if (ahead_begin < view_length_)
+    {
+        const std::uint64_t ahead = view_length_ - ahead_begin < kReadAheadBytes ? view_length_ - ahead_begin : kReadAheadBytes;
+        madvise(view_ + ahead_begin, static_cast<size_t>(ahead), MADV_WILLNEED);
+    }
+#endif
+    return true;
+}
+
+bool MappedWindow::map_window(std::uint64_t offset, std::uint64_t length)
+{
+    unmap();
+
+    // Keep a quarter window behind the cursor for paging back.
+    const std::uint64_t granularity = allocation_granularity();
+    const std::uint64_t behind = offset < kWindowBytes / 4 ? offset : kWindowBytes / 4;
+    const std::uint64_t begin = ((offset - behind) / granularity) * granularity;
+    std::uint64_t end = begin + kWindowBytes;
+    if (end < offset + length) end = offset + length;
+    if (end > size_) end = size_;
+    if (end - begin > std::numeric_limits<size_t>::max()) return false;
+    const size_t mapped_length = static_cast<size_t>(end - begin);
+
+#ifdef _WIN32
+    if (mapping_ == nullptr)
+    {
+        mapping_ = CreateFileMappingA(static_cast<HANDLE>(file_), nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_ == nullptr) return false;
+        mapping_size_ = size_;
+    }
+    void *view = MapViewOfFile(static_cast<HANDLE>(mapping_), FILE_MAP_READ, static_cast<DWORD>(begin >> 32),
+                               static_cast<DWORD>(begin & 0xFFFFFFFFu), mapped_length);
+    if (view == nullptr) return false;
+#else
+    void *view = mmap(nullptr, mapped_length, PROT_READ, MAP_SHARED, fd_, static_cast<off_t>(begin));
+    if (view == MAP_FAILED) return false;
+#ifdef MADV_SEQUENTIAL
+    madvise(view, mapped_length, MADV_SEQUENTIAL);
+#endif
+#endif
+
+    view_ = static_cast<char *>(view);
+    view_offset_ = begin;
+    view_length_ = mapped_length;
+    return true;
+}
+
+#ifdef _WIN32
+
+bool MappedWindow::open(const std::string &path, std::string *error_message)
+{
+    TRACE_SPAN("open file");
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        if (error_message) *error_message = "Could not open " + path;
+        return false;
+    }
+    file_ = file;
+    return update_size();
+}
+
+void MappedWindow::close()
+{
+    unmap();
+    if (mapping_ != nullptr) CloseHandle(static_cast<HANDLE>(mapping_));
+    if (file_ != nullptr) CloseHandle(static_cast<HANDLE>(file_));
+    mapping_ = nullptr;
+    mapping_size_ = 0;
+    file_ = nullptr;
+    size_ = 0;
+}
+
+bool MappedWindow::is_open() const
+{
+    return file_ != nullptr;
+}
+
+bool MappedWindow::update_size()
+{
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(static_cast<HANDLE>(file_), &size)) return false;
+    size_ = static_cast<std::uint64_t>(size.QuadPart);
+    if (mapping_ != nullptr && mapping_size_ != size_)
+    {
+        // A file mapping has a fixed size; map the new length on the next read.
+        unmap();
+        CloseHandle(static_cast<HANDLE>(mapping_));
+        mapping_ = nullptr;
+        mapping_size_ = 0;
+    }
+    return true;
+}
+
+void MappedWindow::unmap()
+{
+    if (view_ != nullptr) UnmapViewOfFile(view_);
+    view_ = nullptr;
+    view_offset_ = 0;
+    view_length_ = 0;
+}
+
+bool MappedWindow::read_direct(std::uint64_t offset, std::uint64_t length, std::string &out)
+{
+    if (length > std::numeric_limits<size_t>::max()) return false;
+    out.resize(static_cast<size_t>(length));
+    size_t done = 0;
+    while (done < out.size())
+    {
+        OVERLAPPED at = {};
+        const std::uint64_t position = offset + done;
+        at.Offset = static_cast<DWORD>(position & 0xFFFFFFFFu);
+        at.OffsetHigh = static_cast<DWORD>(position >> 32);
+        const size_t remaining = out.size() - done;
+        const DWORD want = remaining > 0x40000000u ? 0x40000000u : static_cast<DWORD>(remaining);
+        DWORD got = 0;
+        if (!ReadFile(static_cast<HANDLE>(file_), &out[done], want, &got, &at) || got == 0) break;
+        done += got;
+    }
+    out.resize(done);
+    return true;
+}
+
+void MappedWindow::release(std::uint64_t, std::uint64_t)
+{
+    // No per-range page-cache control on Windows.
+}
+
+void release_page_cache(const std::string &, std::uint64_t, std::uint64_t)
+{
+}
+
+bool MappedFile::open(const std::string &path, std::string *error_message)
+{
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        if (error_message) *error_message = "Could not open " + path;
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    const bool have_size = GetFileSizeEx(file, &size) != 0;
+    if (have_size && size.QuadPart == 0)
+    {
+        // Nothing to map; an empty file is still a valid file.
+        CloseHandle(file);
+        return true;
+    }
+    if (have_size && size.QuadPart > 0 &&
+        static_cast<std::uint64_t>(size.QuadPart) <= std::numeric_limits<size_t>::max())
+    {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    // The view keeps the mapping alive on its own.
+    const void *view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (mapping != nullptr) CloseHandle(mapping);
+    CloseHandle(file);
+    if (view == nullptr)
+    {
+        if (error_message) *error_message = "Could not map " + path;
+        return false;
+    }
+    data_ = static_cast<const char *>(view);
+    size_ = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data_ != nullptr) UnmapViewOfFile(data_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#else
+
+bool MappedWindow::open(const std::string &path, std::string *error_message)
+{
+    TRACE_SPAN("open file");
+    close();
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0)
+    {
+        if (error_message) *error_message = std::strerror(errno);
+        return false;
+    }
+    return update_size();
+}
+
+void MappedWindow::close()
+{
+    unmap();
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    size_ = 0;
+}
+
+bool MappedWindow::is_open() const
+{
+    return fd_ >= 0;
+}
+
+bool MappedWindow::update_size()
+{
+    struct stat st;
+    if (fstat(fd_, &st) != 0) return false;
+    size_ = static_cast<std::uint64_t>(st.st_size);
+    // Touching mapped pages past EOF raises SIGBUS; drop a window the file no longer covers.
+    if (view_ != nullptr && view_offset_ + view_length_ > size_) unmap();
+    return true;
+}
+
+void MappedWindow::unmap()
+{
+    if (view_ != nullptr) munmap(view_, view_length_);
+    view_ = nullptr;
+    view_offset_ = 0;
+    view_length_ = 0;
+}
+
+bool MappedWindow::read_direct(std::uint64_t offset, std::uint64_t length, std::string &out)
+{
+    if (length > std::numeric_limits<size_t>::max()) return false;
+    out.resize(static_cast<size_t>(length));
+    size_t done = 0;
+    while (done < out.size())
+    {
+        const ssize_t got = pread(fd_, &out[done], out.size() - done, static_cast<off_t>(offset + done));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        done += static_cast<size_t>(got);
+    }
+    out.resize(done);
+    return true;
+}
+
+void MappedWindow::release(std::uint64_t offset, std::uint64_t length)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    // Books that fit in one window are left to the kernel.
+    if (fd_ < 0 || length == 0 || size_ <= kWindowBytes) return;
+    // Leave the pages around the reader alone.
+    if (view_ != nullptr && offset < view_offset_ + view_length_ && view_offset_ < offset + length) return;
+    posix_fadvise(fd_, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+#else
+    (void)offset;
+    (void)length;
+#endif
+}
+
+void release_page_cache(const std::string &path, std::uint64_t offset, std::uint64_t length)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+    ::close(fd);
+#else
+    (void)path;
+    (void)offset;
+    (void)length;
+#endif
+}
+
+bool MappedFile::open(const std::string &path, std::string *error_message)
+{
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (error_message) *error_message = std::strerror(errno);
+        return false;
+    }
+    struct stat st = {};
+    void *view = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size == 0)
+    {
+        // Nothing to map; an empty file is still a valid file.
+        ::close(fd);
+        return true;
+    }
+    if (st.st_size > 0 &&
+        static_cast<std::uint64_t>(st.st_size) <= std::numeric_limits<size_t>::max())
+    {
+        view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    const int map_errno = errno;
+    ::close(fd);
+    if (view == MAP_FAILED)
+    {
+        if (error_message) *error_message = std::strerror(map_errno);
+        return false;
+    }
+    data_ = static_cast<const char *>(view);
+    size_ = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data_ != nullptr) munmap(const_cast<char *>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#endif
+
+} // namespace FileView
@@ -1,5 +1,7 @@
 #include "platform_utils.h"
 
+#include "trace.h"
+
 #ifdef _WIN32
 #include <windows.h>
 #else // Assuming Linux/POSIX
@@ -7,6 +9,13 @@
 #include <cstdlib>
 #endif
 
+#include <cerrno>
+#include <cstdio>
+
+#if defined(_WIN32) && !defined(ENABLE_VIRTUAL_TERMINAL_PROCESSING)
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+
 namespace PlatformUtils {
 
 void platform_sleep(int milliseconds) {
@@ -27,6 +36,40 @@ void clear_screen() {
 #endif
 }
 
+bool write_terminal(const std::string& bytes) {
+    std::fflush(stdout);
+#ifdef _WIN32
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode = 0;
+    if (console == INVALID_HANDLE_VALUE || !GetConsoleMode(console, &mode) ||
+        !SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING)) {
+        // Older consoles don't understand escape sequences.
+        return false;
+    }
+    DWORD written = 0;
+    WriteConsoleA(console, bytes.data(), static_cast<DWORD>(bytes.size()), &written, nullptr);
+#else
+    size_t done = 0;
+    while (done < bytes.size()) {
+        const ssize_t n = write(STDOUT_FILENO, bytes.data() + done, bytes.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += static_cast<size_t>(n);
+    }
+#endif
+    return true;
+}
+
+void paint_screen(const std::string& contents) {
+    TRACE_SPAN("paint screen");
+    // Cursor home + erase display, then the frame, all in one buffer.
+    if (!write_terminal("\x1b[H\x1b[2J" + contents)) {
+        clear_screen();
+        std::fwrite(contents.data(), 1, contents.size(), stdout);
+        std::fflush(stdout);
+    }
+}
+
 char get_path_separator() {
 #ifdef _WIN32
     return '\\';
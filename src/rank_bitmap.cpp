@@ -0,0 +1,240 @@
+#include "rank_bitmap.h"
+
+#include "compact_offsets.h"
+
+#include <algorithm>
+
+namespace TextIndex {
+
+namespace {
+
+unsigned popcount64(std::uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_popcountll(x));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<unsigned>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Position of the k-th (0-based) set bit of `word`; k < popcount64(word).
+unsigned select_in_word(std::uint64_t word, unsigned k)
+{
+    for (unsigned i = 0; i < k; ++i) word &= word - 1;
+    unsigned position = 0;
+    while ((word & 1) == 0)
+    {
+        word >>= 1;
+        ++position;
+    }
+    return position;
+}
+
+} // namespace
+
+const size_t RankSelectBitmap::npos;
+const size_t RankSelectBitmap::kWordsPerSample;
+
+void RankSelectBitmap::clear()
+{
+    words_.clear();
+    samples_.clear();
+    size_ = 0;
+    ones_ = 0;
+}
+
+void RankSelectBitmap::push_back(bool bit)
+{
+    if (size_ % 64 == 0)
+    {
+        if (words_.size() % kWordsPerSample == 0) samples_.push_back(ones_);
+        words_.push_back(0);
+    }
+    if (bit)
+    {
+        words_.back() |= std::uint64_t(1) << (size_ % 64);
+        ++ones_;
+    }
+    ++size_;
+}
+
+void RankSelectBitmap::rebuild_samples(size_t first_word)
+{
+    // Samples up to the block holding `first_word` count only words before it, so they still hold.
+    size_t sample = first_word / kWordsPerSample;
+    if (sample >= samples_.size()) sample = samples_.empty() ? 0 : samples_.size() - 1;
+    ones_ = sample < samples_.size() ? static_cast<size_t>(samples_[sample]) : 0;
+    samples_.resize(sample);
+    for (size_t w = sample * kWordsPerSample; w < words_.size(); ++w)
+    {
+        if (w % kWordsPerSample == 0) samples_.push_back(ones_);
+        ones_ += popcount64(words_[w]);
+    }
+}
+
+std::uint64_t RankSelectBitmap::bits_at(size_t i, unsigned width) const
+{
+    const size_t word = i / 64;
+    const unsigned shift = static_cast<unsigned>(i % 64);
+    std::uint64_t value = words_[word] >> shift;
+    if (shift + width > 64) value |= words_[word + 1] << (64 - shift);
+    return width >= 64 ? value : value & ((std::uint64_t(1) << width) - 1);
+}
+
+void RankSelectBitmap::append_bits(std::uint64_t value, unsigned width)
+{
+    const unsigned shift = static_cast<unsigned>(size_ % 64);
+    if (shift == 0) words_.push_back(0);
+    words_.back() |= value << shift;
+    if (shift + width > 64) words_.push_back(value >> (64 - shift));
+    size_ += width;
+}
+
+void RankSelectBitmap::truncate(size_t count)
+{
+    if (count >= size_) return;
+    size_ = count;
+    words_.resize((count + 63) / 64);
+    if (count % 64 != 0) words_.back() &= (std::uint64_t(1) << (count % 64)) - 1;
+    // Only the last sample's block changed; earlier samples stay valid.
+    samples_.resize((words_.size() + kWordsPerSample - 1) / kWordsPerSample);
+    ones_ = samples_.empty() ? 0 : static_cast<size_t>(samples_.back());
+    for (size_t w = (samples_.empty() ? 0 : (samples_.size() - 1) * kWordsPerSample); w < words_.size(); ++w)
+    {
+        ones_ += popcount64(words_[w]);
+    }
+}
+
+void RankSelectBitmap::replace(size_t first, size_t last, const std::vector<bool> &bits)
+{
+    if (last > size_) last = size_;
+    if (first > last) first = last;
+
+    if (bits.empty() && first == last) return;
+    if (bits.size() == last - first)
+    {
+        const size_t first_word = first / 64;
+        const size_t end_word = (last - 1) / 64 + 1;
+        std::uint64_t old_ones = 0;
+        for (size_t w = first_word; w < end_word; ++w) old_ones += popcount64(words_[w]);
+        for (size_t k = 0; k < bits.size(); ++k)
+        {
+            const std::uint64_t mask = std::uint64_t(1) << ((first + k) % 64);
+            std::uint64_t &word = words_[(first + k) / 64];
+            word = bits[k] ? (word | mask) : (word & ~mask);
+        }
+        std::uint64_t new_ones = 0;
+        for (size_t w = first_word; w < end_word; ++w) new_ones += popcount64(words_[w]);
+
+        // Samples inside the changed words are recounted; the later ones move by the difference (mod 2^64).
+        const std::uint64_t delta = new_ones - old_ones;
+        for (size_t sample = first_word / kWordsPerSample + 1; sample < samples_.size(); ++sample)
+        {
+            if (sample * kWordsPerSample < end_word)
+            {
+                std::uint64_t ones = samples_[sample - 1];
+                for (size_t w = (sample - 1) * kWordsPerSample; w < sample * kWordsPerSample; ++w)
+                {
+                    ones += popcount64(words_[w]);
+                }
+                samples_[sample] = ones;
+            }
+            else
+            {
+                samples_[sample] += delta;
+            }
+        }
+        ones_ = static_cast<size_t>(ones_ + delta);
+        return;
+    }
+
+    // The bits after the range move; they are copied a word at a time.
+    std::vector<std::uint64_t> after;
+    const size_t after_size = size_ - last;
+    for (size_t i = last; i < size_; i += 64)
+    {
+        after.push_back(bits_at(i, static_cast<unsigned>(std::min<size_t>(64, size_ - i))));
+    }
+    truncate(first);
+    for (bool bit : bits) push_back(bit);
+    for (size_t k = 0; k < after.size(); ++k)
+    {
+        append_bits(after[k], static_cast<unsigned>(std::min<size_t>(64, after_size - k * 64)));
+    }
+    rebuild_samples(first / 64);
+}
+
+size_t RankSelectBitmap::rank(size_t i) const
+{
+    if (i >= size_) return ones_;
+    const size_t word = i / 64;
+    const size_t sample = word / kWordsPerSample;
+    size_t result = static_cast<size_t>(samples_[sample]);
+    for (size_t w = sample * kWordsPerSample; w < word; ++w) result += popcount64(words_[w]);
+    if (i % 64 != 0) result += popcount64(words_[word] & ((std::uint64_t(1) << (i % 64)) - 1));
+    return result;
+}
+
+size_t RankSelectBitmap::select(size_t k) const
+{
+    if (k >= ones_) return npos;
+    // Last block whose preceding count is <= k.
+    const size_t sample = static_cast<size_t>(std::upper_bound(samples_.begin(), samples_.end(),
+                                                               static_cast<std::uint64_t>(k)) -
+                                              samples_.begin()) -
+                          1;
+    size_t remaining = k - static_cast<size_t>(samples_[sample]);
+    for (size_t w = sample * kWordsPerSample; w < words_.size(); ++w)
+    {
+        const unsigned ones = popcount64(words_[w]);
+        if (remaining < ones) return w * 64 + select_in_word(words_[w], static_cast<unsigned>(remaining));
+        remaining -= ones;
+    }
+    return npos;
+}
+
+size_t RankSelectBitmap::next_set(size_t i) const
+{
+    if (i >= size_) return npos;
+    return select(rank(i));
+}
+
+size_t RankSelectBitmap::prev_set(size_t i) const
+{
+    if (size_ == 0) return npos;
+    const size_t through = rank(i >= size_ ? size_ : i + 1);
+    return through == 0 ? npos : select(through - 1);
+}
+
+size_t RankSelectBitmap::memory_bytes() const
+{
+    return (words_.capacity() + samples_.capacity()) * sizeof(std::uint64_t);
+}
+
+void RankSelectBitmap::write(std::ostream &out) const
+{
+    write_u64_le(out, size_);
+    for (std::uint64_t word : words_) write_u64_le(out, word);
+}
+
+bool RankSelectBitmap::read(std::istream &in)
+{
+    clear();
+    std::uint64_t size = 0;
+    if (!read_u64_le(in, size)) return false;
+    for (std::uint64_t i = 0; i < (size + 63) / 64; ++i)
+    {
+        std::uint64_t word = 0;
+        if (!read_u64_le(in, word)) return false;
+        words_.push_back(word);
+    }
+    if (size % 64 != 0 && (words_.back() >> (size % 64)) != 0) return false;
+    size_ = static_cast<size_t>(size);
+    rebuild_samples();
+    return true;
+}
+
+} // namespace TextIndex
@@ -0,0 +1,434 @@
+#include "readahead.h"
+
+#include "task_scheduler.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NOVELREADER_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+namespace FileView {
+
+namespace {
+
+// Reads in flight at once (io_uring entries / queued pool reads).
+const unsigned kQueueDepth = 16;
+// Blocks fetched ahead of and behind the cursor's block.
+const std::uint64_t kAheadBlocks = 16;
+const std::uint64_t kBehindBlocks = 4;
+const size_t kPoolThreads = 2;
+// Remembered fetched blocks; older ones may have left the page cache by now.
+const size_t kRememberedBlocks = 2048;
+
+} // namespace
+
+const std::uint64_t Readahead::kBlockBytes;
+
+#if defined(NOVELREADER_HAVE_IO_URING)
+
+// A minimal io_uring driven through the raw system calls: one submission
+// ring of kQueueDepth entries and one registered buffer per entry. Owns the
+// file descriptor once setup() succeeds.
+struct Readahead::Ring {
+    int ring_fd = -1;
+    int file_fd = -1;
+    void *sq_ring = nullptr;
+    size_t sq_ring_bytes = 0;
+    void *cq_ring = nullptr;
+    size_t cq_ring_bytes = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_bytes = 0;
+    unsigned *sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe *cqes = nullptr;
+    char *buffers = nullptr;
+    std::vector<unsigned> free_slots;
+    bool buffers_registered = false;
+
+    ~Ring() { teardown(); }
+
+    bool setup(int fd)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, kQueueDepth, &params));
+        if (ring_fd < 0) return false;
+
+        sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap && cq_ring_bytes > sq_ring_bytes) sq_ring_bytes = cq_ring_bytes;
+        sq_ring = mmap(nullptr, sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                       IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED)
+        {
+            sq_ring = nullptr;
+            return false;
+        }
+        if (single_mmap)
+        {
+            cq_ring = sq_ring;
+        }
+        else
+        {
+            cq_ring = mmap(nullptr, cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                           IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED)
+            {
+                cq_ring = nullptr;
+                return false;
+            }
+        }
+        sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        void *mapped_sqes =
+            mmap(nullptr, sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (mapped_sqes == MAP_FAILED) return false;
+        sqes = static_cast<io_uring_sqe *>(mapped_sqes);
+
+        char *sq = static_cast<char *>(sq_ring);
+        char *cq = static_cast<char *>(cq_ring);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        // Registered once, so each read skips pinning and unpinning its buffer.
+        void *memory = mmap(nullptr, kQueueDepth * kBlockBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                            -1, 0);
+        if (memory == MAP_FAILED) return false;
+        buffers = static_cast<char *>(memory);
+        std::vector<iovec> iovecs(kQueueDepth);
+        for (unsigned slot = 0; slot < kQueueDepth; ++slot)
+        {
+            iovecs[slot].iov_base = buffers + slot * kBlockBytes;
+            iovecs[slot].iov_len = kBlockBytes;
+            free_slots.push_back(kQueueDepth - 1 - slot);
+        }
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iovecs.data(), kQueueDepth) != 0)
+        {
+            return false;
+        }
+        buffers_registered = true;
+        file_fd = fd;
+        return true;
+    }
+
+    // Collects finished reads without waiting.
+    void reap()
+    {
+        unsigned head = *cq_head;
+        const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            free_slots.push_back(static_cast<unsigned>(cqes[head & cq_mask].user_data));
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // Submits reads of `blocks`, as many as there are free buffers, in one
+    // system call; returns how many went out (the first ones of `blocks`), or
+    // -1 if the ring failed.
+    int submit(const std::vector<std::uint64_t> &blocks)
+    {
+        unsigned tail = *sq_tail;
+        unsigned queued = 0;
+        std::vector<unsigned> slots;
+        for (std::uint64_t block : blocks)
+        {
+            if (free_slots.empty()) break;
+            const unsigned slot = free_slots.back();
+            free_slots.pop_back();
+            slots.push_back(slot);
+            const unsigned index = tail & sq_mask;
+            io_uring_sqe &sqe = sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ_FIXED;
+            sqe.fd = file_fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(buffers + slot * kBlockBytes);
+            sqe.len = static_cast<std::uint32_t>(kBlockBytes);
+            sqe.off = block * kBlockBytes;
+            sqe.buf_index = static_cast<std::uint16_t>(slot);
+            sqe.user_data = slot;
+            sq_array[index] = index;
+            ++tail;
+            ++queued;
+        }
+        if (queued == 0) return 0;
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        long submitted;
+        do
+        {
+            submitted = syscall(__NR_io_uring_enter, ring_fd, queued, 0, 0, nullptr, 0);
+        } while (submitted < 0 && errno == EINTR);
+        const unsigned accepted = submitted < 0 ? 0 : static_cast<unsigned>(submitted);
+        if (accepted < queued)
+        {
+            // The kernel took only the first entries; without SQPOLL it reads
+            // the ring only inside io_uring_enter, so the rest can be taken back.
+            __atomic_store_n(sq_tail, tail - (queued - accepted), __ATOMIC_RELEASE);
+            for (unsigned i = accepted; i < queued; ++i) free_slots.push_back(slots[i]);
+        }
+        return submitted < 0 ? -1 : static_cast<int>(submitted);
+    }
+
+    void teardown()
+    {
+        // The kernel may still be writing into the buffers; wait for every read.
+        while (ring_fd >= 0 && buffers_registered && free_slots.size() < kQueueDepth)
+        {
+            const long waited = syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (waited < 0 && errno != EINTR) break;
+            reap();
+        }
+        if (ring_fd >= 0) ::close(ring_fd);
+        ring_fd = -1;
+        if (file_fd >= 0) ::close(file_fd);
+        file_fd = -1;
+        if (buffers != nullptr) munmap(buffers, kQueueDepth * kBlockBytes);
+        buffers = nullptr;
+        if (sqes != nullptr) munmap(sqes, sqes_bytes);
+        sqes = nullptr;
+        if (cq_ring != nullptr && cq_ring != sq_ring) munmap(cq_ring, cq_ring_bytes);
+        cq_ring = nullptr;
+        if (sq_ring != nullptr) munmap(sq_ring, sq_ring_bytes);
+        sq_ring = nullptr;
+        free_slots.clear();
+        buffers_registered = false;
+    }
+};
+
+#else
+
+struct Readahead::Ring {
+    int file_fd = -1;
+    bool setup(int) { return false; }
+    void reap() {}
+    int submit(const std::vector<std::uint64_t> &) { return -1; }
+};
+
+#endif
+
+// Fallback: blocking positioned reads off a shared queue, drained by at most
+// kPoolThreads Tasks::Priority::Prefetch tasks of the shared scheduler.
+struct Readahead::Pool {
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int file_fd = -1;
+#endif
+    std::mutex mutex;
+    std::deque<std::uint64_t> queue;
+    bool stopping = false;
+    // Drain tasks submitted and not yet returned.
+    size_t readers = 0;
+    Tasks::TaskGroup readers_group;
+
+    ~Pool() { stop(); }
+
+    // Replaces the queued reads with `blocks`; returns the ones dropped unread.
+    std::vector<std::uint64_t> replace(const std::vector<std::uint64_t> &blocks)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::uint64_t> dropped(queue.begin(), queue.end());
+        queue.assign(blocks.begin(), blocks.end());
+        while (!stopping && readers < kPoolThreads && readers < queue.size())
+        {
+            ++readers;
+            Tasks::shared_scheduler().submit(Tasks::Priority::Prefetch, [this]() { drain(); }, Tasks::CancelToken(),
+                                             &readers_group);
+        }
+        return dropped;
+    }
+
+    void drain()
+    {
+        std::vector<char> buffer(static_cast<size_t>(kBlockBytes));
+        while (true)
+        {
+            std::uint64_t block = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping || queue.empty())
+                {
+                    --readers;
+                    return;
+                }
+                block = queue.front();
+                queue.pop_front();
+            }
+            TRACE_SPAN("readahead block");
+            const std::uint64_t offset = block * kBlockBytes;
+#ifdef _WIN32
+            OVERLAPPED at = {};
+            at.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFu);
+            at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD got = 0;
+            ReadFile(file, buffer.data(), static_cast<DWORD>(buffer.size()), &got, &at);
+#else
+            ssize_t got;
+            do
+            {
+                got = pread(file_fd, buffer.data(), buffer.size(), static_cast<off_t>(offset));
+            } while (got < 0 && errno == EINTR);
+#endif
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        readers_group.wait();
+#ifdef _WIN32
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (file_fd >= 0) ::close(file_fd);
+        file_fd = -1;
+#endif
+    }
+};
+
+Readahead::Readahead() = default;
+
+Readahead::~Readahead()
+{
+    close();
+}
+
+bool Readahead::open(const std::string &path, std::string *error_message)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        if (error_message) *error_message = "CreateFile failed";
+        return false;
+    }
+    pool_.reset(new Pool);
+    pool_->file = file;
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (error_message) *error_message = std::strerror(errno);
+        return false;
+    }
+    ring_.reset(new Ring);
+    if (ring_->setup(fd)) return true;
+    // io_uring is missing, disabled (e.g. by a seccomp filter) or short of locked memory.
+    ring_.reset();
+    pool_.reset(new Pool);
+    pool_->file_fd = fd;
+#endif
+    return true;
+}
+
+void Readahead::close()
+{
+    ring_.reset();
+    pool_.reset();
+    forget();
+}
+
+bool Readahead::is_open() const
+{
+    return ring_ || pool_;
+}
+
+const char *Readahead::backend_name() const
+{
+    if (ring_) return "io_uring";
+    if (pool_) return "threads";
+    return "";
+}
+
+void Readahead::forget()
+{
+    fetched_.clear();
+    fetch_order_.clear();
+}
+
+void Readahead::remember(std::uint64_t block)
+{
+    if (!fetched_.insert(block).second) return;
+    fetch_order_.push_back(block);
+    if (fetch_order_.size() > kRememberedBlocks)
+    {
+        fetched_.erase(fetch_order_.front());
+        fetch_order_.pop_front();
+    }
+}
+
+void Readahead::prefetch_around(std::uint64_t offset, std::uint64_t file_size)
+{
+    if (!is_open() || file_size == 0) return;
+    const std::uint64_t last_block = (file_size - 1) / kBlockBytes;
+    const std::uint64_t cursor = offset / kBlockBytes < last_block ? offset / kBlockBytes : last_block;
+
+    // The cursor's block, the one before it (paging back a screen), then ahead, then further behind.
+    std::vector<std::uint64_t> wanted;
+    auto want = [&](std::uint64_t block) {
+        if (block <= last_block && !remembered(block)) wanted.push_back(block);
+    };
+    want(cursor);
+    if (cursor >= 1) want(cursor - 1);
+    for (std::uint64_t i = 1; i <= kAheadBlocks; ++i) want(cursor + i);
+    for (std::uint64_t i = 2; i <= kBehindBlocks && i <= cursor; ++i) want(cursor - i);
+    if (wanted.empty()) return;
+
+    TRACE_SPAN("readahead submit");
+    if (ring_)
+    {
+        ring_->reap();
+        const int submitted = ring_->submit(wanted);
+        if (submitted >= 0)
+        {
+            for (int i = 0; i < submitted; ++i) remember(wanted[static_cast<size_t>(i)]);
+            return;
+        }
+#ifndef _WIN32
+        // The ring stopped working; carry on with threads.
+        const int fd = ::dup(ring_->file_fd);
+        ring_.reset();
+        if (fd < 0) return;
+        pool_.reset(new Pool);
+        pool_->file_fd = fd;
+#endif
+    }
+    if (wanted.size() > kQueueDepth) wanted.resize(kQueueDepth);
+    for (std::uint64_t block : pool_->replace(wanted)) fetched_.erase(block);
+    for (std::uint64_t block : wanted) remember(block);
+}
+
+} // namespace FileView
@@ -0,0 +1,670 @@
+#include "reader_daemon.h"
+
+#include "encoding_utils.h"
+#include "file_system_utils.h"
+#include "junk_filter.h"
+#include "mapped_window.h"
+#include "platform_utils.h"
+#include "task_scheduler.h"
+#include "trace.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <vector>
+
+#ifndef _WIN32
+#include <climits>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace ReaderDaemon {
+
+namespace {
+
+// Lets LineIndex::read() parse the shared index where it is mapped.
+class MemoryBuffer : public std::streambuf {
+public:
+    MemoryBuffer(const char *data, size_t size)
+    {
+        char *begin = const_cast<char *>(data);
+        setg(begin, begin, begin + size);
+    }
+};
+
+} // namespace
+
+BookInfo::~BookInfo()
+{
+    release();
+}
+
+bool BookInfo::load_index(TextIndex::LineIndex &index, std::istream &file, std::uint64_t file_size) const
+{
+    if (index_data_ == nullptr) return false;
+    MemoryBuffer buffer(index_data_, index_bytes_);
+    std::istream in(&buffer);
+    return index.read(in, file, file_size);
+}
+
+#ifdef _WIN32
+
+void BookInfo::release()
+{
+    index_data_ = nullptr;
+    index_bytes_ = 0;
+}
+
+std::string socket_path()
+{
+    return "";
+}
+
+bool run(std::string *error_message)
+{
+    if (error_message) *error_message = "The reader daemon is not supported on Windows.";
+    return false;
+}
+
+bool request_book(const std::string &, BookInfo &out, std::string *error_message)
+{
+    out.release();
+    if (error_message) *error_message = "The reader daemon is not supported on Windows.";
+    return false;
+}
+
+#else
+
+namespace {
+
+const char kSocketName[] = "NovelReader.sock";
+const size_t kMaxBooks = 8;
+const size_t kMaxMessageBytes = 64 * 1024;
+// The indexer holds a book's lock for this much of the file at a time, so a
+// client asking for the same book never waits long.
+const std::uint64_t kIndexStepBytes = 4 * 1024 * 1024;
+const int kTimeoutMs = 2000;
+const int kPollIntervalMs = 500;
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void request_stop(int)
+{
+    stop_requested = 1;
+}
+
+// Cheap change detection before a book is served again.
+struct FileState {
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0;
+    std::uint64_t inode = 0;
+};
+
+bool stat_file(const std::string &path, FileState &out)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    out.size = static_cast<std::uint64_t>(st.st_size);
+    out.mtime = static_cast<std::int64_t>(st.st_mtime);
+    out.inode = static_cast<std::uint64_t>(st.st_ino);
+    return true;
+}
+
+bool fill_address(const std::string &path, sockaddr_un &address)
+{
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) return false;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+int open_socket()
+{
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0) fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+int connect_to(const std::string &path)
+{
+    sockaddr_un address;
+    if (!fill_address(path, address)) return -1;
+    const int fd = open_socket();
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void set_timeouts(int fd)
+{
+    timeval timeout;
+    timeout.tv_sec = kTimeoutMs / 1000;
+    timeout.tv_usec = (kTimeoutMs % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// Sends `data`, attaching `attached_fd` (if >= 0) to its first byte.
+bool send_message(int socket_fd, const std::string &data, int attached_fd)
+{
+    size_t done = 0;
+    while (done < data.size())
+    {
+        iovec iov;
+        iov.iov_base = const_cast<char *>(data.data() + done);
+        iov.iov_len = data.size() - done;
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+
+        union {
+            cmsghdr align;
+            char space[CMSG_SPACE(sizeof(int))];
+        } control;
+        if (done == 0 && attached_fd >= 0)
+        {
+            std::memset(&control, 0, sizeof(control));
+            message.msg_control = control.space;
+            message.msg_controllen = sizeof(control.space);
+            cmsghdr *header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(header), &attached_fd, sizeof(int));
+        }
+
+        const ssize_t sent = sendmsg(socket_fd, &message, 0);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        done += static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// Reads one '\n'-terminated message (without the newline). A descriptor sent
+// along with it lands in `*received_fd` when that is given; the caller owns it
+// even if the read then fails.
+bool receive_message(int socket_fd, std::string &out, int *received_fd)
+{
+    out.clear();
+    if (received_fd) *received_fd = -1;
+    char chunk[4096];
+    while (out.find('\n') == std::string::npos)
+    {
+        if (out.size() > kMaxMessageBytes) return false;
+        iovec iov;
+        iov.iov_base = chunk;
+        iov.iov_len = sizeof(chunk);
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        union {
+            cmsghdr align;
+            char space[CMSG_SPACE(sizeof(int))];
+        } control;
+        if (received_fd)
+        {
+            message.msg_control = control.space;
+            message.msg_controllen = sizeof(control.space);
+        }
+
+        const ssize_t got = recvmsg(socket_fd, &message, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        if (received_fd)
+        {
+            for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr;
+                 header = CMSG_NXTHDR(&message, header))
+            {
+                if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) continue;
+                int fd = -1;
+                std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+                if (*received_fd < 0)
+                {
+                    *received_fd = fd;
+                }
+                else
+                {
+                    close(fd);
+                }
+            }
+        }
+        out.append(chunk, static_cast<size_t>(got));
+    }
+    out.resize(out.find('\n'));
+    return true;
+}
+
+std::vector<std::string> split_tabs(const std::string &text, size_t max_fields)
+{
+    std::vector<std::string> fields;
+    size_t begin = 0;
+    while (fields.size() + 1 < max_fields)
+    {
+        const size_t tab = text.find('\t', begin);
+        if (tab == std::string::npos) break;
+        fields.push_back(text.substr(begin, tab - begin));
+        begin = tab + 1;
+    }
+    fields.push_back(text.substr(begin));
+    return fields;
+}
+
+// Anonymous shared memory holding `contents`, sealed against changes where
+// the platform allows it; -1 on failure.
+int create_shared_object(const std::string &contents)
+{
+    if (contents.empty()) return -1;
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+    const int fd = memfd_create("novelreader-index", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    static std::atomic<unsigned> counter(0);
+    // The name only exists until the unlink below.
+    const std::string name = "/novelreader-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+    {
+        shm_unlink(name.c_str());
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (fd < 0) return -1;
+    if (ftruncate(fd, static_cast<off_t>(contents.size())) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    void *view = mmap(nullptr, contents.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    std::memcpy(view, contents.data(), contents.size());
+    munmap(view, contents.size());
+#ifdef F_ADD_SEALS
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    return fd;
+}
+
+struct Book {
+    std::mutex mutex;
+    std::string path;
+    FileState state;
+    std::ifstream stream;
+    std::string encoding;
+    Fingerprint::BookFingerprint fingerprint;
+    TextIndex::LineIndex index;
+    std::uint64_t revision = 0; // bumped whenever the file changes under the index
+
+    // The index as last serialized for clients.
+    int shared_fd = -1;
+    std::uint64_t shared_bytes = 0;
+    std::uint64_t shared_revision = 0;
+    std::uint64_t shared_scanned = 0;
+
+    // Background indexing runs as a chain of Bulk tasks, one step each.
+    Tasks::TaskGroup indexer;
+    Tasks::CancelToken stop;
+    std::atomic<bool> indexing{false};
+
+    ~Book()
+    {
+        stop.cancel();
+        indexer.wait();
+        if (shared_fd >= 0) close(shared_fd);
+    }
+};
+
+bool is_utf16(const std::string &encoding)
+{
+    return encoding == "UTF-16LE" || encoding == "UTF-16BE";
+}
+
+// (Re)opens `book` from scratch. Called with the book's lock held.
+bool open_book(Book &book, std::string &error)
+{
+    if (book.stream.is_open()) book.stream.close();
+    book.stream.clear();
+    book.stream.open(book.path, std::ios::in | std::ios::binary);
+    if (!book.stream.is_open() || !stat_file(book.path, book.state))
+    {
+        error = "Could not open " + book.path;
+        return false;
+    }
+    if (!Fingerprint::compute_fingerprint(book.path, book.fingerprint, &error)) return false;
+    book.encoding = EncodingUtils::detect_encoding(book.path);
+    book.index.set_encoding(book.encoding);
+    book.index.set_max_line_bytes(TextIndex::read_max_line_bytes());
+    book.index.set_junk_patterns(
+        TextIndex::encode_junk_patterns(TextIndex::read_junk_patterns(TextIndex::junk_patterns_path()), book.encoding));
+    book.index.reset(TextIndex::stream_size(book.stream));
+    ++book.revision;
+    return true;
+}
+
+// Brings an already open book up to date with its file. Called with the lock held.
+bool update_book(Book &book, std::string &error)
+{
+    FileState now;
+    if (!stat_file(book.path, now))
+    {
+        error = "Could not open " + book.path;
+        return false;
+    }
+    if (now.size == book.state.size && now.mtime == book.state.mtime && now.inode == book.state.inode) return true;
+    if (now.inode != book.state.inode) return open_book(book, error);
+
+    book.state = now;
+    const TextIndex::RefreshResult result = book.index.refresh(book.stream, TextIndex::stream_size(book.stream));
+    if (!Fingerprint::compute_fingerprint(book.path, book.fingerprint, &error)) return false;
+    if (result != TextIndex::RefreshResult::Unchanged) ++book.revision;
+    return true;
+}
+
+// Indexes one step of the book, then queues the next step behind whatever
+// more urgent work has arrived in the meantime.
+void index_step(Book *book)
+{
+    TRACE_SPAN("daemon index step");
+    std::uint64_t begin = 0;
+    std::uint64_t end = 0;
+    std::uint64_t file_size = 0;
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lock(book->mutex);
+        done = book->index.fully_indexed();
+        if (!done)
+        {
+            begin = book->index.scanned_bytes();
+            book->index.index_through_offset(book->stream, begin + kIndexStepBytes);
+            end = book->index.scanned_bytes();
+            file_size = book->index.file_size();
+        }
+    }
+    if (done || end <= begin) // end <= begin: the file shrank; the next request refreshes it
+    {
+        book->indexing = false;
+        return;
+    }
+    // Leave small books cached for the clients that are about to read them.
+    if (file_size > FileView::MappedWindow::kWindowBytes)
+    {
+        FileView::release_page_cache(book->path, begin, end - begin);
+    }
+    // A cancelled step is dropped unrun; `indexing` no longer matters then.
+    Tasks::shared_scheduler().submit(Tasks::Priority::Bulk, [book]() { index_step(book); }, book->stop, &book->indexer);
+}
+
+// Starts indexing the rest of the book unless that is done or under way. Called with the lock held.
+void ensure_indexer(Book &book)
+{
+    if (book.indexing || book.index.fully_indexed() || is_utf16(book.encoding)) return;
+    book.indexing = true;
+    Book *indexed = &book;
+    Tasks::shared_scheduler().submit(Tasks::Priority::Bulk, [indexed]() { index_step(indexed); }, book.stop,
+                                     &book.indexer);
+}
+
+// Serializes the index for clients if it changed since last time. Called with the lock held.
+bool share_index(Book &book)
+{
+    if (book.shared_fd >= 0 && book.shared_revision == book.revision &&
+        book.shared_scanned == book.index.scanned_bytes())
+    {
+        return true;
+    }
+    std::ostringstream contents;
+    book.index.write(contents);
+    const int fd = create_shared_object(contents.str());
+    if (fd < 0) return false;
+    // Clients that were already handed the old object keep their own reference.
+    if (book.shared_fd >= 0) close(book.shared_fd);
+    book.shared_fd = fd;
+    book.shared_bytes = contents.str().size();
+    book.shared_revision = book.revision;
+    book.shared_scanned = book.index.scanned_bytes();
+    return true;
+}
+
+class Server {
+public:
+    void serve(int client)
+    {
+        set_timeouts(client);
+        std::string request;
+        if (!receive_message(client, request, nullptr)) return;
+
+        const std::vector<std::string> fields = split_tabs(request, 2);
+        if (fields.size() != 2 || fields[0] != "OPEN" || fields[1].empty())
+        {
+            send_message(client, "ERR\tUnknown request\n", -1);
+            return;
+        }
+
+        std::shared_ptr<Book> book = find_book(fields[1]);
+        std::lock_guard<std::mutex> lock(book->mutex);
+        std::string error;
+        const bool ready = book->stream.is_open() ? update_book(*book, error) : open_book(*book, error);
+        if (!ready)
+        {
+            book->stream.close();
+            send_message(client, "ERR\t" + error + "\n", -1);
+            return;
+        }
+        ensure_indexer(*book);
+        if (!share_index(*book))
+        {
+            send_message(client, "ERR\tCould not share the line index\n", -1);
+            return;
+        }
+
+        std::ostringstream reply;
+        reply << "OK\t" << book->fingerprint.to_string() << '\t' << book->encoding << '\t' << book->shared_bytes
+              << '\n';
+        send_message(client, reply.str(), book->shared_fd);
+    }
+
+    void clear() { books_.clear(); }
+
+private:
+    // Most recently used first; the oldest is dropped beyond kMaxBooks.
+    std::shared_ptr<Book> find_book(const std::string &path)
+    {
+        for (auto it = books_.begin(); it != books_.end(); ++it)
+        {
+            if ((*it)->path == path)
+            {
+                books_.splice(books_.begin(), books_, it);
+                return books_.front();
+            }
+        }
+        std::shared_ptr<Book> book = std::make_shared<Book>();
+        book->path = path;
+        books_.push_front(book);
+        if (books_.size() > kMaxBooks) books_.pop_back();
+        return book;
+    }
+
+    std::list<std::shared_ptr<Book>> books_;
+};
+
+} // namespace
+
+void BookInfo::release()
+{
+    if (index_data_ != nullptr) munmap(const_cast<char *>(index_data_), index_bytes_);
+    index_data_ = nullptr;
+    index_bytes_ = 0;
+}
+
+std::string socket_path()
+{
+    const char *runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir != nullptr && runtime_dir[0] != '\0')
+    {
+        return std::string(runtime_dir) + PlatformUtils::get_path_separator() + kSocketName;
+    }
+    const std::string cache_dir = FileSystemUtils::get_cache_directory_path();
+    if (cache_dir.empty()) return "";
+    return cache_dir + PlatformUtils::get_path_separator() + "daemon.sock";
+}
+
+bool run(std::string *error_message)
+{
+    const std::string path = socket_path();
+    sockaddr_un address;
+    if (!fill_address(path, address))
+    {
+        if (error_message) *error_message = "No usable socket path: " + path;
+        return false;
+    }
+    const int existing = connect_to(path);
+    if (existing >= 0)
+    {
+        close(existing);
+        if (error_message) *error_message = "A reader daemon is already running on " + path;
+        return false;
+    }
+    if (std::getenv("XDG_RUNTIME_DIR") == nullptr)
+    {
+        FileSystemUtils::create_directory_if_not_exists(FileSystemUtils::get_cache_directory_path());
+    }
+
+    // Nobody answered, so whatever is left at `path` is stale.
+    unlink(path.c_str());
+    const int listener = open_socket();
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        chmod(path.c_str(), 0600) != 0 || listen(listener, 16) != 0)
+    {
+        if (error_message) *error_message = "Could not listen on " + path + ": " + std::strerror(errno);
+        if (listener >= 0) close(listener);
+        return false;
+    }
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "NovelReader daemon listening on " << path << " (Ctrl+C to stop)" << std::endl;
+    Server server;
+    while (!stop_requested)
+    {
+        pollfd ready;
+        ready.fd = listener;
+        ready.events = POLLIN;
+        ready.revents = 0;
+        if (poll(&ready, 1, kPollIntervalMs) <= 0) continue;
+        const int client = accept(listener, nullptr, nullptr);
+        if (client < 0) continue;
+        fcntl(client, F_SETFD, FD_CLOEXEC);
+        server.serve(client);
+        close(client);
+    }
+
+    close(listener);
+    unlink(path.c_str());
+    server.clear();
+    return true;
+}
+
+bool request_book(const std::string &path, BookInfo &out, std::string *error_message)
+{
+    out.release();
+    out.fingerprint = Fingerprint::BookFingerprint{};
+    out.encoding.clear();
+
+    const int fd = connect_to(socket_path());
+    if (fd < 0)
+    {
+        if (error_message) *error_message = "No reader daemon is running.";
+        return false;
+    }
+    set_timeouts(fd);
+
+    // The daemon keys books by absolute path and may run in another directory.
+    std::string absolute = path;
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) != nullptr) absolute = resolved;
+
+    std::string reply;
+    int shared_fd = -1;
+    const bool answered = send_message(fd, "OPEN\t" + absolute + "\n", -1) && receive_message(fd, reply, &shared_fd);
+    close(fd);
+
+    const std::vector<std::string> fields = split_tabs(reply, 4);
+    std::uint64_t bytes = 0;
+    bool ok = answered && fields.size() == 4 && fields[0] == "OK" &&
+              Fingerprint::parse_fingerprint(fields[1], out.fingerprint) && shared_fd >= 0;
+    if (ok)
+    {
+        try
+        {
+            bytes = static_cast<std::uint64_t>(std::stoull(fields[3]));
+        }
+        catch (...)
+        {
+            ok = false;
+        }
+    }
+    struct stat st;
+    if (ok && (bytes == 0 || fstat(shared_fd, &st) != 0 || static_cast<std::uint64_t>(st.st_size) < bytes)) ok = false;
+    if (ok)
+    {
+        void *view = mmap(nullptr, static_cast<size_t>(bytes), PROT_READ, MAP_SHARED, shared_fd, 0);
+        if (view != MAP_FAILED)
+        {
+            out.index_data_ = static_cast<const char *>(view);
+            out.index_bytes_ = static_cast<size_t>(bytes);
+            out.encoding = fields[2];
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+    if (shared_fd >= 0) close(shared_fd);
+
+    if (!ok)
+    {
+        out.fingerprint = Fingerprint::BookFingerprint{};
+        if (error_message)
+        {
+            *error_message = (answered && fields.size() >= 2 && fields[0] == "ERR") ? fields[1]
+                                                                                    : "Bad reply from the reader daemon.";
+        }
+    }
+    return ok;
+}
+
+#endif
+
+} // namespace ReaderDaemon
@@ -0,0 +1,1073 @@
+#include "regex_search.h"
+
+#include "encoding_utils.h"
+#include "mapped_window.h"
+#include "task_scheduler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace TextSearch {
+
+namespace {
+
+const std::uint32_t kMaxCodePoint = 0x10FFFF;
+// Bounds on {n,m} and on the compiled automaton, so a pattern can't blow up.
+const int kMaxRepeat = 1000;
+const size_t kMaxStates = 200000;
+const std::uint64_t kChunkBytes = 8 * 1024 * 1024;
+const size_t kMaxSearchThreads = 8;
+const size_t kMatcherMemoryBudget = 2 * 1024 * 1024;
+// Lines between checks of the cancel flag.
+const size_t kCancelCheckLines = 4096;
+
+typedef std::vector<std::pair<std::uint32_t, std::uint32_t>> CodePointRanges;
+
+void normalize(CodePointRanges &ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+    CodePointRanges merged;
+    for (const auto &range : ranges)
+    {
+        if (!merged.empty() && range.first <= merged.back().second + 1)
+        {
+            merged.back().second = std::max(merged.back().second, range.second);
+        }
+        else
+        {
+            merged.push_back(range);
+        }
+    }
+    ranges.swap(merged);
+}
+
+// Everything but `ranges` and '\n' (lines never contain one).
+CodePointRanges complement(CodePointRanges ranges)
+{
+    ranges.push_back(std::make_pair(std::uint32_t('\n'), std::uint32_t('\n')));
+    normalize(ranges);
+    CodePointRanges out;
+    std::uint32_t next = 0;
+    for (const auto &range : ranges)
+    {
+        if (range.first > next) out.push_back(std::make_pair(next, range.first - 1));
+        next = range.second + 1;
+    }
+    if (next <= kMaxCodePoint) out.push_back(std::make_pair(next, kMaxCodePoint));
+    return out;
+}
+
+size_t encode_utf8(std::uint32_t cp, unsigned char *out)
+{
+    if (cp < 0x80)
+    {
+        out[0] = static_cast<unsigned char>(cp);
+        return 1;
+    }
+    if (cp < 0x800)
+    {
+        out[0] = static_cast<unsigned char>(0xC0 | (cp >> 6));
+        out[1] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000)
+    {
+        out[0] = static_cast<unsigned char>(0xE0 | (cp >> 12));
+        out[1] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = static_cast<unsigned char>(0xF0 | (cp >> 18));
+    out[1] = static_cast<unsigned char>(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+typedef std::vector<std::pair<unsigned char, unsigned char>> ByteSequence;
+
+// Splits [lo, hi] into runs whose UTF-8 encodings differ only in ranges of
+// each byte, so each run is one sequence of byte ranges (as in RE2).
+void utf8_sequences(std::uint32_t lo, std::uint32_t hi, std::vector<ByteSequence> &out)
+{
+    if (lo > hi) return;
+    // Surrogates are not characters.
+    if (lo <= 0xDFFF && hi >= 0xD800)
+    {
+        if (lo < 0xD800) utf8_sequences(lo, 0xD7FF, out);
+        if (hi > 0xDFFF) utf8_sequences(0xE000, hi, out);
+        return;
+    }
+    // Never straddle a change of encoded length.
+    static const std::uint32_t kLengthLimits[] = {0x7F, 0x7FF, 0xFFFF};
+    for (std::uint32_t limit : kLengthLimits)
+    {
+        if (lo <= limit && hi > limit)
+        {
+            utf8_sequences(lo, limit, out);
+            utf8_sequences(limit + 1, hi, out);
+            return;
+        }
+    }
+    unsigned char lo_bytes[4];
+    unsigned char hi_bytes[4];
+    const size_t length = encode_utf8(lo, lo_bytes);
+    for (size_t i = 1; i < length; ++i)
+    {
+        // Below the top i continuation bytes, lo must start and hi must end a full block.
+        const std::uint32_t mask = (1u << (6 * i)) - 1;
+        if ((lo & ~mask) != (hi & ~mask))
+        {
+            if ((lo & mask) != 0)
+            {
+                utf8_sequences(lo, lo | mask, out);
+                utf8_sequences((lo | mask) + 1, hi, out);
+                return;
+            }
+            if ((hi & mask) != mask)
+            {
+                utf8_sequences(lo, (hi & ~mask) - 1, out);
+                utf8_sequences(hi & ~mask, hi, out);
+                return;
+            }
+        }
+    }
+    encode_utf8(hi, hi_bytes);
+    ByteSequence sequence;
+    for (size_t i = 0; i < length; ++i) sequence.push_back(std::make_pair(lo_bytes[i], hi_bytes[i]));
+    out.push_back(sequence);
+}
+
+struct Node {
+    enum Kind { Empty, Chars, Concat, Alternate, Repeat, EndOfLine };
+    Kind kind = Empty;
+    CodePointRanges chars;
+    std::vector<int> children;
+    int min = 0;
+    int max = 0; // -1: unbounded
+};
+
+class Parser {
+public:
+    explicit Parser(const std::string &pattern) : pattern_(pattern) {}
+
+    // The syntax tree's root, or -1 with error() set.
+    int parse(bool &anchored)
+    {
+        size_t end = pattern_.size();
+        anchored = !pattern_.empty() && pattern_[0] == '^';
+        if (anchored) pos_ = 1;
+        // A final '$' counts unless it is escaped.
+        bool at_end = false;
+        if (end > pos_ && pattern_[end - 1] == '$')
+        {
+            size_t backslashes = 0;
+            while (end - 1 - backslashes > pos_ && pattern_[end - 2 - backslashes] == '\\') ++backslashes;
+            if (backslashes % 2 == 0)
+            {
+                at_end = true;
+                --end;
+            }
+        }
+        end_ = end;
+
+        int root = parse_alternation();
+        if (root < 0) return -1;
+        if (pos_ < end_)
+        {
+            error_ = "unmatched ')'";
+            return -1;
+        }
+        if (at_end)
+        {
+            Node tail;
+            tail.kind = Node::EndOfLine;
+            Node concat;
+            concat.kind = Node::Concat;
+            concat.children.push_back(root);
+            concat.children.push_back(add(tail));
+            root = add(concat);
+        }
+        return root;
+    }
+
+    const std::vector<Node> &nodes() const { return nodes_; }
+    const std::string &error() const { return error_; }
+
+private:
+    int add(const Node &node)
+    {
+        nodes_.push_back(node);
+        return static_cast<int>(nodes_.size() - 1);
+    }
+
+    bool more() const { return pos_ < end_; }
+    char peek() const { return pattern_[pos_]; }
+
+    int fail(const std::string &message)
+    {
+        if (error_.empty()) error_ = message;
+        return -1;
+    }
+
+    int parse_alternation()
+    {
+        Node alternate;
+        alternate.kind = Node::Alternate;
+        while (true)
+        {
+            const int branch = parse_concat();
+            if (branch < 0) return -1;
+            alternate.children.push_back(branch);
+            if (!more() || peek() != '|') break;
+            ++pos_;
+        }
+        return alternate.children.size() == 1 ? alternate.children[0] : add(alternate);
+    }
+
+    int parse_concat()
+    {
+        Node concat;
+        concat.kind = Node::Concat;
+        while (more() && peek() != '|' && peek() != ')')
+        {
+            const int item = parse_repeat();
+            if (item < 0) return -1;
+            concat.children.push_back(item);
+        }
+        if (concat.children.empty()) return add(Node());
+        return concat.children.size() == 1 ? concat.children[0] : add(concat);
+    }
+
+    int parse_repeat()
+    {
+        int atom = parse_atom();
+        while (atom >= 0 && more())
+        {
+            int min = 0;
+            int max = 0;
+            const char c = peek();
+            if (c == '*')
+            {
+                max = -1;
+                ++pos_;
+            }
+            else if (c == '+')
+            {
+                min = 1;
+                max = -1;
+                ++pos_;
+            }
+            else if (c == '?')
+            {
+                max = 1;
+                ++pos_;
+            }
+            else if (c != '{' || !parse_counts(min, max))
+            {
+                break;
+            }
+            if (max > kMaxRepeat || min > kMaxRepeat) return fail("repeat count above 1000");
+            if (max >= 0 && min > max) return fail("bad repeat range");
+            // Lazy quantifiers match the same lines.
+            if (more() && peek() == '?') ++pos_;
+            Node repeat;
+            repeat.kind = Node::Repeat;
+            repeat.children.push_back(atom);
+            repeat.min = min;
+            repeat.max = max;
+            atom = add(repeat);
+        }
+        return atom;
+    }
+
+    // "{n}", "{n,}" or "{n,m}" at pos_; anything else is left as a literal '{'.
+    bool parse_counts(int &min, int &max)
+    {
+        size_t at = pos_ + 1;
+        auto number = [&](int &value) {
+            const size_t begin = at;
+            long long parsed = 0;
+            while (at < end_ && pattern_[at] >= '0' && pattern_[at] <= '9' && at - begin < 9)
+            {
+                parsed = parsed * 10 + (pattern_[at] - '0');
+                ++at;
+            }
+            value = static_cast<int>(parsed);
+            return at > begin;
+        };
+        if (!number(min)) return false;
+        max = min;
+        if (at < end_ && pattern_[at] == ',')
+        {
+            ++at;
+            if (!number(max)) max = -1;
+        }
+        if (at >= end_ || pattern_[at] != '}') return false;
+        pos_ = at + 1;
+        return true;
+    }
+
+    bool read_code_point(std::uint32_t &cp)
+    {
+        const unsigned char lead = static_cast<unsigned char>(pattern_[pos_]);
+        size_t length = 1;
+        if (lead >= 0xF0 && lead < 0xF5)
+        {
+            length = 4;
+            cp = lead & 0x07;
+        }
+        else if (lead >= 0xE0)
+        {
+            length = 3;
+            cp = lead & 0x0F;
+        }
+        else if (lead >= 0xC2)
+        {
+            length = 2;
+            cp = lead & 0x1F;
+        }
+        else if (lead < 0x80)
+        {
+            cp = lead;
+        }
+        else
+        {
+            fail("pattern is not valid UTF-8");
+            return false;
+        }
+        if (length > 1 && (lead >= 0xF5 || pos_ + length > end_))
+        {
+            fail("pattern is not valid UTF-8");
+            return false;
+        }
+        for (size_t i = 1; i < length; ++i)
+        {
+            const unsigned char next = static_cast<unsigned char>(pattern_[pos_ + i]);
+            if ((next & 0xC0) != 0x80)
+            {
+                fail("pattern is not valid UTF-8");
+                return false;
+            }
+            cp = (cp << 6) | (next & 0x3F);
+        }
+        pos_ += length;
+        return true;
+    }
+
+    // Class escapes (\d \w \s and their negations); false for anything else.
+    static bool class_escape(char c, CodePointRanges &out)
+    {
+        CodePointRanges ranges;
+        switch (c)
+        {
+            case 'd':
+            case 'D':
+                ranges.push_back(std::make_pair(std::uint32_t('0'), std::uint32_t('9')));
+                break;
+            case 'w':
+            case 'W':
+                ranges.push_back(std::make_pair(std::uint32_t('0'), std::uint32_t('9')));
+                ranges.push_back(std::make_pair(std::uint32_t('A'), std::uint32_t('Z')));
+                ranges.push_back(std::make_pair(std::uint32_t('a'), std::uint32_t('z')));
+                ranges.push_back(std::make_pair(std::uint32_t('_'), std::uint32_t('_')));
+                break;
+            case 's':
+            case 'S':
+                ranges.push_back(std::make_pair(std::uint32_t('\t'), std::uint32_t('\r')));
+                ranges.push_back(std::make_pair(std::uint32_t(' '), std::uint32_t(' ')));
+                ranges.push_back(std::make_pair(std::uint32_t(0x3000), std::uint32_t(0x3000))); // 全角空格
+                break;
+            default:
+                return false;
+        }
+        if (c >= 'A' && c <= 'Z') ranges = complement(ranges);
+        out.insert(out.end(), ranges.begin(), ranges.end());
+        return true;
+    }
+
+    // The character after a backslash, as a literal.
+    static std::uint32_t escaped_literal(std::uint32_t c)
+    {
+        switch (c)
+        {
+            case 't':
+                return '\t';
+            case 'r':
+                return '\r';
+            case 'f':
+                return '\f';
+            case 'v':
+                return '\v';
+            default:
+                return c;
+        }
+    }
+
+    int parse_atom()
+    {
+        const char c = peek();
+        Node node;
+        node.kind = Node::Chars;
+        if (c == '(')
+        {
+            ++pos_;
+            if (end_ - pos_ >= 2 && pattern_.compare(pos_, 2, "?:") == 0) pos_ += 2;
+            const int inner = parse_alternation();
+            if (inner < 0) return -1;
+            if (!more() || peek() != ')') return fail("missing ')'");
+            ++pos_;
+            return inner;
+        }
+        if (c == '*' || c == '+' || c == '?') return fail(std::string("nothing to repeat before '") + c + "'");
+        if (c == '^' || c == '$') return fail("'^' and '$' are only supported at the ends of the pattern");
+        if (c == '[') return parse_class();
+        if (c == '.')
+        {
+            ++pos_;
+            node.chars = complement(CodePointRanges());
+            return add(node);
+        }
+        if (c == '\\')
+        {
+            ++pos_;
+            if (!more()) return fail("trailing backslash");
+            if (class_escape(peek(), node.chars))
+            {
+                ++pos_;
+                return add(node);
+            }
+        }
+        std::uint32_t cp = 0;
+        if (!read_code_point(cp)) return -1;
+        if (c == '\\') cp = escaped_literal(cp);
+        node.chars.push_back(std::make_pair(cp, cp));
+        return add(node);
+    }
+
+    int parse_class()
+    {
+        ++pos_; // '['
+        bool negated = false;
+        if (more() && peek() == '^')
+        {
+            negated = true;
+            ++pos_;
+        }
+        Node node;
+        node.kind = Node::Chars;
+        bool first = true;
+        while (true)
+        {
+            if (!more()) return fail("missing ']'");
+            if (peek() == ']' && !first) break;
+            first = false;
+            std::uint32_t lo = 0;
+            if (peek() == '\\')
+            {
+                ++pos_;
+                if (!more()) return fail("missing ']'");
+                if (class_escape(peek(), node.chars))
+                {
+                    ++pos_;
+                    continue;
+                }
+                if (!read_code_point(lo)) return -1;
+                lo = escaped_literal(lo);
+            }
+            else if (!read_code_point(lo))
+            {
+                return -1;
+            }
+            std::uint32_t hi = lo;
+            if (end_ - pos_ >= 2 && peek() == '-' && pattern_[pos_ + 1] != ']')
+            {
+                ++pos_;
+                if (peek() == '\\')
+                {
+                    ++pos_;
+                    if (!more()) return fail("missing ']'");
+                    if (!read_code_point(hi)) return -1;
+                    hi = escaped_literal(hi);
+                }
+                else if (!read_code_point(hi))
+                {
+                    return -1;
+                }
+                if (hi < lo) return fail("bad character range");
+            }
+            node.chars.push_back(std::make_pair(lo, hi));
+        }
+        ++pos_; // ']'
+        if (negated) node.chars = complement(node.chars);
+        normalize(node.chars);
+        return add(node);
+    }
+
+    const std::string &pattern_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    std::vector<Node> nodes_;
+    std::string error_;
+};
+
+// Thompson construction; a fragment's dangling exits are (state, second branch?) pairs.
+class NfaBuilder {
+public:
+    typedef std::vector<std::pair<int, bool>> Exits;
+    struct Fragment {
+        int start;
+        Exits exits;
+    };
+
+    NfaBuilder(const std::vector<Node> &nodes, std::vector<Regex::State> &states) : nodes_(nodes), states_(states) {}
+
+    bool build(int node, Fragment &out)
+    {
+        if (states_.size() > kMaxStates) return false;
+        const Node &n = nodes_[static_cast<size_t>(node)];
+        switch (n.kind)
+        {
+            case Node::Empty:
+                out = epsilon();
+                return true;
+            case Node::EndOfLine:
+            {
+                const int state = add(Regex::StateType::EndOfLine, 0, 0);
+                out.start = state;
+                out.exits.assign(1, std::make_pair(state, false));
+                return true;
+            }
+            case Node::Chars:
+                return build_chars(n.chars, out);
+            case Node::Concat:
+            {
+                if (!build(n.children[0], out)) return false;
+                for (size_t i = 1; i < n.children.size(); ++i)
+                {
+                    Fragment next;
+                    if (!build(n.children[i], next)) return false;
+                    patch(out.exits, next.start);
+                    out.exits.swap(next.exits);
+                }
+                return true;
+            }
+            case Node::Alternate:
+            {
+                std::vector<Fragment> branches(n.children.size());
+                for (size_t i = 0; i < n.children.size(); ++i)
+                {
+                    if (!build(n.children[i], branches[i])) return false;
+                }
+                out = alternate(branches);
+                return true;
+            }
+            case Node::Repeat:
+                return build_repeat(n, out);
+        }
+        return false;
+    }
+
+    void patch(const Exits &exits, int target)
+    {
+        for (const auto &exit : exits)
+        {
+            Regex::State &state = states_[static_cast<size_t>(exit.first)];
+            (exit.second ? state.out1 : state.out) = target;
+        }
+    }
+
+private:
+    int add(Regex::StateType type, std::uint8_t lo, std::uint8_t hi)
+    {
+        Regex::State state;
+        state.type = type;
+        state.lo = lo;
+        state.hi = hi;
+        state.out = -1;
+        state.out1 = -1;
+        states_.push_back(state);
+        return static_cast<int>(states_.size() - 1);
+    }
+
+    Fragment epsilon()
+    {
+        const int state = add(Regex::StateType::Split, 0, 0);
+        Fragment fragment;
+        fragment.start = state;
+        fragment.exits.assign(1, std::make_pair(state, false));
+        return fragment;
+    }
+
+    Fragment alternate(std::vector<Fragment> &branches)
+    {
+        Fragment out = branches.back();
+        for (size_t i = branches.size() - 1; i-- > 0;)
+        {
+            const int split = add(Regex::StateType::Split, 0, 0);
+            states_[static_cast<size_t>(split)].out = branches[i].start;
+            states_[static_cast<size_t>(split)].out1 = out.start;
+            out.start = split;
+            out.exits.insert(out.exits.end(), branches[i].exits.begin(), branches[i].exits.end());
+        }
+        return out;
+    }
+
+    bool build_chars(const CodePointRanges &chars, Fragment &out)
+    {
+        std::vector<ByteSequence> sequences;
+        for (const auto &range : chars) utf8_sequences(range.first, range.second, sequences);
+        if (sequences.empty())
+        {
+            // Matches nothing: a byte range no UTF-8 text contains.
+            const int state = add(Regex::StateType::Bytes, 0xFF, 0xFF);
+            out.start = state;
+            out.exits.assign(1, std::make_pair(state, false));
+            return true;
+        }
+        std::vector<Fragment> branches;
+        for (const ByteSequence &sequence : sequences)
+        {
+            Fragment branch;
+            int previous = -1;
+            for (const auto &bytes : sequence)
+            {
+                const int state = add(Regex::StateType::Bytes, bytes.first, bytes.second);
+                if (previous < 0)
+                {
+                    branch.start = state;
+                }
+                else
+                {
+                    states_[static_cast<size_t>(previous)].out = state;
+                }
+                previous = state;
+            }
+            branch.exits.assign(1, std::make_pair(previous, false));
+            branches.push_back(branch);
+        }
+        out = alternate(branches);
+        return states_.size() <= kMaxStates;
+    }
+
+    bool build_repeat(const Node &n, Fragment &out)
+    {
+        // x{min,max}: min copies, then either a loop or (max - min) nested optional copies.
+        out = epsilon();
+        for (int i = 0; i < n.min; ++i)
+        {
+            Fragment copy;
+            if (!build(n.children[0], copy)) return false;
+            patch(out.exits, copy.start);
+            out.exits.swap(copy.exits);
+        }
+        if (n.max < 0)
+        {
+            Fragment body;
+            if (!build(n.children[0], body)) return false;
+            const int split = add(Regex::StateType::Split, 0, 0);
+            states_[static_cast<size_t>(split)].out = body.start;
+            patch(body.exits, split);
+            patch(out.exits, split);
+            out.exits.assign(1, std::make_pair(split, true));
+            return true;
+        }
+        Exits skipped;
+        for (int i = n.min; i < n.max; ++i)
+        {
+            Fragment body;
+            if (!build(n.children[0], body)) return false;
+            const int split = add(Regex::StateType::Split, 0, 0);
+            states_[static_cast<size_t>(split)].out = body.start;
+            patch(out.exits, split);
+            skipped.push_back(std::make_pair(split, true));
+            out.exits.swap(body.exits);
+        }
+        out.exits.insert(out.exits.end(), skipped.begin(), skipped.end());
+        return true;
+    }
+
+    const std::vector<Node> &nodes_;
+    std::vector<Regex::State> &states_;
+};
+
+} // namespace
+
+bool Regex::compile(const std::string &pattern, std::string *error_message)
+{
+    states_.clear();
+    start_ = -1;
+    class_count_ = 0;
+
+    Parser parser(pattern);
+    const int root = parser.parse(anchored_);
+    if (root < 0)
+    {
+        if (error_message) *error_message = parser.error();
+        return false;
+    }
+    NfaBuilder builder(parser.nodes(), states_);
+    NfaBuilder::Fragment fragment;
+    if (!builder.build(root, fragment) || states_.size() > kMaxStates)
+    {
+        states_.clear();
+        if (error_message) *error_message = "pattern too large";
+        return false;
+    }
+    State match;
+    match.type = StateType::Match;
+    match.lo = 0;
+    match.hi = 0;
+    match.out = -1;
+    match.out1 = -1;
+    states_.push_back(match);
+    builder.patch(fragment.exits, static_cast<int>(states_.size() - 1));
+    start_ = fragment.start;
+
+    // Bytes no range boundary separates behave alike and share a DFA column.
+    bool boundary[257] = {};
+    for (const State &state : states_)
+    {
+        if (state.type != StateType::Bytes) continue;
+        boundary[state.lo] = true;
+        boundary[state.hi + 1] = true;
+    }
+    size_t cls = 0;
+    for (size_t b = 0; b < 256; ++b)
+    {
+        if (b > 0 && boundary[b]) ++cls;
+        byte_class_[b] = static_cast<std::uint8_t>(cls);
+    }
+    class_count_ = cls + 1;
+    return true;
+}
+
+const int Matcher::kUnknown;
+const int Matcher::kDead;
+
+Matcher::Matcher(const Regex &regex, size_t memory_budget)
+    : regex_(regex), memory_budget_(memory_budget), stride_(regex.class_count_ + 1), seen_(regex.states_.size(), 0)
+{
+    reset_cache();
+}
+
+void Matcher::reset_cache()
+{
+    transitions_.clear();
+    sets_.clear();
+    matching_.clear();
+    ids_.clear();
+    memory_used_ = 0;
+    std::vector<int> dead;
+    add_state(dead);
+    std::vector<int> start;
+    ++generation_;
+    if (regex_.start_ >= 0) add_closure(regex_.start_, start, seen_);
+    start_ = add_state(start);
+}
+
+void Matcher::add_closure(int nfa_state, std::vector<int> &out, std::vector<unsigned> &seen) const
+{
+    std::vector<int> stack(1, nfa_state);
+    while (!stack.empty())
+    {
+        const int at = stack.back();
+        stack.pop_back();
+        if (at < 0 || seen[static_cast<size_t>(at)] == generation_) continue;
+        seen[static_cast<size_t>(at)] = generation_;
+        const Regex::State &state = regex_.states_[static_cast<size_t>(at)];
+        if (state.type == Regex::StateType::Split)
+        {
+            stack.push_back(state.out1);
+            stack.push_back(state.out);
+        }
+        else
+        {
+            out.push_back(at);
+        }
+    }
+}
+
+int Matcher::add_state(std::vector<int> &nfa_states)
+{
+    std::sort(nfa_states.begin(), nfa_states.end());
+    const std::string key(reinterpret_cast<const char *>(nfa_states.data()), nfa_states.size() * sizeof(int));
+    const auto found = ids_.find(key);
+    if (found != ids_.end()) return found->second;
+
+    const int id = static_cast<int>(sets_.size());
+    bool matching = false;
+    for (int s : nfa_states) matching = matching || regex_.states_[static_cast<size_t>(s)].type == Regex::StateType::Match;
+    transitions_.resize(transitions_.size() + stride_, kUnknown);
+    matching_.push_back(matching ? 1 : 0);
+    memory_used_ += stride_ * sizeof(int) + 2 * key.size() + 64;
+    sets_.push_back(std::move(nfa_states));
+    ids_.emplace(key, id);
+    if (id == kDead)
+    {
+        // The dead state stays dead.
+        std::fill(transitions_.begin(), transitions_.end(), kDead);
+    }
+    return id;
+}
+
+int Matcher::step(int state, size_t symbol)
+{
+    const bool end_of_line = symbol == regex_.class_count_;
+    unsigned char representative = 0;
+    if (!end_of_line)
+    {
+        while (regex_.byte_class_[representative] != symbol) ++representative;
+    }
+
+    std::vector<int> next;
+    ++generation_;
+    for (int s : sets_[static_cast<size_t>(state)])
+    {
+        const Regex::State &nfa = regex_.states_[static_cast<size_t>(s)];
+        if (end_of_line ? nfa.type == Regex::StateType::EndOfLine
+                        : (nfa.type == Regex::StateType::Bytes && nfa.lo <= representative && representative <= nfa.hi))
+        {
+            add_closure(nfa.out, next, seen_);
+        }
+    }
+    // Unanchored: a match may also begin at the next byte.
+    if (!regex_.anchored_ && !end_of_line) add_closure(regex_.start_, next, seen_);
+
+    if (memory_used_ > memory_budget_)
+    {
+        // Start over rather than grow; the states in use are rebuilt as they are reached.
+        ++flushes_;
+        reset_cache();
+        return add_state(next);
+    }
+    const int id = add_state(next);
+    transitions_[static_cast<size_t>(state) * stride_ + symbol] = id;
+    return id;
+}
+
+bool Matcher::matches_line(const char *begin, const char *end)
+{
+    if (regex_.empty()) return false;
+    const std::uint8_t *classes = regex_.byte_class_;
+    int state = start_;
+    if (matching_[static_cast<size_t>(state)]) return true;
+    for (const char *p = begin; p < end; ++p)
+    {
+        const size_t symbol = classes[static_cast<unsigned char>(*p)];
+        int next = transitions_[static_cast<size_t>(state) * stride_ + symbol];
+        if (next == kUnknown) next = step(state, symbol);
+        state = next;
+        if (matching_[static_cast<size_t>(state)]) return true;
+        if (state == kDead) return false;
+    }
+    const size_t end_of_line = regex_.class_count_;
+    int next = transitions_[static_cast<size_t>(state) * stride_ + end_of_line];
+    if (next == kUnknown) next = step(state, end_of_line);
+    return matching_[static_cast<size_t>(next)] != 0;
+}
+
+namespace {
+
+struct ChunkResult {
+    bool done = false;
+    std::uint64_t newlines = 0;
+    std::vector<Hit> hits; // line = newlines in the chunk before the hit
+};
+
+// Turns lines of the file into UTF-8 for matching. Books concatenated from
+// differently encoded sources are handled line by line, between the detected
+// encoding and its alternate; a UTF-8 book's chunk that is UTF-8 throughout is
+// matched in place without looking at its lines.
+class LineDecoder {
+public:
+    explicit LineDecoder(const std::string &encoding)
+        : encoding_(encoding), detected_utf8_(EncodingUtils::alternate_encoding(encoding) != "UTF-8"),
+          converter_(encoding), alternate_converter_(EncodingUtils::alternate_encoding(encoding))
+    {
+    }
+
+    void start_chunk(const char *begin, const char *end)
+    {
+        const size_t size = static_cast<size_t>(end - begin);
+        check_lines_ = !detected_utf8_ || EncodingUtils::survey_utf8(begin, size).first_invalid < size;
+    }
+
+    // Points [begin, end) at the UTF-8 form of the line it spans.
+    void decode(const char *&begin, const char *&end)
+    {
+        const size_t size = static_cast<size_t>(end - begin);
+        const bool alternate =
+            check_lines_ && EncodingUtils::line_in_alternate_encoding(begin, size, encoding_);
+        if (detected_utf8_ != alternate) return;
+        raw_.assign(begin, end);
+        utf8_ = (alternate ? alternate_converter_ : converter_).convert(raw_);
+        begin = utf8_.data();
+        end = begin + utf8_.size();
+    }
+
+private:
+    const std::string &encoding_;
+    bool detected_utf8_;
+    bool check_lines_ = true;
+    EncodingUtils::Utf8Converter converter_;
+    EncodingUtils::Utf8Converter alternate_converter_;
+    std::string raw_;
+    std::string utf8_;
+};
+
+class ChunkSearch {
+public:
+    ChunkSearch(const char *data, std::uint64_t size, const std::string &encoding, size_t max_line_bytes,
+                const Regex &regex, size_t max_hits, const std::atomic<bool> *cancel)
+        : data_(data), size_(size), encoding_(encoding), max_line_bytes_(max_line_bytes),
+          sentence_ends_(EncodingUtils::sentence_end_sequences_with_alternate(encoding)), regex_(regex),
+          max_hits_(max_hits), cancel_(cancel), results_(static_cast<size_t>((size + kChunkBytes - 1) / kChunkBytes))
+    {
+    }
+
+    std::vector<ChunkResult> &results() { return results_; }
+
+    bool cancelled() const { return cancel_ != nullptr && cancel_->load(); }
+
+    void run_worker()
+    {
+        Matcher matcher(regex_, kMatcherMemoryBudget);
+        LineDecoder decoder(encoding_);
+        while (true)
+        {
+            const size_t chunk = next_chunk_.fetch_add(1);
+            if (chunk >= results_.size() || cancelled() || hit_count_.load() >= max_hits_) return;
+            TRACE_SPAN("search chunk");
+            scan_chunk(chunk, matcher, decoder);
+        }
+    }
+
+private:
+    void scan_chunk(size_t chunk, Matcher &matcher, LineDecoder &decoder)
+    {
+        ChunkResult &result = results_[chunk];
+        const std::uint64_t begin = chunk * kChunkBytes;
+        const std::uint64_t end = std::min(size_, begin + kChunkBytes);
+        std::uint64_t at = begin;
+        // A line that started in the previous chunk is that chunk's.
+        if (begin > 0 && data_[begin - 1] != '\n')
+        {
+            const void *newline = std::memchr(data_ + begin, '\n', static_cast<size_t>(size_ - begin));
+            at = newline == nullptr ? size_ : static_cast<std::uint64_t>(static_cast<const char *>(newline) - data_) + 1;
+            if (at <= end) ++result.newlines;
+        }
+        if (at < end) decoder.start_chunk(data_ + at, data_ + line_end_after(end));
+        size_t lines = 0;
+        while (at < end)
+        {
+            if (++lines % kCancelCheckLines == 0 && cancelled()) return;
+            const void *newline = std::memchr(data_ + at, '\n', static_cast<size_t>(size_ - at));
+            const std::uint64_t line_end =
+                newline == nullptr ? size_ : static_cast<std::uint64_t>(static_cast<const char *>(newline) - data_);
+            // An overlong line is searched as the virtual lines the index cuts it into.
+            for (std::uint64_t piece = at; piece < line_end || piece == at;)
+            {
+                const size_t length =
+                    EncodingUtils::line_piece_length(data_ + piece, static_cast<size_t>(line_end - piece),
+                                                     max_line_bytes_, encoding_, sentence_ends_);
+                const char *text = data_ + piece;
+                const char *text_end = text + length;
+                if (text_end > text && text_end[-1] == '\r' && piece + length == line_end) --text_end;
+                if (piece == 0 && text_end - text >= 3 && std::memcmp(text, "\xEF\xBB\xBF", 3) == 0) text += 3;
+
+                const char *utf8 = text;
+                const char *utf8_end = text_end;
+                decoder.decode(utf8, utf8_end);
+                if (matcher.matches_line(utf8, utf8_end))
+                {
+                    Hit hit;
+                    hit.line = static_cast<std::int64_t>(result.newlines);
+                    hit.offset = piece;
+                    result.hits.push_back(hit);
+                    // Only stops taking new chunks, so every chunk searched is searched whole.
+                    hit_count_.fetch_add(1);
+                }
+                piece += length;
+                if (piece < line_end) ++result.newlines;
+                if (length == 0) break;
+            }
+            if (line_end < end) ++result.newlines;
+            at = line_end + 1;
+        }
+        result.done = true;
+    }
+
+    // End of the line holding byte `at - 1`, i.e. of the last line a chunk ending at `at` searches.
+    std::uint64_t line_end_after(std::uint64_t at) const
+    {
+        if (at >= size_ || data_[at - 1] == '\n') return at;
+        const void *newline = std::memchr(data_ + at, '\n', static_cast<size_t>(size_ - at));
+        return newline == nullptr ? size_ : static_cast<std::uint64_t>(static_cast<const char *>(newline) - data_);
+    }
+
+    const char *data_;
+    std::uint64_t size_;
+    const std::string &encoding_;
+    size_t max_line_bytes_;
+    std::vector<std::string> sentence_ends_;
+    const Regex &regex_;
+    size_t max_hits_;
+    const std::atomic<bool> *cancel_;
+    std::vector<ChunkResult> results_;
+    std::atomic<size_t> next_chunk_{0};
+    std::atomic<size_t> hit_count_{0};
+};
+
+} // namespace
+
+bool search_file(const std::string &path, const std::string &encoding, size_t max_line_bytes, const Regex &regex,
+                 size_t max_hits, const std::atomic<bool> *cancel, std::vector<Hit> &hits,
+                 std::string *error_message)
+{
+    TRACE_SPAN("regex search");
+    hits.clear();
+    FileView::MappedFile file;
+    if (!file.open(path, error_message)) return false;
+    if (regex.empty() || file.size() == 0 || max_hits == 0) return true;
+
+    ChunkSearch search(file.data(), file.size(), encoding, max_line_bytes, regex, max_hits, cancel);
+    Tasks::Scheduler &scheduler = Tasks::shared_scheduler();
+    size_t thread_count = scheduler.max_running(Tasks::Priority::Search);
+    if (thread_count > kMaxSearchThreads) thread_count = kMaxSearchThreads;
+    if (thread_count > search.results().size()) thread_count = search.results().size();
+
+    // The calling thread takes chunks too; the pool adds helpers as its search share allows.
+    Tasks::TaskGroup helpers;
+    for (size_t i = 1; i < thread_count; ++i)
+    {
+        scheduler.submit(Tasks::Priority::Search, [&search]() { search.run_worker(); }, Tasks::CancelToken(), &helpers);
+    }
+    search.run_worker();
+    helpers.wait();
+    if (search.cancelled())
+    {
+        if (error_message) *error_message = "cancelled";
+        return false;
+    }
+
+    // Chunks are taken in order, so the finished ones form a prefix once the hit limit stops the rest.
+    std::uint64_t lines_before = 0;
+    for (const ChunkResult &result : search.results())
+    {
+        for (const Hit &hit : result.hits)
+        {
+            if (hits.size() >= max_hits) break;
+            Hit global = hit;
+            global.line = static_cast<std::int64_t>(lines_before) + hit.line + 1;
+            hits.push_back(global);
+        }
+        if (!result.done || hits.size() >= max_hits) break;
+        lines_before += result.newlines;
+    }
+    return true;
+}
+
+} // namespace TextSearch
@@ -0,0 +1,118 @@
+#include "session_snapshot.h"
+
+#include "file_system_utils.h"
+
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace Session {
+
+namespace {
+
+const char kSnapshotHeader[] = "# NovelReader session v1";
+// A frame is one screen; anything larger is not a snapshot we wrote.
+const std::uint64_t kMaxFrameBytes = 1 << 20;
+
+bool parse_u64(const std::string &text, int base, std::uint64_t &out)
+{
+    if (text.empty()) return false;
+    try
+    {
+        size_t used = 0;
+        out = static_cast<std::uint64_t>(std::stoull(text, &used, base));
+        return used == text.size();
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+} // namespace
+
+bool read_snapshot(const std::string &path, Snapshot &out)
+{
+    out = Snapshot{};
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in.is_open()) return false;
+
+    std::string line;
+    if (!std::getline(in, line) || line != kSnapshotHeader) return false;
+
+    // "key \t value" lines, ending with "frame \t <byte count>" followed by the frame itself.
+    std::uint64_t line_number = 0;
+    bool have_line = false;
+    while (std::getline(in, line))
+    {
+        const size_t tab = line.find('\t');
+        if (tab == std::string::npos) return false;
+        const std::string key = line.substr(0, tab);
+        const std::string value = line.substr(tab + 1);
+
+        if (key == "fingerprint") out.fingerprint = value;
+        else if (key == "encoding") out.encoding = value;
+        else if (key == "path") out.novel_path = value;
+        else if (key == "line") have_line = parse_u64(value, 10, line_number);
+        else if (key == "offset" && !parse_u64(value, 10, out.byte_offset)) return false;
+        else if (key == "line_bytes" && !parse_u64(value, 10, out.line_bytes)) return false;
+        else if (key == "line_hash" && !parse_u64(value, 16, out.line_hash)) return false;
+        else if (key == "frame")
+        {
+            std::uint64_t frame_bytes = 0;
+            if (!parse_u64(value, 10, frame_bytes) || frame_bytes > kMaxFrameBytes) return false;
+            out.frame.resize(static_cast<size_t>(frame_bytes));
+            if (frame_bytes > 0 && !in.read(&out.frame[0], static_cast<std::streamsize>(frame_bytes))) return false;
+            break;
+        }
+    }
+
+    // Line 0 means the position was known only by its byte offset.
+    if (!have_line ||
+        line_number > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()))
+    {
+        return false;
+    }
+    out.line_number = static_cast<std::int64_t>(line_number);
+    return !out.fingerprint.empty() && !out.novel_path.empty() && !out.frame.empty();
+}
+
+bool write_snapshot(const std::string &path, const Snapshot &snapshot)
+{
+    std::ostringstream contents;
+    contents << kSnapshotHeader << '\n';
+    contents << "fingerprint\t" << snapshot.fingerprint << '\n';
+    contents << "encoding\t" << snapshot.encoding << '\n';
+    contents << "line\t" << snapshot.line_number << '\n';
+    contents << "offset\t" << snapshot.byte_offset << '\n';
+    contents << "line_bytes\t" << snapshot.line_bytes << '\n';
+    contents << "line_hash\t" << std::hex << snapshot.line_hash << std::dec << '\n';
+    contents << "path\t" << snapshot.novel_path << '\n';
+    contents << "frame\t" << snapshot.frame.size() << '\n';
+    contents << snapshot.frame;
+    return FileSystemUtils::write_file_atomic(path, contents.str());
+}
+
+bool validate_snapshot(const Snapshot &snapshot, Fingerprint::BookFingerprint &fingerprint)
+{
+    if (!Fingerprint::compute_fingerprint(snapshot.novel_path, fingerprint, nullptr))
+    {
+        fingerprint = Fingerprint::BookFingerprint{};
+        return false;
+    }
+    if (fingerprint.to_string() != snapshot.fingerprint) return false;
+
+    // The fingerprint only samples the file; also check the line that was on screen.
+    if (snapshot.line_bytes > fingerprint.size || snapshot.byte_offset > fingerprint.size - snapshot.line_bytes)
+    {
+        return false;
+    }
+    std::ifstream in(snapshot.novel_path, std::ios::in | std::ios::binary);
+    if (!in.is_open()) return false;
+    std::string bytes(static_cast<size_t>(snapshot.line_bytes), '\0');
+    in.seekg(static_cast<std::streamoff>(snapshot.byte_offset));
+    if (!bytes.empty() && !in.read(&bytes[0], static_cast<std::streamsize>(bytes.size()))) return false;
+    return Fingerprint::xxhash64(bytes.data(), bytes.size(), 0) == snapshot.line_hash;
+}
+
+} // namespace Session
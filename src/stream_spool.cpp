@@ -0,0 +1,206 @@
+#include "stream_spool.h"
+
+#include "trace.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FileView {
+
+namespace {
+
+// Bytes moved per read from the source; the only memory the spool holds.
+const size_t kCopyBytes = 1024 * 1024;
+// How often the copy thread looks up from an idle source to see if it should stop.
+const int kPollMilliseconds = 200;
+
+void set_error(std::string *error_message, const std::string &text)
+{
+    if (error_message != nullptr) *error_message = text;
+}
+
+} // namespace
+
+StreamSpool::~StreamSpool()
+{
+    stop();
+}
+
+std::string StreamSpool::error() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+void StreamSpool::wait_for(std::uint64_t bytes)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    arrived_.wait(lock, [&]() { return received_ >= bytes || finished_; });
+}
+
+#ifdef _WIN32
+
+bool StreamSpool::is_stream_source(const std::string &name)
+{
+    return name == "-";
+}
+
+bool StreamSpool::start(const std::string &, bool, std::string *error_message)
+{
+    set_error(error_message, "Reading from a pipe is not supported on Windows.");
+    return false;
+}
+
+void StreamSpool::run()
+{
+}
+
+void StreamSpool::stop()
+{
+}
+
+#else
+
+bool StreamSpool::is_stream_source(const std::string &name)
+{
+    if (name == "-") return true;
+    struct stat info;
+    if (stat(name.c_str(), &info) != 0) return false;
+    return S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode) || S_ISCHR(info.st_mode);
+}
+
+bool StreamSpool::start(const std::string &name, bool take_terminal, std::string *error_message)
+{
+    if (name == "-" && !take_terminal)
+    {
+        source_fd_ = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+        if (source_fd_ < 0)
+        {
+            set_error(error_message, "Could not read standard input: " + std::string(std::strerror(errno)));
+            return false;
+        }
+    }
+    else if (name == "-")
+    {
+        if (isatty(STDIN_FILENO))
+        {
+            set_error(error_message, "Standard input is a terminal; pipe the book in, e.g. 'zcat book.txt.gz | NovelReaderCLI -'.");
+            return false;
+        }
+        // Keys are read from standard input, so the terminal takes the pipe's place there.
+        const int tty = open("/dev/tty", O_RDWR | O_CLOEXEC);
+        if (tty < 0)
+        {
+            set_error(error_message, "No terminal to read keys from: " + std::string(std::strerror(errno)));
+            return false;
+        }
+        source_fd_ = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+        if (source_fd_ < 0 || dup2(tty, STDIN_FILENO) < 0)
+        {
+            set_error(error_message, "Could not take over standard input: " + std::string(std::strerror(errno)));
+            close(tty);
+            return false;
+        }
+        close(tty);
+    }
+    else
+    {
+        // Opening a FIFO waits here until something opens it for writing.
+        source_fd_ = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (source_fd_ < 0)
+        {
+            set_error(error_message, "Could not open " + name + ": " + std::strerror(errno));
+            return false;
+        }
+    }
+
+    const char *tmp = std::getenv("TMPDIR");
+    std::string pattern = (tmp != nullptr && *tmp != '\0') ? tmp : "/tmp";
+    if (pattern.back() != '/') pattern += '/';
+    pattern += "NovelReader-stream-XXXXXX";
+    std::vector<char> name_buffer(pattern.begin(), pattern.end());
+    name_buffer.push_back('\0');
+    spool_fd_ = mkstemp(name_buffer.data());
+    if (spool_fd_ < 0)
+    {
+        set_error(error_message, "Could not create a spool file in " + pattern + ": " + std::strerror(errno));
+        close(source_fd_);
+        source_fd_ = -1;
+        return false;
+    }
+    fcntl(spool_fd_, F_SETFD, FD_CLOEXEC);
+    path_ = name_buffer.data();
+    thread_ = std::thread(&StreamSpool::run, this);
+    return true;
+}
+
+void StreamSpool::run()
+{
+    TRACE_THREAD_NAME("stream spool");
+    std::vector<char> buffer(kCopyBytes);
+    std::string failure;
+    while (!stopping_)
+    {
+        struct pollfd source = {source_fd_, POLLIN, 0};
+        const int ready = poll(&source, 1, kPollMilliseconds);
+        if (ready == 0 || (ready < 0 && errno == EINTR)) continue;
+        const ssize_t got = read(source_fd_, buffer.data(), buffer.size());
+        if (got == 0) break;
+        if (got < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            failure = "Could not read the input: " + std::string(std::strerror(errno));
+            break;
+        }
+        TRACE_SPAN("spool chunk");
+        ssize_t written = 0;
+        while (written < got)
+        {
+            const ssize_t n = write(spool_fd_, buffer.data() + written, static_cast<size_t>(got - written));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0)
+            {
+                failure = "Could not write " + path_ + ": " + std::strerror(errno);
+                break;
+            }
+            written += n;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            received_ += static_cast<std::uint64_t>(written);
+        }
+        arrived_.notify_all();
+        if (!failure.empty()) break;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = failure;
+        finished_ = true;
+    }
+    arrived_.notify_all();
+}
+
+void StreamSpool::stop()
+{
+    stopping_ = true;
+    if (thread_.joinable()) thread_.join();
+    if (source_fd_ >= 0) close(source_fd_);
+    if (spool_fd_ >= 0) close(spool_fd_);
+    if (!path_.empty()) unlink(path_.c_str());
+    source_fd_ = -1;
+    spool_fd_ = -1;
+    path_.clear();
+}
+
+#endif
+
+} // namespace FileView
@@ -0,0 +1,275 @@
+#include "task_scheduler.h"
+
+#include "file_system_utils.h"
+#include "platform_utils.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+namespace Tasks {
+
+namespace {
+
+// The pool the current thread works for, if any, and its worker number.
+thread_local Scheduler *current_scheduler = nullptr;
+thread_local size_t current_worker = 0;
+
+// How long a waiting group sleeps before looking for its queued tasks again.
+const std::chrono::milliseconds kGroupPollInterval(10);
+
+size_t index_of(Priority priority)
+{
+    return static_cast<size_t>(priority);
+}
+
+bool is_cpu_heavy(size_t priority)
+{
+    return priority == index_of(Priority::Search) || priority == index_of(Priority::Bulk);
+}
+
+} // namespace
+
+const size_t Scheduler::kMaxWorkers;
+const unsigned Scheduler::kDefaultCpuSharePercent;
+
+void TaskGroup::wait()
+{
+    Scheduler *scheduler = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (outstanding_ == 0) return;
+        scheduler = scheduler_;
+    }
+    while (true)
+    {
+        Scheduler::Task task;
+        if (scheduler->take_from_group(this, task))
+        {
+            scheduler->execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (done_.wait_for(lock, kGroupPollInterval, [this]() { return outstanding_ == 0; })) return;
+    }
+}
+
+bool TaskGroup::idle() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return outstanding_ == 0;
+}
+
+Scheduler::Scheduler(size_t workers, unsigned cpu_share_percent)
+{
+    const unsigned hardware = std::thread::hardware_concurrency();
+    const size_t hardware_threads = hardware == 0 ? 2 : hardware;
+    size_t count = workers == 0 ? hardware_threads : workers;
+    count = std::max<size_t>(2, std::min(count, kMaxWorkers));
+    const unsigned percent = std::max(10u, std::min(cpu_share_percent, 100u));
+
+    max_running_cpu_heavy_ = std::max<size_t>(1, std::min(count, hardware_threads * percent / 100));
+    max_running_[index_of(Priority::Viewport)] = count;
+    max_running_[index_of(Priority::Prefetch)] = count;
+    max_running_[index_of(Priority::Search)] = max_running_cpu_heavy_;
+    max_running_[index_of(Priority::Bulk)] = std::max<size_t>(1, max_running_cpu_heavy_ / 2);
+
+    for (size_t i = 0; i < count; ++i) worker_queues_.emplace_back(new Queues());
+    for (size_t i = 0; i < count; ++i) workers_.emplace_back(&Scheduler::run_worker, this, i);
+}
+
+Scheduler::~Scheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &worker : workers_) worker.join();
+
+    // Whatever is still queued is dropped, which releases anyone waiting on its group.
+    std::vector<Queues *> all_queues = {&shared_};
+    for (const auto &queues : worker_queues_) all_queues.push_back(queues.get());
+    for (Queues *queues : all_queues)
+    {
+        for (size_t priority = 0; priority < kPriorityCount; ++priority)
+        {
+            Task task;
+            while (pop(*queues, priority, false, nullptr, task))
+            {
+                reserve(priority, true);
+                finish(task);
+            }
+        }
+    }
+}
+
+void Scheduler::submit(Priority priority, std::function<void()> task, const CancelToken &token, TaskGroup *group)
+{
+    if (group != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(group->mutex_);
+        group->scheduler_ = this;
+        ++group->outstanding_;
+    }
+    Queues &queues = current_scheduler == this ? *worker_queues_[current_worker] : shared_;
+    {
+        std::lock_guard<std::mutex> lock(queues.mutex);
+        queues.tasks[index_of(priority)].push_back(Task{std::move(task), priority, token, group});
+    }
+    wake_workers();
+}
+
+void Scheduler::run_worker(size_t index)
+{
+    TRACE_THREAD_NAME("task worker");
+    current_scheduler = this;
+    current_worker = index;
+    while (true)
+    {
+        std::uint64_t seen = 0;
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            if (stopping_) return;
+            seen = generation_;
+        }
+        Task task;
+        if (take(index, task))
+        {
+            execute(task);
+            continue;
+        }
+        // Nothing runnable: either nothing is queued or the caps hold it back until a task finishes.
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [&]() { return stopping_ || generation_ != seen; });
+    }
+}
+
+bool Scheduler::reserve(size_t priority, bool ignore_caps)
+{
+    std::lock_guard<std::mutex> lock(slots_mutex_);
+    if (!ignore_caps)
+    {
+        if (running_[priority] >= max_running_[priority]) return false;
+        const size_t heavy = running_[index_of(Priority::Search)] + running_[index_of(Priority::Bulk)];
+        if (is_cpu_heavy(priority) && heavy >= max_running_cpu_heavy_) return false;
+    }
+    ++running_[priority];
+    return true;
+}
+
+bool Scheduler::pop(Queues &queues, size_t priority, bool newest, const TaskGroup *group, Task &task)
+{
+    std::lock_guard<std::mutex> lock(queues.mutex);
+    std::deque<Task> &tasks = queues.tasks[priority];
+    if (tasks.empty()) return false;
+    if (group == nullptr)
+    {
+        if (newest)
+        {
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        return true;
+    }
+    for (auto it = tasks.begin(); it != tasks.end(); ++it)
+    {
+        if (it->group != group) continue;
+        task = std::move(*it);
+        tasks.erase(it);
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::take(size_t worker, Task &task)
+{
+    for (size_t priority = 0; priority < kPriorityCount; ++priority)
+    {
+        if (!reserve(priority, false)) continue;
+        if (pop(*worker_queues_[worker], priority, true, nullptr, task)) return true;
+        if (pop(shared_, priority, false, nullptr, task)) return true;
+        for (size_t i = 1; i < worker_queues_.size(); ++i)
+        {
+            if (pop(*worker_queues_[(worker + i) % worker_queues_.size()], priority, false, nullptr, task)) return true;
+        }
+        std::lock_guard<std::mutex> lock(slots_mutex_);
+        --running_[priority];
+    }
+    return false;
+}
+
+bool Scheduler::take_from_group(const TaskGroup *group, Task &task)
+{
+    // The caller is blocked on the group anyway, so running its tasks adds no
+    // parallelism and skips the caps.
+    for (size_t priority = 0; priority < kPriorityCount; ++priority)
+    {
+        bool found = pop(shared_, priority, false, group, task);
+        for (size_t i = 0; !found && i < worker_queues_.size(); ++i)
+        {
+            found = pop(*worker_queues_[i], priority, false, group, task);
+        }
+        if (found)
+        {
+            reserve(priority, true);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::execute(Task &task)
+{
+    if (!task.token.cancelled()) task.run();
+    finish(task);
+}
+
+void Scheduler::finish(Task &task)
+{
+    // Captured state goes before waiters are told, since they may free what it points to.
+    task.run = std::function<void()>();
+    {
+        std::lock_guard<std::mutex> lock(slots_mutex_);
+        --running_[index_of(task.priority)];
+    }
+    if (task.group != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(task.group->mutex_);
+        if (--task.group->outstanding_ == 0) task.group->done_.notify_all();
+    }
+    wake_workers();
+}
+
+void Scheduler::wake_workers()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        ++generation_;
+    }
+    wake_.notify_all();
+}
+
+Scheduler &shared_scheduler()
+{
+    static Scheduler scheduler(0, read_cpu_share_percent());
+    return scheduler;
+}
+
+unsigned read_cpu_share_percent()
+{
+    const std::string config_dir = FileSystemUtils::get_config_directory_path();
+    if (config_dir.empty()) return Scheduler::kDefaultCpuSharePercent;
+    std::ifstream in(config_dir + PlatformUtils::get_path_separator() + "cpu_share");
+    unsigned percent = 0;
+    if (!(in >> percent) || percent == 0) return Scheduler::kDefaultCpuSharePercent;
+    return percent;
+}
+
+} // namespace Tasks
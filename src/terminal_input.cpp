@@ -1,6 +1,9 @@
 #include "terminal_input.h"
 
+#include "trace.h"
+
 #include <cerrno>
+#include <cstdlib>
 #include <cstring>
 
 #ifdef _WIN32
@@ -12,6 +15,425 @@
 
 namespace TerminalInput {
 
+namespace {
+
+// Single-byte keys that never start a sequence.
+struct ControlKey {
+    unsigned char byte;
+    KeyType type;
+};
+
+const ControlKey kControlKeys[] = {
+    {'\r', KeyType::Enter},
+    {'\n', KeyType::Enter},
+    {' ', KeyType::Space},
+    {0x03, KeyType::CtrlC},
+    {0x04, KeyType::CtrlD},
+    {0x08, KeyType::Backspace},
+    {0x7F, KeyType::Backspace},
+};
+
+// Keys identified by the final byte of "CSI [params] X" or "SS3 X".
+struct FinalByteKey {
+    unsigned char final_byte;
+    KeyType type;
+    int function_number;
+};
+
+const FinalByteKey kFinalByteKeys[] = {
+    {'A', KeyType::ArrowUp, 0},
+    {'B', KeyType::ArrowDown, 0},
+    {'C', KeyType::ArrowRight, 0},
+    {'D', KeyType::ArrowLeft, 0},
+    {'H', KeyType::Home, 0},
+    {'F', KeyType::End, 0},
+    {'P', KeyType::Function, 1},
+    {'Q', KeyType::Function, 2},
+    {'R', KeyType::Function, 3},
+    {'S', KeyType::Function, 4},
+};
+
+// Keys identified by the first parameter of "CSI <code> [; mod] ~".
+struct TildeKey {
+    int code;
+    KeyType type;
+    int function_number;
+};
+
+const TildeKey kTildeKeys[] = {
+    {1, KeyType::Home, 0},
+    {2, KeyType::Insert, 0},
+    {3, KeyType::Delete, 0},
+    {4, KeyType::End, 0},
+    {5, KeyType::PageUp, 0},
+    {6, KeyType::PageDown, 0},
+    {7, KeyType::Home, 0},
+    {8, KeyType::End, 0},
+    {11, KeyType::Function, 1},
+    {12, KeyType::Function, 2},
+    {13, KeyType::Function, 3},
+    {14, KeyType::Function, 4},
+    {15, KeyType::Function, 5},
+    {17, KeyType::Function, 6},
+    {18, KeyType::Function, 7},
+    {19, KeyType::Function, 8},
+    {20, KeyType::Function, 9},
+    {21, KeyType::Function, 10},
+    {23, KeyType::Function, 11},
+    {24, KeyType::Function, 12},
+};
+
+constexpr int kBracketedPasteBegin = 200;
+const char kBracketedPasteEnd[] = "\x1b[201~";
+constexpr size_t kBracketedPasteEndLength = sizeof(kBracketedPasteEnd) - 1;
+constexpr size_t kMaxPasteBytes = 64 * 1024;
+constexpr size_t kMaxCsiParamBytes = 32;
+
+// How long to wait for the rest of a sequence once ESC has been seen.
+// Terminals emit a whole sequence in one write, so this only matters for a
+// lone Esc press (one wait, not one per byte) or a very slow link.
+constexpr int kEscapeTimeoutMs = 25;
+constexpr int kPasteTimeoutMs = 500;
+
+void decode_single_byte(unsigned char byte, KeyEvent &out)
+{
+    for (const ControlKey &entry : kControlKeys)
+    {
+        if (entry.byte == byte)
+        {
+            out.type = entry.type;
+            return;
+        }
+    }
+    out.type = KeyType::Character;
+    out.ch = static_cast<char>(byte);
+}
+
+unsigned modifiers_from_param(int param)
+{
+    // xterm encodes modifiers as 1 + bitmask.
+    if (param <= 1) return ModNone;
+    return static_cast<unsigned>(param - 1) & (ModShift | ModAlt | ModCtrl | ModMeta);
+}
+
+bool lookup_final_byte(unsigned char final_byte, KeyEvent &out)
+{
+    for (const FinalByteKey &entry : kFinalByteKeys)
+    {
+        if (entry.final_byte == final_byte)
+        {
+            out.type = entry.type;
+            out.function_number = entry.function_number;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool lookup_tilde_code(int code, KeyEvent &out)
+{
+    for (const TildeKey &entry : kTildeKeys)
+    {
+        if (entry.code == code)
+        {
+            out.type = entry.type;
+            out.function_number = entry.function_number;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Table-driven decoder for the byte stream of one key press: plain bytes,
+// Alt-prefixed bytes, CSI and SS3 sequences (with xterm modifiers) and
+// bracketed paste blocks.
+class KeyDecoder {
+public:
+    // Returns true once `out` holds a complete key.
+    bool feed(unsigned char byte, KeyEvent &out)
+    {
+        switch (state_)
+        {
+            case State::Ground:
+                if (byte == 0x1B)
+                {
+                    state_ = State::Escape;
+                    return false;
+                }
+                decode_single_byte(byte, out);
+                return true;
+
+            case State::Escape:
+                if (byte == '[')
+                {
+                    state_ = State::Csi;
+                    params_.clear();
+                    return false;
+                }
+                if (byte == 'O')
+                {
+                    state_ = State::Ss3;
+                    return false;
+                }
+                state_ = State::Ground;
+                if (byte == 0x1B)
+                {
+                    out.type = KeyType::Escape;
+                }
+                else
+                {
+                    decode_single_byte(byte, out);
+                }
+                out.modifiers |= ModAlt;
+                return true;
+
+            case State::Ss3:
+                state_ = State::Ground;
+                if (!lookup_final_byte(byte, out)) out.type = KeyType::Unknown;
+                return true;
+
+            case State::Csi:
+                if (byte >= 0x20 && byte <= 0x3F)
+                {
+                    // Parameter and intermediate bytes.
+                    if (params_.size() < kMaxCsiParamBytes) params_.push_back(static_cast<char>(byte));
+                    return false;
+                }
+                state_ = State::Ground;
+                if (byte < 0x40 || byte > 0x7E)
+                {
+                    out.type = KeyType::Unknown;
+                    return true;
+                }
+                return finish_csi(byte, out);
+
+            case State::Paste:
+                if (paste_.size() < kMaxPasteBytes + kBracketedPasteEndLength)
+                {
+                    paste_.push_back(static_cast<char>(byte));
+                }
+                paste_tail_.push_back(static_cast<char>(byte));
+                if (paste_tail_.size() > kBracketedPasteEndLength) paste_tail_.erase(0, 1);
+                if (paste_tail_ != kBracketedPasteEnd) return false;
+
+                state_ = State::Ground;
+                if (paste_.size() >= kBracketedPasteEndLength &&
+                    paste_.compare(paste_.size() - kBracketedPasteEndLength, kBracketedPasteEndLength,
+                                   kBracketedPasteEnd) == 0)
+                {
+                    paste_.resize(paste_.size() - kBracketedPasteEndLength);
+                }
+                if (paste_.size() > kMaxPasteBytes) paste_.resize(kMaxPasteBytes);
+                out.type = KeyType::Paste;
+                out.text.swap(paste_);
+                return true;
+        }
+        return true;
+    }
+
+    // Completes a partial sequence after the inter-byte timeout expired.
+    void flush(KeyEvent &out)
+    {
+        switch (state_)
+        {
+            case State::Escape:
+                out.type = KeyType::Escape;
+                break;
+            case State::Paste:
+                out.type = KeyType::Paste;
+                out.text.swap(paste_);
+                if (out.text.size() > kMaxPasteBytes) out.text.resize(kMaxPasteBytes);
+                break;
+            default:
+                out.type = KeyType::Unknown;
+                break;
+        }
+        state_ = State::Ground;
+    }
+
+    int timeout_ms() const { return state_ == State::Paste ? kPasteTimeoutMs : kEscapeTimeoutMs; }
+
+private:
+    enum class State {
+        Ground,
+        Escape,
+        Csi,
+        Ss3,
+        Paste,
+    };
+
+    bool finish_csi(unsigned char final_byte, KeyEvent &out)
+    {
+        int params[2] = {0, 0};
+        size_t count = 0;
+        const char *cursor = params_.c_str();
+        while (*cursor != '\0' && count < 2)
+        {
+            char *end = nullptr;
+            const long value = std::strtol(cursor, &end, 10);
+            params[count++] = (end == cursor) ? 0 : static_cast<int>(value);
+            cursor = end;
+            while (*cursor != '\0' && *cursor != ';') cursor++;
+            if (*cursor == ';') cursor++;
+        }
+
+        if (final_byte == '~')
+        {
+            if (params[0] == kBracketedPasteBegin)
+            {
+                state_ = State::Paste;
+                paste_.clear();
+                paste_tail_.clear();
+                return false;
+            }
+            if (!lookup_tilde_code(params[0], out))
+            {
+                out.type = KeyType::Unknown;
+                return true;
+            }
+        }
+        else if (!lookup_final_byte(final_byte, out))
+        {
+            out.type = KeyType::Unknown;
+            return true;
+        }
+
+        out.modifiers |= modifiers_from_param(params[1]);
+        return true;
+    }
+
+    State state_ = State::Ground;
+    std::string params_;
+    std::string paste_;
+    std::string paste_tail_;
+};
+
+#ifndef _WIN32
+// Bytes already read from stdin but not yet decoded. Reading in chunks lets a
+// whole escape sequence be decoded without waiting on select() per byte.
+struct InputBuffer {
+    unsigned char data[256];
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+InputBuffer g_input;
+
+bool wait_readable(int timeout_ms)
+{
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(STDIN_FILENO, &read_fds);
+
+    timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    return select(STDIN_FILENO + 1, &read_fds, nullptr, nullptr, &tv) > 0;
+}
+
+// Blocks until stdin or `wake_fd` is readable; false if only `wake_fd` is.
+bool wait_for_stdin_or_wake(int wake_fd)
+{
+    if (g_input.begin != g_input.end || wake_fd < 0) return true;
+    while (true)
+    {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(STDIN_FILENO, &read_fds);
+        FD_SET(wake_fd, &read_fds);
+        const int max_fd = wake_fd > STDIN_FILENO ? wake_fd : STDIN_FILENO;
+        const int rc = select(max_fd + 1, &read_fds, nullptr, nullptr, nullptr);
+        if (rc < 0 && errno == EINTR) continue;
+        // On select errors fall through to the blocking read, which reports them.
+        if (rc <= 0 || FD_ISSET(STDIN_FILENO, &read_fds)) return true;
+        return false;
+    }
+}
+
+// Negative timeout blocks until input arrives.
+bool next_byte(unsigned char &out, int timeout_ms, std::string *error_message)
+{
+    if (g_input.begin == g_input.end)
+    {
+        if (timeout_ms >= 0 && !wait_readable(timeout_ms)) return false;
+        while (true)
+        {
+            const ssize_t n = read(STDIN_FILENO, g_input.data, sizeof(g_input.data));
+            if (n > 0)
+            {
+                g_input.begin = 0;
+                g_input.end = static_cast<size_t>(n);
+                break;
+            }
+            if (n == 0)
+            {
+                if (error_message) *error_message = "stdin EOF";
+                return false;
+            }
+            if (errno == EINTR) continue;
+            if (error_message) *error_message = std::strerror(errno);
+            return false;
+        }
+    }
+    out = g_input.data[g_input.begin++];
+    return true;
+}
+
+const char kEnableBracketedPaste[] = "\x1b[?2004h";
+const char kDisableBracketedPaste[] = "\x1b[?2004l";
+
+void write_control_sequence(const char *sequence, size_t length)
+{
+    if (!isatty(STDOUT_FILENO)) return;
+    const ssize_t rc = write(STDOUT_FILENO, sequence, length);
+    (void)rc;
+}
+#else
+// Second byte after a 0/224 prefix from _getch().
+struct ConsoleScanKey {
+    int scan_code;
+    KeyType type;
+    unsigned modifiers;
+    int function_number;
+};
+
+const ConsoleScanKey kConsoleScanKeys[] = {
+    {72, KeyType::ArrowUp, ModNone, 0},
+    {80, KeyType::ArrowDown, ModNone, 0},
+    {75, KeyType::ArrowLeft, ModNone, 0},
+    {77, KeyType::ArrowRight, ModNone, 0},
+    {73, KeyType::PageUp, ModNone, 0},
+    {81, KeyType::PageDown, ModNone, 0},
+    {71, KeyType::Home, ModNone, 0},
+    {79, KeyType::End, ModNone, 0},
+    {82, KeyType::Insert, ModNone, 0},
+    {83, KeyType::Delete, ModNone, 0},
+    {141, KeyType::ArrowUp, ModCtrl, 0},
+    {145, KeyType::ArrowDown, ModCtrl, 0},
+    {115, KeyType::ArrowLeft, ModCtrl, 0},
+    {116, KeyType::ArrowRight, ModCtrl, 0},
+    {132, KeyType::PageUp, ModCtrl, 0},
+    {118, KeyType::PageDown, ModCtrl, 0},
+    {119, KeyType::Home, ModCtrl, 0},
+    {117, KeyType::End, ModCtrl, 0},
+    {59, KeyType::Function, ModNone, 1},
+    {60, KeyType::Function, ModNone, 2},
+    {61, KeyType::Function, ModNone, 3},
+    {62, KeyType::Function, ModNone, 4},
+    {63, KeyType::Function, ModNone, 5},
+    {64, KeyType::Function, ModNone, 6},
+    {65, KeyType::Function, ModNone, 7},
+    {66, KeyType::Function, ModNone, 8},
+    {67, KeyType::Function, ModNone, 9},
+    {68, KeyType::Function, ModNone, 10},
+    {133, KeyType::Function, ModNone, 11},
+    {134, KeyType::Function, ModNone, 12},
+};
+#endif
+
+} // namespace
+
 ScopedRawMode::ScopedRawMode()
 {
 #ifdef _WIN32
@@ -35,6 +457,7 @@ ScopedRawMode::ScopedRawMode()
         return;
     }
 
+    write_control_sequence(kEnableBracketedPaste, sizeof(kEnableBracketedPaste) - 1);
     enabled_ = true;
 #endif
 }
@@ -43,176 +466,74 @@ ScopedRawMode::~ScopedRawMode()
 {
 #ifndef _WIN32
     if (!enabled_) return;
+    write_control_sequence(kDisableBracketedPaste, sizeof(kDisableBracketedPaste) - 1);
     int rc = tcsetattr(STDIN_FILENO, TCSANOW, &original_);
     (void)rc;
 #endif
 }
 
-#ifndef _WIN32
-static bool read_byte_blocking(unsigned char &out, std::string *error_message)
-{
-    while (true)
-    {
-        const ssize_t n = read(STDIN_FILENO, &out, 1);
-        if (n == 1) return true;
-        if (n == 0)
-        {
-            if (error_message) *error_message = "stdin EOF";
-            return false;
-        }
-        if (errno == EINTR) continue;
-        if (error_message) *error_message = std::strerror(errno);
-        return false;
-    }
-}
-
-static bool read_byte_timeout(unsigned char &out, int timeout_ms)
+bool key_pending()
 {
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(STDIN_FILENO, &read_fds);
-
-    timeval tv;
-    tv.tv_sec = timeout_ms / 1000;
-    tv.tv_usec = (timeout_ms % 1000) * 1000;
-
-    const int rc = select(STDIN_FILENO + 1, &read_fds, nullptr, nullptr, &tv);
-    if (rc <= 0) return false;
-    const ssize_t n = read(STDIN_FILENO, &out, 1);
-    return n == 1;
-}
+#ifdef _WIN32
+    return _kbhit() != 0;
+#else
+    return g_input.begin != g_input.end || wait_readable(0);
 #endif
+}
 
-bool read_key_blocking(KeyEvent &out, std::string *error_message)
+bool read_key_blocking(KeyEvent &out, std::string *error_message, int wake_fd)
 {
+    TRACE_SPAN("wait for key");
     out = KeyEvent{};
 
 #ifdef _WIN32
+    (void)wake_fd;
     const int first = _getch();
 
     if (first == 0 || first == 224)
     {
         const int second = _getch();
-        switch (second)
+        for (const ConsoleScanKey &entry : kConsoleScanKeys)
         {
-            case 72:
-                out.type = KeyType::ArrowUp;
-                return true;
-            case 80:
-                out.type = KeyType::ArrowDown;
-                return true;
-            case 75:
-                out.type = KeyType::ArrowLeft;
-                return true;
-            case 77:
-                out.type = KeyType::ArrowRight;
-                return true;
-            default:
-                out.type = KeyType::Unknown;
+            if (entry.scan_code == second)
+            {
+                out.type = entry.type;
+                out.modifiers = entry.modifiers;
+                out.function_number = entry.function_number;
                 return true;
+            }
         }
+        out.type = KeyType::Unknown;
+        return true;
     }
 
     const unsigned char ch = static_cast<unsigned char>(first);
-    if (ch == '\r' || ch == '\n')
-    {
-        out.type = KeyType::Enter;
-        return true;
-    }
-    if (ch == ' ')
-    {
-        out.type = KeyType::Space;
-        return true;
-    }
     if (ch == 0x1B)
     {
         out.type = KeyType::Escape;
         return true;
     }
-    if (ch == 0x03)
-    {
-        out.type = KeyType::CtrlC;
-        return true;
-    }
-    if (ch == 0x04)
-    {
-        out.type = KeyType::CtrlD;
-        return true;
-    }
-
-    out.type = KeyType::Character;
-    out.ch = static_cast<char>(ch);
+    decode_single_byte(ch, out);
     return true;
 #else
-    unsigned char ch = 0;
-    if (!read_byte_blocking(ch, error_message)) return false;
-
-    if (ch == '\r' || ch == '\n')
-    {
-        out.type = KeyType::Enter;
-        return true;
-    }
-    if (ch == ' ')
-    {
-        out.type = KeyType::Space;
-        return true;
-    }
-    if (ch == 0x03)
-    {
-        out.type = KeyType::CtrlC;
-        return true;
-    }
-    if (ch == 0x04)
+    if (!wait_for_stdin_or_wake(wake_fd))
     {
-        out.type = KeyType::CtrlD;
+        out.type = KeyType::Wakeup;
         return true;
     }
 
-    if (ch == 0x1B)
-    {
-        // Best-effort arrow keys parsing (ESC [ A/B/C/D).
-        unsigned char next = 0;
-        if (!read_byte_timeout(next, 30))
-        {
-            out.type = KeyType::Escape;
-            return true;
-        }
-
-        if (next != '[')
-        {
-            out.type = KeyType::Escape;
-            return true;
-        }
+    KeyDecoder decoder;
+    unsigned char byte = 0;
+    if (!next_byte(byte, -1, error_message)) return false;
 
-        unsigned char code = 0;
-        if (!read_byte_timeout(code, 30))
+    while (!decoder.feed(byte, out))
+    {
+        if (!next_byte(byte, decoder.timeout_ms(), nullptr))
         {
-            out.type = KeyType::Escape;
+            decoder.flush(out);
             return true;
         }
-
-        switch (code)
-        {
-            case 'A':
-                out.type = KeyType::ArrowUp;
-                return true;
-            case 'B':
-                out.type = KeyType::ArrowDown;
-                return true;
-            case 'C':
-                out.type = KeyType::ArrowRight;
-                return true;
-            case 'D':
-                out.type = KeyType::ArrowLeft;
-                return true;
-            default:
-                out.type = KeyType::Escape;
-                return true;
-        }
     }
-
-    out.type = KeyType::Character;
-    out.ch = static_cast<char>(ch);
     return true;
 #endif
 }
@@ -0,0 +1,187 @@
+#include "text_analysis.h"
+
+#include <cctype>
+#include <cstring>
+
+namespace TextAnalysis {
+
+namespace {
+
+const std::uint32_t kReplacementCharacter = 0xFFFD;
+const std::uint32_t kIdeographicSpace = 0x3000;
+
+// Longest numeral between "第" and the unit character.
+const int kMaxHeadingNumeralChars = 10;
+
+bool is_space_code_point(std::uint32_t cp)
+{
+    return cp == ' ' || cp == '\t' || cp == '\r' || cp == '\n' || cp == '\v' || cp == '\f' ||
+           cp == kIdeographicSpace;
+}
+
+bool is_numeral(std::uint32_t cp)
+{
+    if (cp >= '0' && cp <= '9') return true;
+    if (cp >= 0xFF10 && cp <= 0xFF19) return true; // full-width digits
+    static const std::uint32_t kChineseNumerals[] = {
+        0x96F6, 0x3007, 0x4E00, 0x4E8C, 0x4E09, 0x56DB, 0x4E94, 0x516D, 0x4E03, 0x516B, 0x4E5D,
+        0x5341, 0x767E, 0x5343, 0x4E07, 0x4E24, 0x58F9, 0x8D30, 0x53C1, 0x8086, 0x4F0D, 0x9646,
+        0x67D2, 0x634C, 0x7396, 0x62FE, 0x4F70, 0x4EDF,
+    }; // 零〇一二三四五六七八九十百千万两 壹贰叁肆伍陆柒捌玖拾佰仟
+    for (std::uint32_t numeral : kChineseNumerals)
+    {
+        if (cp == numeral) return true;
+    }
+    return false;
+}
+
+bool is_heading_unit(std::uint32_t cp)
+{
+    // 章 节 回 卷 集 部 篇 幕
+    static const std::uint32_t kUnits[] = {0x7AE0, 0x8282, 0x56DE, 0x5377, 0x96C6, 0x90E8, 0x7BC7, 0x5E55};
+    for (std::uint32_t unit : kUnits)
+    {
+        if (cp == unit) return true;
+    }
+    return false;
+}
+
+bool starts_with(const std::string &text, const char *prefix)
+{
+    return text.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+bool starts_with_ignore_case(const std::string &text, const char *prefix)
+{
+    const size_t n = std::strlen(prefix);
+    if (text.size() < n) return false;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (std::tolower(static_cast<unsigned char>(text[i])) != prefix[i]) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+std::uint32_t next_code_point(const std::string &utf8, size_t &pos)
+{
+    const unsigned char lead = static_cast<unsigned char>(utf8[pos]);
+    size_t length = 1;
+    std::uint32_t cp = lead;
+    if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        length = 4;
+        cp = lead & 0x07;
+    }
+    else if (lead >= 0xE0)
+    {
+        length = 3;
+        cp = lead & 0x0F;
+    }
+    else if (lead >= 0xC2 && lead < 0xE0)
+    {
+        length = 2;
+        cp = lead & 0x1F;
+    }
+    else if (lead >= 0x80)
+    {
+        pos += 1;
+        return kReplacementCharacter;
+    }
+
+    if (pos + length > utf8.size())
+    {
+        pos += 1;
+        return kReplacementCharacter;
+    }
+    for (size_t i = 1; i < length; ++i)
+    {
+        const unsigned char c = static_cast<unsigned char>(utf8[pos + i]);
+        if ((c & 0xC0) != 0x80)
+        {
+            pos += 1;
+            return kReplacementCharacter;
+        }
+        cp = (cp << 6) | (c & 0x3F);
+    }
+    pos += length;
+    return cp;
+}
+
+std::string trim_text(const std::string &utf8)
+{
+    size_t begin = 0;
+    size_t end = utf8.size();
+    while (begin < end)
+    {
+        size_t next = begin;
+        if (!is_space_code_point(next_code_point(utf8, next))) break;
+        begin = next;
+    }
+    while (end > begin)
+    {
+        // Step back over one code point (continuation bytes first).
+        size_t start = end - 1;
+        while (start > begin && (static_cast<unsigned char>(utf8[start]) & 0xC0) == 0x80) start--;
+        size_t next = start;
+        if (!is_space_code_point(next_code_point(utf8, next)) || next != end) break;
+        end = start;
+    }
+    return utf8.substr(begin, end - begin);
+}
+
+bool is_chapter_heading(const std::string &utf8_line)
+{
+    if (utf8_line.empty() || utf8_line.size() > kMaxHeadingBytes) return false;
+    const std::string text = trim_text(utf8_line);
+    if (text.empty()) return false;
+
+    if (starts_with_ignore_case(text, "chapter ")) return text.size() > 8 && std::isalnum(static_cast<unsigned char>(text[8]));
+
+    // 序章 楔子 引子 序言 尾声 后记 番外
+    static const char *const kStandaloneHeadings[] = {
+        "\xE5\xBA\x8F\xE7\xAB\xA0", "\xE6\xA5\x94\xE5\xAD\x90", "\xE5\xBC\x95\xE5\xAD\x90",
+        "\xE5\xBA\x8F\xE8\xA8\x80", "\xE5\xB0\xBE\xE5\xA3\xB0", "\xE5\x90\x8E\xE8\xAE\xB0",
+        "\xE7\x95\xAA\xE5\xA4\x96",
+    };
+    for (const char *heading : kStandaloneHeadings)
+    {
+        if (starts_with(text, heading)) return true;
+    }
+
+    size_t pos = 0;
+    const std::uint32_t first = next_code_point(text, pos);
+    if (first == 0x7B2C) // 第
+    {
+        int numerals = 0;
+        while (pos < text.size() && numerals <= kMaxHeadingNumeralChars)
+        {
+            const std::uint32_t cp = next_code_point(text, pos);
+            if (is_numeral(cp))
+            {
+                numerals++;
+                continue;
+            }
+            return numerals > 0 && is_heading_unit(cp);
+        }
+        return false;
+    }
+    if (first == 0x5377) // 卷 followed by a numeral, e.g. "卷三"
+    {
+        return pos < text.size() && is_numeral(next_code_point(text, pos));
+    }
+    return false;
+}
+
+const std::vector<std::string> &chapter_heading_initials()
+{
+    // 第 卷 序 楔 引 尾 后 番, and "Chapter" in either case
+    static const std::vector<std::string> kInitials = {
+        "\xE7\xAC\xAC", "\xE5\x8D\xB7", "\xE5\xBA\x8F", "\xE6\xA5\x94", "\xE5\xBC\x95",
+        "\xE5\xB0\xBE", "\xE5\x90\x8E", "\xE7\x95\xAA", "C",            "c",
+    };
+    return kInitials;
+}
+
+} // namespace TextAnalysis
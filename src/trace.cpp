@@ -0,0 +1,129 @@
+#include "trace.h"
+
+#if defined(NOVELREADER_TRACE)
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Trace {
+
+namespace {
+
+std::mutex output_mutex;
+std::FILE *output = nullptr;
+bool first_event = true;
+std::atomic<bool> recording(false);
+std::chrono::steady_clock::time_point epoch;
+std::atomic<int> next_thread_id(1);
+long process_id = 0;
+
+// Small sequential ids read better in the viewer than native thread ids.
+int current_thread_id()
+{
+    thread_local int id = next_thread_id.fetch_add(1);
+    return id;
+}
+
+double microseconds_since_epoch(std::chrono::steady_clock::time_point at)
+{
+    return std::chrono::duration<double, std::micro>(at - epoch).count();
+}
+
+std::string json_string(const char *text)
+{
+    std::string out = "\"";
+    for (const char *p = text; *p != '\0'; ++p)
+    {
+        if (*p == '"' || *p == '\\') out += '\\';
+        out += *p;
+    }
+    return out + '"';
+}
+
+void write_event(const std::string &event)
+{
+    std::lock_guard<std::mutex> lock(output_mutex);
+    if (output == nullptr) return;
+    if (!first_event) std::fputs(",\n", output);
+    first_event = false;
+    std::fputs(event.c_str(), output);
+    std::fflush(output);
+}
+
+void finish()
+{
+    recording = false;
+    std::lock_guard<std::mutex> lock(output_mutex);
+    if (output == nullptr) return;
+    // Without the closing bracket (after a crash) the viewers still load the events.
+    std::fputs("\n]\n", output);
+    std::fclose(output);
+    output = nullptr;
+}
+
+} // namespace
+
+void start_from_environment()
+{
+    const char *path = std::getenv("NOVELREADER_TRACE");
+    if (path == nullptr || *path == '\0' || recording) return;
+    std::FILE *file = std::fopen(path, "w");
+    if (file == nullptr) return;
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        output = file;
+        std::fputs("[\n", output);
+    }
+#ifdef _WIN32
+    process_id = static_cast<long>(GetCurrentProcessId());
+#else
+    process_id = static_cast<long>(getpid());
+#endif
+    epoch = std::chrono::steady_clock::now();
+    recording = true;
+    name_thread("main");
+    std::atexit(finish);
+}
+
+bool enabled()
+{
+    return recording;
+}
+
+void name_thread(const char *name)
+{
+    if (!recording) return;
+    char prefix[96];
+    std::snprintf(prefix, sizeof(prefix), "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%ld,\"tid\":%d,", process_id,
+                  current_thread_id());
+    write_event(std::string(prefix) + "\"args\":{\"name\":" + json_string(name) + "}}");
+}
+
+Span::Span(const char *name) : name_(recording ? name : nullptr)
+{
+    if (name_ != nullptr) begin_ = std::chrono::steady_clock::now();
+}
+
+Span::~Span()
+{
+    if (name_ == nullptr || !recording) return;
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    char fields[128];
+    std::snprintf(fields, sizeof(fields), "\"pid\":%ld,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", process_id,
+                  current_thread_id(), microseconds_since_epoch(begin_),
+                  std::chrono::duration<double, std::micro>(end - begin_).count());
+    write_event("{\"ph\":\"X\",\"name\":" + json_string(name_) + ',' + fields);
+}
+
+} // namespace Trace
+
+#endif // NOVELREADER_TRACE
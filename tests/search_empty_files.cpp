@@ -0,0 +1,93 @@
+// Searching an empty file, alone or as a chapter of a folder, finds nothing
+// instead of failing the search.
+//
+// Usage: search_empty_files <scratch directory>
+
+#include "concatenated_files.h"
+#include "file_system_utils.h"
+#include "platform_utils.h"
+#include "regex_search.h"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string &what)
+{
+    if (condition) return;
+    std::cerr << "FAILED: " << what << std::endl;
+    ++failures;
+}
+
+std::string join(const std::string &directory, const std::string &name)
+{
+    return directory + PlatformUtils::get_path_separator() + name;
+}
+
+bool search(const std::string &path, const TextSearch::Regex &regex, std::vector<TextSearch::Hit> &hits,
+            std::string *error)
+{
+    return TextSearch::search_file(path, "UTF-8", 4096, regex, 100, nullptr, hits, error);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: search_empty_files <scratch directory>" << std::endl;
+        return 2;
+    }
+    const std::string root = argv[1];
+    const std::string folder = join(root, "chapters");
+    if (!FileSystemUtils::create_directory_if_not_exists(root) ||
+        !FileSystemUtils::create_directory_if_not_exists(folder) ||
+        !FileSystemUtils::write_file_atomic(join(root, "empty.txt"), "") ||
+        !FileSystemUtils::write_file_atomic(join(folder, "1.txt"), "first chapter\nhere\n") ||
+        !FileSystemUtils::write_file_atomic(join(folder, "2.txt"), "") ||
+        !FileSystemUtils::write_file_atomic(join(folder, "3.txt"), "third chapter\n"))
+    {
+        std::cerr << "Could not write the test files under " << root << std::endl;
+        return 2;
+    }
+
+    TextSearch::Regex regex;
+    std::string error;
+    const bool compiled = regex.compile("chapter", &error);
+    check(compiled, "compile pattern: " + error);
+
+    std::vector<TextSearch::Hit> hits(1);
+    error.clear();
+    const bool searched = search(join(root, "empty.txt"), regex, hits, &error);
+    check(searched, "search empty file: " + error);
+    check(hits.empty(), "empty file has no hits");
+
+    // The folder is searched file by file, as the reader does.
+    FileView::ConcatenatedFiles book;
+    error.clear();
+    const bool opened = book.open(folder, &error);
+    check(opened, "open folder: " + error);
+    check(book.file_count() == 3, "folder lists all three chapters");
+    size_t total_hits = 0;
+    for (size_t file = 0; file < book.file_count(); ++file)
+    {
+        error.clear();
+        const bool searched_file = search(book.file_path(file), regex, hits, &error);
+        check(searched_file, "search " + book.file_name(file) + ": " + error);
+        total_hits += hits.size();
+    }
+    check(total_hits == 2, "folder with an empty chapter has two hits");
+
+    std::remove(join(root, "empty.txt").c_str());
+    for (const char *name : {"1.txt", "2.txt", "3.txt"}) std::remove(join(folder, name).c_str());
+
+    if (failures != 0) return 1;
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,775 @@
+// Training and benchmark driver for profile-guided builds of NovelReaderCLI
+// (see the pgo-train, pgo-build and pgo-report targets in CMakeLists.txt).
+//
+//   pgo_workload train <NovelReaderCLI> <work dir>
+//   pgo_workload compare <plain> <optimized> <work dir> <report.md> [runs]
+//   pgo_workload merge <llvm-profdata> <profile dir> <output.profdata>
+//
+// A synthetic corpus is generated into <work dir>/corpus on first use: a
+// UTF-8 book with junk lines and overlong paragraphs, a GB18030 book with
+// CRLF line ends, a book alternating between the two encodings, and a folder
+// of chapter files. The workload runs the command-line extraction commands
+// over it, which share the line index, encoding detection, transcoding and
+// line cutting with the reading screen, and then reads the books on the
+// reading screen itself: the reader runs on a pseudo-terminal and is sent
+// scripted keys (paging, jumps, paragraph mode, S/T conversion, search), each
+// only once the frame for the previous one has been painted. Windows has no
+// pseudo-terminal to drive, so there the reading screen goes untrained.
+// Every run gets its own configuration and cache directories under
+// <work dir>/home, so the user's own settings and indexes are never touched.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Bumped whenever the generated corpus changes, so stale corpora are rebuilt.
+const char *const kCorpusVersion = "2";
+
+const std::uint64_t kUtf8BookBytes = 24 * 1024 * 1024;
+const std::uint64_t kGb18030BookBytes = 12 * 1024 * 1024;
+const std::uint64_t kMixedBookBytes = 8 * 1024 * 1024;
+const std::uint64_t kMixedRunBytes = 256 * 1024;
+const int kChapterFiles = 200;
+const std::uint64_t kChapterFileBytes = 32 * 1024;
+
+struct Sentence {
+    const char *utf8;
+    const char *gb18030;
+};
+
+const Sentence kSentences[] = {
+    // 他说：“你好，世界。”
+    {"\xE4\xBB\x96\xE8\xAF\xB4\xEF\xBC\x9A\xE2\x80\x9C\xE4\xBD\xA0\xE5\xA5\xBD\xEF\xBC\x8C\xE4\xB8\x96\xE7\x95\x8C"
+     "\xE3\x80\x82\xE2\x80\x9D",
+     "\xCB\xFB\xCB\xB5\xA3\xBA\xA1\xB0\xC4\xE3\xBA\xC3\xA3\xAC\xCA\xC0\xBD\xE7\xA1\xA3\xA1\xB1"},
+    // 她摇了摇头，没有回答。
+    {"\xE5\xA5\xB9\xE6\x91\x87\xE4\xBA\x86\xE6\x91\x87\xE5\xA4\xB4\xEF\xBC\x8C\xE6\xB2\xA1\xE6\x9C\x89\xE5\x9B\x9E"
+     "\xE7\xAD\x94\xE3\x80\x82",
+     "\xCB\xFD\xD2\xA1\xC1\xCB\xD2\xA1\xCD\xB7\xA3\xAC\xC3\xBB\xD3\xD0\xBB\xD8\xB4\xF0\xA1\xA3"},
+    // 窗外的雨下了一整夜，直到天亮才停。
+    {"\xE7\xAA\x97\xE5\xA4\x96\xE7\x9A\x84\xE9\x9B\xA8\xE4\xB8\x8B\xE4\xBA\x86\xE4\xB8\x80\xE6\x95\xB4\xE5\xA4\x9C"
+     "\xEF\xBC\x8C\xE7\x9B\xB4\xE5\x88\xB0\xE5\xA4\xA9\xE4\xBA\xAE\xE6\x89\x8D\xE5\x81\x9C\xE3\x80\x82",
+     "\xB4\xB0\xCD\xE2\xB5\xC4\xD3\xEA\xCF\xC2\xC1\xCB\xD2\xBB\xD5\xFB\xD2\xB9\xA3\xAC\xD6\xB1\xB5\xBD\xCC\xEC\xC1"
+     "\xC1\xB2\xC5\xCD\xA3\xA1\xA3"},
+    // “走吧，”老人站起身来，“天色不早了。”
+    {"\xE2\x80\x9C\xE8\xB5\xB0\xE5\x90\xA7\xEF\xBC\x8C\xE2\x80\x9D\xE8\x80\x81\xE4\xBA\xBA\xE7\xAB\x99\xE8\xB5\xB7"
+     "\xE8\xBA\xAB\xE6\x9D\xA5\xEF\xBC\x8C\xE2\x80\x9C\xE5\xA4\xA9\xE8\x89\xB2\xE4\xB8\x8D\xE6\x97\xA9\xE4\xBA\x86"
+     "\xE3\x80\x82\xE2\x80\x9D",
+     "\xA1\xB0\xD7\xDF\xB0\xC9\xA3\xAC\xA1\xB1\xC0\xCF\xC8\xCB\xD5\xBE\xC6\xF0\xC9\xED\xC0\xB4\xA3\xAC\xA1\xB0\xCC"
+     "\xEC\xC9\xAB\xB2\xBB\xD4\xE7\xC1\xCB\xA1\xA3\xA1\xB1"},
+    // 他握紧了手中的剑，目光冷冷地扫过众人。
+    {"\xE4\xBB\x96\xE6\x8F\xA1\xE7\xB4\xA7\xE4\xBA\x86\xE6\x89\x8B\xE4\xB8\xAD\xE7\x9A\x84\xE5\x89\x91\xEF\xBC\x8C"
+     "\xE7\x9B\xAE\xE5\x85\x89\xE5\x86\xB7\xE5\x86\xB7\xE5\x9C\xB0\xE6\x89\xAB\xE8\xBF\x87\xE4\xBC\x97\xE4\xBA\xBA"
+     "\xE3\x80\x82",
+     "\xCB\xFB\xCE\xD5\xBD\xF4\xC1\xCB\xCA\xD6\xD6\xD0\xB5\xC4\xBD\xA3\xA3\xAC\xC4\xBF\xB9\xE2\xC0\xE4\xC0\xE4\xB5"
+     "\xD8\xC9\xA8\xB9\xFD\xD6\xDA\xC8\xCB\xA1\xA3"},
+    // 没有人知道那封信里写了什么。
+    {"\xE6\xB2\xA1\xE6\x9C\x89\xE4\xBA\xBA\xE7\x9F\xA5\xE9\x81\x93\xE9\x82\xA3\xE5\xB0\x81\xE4\xBF\xA1\xE9\x87\x8C"
+     "\xE5\x86\x99\xE4\xBA\x86\xE4\xBB\x80\xE4\xB9\x88\xE3\x80\x82",
+     "\xC3\xBB\xD3\xD0\xC8\xCB\xD6\xAA\xB5\xC0\xC4\xC7\xB7\xE2\xD0\xC5\xC0\xEF\xD0\xB4\xC1\xCB\xCA\xB2\xC3\xB4\xA1"
+     "\xA3"},
+    // 她笑了笑：“你果然还是来了。”
+    {"\xE5\xA5\xB9\xE7\xAC\x91\xE4\xBA\x86\xE7\xAC\x91\xEF\xBC\x9A\xE2\x80\x9C\xE4\xBD\xA0\xE6\x9E\x9C\xE7\x84\xB6"
+     "\xE8\xBF\x98\xE6\x98\xAF\xE6\x9D\xA5\xE4\xBA\x86\xE3\x80\x82\xE2\x80\x9D",
+     "\xCB\xFD\xD0\xA6\xC1\xCB\xD0\xA6\xA3\xBA\xA1\xB0\xC4\xE3\xB9\xFB\xC8\xBB\xBB\xB9\xCA\xC7\xC0\xB4\xC1\xCB\xA1"
+     "\xA3\xA1\xB1"},
+    // 夜深了，客栈里只剩下他一个人。
+    {"\xE5\xA4\x9C\xE6\xB7\xB1\xE4\xBA\x86\xEF\xBC\x8C\xE5\xAE\xA2\xE6\xA0\x88\xE9\x87\x8C\xE5\x8F\xAA\xE5\x89\xA9"
+     "\xE4\xB8\x8B\xE4\xBB\x96\xE4\xB8\x80\xE4\xB8\xAA\xE4\xBA\xBA\xE3\x80\x82",
+     "\xD2\xB9\xC9\xEE\xC1\xCB\xA3\xAC\xBF\xCD\xD5\xBB\xC0\xEF\xD6\xBB\xCA\xA3\xCF\xC2\xCB\xFB\xD2\xBB\xB8\xF6\xC8"
+     "\xCB\xA1\xA3"},
+};
+const size_t kSentenceCount = sizeof(kSentences) / sizeof(kSentences[0]);
+
+// 第 / 章 / two full-width spaces
+const Sentence kChapterPrefix = {"\xE7\xAC\xAC", "\xB5\xDA"};
+const Sentence kChapterUnit = {"\xE7\xAB\xA0", "\xD5\xC2"};
+const Sentence kIndent = {"\xE3\x80\x80\xE3\x80\x80", "\xA1\xA1\xA1\xA1"};
+// 本章未完，请点击下一页继续阅读 / 请收藏本站 www.example.com
+const Sentence kJunkLines[] = {
+    {"\xE6\x9C\xAC\xE7\xAB\xA0\xE6\x9C\xAA\xE5\xAE\x8C\xEF\xBC\x8C\xE8\xAF\xB7\xE7\x82\xB9\xE5\x87\xBB\xE4\xB8\x8B"
+     "\xE4\xB8\x80\xE9\xA1\xB5\xE7\xBB\xA7\xE7\xBB\xAD\xE9\x98\x85\xE8\xAF\xBB",
+     "\xB1\xBE\xD5\xC2\xCE\xB4\xCD\xEA\xA3\xAC\xC7\xEB\xB5\xE3\xBB\xF7\xCF\xC2\xD2\xBB\xD2\xB3\xBC\xCC\xD0\xF8\xD4"
+     "\xC4\xB6\xC1"},
+    {"\xE8\xAF\xB7\xE6\x94\xB6\xE8\x97\x8F\xE6\x9C\xAC\xE7\xAB\x99 www.example.com",
+     "\xC7\xEB\xCA\xD5\xB2\xD8\xB1\xBE\xD5\xBE www.example.com"},
+};
+// Written to the junk_patterns file of every run: 本章未完, 请收藏, www.
+const char *const kJunkPatterns = "\xE6\x9C\xAC\xE7\xAB\xA0\xE6\x9C\xAA\xE5\xAE\x8C\n"
+                                  "\xE8\xAF\xB7\xE6\x94\xB6\xE8\x97\x8F\n"
+                                  "www.\n";
+
+// Phrase list for --build-dict s2t, so that the reading session can turn on
+// S/T conversion: characters of kSentences and their traditional forms.
+const char *const kS2tPhrases = "\xE8\xAF\xB4\t\xE8\xAA\xAA\n"
+                                "\xE6\xB2\xA1\t\xE6\xB2\x92\n"
+                                "\xE5\xA4\xB4\t\xE9\xA0\xAD\n"
+                                "\xE5\x89\x91\t\xE5\x8A\x8D\n"
+                                "\xE6\xA0\x88\t\xE6\xA3\xA7\n"
+                                "\xE9\x87\x8C\t\xE8\xA3\x8F\n"
+                                "\xE8\xA7\x81\t\xE8\xA6\x8B\n";
+// What the reading session searches for.
+const char *const kSearchPattern = "\xE4\xB8\x96\xE7\x95\x8C";
+
+enum class Encoding { Utf8, Gb18030 };
+
+const char *pick(const Sentence &sentence, Encoding encoding)
+{
+    return encoding == Encoding::Utf8 ? sentence.utf8 : sentence.gb18030;
+}
+
+// Appends novel-like text to `out` until it holds `bytes` more: chapters of
+// 20 to 60 paragraphs, paragraphs of 1 to 12 sentences, now and then a
+// blank line, a junk line or a paragraph long enough to be cut into
+// virtual lines.
+class TextWriter {
+public:
+    TextWriter(std::uint32_t seed, const std::string &line_end) : random_(seed), line_end_(line_end) {}
+
+    void write(std::string &out, std::uint64_t bytes, Encoding encoding)
+    {
+        const size_t target = out.size() + static_cast<size_t>(bytes);
+        while (out.size() < target)
+        {
+            if (paragraphs_left_ == 0)
+            {
+                out += pick(kChapterPrefix, encoding);
+                out += std::to_string(++chapter_);
+                out += pick(kChapterUnit, encoding);
+                out += ' ';
+                out += pick(kSentences[random_() % kSentenceCount], encoding);
+                out += line_end_;
+                paragraphs_left_ = 20 + random_() % 41;
+            }
+            --paragraphs_left_;
+            const std::uint32_t roll = random_() % 100;
+            if (roll < 5)
+            {
+                out += line_end_;
+                continue;
+            }
+            if (roll < 8)
+            {
+                out += pick(kJunkLines[random_() % 2], encoding);
+                out += line_end_;
+                continue;
+            }
+            const int sentences = roll < 10 ? 150 + static_cast<int>(random_() % 100) : 1 + static_cast<int>(random_() % 12);
+            out += pick(kIndent, encoding);
+            for (int i = 0; i < sentences; ++i) out += pick(kSentences[random_() % kSentenceCount], encoding);
+            out += line_end_;
+        }
+    }
+
+private:
+    std::mt19937 random_;
+    std::string line_end_;
+    int chapter_ = 0;
+    std::uint32_t paragraphs_left_ = 0;
+};
+
+std::string join_path(const std::string &dir, const std::string &name)
+{
+#ifdef _WIN32
+    return dir + "\\" + name;
+#else
+    return dir + "/" + name;
+#endif
+}
+
+bool make_directory(const std::string &path)
+{
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+// Deletes `path` and everything under it; a missing path is fine.
+void remove_tree(const std::string &path)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA(join_path(path, "*").c_str(), &data);
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            const std::string name = data.cFileName;
+            if (name == "." || name == "..") continue;
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                remove_tree(join_path(path, name));
+            }
+            else
+            {
+                DeleteFileA(join_path(path, name).c_str());
+            }
+        } while (FindNextFileA(handle, &data));
+        FindClose(handle);
+    }
+    RemoveDirectoryA(path.c_str());
+#else
+    if (DIR *handle = opendir(path.c_str()))
+    {
+        while (dirent *entry = readdir(handle))
+        {
+            const std::string name = entry->d_name;
+            if (name == "." || name == "..") continue;
+            const std::string child = join_path(path, name);
+            struct stat st;
+            if (lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+            {
+                remove_tree(child);
+            }
+            else
+            {
+                unlink(child.c_str());
+            }
+        }
+        closedir(handle);
+    }
+    rmdir(path.c_str());
+#endif
+}
+
+std::vector<std::string> list_directory(const std::string &path)
+{
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA(join_path(path, "*").c_str(), &data);
+    if (handle == INVALID_HANDLE_VALUE) return names;
+    do
+    {
+        names.push_back(data.cFileName);
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+#else
+    if (DIR *handle = opendir(path.c_str()))
+    {
+        while (dirent *entry = readdir(handle)) names.push_back(entry->d_name);
+        closedir(handle);
+    }
+#endif
+    return names;
+}
+
+void set_environment(const char *name, const std::string &value)
+{
+#ifdef _WIN32
+    _putenv_s(name, value.c_str());
+#else
+    setenv(name, value.c_str(), 1);
+#endif
+}
+
+bool write_file(const std::string &path, const std::string &contents)
+{
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    out << contents;
+    return static_cast<bool>(out);
+}
+
+std::uint64_t file_size(const std::string &path)
+{
+    std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+    return in ? static_cast<std::uint64_t>(in.tellg()) : 0;
+}
+
+struct Corpus {
+    std::string dir;
+    std::string utf8;
+    std::string gb18030;
+    std::string mixed;
+    std::string chapters;
+    std::string s2t_phrases;
+};
+
+Corpus corpus_paths(const std::string &work_dir)
+{
+    Corpus corpus;
+    corpus.dir = join_path(work_dir, "corpus");
+    corpus.utf8 = join_path(corpus.dir, "utf8.txt");
+    corpus.gb18030 = join_path(corpus.dir, "gb18030.txt");
+    corpus.mixed = join_path(corpus.dir, "mixed.txt");
+    corpus.chapters = join_path(corpus.dir, "chapters");
+    corpus.s2t_phrases = join_path(corpus.dir, "s2t-phrases.txt");
+    return corpus;
+}
+
+// Generates the corpus unless a complete one of this version is there already.
+bool prepare_corpus(const Corpus &corpus)
+{
+    const std::string stamp = join_path(corpus.dir, "corpus-version");
+    std::ifstream stamp_in(stamp);
+    std::string version;
+    if (stamp_in && std::getline(stamp_in, version) && version == kCorpusVersion) return true;
+
+    std::cout << "Generating the synthetic corpus in " << corpus.dir << " ..." << std::endl;
+    remove_tree(corpus.dir);
+    if (!make_directory(corpus.dir) || !make_directory(corpus.chapters)) return false;
+
+    std::string text = "\xEF\xBB\xBF";
+    TextWriter(1, "\n").write(text, kUtf8BookBytes, Encoding::Utf8);
+    if (!write_file(corpus.utf8, text)) return false;
+
+    text.clear();
+    TextWriter(2, "\r\n").write(text, kGb18030BookBytes, Encoding::Gb18030);
+    if (!write_file(corpus.gb18030, text)) return false;
+
+    text.clear();
+    TextWriter mixed(3, "\n");
+    for (std::uint64_t run = 0; run * kMixedRunBytes < kMixedBookBytes; ++run)
+    {
+        mixed.write(text, kMixedRunBytes, run % 2 == 0 ? Encoding::Utf8 : Encoding::Gb18030);
+    }
+    if (!write_file(corpus.mixed, text)) return false;
+
+    TextWriter chapters(4, "\n");
+    for (int file = 1; file <= kChapterFiles; ++file)
+    {
+        text.clear();
+        chapters.write(text, kChapterFileBytes, file % 5 == 0 ? Encoding::Gb18030 : Encoding::Utf8);
+        std::ostringstream name;
+        name << std::setw(4) << std::setfill('0') << file << ".txt";
+        if (!write_file(join_path(corpus.chapters, name.str()), text)) return false;
+    }
+    if (!write_file(corpus.s2t_phrases, kS2tPhrases)) return false;
+    return write_file(stamp, std::string(kCorpusVersion) + "\n");
+}
+
+// Keys typed on the reading screen, and text that shows up once they have been handled.
+struct KeyPress {
+    std::string keys;
+    std::string expect;
+};
+
+struct Step {
+    std::string name;
+    // Each command is one NovelReaderCLI invocation (arguments only).
+    std::vector<std::vector<std::string>> commands;
+    // Start from an empty cache; otherwise the step runs once untimed first,
+    // so that the saved index and the page cache are warm.
+    bool cold;
+    // After the commands, opens this book from the menu and types `keys`.
+    std::string book;
+    std::vector<KeyPress> keys;
+};
+
+// The status line under every frame of the reading screen.
+const char *const kFrameShown = "% read";
+const char *const kMenuShown = "Please select an option";
+// How long a key may take to show its frame; searches and jumps index on the way.
+const std::chrono::seconds kKeyTimeout(30);
+
+// Opens the configured book from the menu, reads it the usual ways and goes
+// back to the menu, which exits.
+std::vector<KeyPress> reading_session(bool convert)
+{
+    const std::string page_down = "\x1b[6~";
+    const std::string page_up = "\x1b[5~";
+    std::vector<KeyPress> keys = {{"1\r", kFrameShown}};
+    for (int i = 0; i < 40; ++i) keys.push_back({i % 2 == 0 ? " " : "j", kFrameShown});
+    for (int i = 0; i < 20; ++i) keys.push_back({page_down, kFrameShown});
+    for (int i = 0; i < 10; ++i) keys.push_back({i % 2 == 0 ? page_up : "k", kFrameShown});
+    keys.push_back({"50%", kFrameShown});
+    for (int i = 0; i < 10; ++i) keys.push_back({page_down, kFrameShown});
+    keys.push_back({"p", kFrameShown});
+    for (int i = 0; i < 20; ++i) keys.push_back({" ", kFrameShown});
+    keys.push_back({"p", kFrameShown});
+    if (convert)
+    {
+        keys.push_back({"c", "S/T conversion: s2t"});
+        for (int i = 0; i < 20; ++i) keys.push_back({page_down, kFrameShown});
+        keys.push_back({"c", "S/T conversion off"});
+    }
+    keys.push_back({std::string("/") + kSearchPattern + "\r", ": match "});
+    for (int i = 0; i < 20; ++i) keys.push_back({i < 15 ? "n" : "N", ": match "});
+    keys.push_back({"G", kFrameShown});
+    for (int i = 0; i < 10; ++i) keys.push_back({page_up, kFrameShown});
+    keys.push_back({"gg", kFrameShown});
+    keys.push_back({"q", kMenuShown});
+    keys.push_back({"4\r", ""});
+    return keys;
+}
+
+std::vector<Step> workload(const Corpus &corpus)
+{
+    const std::string middle = std::to_string(kUtf8BookBytes / 2);
+    std::vector<Step> steps = {
+        {"library scan", {{"--scan", corpus.dir}}, true},
+        {"index UTF-8 book", {{"--stats", corpus.utf8}}, true},
+        {"stats from saved index", {{"--stats", corpus.utf8}}, false},
+        {"decode UTF-8 book", {{"--print-lines", "1..", corpus.utf8}}, false},
+        {"extract chapters",
+         {{"--print-chapter", "3", corpus.utf8},
+          {"--print-chapter", "400", corpus.utf8},
+          {"--line-at-offset", middle, corpus.utf8}},
+         false},
+        {"junk report", {{"--junk-report", corpus.utf8}}, true},
+        {"index GB18030 book", {{"--stats", corpus.gb18030}}, true},
+        {"decode GB18030 book", {{"--print-lines", "1..", corpus.gb18030}}, false},
+        {"index mixed book", {{"--stats", corpus.mixed}}, true},
+        {"decode mixed book", {{"--print-lines", "1..", corpus.mixed}}, false},
+        {"chapter folder", {{"--stats", corpus.chapters}, {"--print-lines", "1..", corpus.chapters}}, true},
+    };
+#ifndef _WIN32
+    steps.push_back({"read UTF-8 book", {{"--build-dict", "s2t", corpus.s2t_phrases}}, false, corpus.utf8,
+                     reading_session(true)});
+    steps.push_back({"read GB18030 book", {}, false, corpus.gb18030, reading_session(false)});
+    steps.push_back({"read chapter folder", {}, false, corpus.chapters, reading_session(false)});
+#endif
+    return steps;
+}
+
+std::string quote(const std::string &argument)
+{
+    return "\"" + argument + "\"";
+}
+
+#ifndef _WIN32
+// NovelReaderCLI on a pseudo-terminal, typed at like a user would.
+class TerminalSession {
+public:
+    ~TerminalSession() { finish(); }
+
+    bool start(const std::string &binary)
+    {
+        master_ = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master_ < 0 || grantpt(master_) != 0 || unlockpt(master_) != 0) return false;
+        const char *slave_name = ptsname(master_);
+        if (slave_name == nullptr) return false;
+        winsize size = {};
+        size.ws_row = 40;
+        size.ws_col = 120;
+        ioctl(master_, TIOCSWINSZ, &size);
+        const std::string slave_path = slave_name;
+        pid_ = fork();
+        if (pid_ < 0) return false;
+        if (pid_ == 0)
+        {
+            // The slave becomes the controlling terminal of a new session.
+            setsid();
+            const int slave = open(slave_path.c_str(), O_RDWR);
+            if (slave < 0) _exit(127);
+            dup2(slave, STDIN_FILENO);
+            dup2(slave, STDOUT_FILENO);
+            dup2(slave, STDERR_FILENO);
+            if (slave > STDERR_FILENO) close(slave);
+            close(master_);
+            setenv("TERM", "xterm", 1);
+            execl(binary.c_str(), binary.c_str(), static_cast<char *>(nullptr));
+            _exit(127);
+        }
+        return true;
+    }
+
+    // Types `keys`, then reads what the reader paints until `expect` shows
+    // up, or until it exits if `expect` is empty.
+    bool type(const std::string &keys, const std::string &expect)
+    {
+        size_t written = 0;
+        while (written < keys.size())
+        {
+            const ssize_t n = write(master_, keys.data() + written, keys.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            written += static_cast<size_t>(n);
+        }
+        std::string shown;
+        const auto deadline = std::chrono::steady_clock::now() + kKeyTimeout;
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            fd_set read_fds;
+            FD_ZERO(&read_fds);
+            FD_SET(master_, &read_fds);
+            timeval timeout = {0, 100 * 1000};
+            const int ready = select(master_ + 1, &read_fds, nullptr, nullptr, &timeout);
+            if (ready < 0 && errno != EINTR) return false;
+            if (ready <= 0) continue;
+            char buffer[65536];
+            const ssize_t n = read(master_, buffer, sizeof(buffer));
+            // The slave side closing reads as EIO.
+            if (n <= 0) return expect.empty();
+            shown.append(buffer, static_cast<size_t>(n));
+            if (!expect.empty() && shown.find(expect) != std::string::npos) return true;
+        }
+        std::cerr << "Error: the reader did not show \"" << expect << "\" after the keys "
+                  << (keys[0] == '\x1b' ? "<escape sequence>" : keys) << std::endl;
+        return false;
+    }
+
+    // Waits for the reader to exit, killing it if it has not; true if it exited cleanly.
+    bool finish()
+    {
+        bool clean = false;
+        if (pid_ > 0)
+        {
+            int status = 0;
+            pid_t done = 0;
+            for (int i = 0; i < 50 && (done = waitpid(pid_, &status, WNOHANG)) == 0; ++i) usleep(100 * 1000);
+            if (done == 0)
+            {
+                kill(pid_, SIGKILL);
+                waitpid(pid_, &status, 0);
+            }
+            clean = done == pid_ && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            pid_ = -1;
+        }
+        if (master_ >= 0) close(master_);
+        master_ = -1;
+        return clean;
+    }
+
+private:
+    int master_ = -1;
+    pid_t pid_ = -1;
+};
+#endif
+
+class Runner {
+public:
+    Runner(const std::string &work_dir)
+        : home_(join_path(work_dir, "home")), output_(join_path(work_dir, "output.txt"))
+    {
+    }
+
+    // Points the configuration, cache and daemon directories into the work
+    // directory and empties them.
+    bool reset()
+    {
+        remove_tree(home_);
+        const std::string config = join_path(home_, "config");
+        const std::string app_config = join_path(config, "NovelReader");
+        if (!make_directory(home_) || !make_directory(config) || !make_directory(app_config)) return false;
+        set_environment("HOME", home_);
+        set_environment("XDG_CONFIG_HOME", config);
+        set_environment("XDG_CACHE_HOME", join_path(home_, "cache"));
+        set_environment("XDG_RUNTIME_DIR", join_path(home_, "run"));
+#ifdef _WIN32
+        set_environment("LOCALAPPDATA", config);
+#endif
+        return write_file(join_path(app_config, "junk_patterns"), kJunkPatterns);
+    }
+
+    bool run(const std::string &binary, const std::vector<std::string> &arguments)
+    {
+        std::string command = quote(binary);
+        for (const std::string &argument : arguments) command += " " + quote(argument);
+        command += " > " + quote(output_);
+#ifdef _WIN32
+        // cmd.exe strips the outer quotes of a command line that starts with one.
+        command = "\"" + command + "\"";
+#endif
+        if (std::system(command.c_str()) == 0) return true;
+        std::cerr << "Error: command failed: " << command << std::endl;
+        return false;
+    }
+
+    // Runs the step once and returns its wall-clock time in milliseconds, or -1.
+    double time_step(const std::string &binary, const Step &step)
+    {
+        if (!reset()) return -1;
+        if (!step.cold && !run_step(binary, step)) return -1;
+        const auto start = std::chrono::steady_clock::now();
+        if (!run_step(binary, step)) return -1;
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    bool run_step(const std::string &binary, const Step &step)
+    {
+        for (const auto &command : step.commands)
+        {
+            if (!run(binary, command)) return false;
+        }
+        return step.book.empty() || read_book(binary, step);
+    }
+
+    // Sets `step.book` as the current novel and types `step.keys` at the reader.
+    bool read_book(const std::string &binary, const Step &step)
+    {
+#ifdef _WIN32
+        (void)binary;
+        (void)step;
+        return true;
+#else
+        const std::string config = join_path(join_path(join_path(home_, "config"), "NovelReader"), "config");
+        if (!write_file(config, step.book + "\n0\n")) return false;
+        TerminalSession session;
+        if (!session.start(binary))
+        {
+            std::cerr << "Error: Could not start " << binary << " on a pseudo-terminal" << std::endl;
+            return false;
+        }
+        for (const KeyPress &key : step.keys)
+        {
+            if (!session.type(key.keys, key.expect)) return false;
+        }
+        if (session.finish()) return true;
+        std::cerr << "Error: " << binary << " did not exit cleanly after reading " << step.book << std::endl;
+        return false;
+#endif
+    }
+
+    std::string home_;
+    std::string output_;
+};
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    const size_t middle = values.size() / 2;
+    return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+int train(const std::string &binary, const std::string &work_dir)
+{
+    const Corpus corpus = corpus_paths(work_dir);
+    if (!make_directory(work_dir) || !prepare_corpus(corpus))
+    {
+        std::cerr << "Error: Could not generate the corpus in " << corpus.dir << std::endl;
+        return 1;
+    }
+    Runner runner(work_dir);
+    for (const Step &step : workload(corpus))
+    {
+        const double ms = runner.time_step(binary, step);
+        if (ms < 0) return 1;
+        std::cout << "  " << std::left << std::setw(26) << step.name << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(8) << ms << " ms" << std::endl;
+    }
+    return 0;
+}
+
+int compare(const std::string &plain, const std::string &optimized, const std::string &work_dir,
+            const std::string &report_path, int runs)
+{
+    const Corpus corpus = corpus_paths(work_dir);
+    if (!make_directory(work_dir) || !prepare_corpus(corpus))
+    {
+        std::cerr << "Error: Could not generate the corpus in " << corpus.dir << std::endl;
+        return 1;
+    }
+    Runner runner(work_dir);
+    std::ostringstream report;
+    report << std::fixed;
+    report << "# NovelReaderCLI: plain build vs. PGO/LTO build\n\n";
+    report << "- plain: `" << plain << "` (" << file_size(plain) << " bytes)\n";
+    report << "- optimized: `" << optimized << "` (" << file_size(optimized) << " bytes)\n";
+    report << "- median wall-clock time of " << runs
+           << " runs per step, process start-up included; the builds take turns run by run\n\n";
+    report << "| Step | Plain (ms) | Optimized (ms) | Speed-up |\n";
+    report << "|------|-----------:|---------------:|---------:|\n";
+    double plain_total = 0;
+    double optimized_total = 0;
+    for (const Step &step : workload(corpus))
+    {
+        std::vector<double> plain_times;
+        std::vector<double> optimized_times;
+        for (int run = 0; run < runs; ++run)
+        {
+            const double a = runner.time_step(plain, step);
+            const double b = runner.time_step(optimized, step);
+            if (a < 0 || b < 0) return 1;
+            plain_times.push_back(a);
+            optimized_times.push_back(b);
+        }
+        const double a = median(plain_times);
+        const double b = median(optimized_times);
+        plain_total += a;
+        optimized_total += b;
+        report << "| " << step.name << " | " << std::setprecision(1) << a << " | " << b << " | "
+               << std::setprecision(2) << (b > 0 ? a / b : 0) << "x |\n";
+        std::cout << "  " << step.name << ": " << std::setprecision(1) << std::fixed << a << " ms -> " << b << " ms"
+                  << std::endl;
+    }
+    report << "| **Total** | " << std::setprecision(1) << plain_total << " | " << optimized_total << " | "
+           << std::setprecision(2) << (optimized_total > 0 ? plain_total / optimized_total : 0) << "x |\n";
+    if (!write_file(report_path, report.str()))
+    {
+        std::cerr << "Error: Could not write " << report_path << std::endl;
+        return 1;
+    }
+    std::cout << "\n" << report.str() << "\nReport written to " << report_path << std::endl;
+    return 0;
+}
+
+// Merges the raw profiles Clang-instrumented runs left in `dir` into one file
+// for -fprofile-use.
+int merge(const std::string &profdata, const std::string &dir, const std::string &output)
+{
+    std::string command = quote(profdata) + " merge -output=" + quote(output);
+    int inputs = 0;
+    for (const std::string &name : list_directory(dir))
+    {
+        if (name.size() > 8 && name.compare(name.size() - 8, 8, ".profraw") == 0)
+        {
+            command += " " + quote(join_path(dir, name));
+            ++inputs;
+        }
+    }
+    if (inputs == 0)
+    {
+        std::cerr << "Error: No .profraw files in " << dir << "; run the training workload first." << std::endl;
+        return 1;
+    }
+#ifdef _WIN32
+    command = "\"" + command + "\"";
+#endif
+    return std::system(command.c_str()) == 0 ? 0 : 1;
+}
+
+int usage()
+{
+    std::cerr << "Usage:\n"
+              << "  pgo_workload train <NovelReaderCLI> <work dir>\n"
+              << "  pgo_workload compare <plain> <optimized> <work dir> <report.md> [runs]\n"
+              << "  pgo_workload merge <llvm-profdata> <profile dir> <output.profdata>" << std::endl;
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    if (args.size() == 3 && args[0] == "train") return train(args[1], args[2]);
+    if ((args.size() == 5 || args.size() == 6) && args[0] == "compare")
+    {
+        const int runs = args.size() == 6 ? std::atoi(args[5].c_str()) : 5;
+        if (runs < 1) return usage();
+        return compare(args[1], args[2], args[3], args[4], runs);
+    }
+    if (args.size() == 4 && args[0] == "merge") return merge(args[1], args[2], args[3]);
+    return usage();
+}